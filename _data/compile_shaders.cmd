@@ -16,4 +16,8 @@ set BINARIES_FOLDER="./shaders/"
 %GLSL_COMPILER% -V -S rmiss %SOURCE_FOLDER%ray_miss.glsl -o %BINARIES_FOLDER%ray_miss.bin
 %GLSL_COMPILER% -V -S rmiss %SOURCE_FOLDER%shadow_ray_miss.glsl -o %BINARIES_FOLDER%shadow_ray_miss.bin
 
+:: compute shaders
+%GLSL_COMPILER% -V -S comp %SOURCE_FOLDER%denoise_temporal.glsl -o %BINARIES_FOLDER%denoise_temporal.bin
+%GLSL_COMPILER% -V -S comp %SOURCE_FOLDER%denoise_atrous.glsl -o %BINARIES_FOLDER%denoise_atrous.bin
+
 pause
@@ -0,0 +1,1417 @@
+#include "benchmarks.h"
+#include "obj_reader.h"
+#include "cpu/cpu_renderer.h"
+#include "cpu/cpu_denoiser.h"
+#include "common/vk_allocator.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+static const char* sBenchScenesFolder = "_data/scenes/cornell_box/";
+static const char* sBenchScenes[] = {
+	"CornellBox.obj",
+	"CornellBox-Empty-CO.obj",
+	"CornellBox-Empty-RG.obj",
+	"CornellBox-Empty-Squashed.obj",
+	"CornellBox-Empty-White.obj",
+	"CornellBox-Glossy.obj",
+	"CornellBox-Mirror.obj",
+	"CornellBox-Original.obj",
+	"CornellBox-Sphere.obj",
+	"CornellBox-Water.obj",
+	"water.obj",
+};
+static const int sBenchIterations = 3;
+
+using BenchClock = std::chrono::high_resolution_clock;
+
+static double ElapsedMs(const BenchClock::time_point& start) {
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+// what LoadSceneGeometry used to do: tinyobj plus expanding every face into the mesh arrays.
+// Faces without normals get the face normal, like obj_reader gives them
+static bool LoadWithTinyObj(const String& fileName, Array<MeshData>& meshes) {
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	String warn, error;
+
+	String baseDir = fileName;
+	const size_t slash = baseDir.find_last_of('/');
+	if (slash != String::npos) {
+		baseDir.erase(slash);
+	}
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &error, fileName.c_str(), baseDir.c_str(), true)) {
+		return false;
+	}
+
+	meshes.clear();
+	meshes.resize(shapes.size());
+	for (size_t s = 0; s < shapes.size(); ++s) {
+		const tinyobj::shape_t& shape = shapes[s];
+		const size_t numFaces = shape.mesh.num_face_vertices.size();
+		MeshData& mesh = meshes[s];
+		mesh.positions.resize(numFaces * 3);
+		mesh.attribs.resize(numFaces * 3);
+		mesh.indices.resize(numFaces * 3);
+		mesh.faces.resize(numFaces * 4, 0u);
+		mesh.matIDs.resize(numFaces);
+
+		for (size_t v = 0; v < numFaces * 3; ++v) {
+			const tinyobj::index_t& i = shape.mesh.indices[v];
+			mesh.positions[v] = vec3(attrib.vertices[3 * i.vertex_index + 0], attrib.vertices[3 * i.vertex_index + 1], attrib.vertices[3 * i.vertex_index + 2]);
+			mesh.indices[v] = static_cast<uint32_t>(v);
+			mesh.faces[(v / 3) * 4 + (v % 3)] = static_cast<uint32_t>(v);
+		}
+		for (size_t f = 0; f < numFaces; ++f) {
+			const vec3* pos = &mesh.positions[f * 3];
+			const vec3 faceNormal = Cross(pos[1] - pos[0], pos[2] - pos[0]);
+			const float faceNormalLength = Length(faceNormal);
+			const vec3 geometricNormal = (faceNormalLength > 0.0f) ? faceNormal / faceNormalLength : vec3(0.0f, 1.0f, 0.0f);
+			for (size_t j = 0; j < 3; ++j) {
+				const tinyobj::index_t& i = shape.mesh.indices[f * 3 + j];
+				const vec3 normal = (i.normal_index >= 0) ? vec3(attrib.normals[3 * i.normal_index + 0], attrib.normals[3 * i.normal_index + 1], attrib.normals[3 * i.normal_index + 2]) : geometricNormal;
+				mesh.attribs[f * 3 + j].normal = vec4(normal, 0.0f);
+			}
+			mesh.matIDs[f] = static_cast<uint32_t>(shape.mesh.material_ids[f]);
+		}
+	}
+
+	return true;
+}
+
+static bool LoadWithObjReader(const String& fileName, Array<MeshData>& meshes) {
+	ObjScene scene;
+	if (!LoadObjScene(fileName, scene)) {
+		return false;
+	}
+
+	meshes.swap(scene.meshes);
+	return true;
+}
+
+static size_t CountTriangles(const Array<MeshData>& meshes) {
+	size_t numTriangles = 0;
+	for (const MeshData& mesh : meshes) {
+		numTriangles += mesh.matIDs.size();
+	}
+	return numTriangles;
+}
+
+// the two readers parse numbers with different code, they may round the last bit differently
+static bool NearlyEqual(const vec3& a, const vec3& b) {
+	const float scale = Max(Max(Max(std::fabs(a.x), std::fabs(a.y)), Max(std::fabs(a.z), std::fabs(b.x))), Max(Max(std::fabs(b.y), std::fabs(b.z)), 1.0f));
+	return std::fabs(a.x - b.x) <= 1e-5f * scale && std::fabs(a.y - b.y) <= 1e-5f * scale && std::fabs(a.z - b.z) <= 1e-5f * scale;
+}
+
+// first difference between the meshes of the two readers, empty when they agree
+static String CompareMeshes(const Array<MeshData>& expected, const Array<MeshData>& meshes) {
+	char text[256];
+	if (expected.size() != meshes.size()) {
+		snprintf(text, sizeof(text), "%zu meshes instead of %zu", meshes.size(), expected.size());
+		return text;
+	}
+
+	for (size_t m = 0; m < meshes.size(); ++m) {
+		const MeshData& a = expected[m];
+		const MeshData& b = meshes[m];
+		if (a.matIDs.size() != b.matIDs.size() || a.positions.size() != b.positions.size() || a.attribs.size() != b.attribs.size() ||
+			a.indices.size() != b.indices.size() || a.faces.size() != b.faces.size()) {
+			snprintf(text, sizeof(text), "mesh %zu: %zu triangles instead of %zu", m, b.matIDs.size(), a.matIDs.size());
+			return text;
+		}
+		for (size_t v = 0; v < a.positions.size(); ++v) {
+			if (!NearlyEqual(a.positions[v], b.positions[v])) {
+				snprintf(text, sizeof(text), "mesh %zu: position %zu differs", m, v);
+				return text;
+			}
+			if (!NearlyEqual(vec3(a.attribs[v].normal), vec3(b.attribs[v].normal))) {
+				snprintf(text, sizeof(text), "mesh %zu: normal %zu differs", m, v);
+				return text;
+			}
+		}
+		if (a.indices != b.indices || a.faces != b.faces) {
+			snprintf(text, sizeof(text), "mesh %zu: indices differ", m);
+			return text;
+		}
+		for (size_t f = 0; f < a.matIDs.size(); ++f) {
+			if (a.matIDs[f] != b.matIDs[f]) {
+				snprintf(text, sizeof(text), "mesh %zu: face %zu has material %d instead of %d", m, f, static_cast<int>(b.matIDs[f]), static_cast<int>(a.matIDs[f]));
+				return text;
+			}
+		}
+	}
+	return String();
+}
+
+static bool WriteRandomObj(const String& fileName, const uint32_t numTriangles) {
+	FILE* file = fopen(fileName.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+
+	std::mt19937 rng(1234u);
+	std::uniform_real_distribution<float> coord(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> dir(-1.0f, 1.0f);
+
+	const uint32_t numVertices = Max(numTriangles / 2, 3u);
+	std::uniform_int_distribution<uint32_t> index(1, numVertices);
+
+	fprintf(file, "# random benchmark mesh, %u triangles\n", numTriangles);
+	for (uint32_t i = 0; i < numVertices; ++i) {
+		fprintf(file, "v %.6f %.6f %.6f\n", coord(rng), coord(rng), coord(rng));
+	}
+	for (uint32_t i = 0; i < numVertices; ++i) {
+		fprintf(file, "vn %.4f %.4f %.4f\n", dir(rng), dir(rng), dir(rng));
+	}
+
+	static const uint32_t kTrianglesPerGroup = 100000;
+	for (uint32_t t = 0; t < numTriangles; ++t) {
+		if (0 == t % kTrianglesPerGroup) {
+			fprintf(file, "g group%u\n", t / kTrianglesPerGroup);
+		}
+		const uint32_t a = index(rng), b = index(rng), c = index(rng);
+		fprintf(file, "f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static bool BenchmarkObjFile(const String& fileName) {
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if (!file) {
+		printf("%-32s missing\n", fileName.c_str());
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	const double sizeMB = static_cast<double>(ftell(file)) / (1024.0 * 1024.0);
+	fclose(file);
+
+	double bestTinyObj = 1e30, bestObjReader = 1e30;
+	Array<MeshData> meshesTinyObj, meshesObjReader;
+	bool loadedTinyObj = true, loadedObjReader = true;
+	for (int i = 0; i < sBenchIterations; ++i) {
+		BenchClock::time_point start = BenchClock::now();
+		loadedTinyObj = LoadWithTinyObj(fileName, meshesTinyObj) && loadedTinyObj;
+		bestTinyObj = Min(bestTinyObj, ElapsedMs(start));
+
+		start = BenchClock::now();
+		loadedObjReader = LoadWithObjReader(fileName, meshesObjReader) && loadedObjReader;
+		bestObjReader = Min(bestObjReader, ElapsedMs(start));
+	}
+
+	const String difference = (loadedTinyObj && loadedObjReader) ? CompareMeshes(meshesTinyObj, meshesObjReader) : String("failed to load");
+
+	const size_t slash = fileName.find_last_of('/');
+	const String shortName = (slash != String::npos) ? fileName.substr(slash + 1) : fileName;
+	printf("%-32s %8.2f MB %10zu tris | tinyobj %9.2f ms %7.1f MB/s | obj_reader %9.2f ms %7.1f MB/s | x%.2f%s%s\n",
+		shortName.c_str(), sizeMB, CountTriangles(meshesObjReader),
+		bestTinyObj, sizeMB / (bestTinyObj * 0.001),
+		bestObjReader, sizeMB / (bestObjReader * 0.001),
+		bestTinyObj / bestObjReader,
+		difference.empty() ? "" : "  MISMATCH: ", difference.c_str());
+	return difference.empty();
+}
+
+bool RunObjReaderBenchmark(const uint32_t numRandomTriangles) {
+	printf("OBJ reader benchmark, %u threads, best of %d runs\n", ThreadPool::GetDefault().GetNumThreads(), sBenchIterations);
+
+	bool valid = true;
+	for (const char* scene : sBenchScenes) {
+		valid = BenchmarkObjFile(String(sBenchScenesFolder) + scene) && valid;
+	}
+
+	const String randomFileName = String(sBenchScenesFolder) + "bench_random.obj";
+	if (WriteRandomObj(randomFileName, numRandomTriangles)) {
+		valid = BenchmarkObjFile(randomFileName) && valid;
+		std::remove(randomFileName.c_str());
+	}
+	else {
+		printf("Failed to write %s\n", randomFileName.c_str());
+		valid = false;
+	}
+
+	printf("%s\n", valid ? "obj_reader matches tinyobj on every file" : "obj_reader DOESN'T match tinyobj");
+	return valid;
+}
+
+// Hit distances from two traversals may differ by a few ulps (FMA contraction, different
+// operation order), t of -1 is a miss. The triangle only matters once the distances really
+// differ, then the same triangle is still the same hit.
+static const float sHitRelativeEpsilon = 1e-4f;
+
+static bool SameHit(const float tA, const uint32_t triangleA, const float tB, const uint32_t triangleB) {
+	if ((tA < 0.0f) != (tB < 0.0f)) {
+		return false;
+	}
+	if (std::abs(tA - tB) <= sHitRelativeEpsilon * Max(Max(std::abs(tA), std::abs(tB)), 1.0f)) {
+		return true;
+	}
+	return triangleA == triangleB;
+}
+
+// same test as Bvh::Intersect, so any difference beyond rounding comes from the tree
+static bool IntersectTriangleBruteForce(const vec3& origin, const vec3& direction, const vec3& v0, const vec3& v1, const vec3& v2, const float tmin, float& closest) {
+	const vec3 e1 = v1 - v0;
+	const vec3 e2 = v2 - v0;
+	const vec3 p = Cross(direction, e2);
+	const float det = Dot(e1, p);
+	if (std::abs(det) < 1e-12f) {
+		return false;
+	}
+	const float invDet = 1.0f / det;
+	const vec3 s = origin - v0;
+	const float u = Dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+	const vec3 q = Cross(s, e1);
+	const float v = Dot(direction, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+	const float t = Dot(e2, q) * invDet;
+	if (t > tmin && t < closest) {
+		closest = t;
+		return true;
+	}
+	return false;
+}
+
+// 3 positions per triangle, every mesh of the scene
+static bool LoadTrianglePositions(const String& fileName, Array<vec3>& positions) {
+	ObjScene objScene;
+	if (!LoadObjScene(fileName, objScene)) {
+		return false;
+	}
+
+	positions.clear();
+	for (const MeshData& mesh : objScene.meshes) {
+		for (const uint32_t index : mesh.indices) {
+			positions.push_back(mesh.positions[index]);
+		}
+	}
+	return true;
+}
+
+static String ShortFileName(const String& fileName) {
+	const size_t slash = fileName.find_last_of('/');
+	return (slash != String::npos) ? fileName.substr(slash + 1) : fileName;
+}
+
+static bool ValidateBvh(const String& fileName, const uint32_t numRays) {
+	Array<vec3> positions;
+	if (!LoadTrianglePositions(fileName, positions)) {
+		printf("%-32s missing or failed to load\n", fileName.c_str());
+		return false;
+	}
+	const uint32_t numTriangles = static_cast<uint32_t>(positions.size() / 3);
+
+	Bvh bvh;
+	bvh.Build(positions);
+	const BvhStats& stats = bvh.GetStats();
+
+	// half the rays start anywhere around the scene and go anywhere, the other half aim at a triangle
+	vec3 sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+	for (const vec3& p : positions) {
+		sceneMin = glm::min(sceneMin, p);
+		sceneMax = glm::max(sceneMax, p);
+	}
+	const vec3 margin = (sceneMax - sceneMin) * 0.1f;
+
+	std::mt19937 rng(4321u);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> gauss(0.0f, 1.0f);
+	std::uniform_int_distribution<uint32_t> triangle(0, Max(numTriangles, 1u) - 1);
+
+	Array<vec3> origins(numRays), directions(numRays);
+	for (uint32_t i = 0; i < numRays; ++i) {
+		const vec3 r(unit(rng), unit(rng), unit(rng));
+		origins[i] = (sceneMin - margin) + (sceneMax - sceneMin + margin * 2.0f) * r;
+		if (i & 1) {
+			const uint32_t t = triangle(rng);
+			const vec3 target = (positions[t * 3 + 0] + positions[t * 3 + 1] + positions[t * 3 + 2]) * (1.0f / 3.0f);
+			directions[i] = target - origins[i];
+		}
+		else {
+			directions[i] = Normalize(vec3(gauss(rng), gauss(rng), gauss(rng)));
+		}
+	}
+
+	const float tmin = 0.0001f;
+	const float tmax = 1e30f;
+
+	Array<float> bvhT(numRays);
+	Array<uint32_t> bvhTriangle(numRays);
+	BenchClock::time_point start = BenchClock::now();
+	for (uint32_t i = 0; i < numRays; ++i) {
+		BvhHit hit;
+		const bool found = bvh.Intersect(origins[i], directions[i], tmin, tmax, hit);
+		bvhT[i] = found ? hit.t : -1.0f;
+		bvhTriangle[i] = found ? hit.triangle : ~0u;
+	}
+	const double bvhMs = ElapsedMs(start);
+
+	uint32_t numMismatches = 0, numHits = 0;
+	start = BenchClock::now();
+	for (uint32_t i = 0; i < numRays; ++i) {
+		float closest = tmax;
+		uint32_t closestTriangle = ~0u;
+		for (uint32_t t = 0; t < numTriangles; ++t) {
+			if (IntersectTriangleBruteForce(origins[i], directions[i], positions[t * 3 + 0], positions[t * 3 + 1], positions[t * 3 + 2], tmin, closest)) {
+				closestTriangle = t;
+			}
+		}
+		const float bruteT = (~0u != closestTriangle) ? closest : -1.0f;
+
+		// two triangles at the same distance (shared edges) may legally swap
+		if (!SameHit(bvhT[i], bvhTriangle[i], bruteT, closestTriangle)) {
+			if (numMismatches < 4) {
+				printf("  ray %u: bvh t %f tri %u, brute force t %f tri %u\n", i, bvhT[i], bvhTriangle[i], bruteT, closestTriangle);
+			}
+			++numMismatches;
+		}
+		numHits += (bruteT >= 0.0f) ? 1 : 0;
+	}
+	const double bruteMs = ElapsedMs(start);
+
+	printf("%-32s %8u tris | build %8.2f ms, %2u subtrees | %7u nodes %7u leaves, depth %2u, max leaf %2u, SAH %7.2f | %6.2f vs %6.2f Mrays/s brute force | %u/%u hits, %u mismatches\n",
+		ShortFileName(fileName).c_str(), numTriangles,
+		stats.buildTimeMs, stats.numSubtrees,
+		stats.numNodes, stats.numLeaves, stats.maxDepth, stats.maxLeafTriangles, stats.sahCost,
+		numRays / (bvhMs * 1000.0), numRays / (bruteMs * 1000.0),
+		numHits, numRays, numMismatches);
+
+	return 0 == numMismatches;
+}
+
+bool RunBvhBenchmark(const uint32_t numRays) {
+	printf("BVH benchmark, %u threads, %u rays per scene\n", ThreadPool::GetDefault().GetNumThreads(), numRays);
+
+	bool valid = true;
+	for (const char* scene : sBenchScenes) {
+		valid = ValidateBvh(String(sBenchScenesFolder) + scene, numRays) && valid;
+	}
+
+	printf("%s\n", valid ? "All BVH hits match brute force" : "BVH hits DON'T match brute force");
+	return valid;
+}
+
+// Times one ray distribution through both trees. Closest hits must agree as in SameHit,
+// shadow rays must give the same answer.
+static uint32_t CompareBvh8(const Bvh& bvh, const Bvh8& bvh8, const Array<vec3>& origins, const Array<vec3>& directions,
+	const float tmin, const float tmax, const bool shadowRays, double& scalarMrays, double& bvh8Mrays) {
+	const uint32_t numRays = static_cast<uint32_t>(origins.size());
+	Array<float> scalarT(numRays), wideT(numRays);
+	Array<uint32_t> scalarTriangle(numRays, ~0u), wideTriangle(numRays, ~0u);
+
+	BenchClock::time_point start = BenchClock::now();
+	for (uint32_t i = 0; i < numRays; ++i) {
+		BvhHit hit;
+		if (shadowRays) {
+			scalarT[i] = bvh.Occluded(origins[i], directions[i], tmin, tmax) ? 1.0f : -1.0f;
+		}
+		else if (bvh.Intersect(origins[i], directions[i], tmin, tmax, hit)) {
+			scalarT[i] = hit.t;
+			scalarTriangle[i] = hit.triangle;
+		}
+		else {
+			scalarT[i] = -1.0f;
+		}
+	}
+	const double scalarMs = ElapsedMs(start);
+
+	start = BenchClock::now();
+	for (uint32_t i = 0; i < numRays; ++i) {
+		BvhHit hit;
+		if (shadowRays) {
+			wideT[i] = bvh8.Occluded(origins[i], directions[i], tmin, tmax) ? 1.0f : -1.0f;
+		}
+		else if (bvh8.Intersect(origins[i], directions[i], tmin, tmax, hit)) {
+			wideT[i] = hit.t;
+			wideTriangle[i] = hit.triangle;
+		}
+		else {
+			wideT[i] = -1.0f;
+		}
+	}
+	const double bvh8Ms = ElapsedMs(start);
+
+	scalarMrays = numRays / (Max(scalarMs, 1e-6) * 1000.0);
+	bvh8Mrays = numRays / (Max(bvh8Ms, 1e-6) * 1000.0);
+
+	uint32_t numMismatches = 0;
+	for (uint32_t i = 0; i < numRays; ++i) {
+		numMismatches += SameHit(scalarT[i], scalarTriangle[i], wideT[i], wideTriangle[i]) ? 0 : 1;
+	}
+	return numMismatches;
+}
+
+static bool BenchmarkBvh8(const String& fileName, const uint32_t numRays) {
+	Array<vec3> positions;
+	if (!LoadTrianglePositions(fileName, positions)) {
+		printf("%-32s missing or failed to load\n", fileName.c_str());
+		return false;
+	}
+	const uint32_t numTriangles = static_cast<uint32_t>(positions.size() / 3);
+
+	Bvh bvh;
+	bvh.Build(positions);
+	BenchClock::time_point start = BenchClock::now();
+	Bvh8 bvh8;
+	bvh8.Build(bvh, positions);
+	const double collapseMs = ElapsedMs(start);
+
+	vec3 sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+	for (const vec3& p : positions) {
+		sceneMin = glm::min(sceneMin, p);
+		sceneMax = glm::max(sceneMax, p);
+	}
+	const vec3 extent = sceneMax - sceneMin;
+	const float tmin = 0.0001f;
+	const float tmax = 1e30f;
+
+	std::mt19937 rng(8765u);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+	// primary - a camera in front of the scene looking down -z at random points of the back wall
+	const vec3 eye(sceneMin.x + extent.x * 0.5f, sceneMin.y + extent.y * 0.5f, sceneMax.z + extent.z);
+	Array<vec3> primaryOrigins(numRays, eye), primaryDirections(numRays);
+	for (uint32_t i = 0; i < numRays; ++i) {
+		const vec3 target(sceneMin.x + extent.x * unit(rng), sceneMin.y + extent.y * unit(rng), sceneMin.z);
+		primaryDirections[i] = Normalize(target - eye);
+	}
+
+	// shadow - from every primary hit to a point light under the ceiling, diffuse - cosine-ish bounce
+	// off the geometric normal like ray_gen does with RandomInUnitSphere
+	const vec3 light(sceneMin.x + extent.x * 0.5f, sceneMax.y - extent.y * 0.05f, sceneMin.z + extent.z * 0.5f);
+	Array<vec3> shadowOrigins, shadowDirections, diffuseOrigins, diffuseDirections;
+	for (uint32_t i = 0; i < numRays; ++i) {
+		BvhHit hit;
+		if (!bvh.Intersect(primaryOrigins[i], primaryDirections[i], tmin, tmax, hit)) {
+			continue;
+		}
+		const vec3 hitPos = primaryOrigins[i] + primaryDirections[i] * hit.t;
+		const vec3* tri = positions.data() + hit.triangle * 3;
+		vec3 normal = Normalize(Cross(tri[1] - tri[0], tri[2] - tri[0]));
+		if (Dot(normal, primaryDirections[i]) > 0.0f) {
+			normal = -normal;
+		}
+		const vec3 origin = hitPos + normal * 0.001f;
+
+		shadowOrigins.push_back(origin);
+		shadowDirections.push_back(light - origin);
+
+		vec3 inSphere(gauss(rng), gauss(rng), gauss(rng));
+		inSphere = Normalize(inSphere) * std::cbrt(unit(rng));
+		diffuseOrigins.push_back(origin);
+		diffuseDirections.push_back(Normalize(normal + inSphere));
+	}
+
+	double primaryScalar, primaryWide, shadowScalar, shadowWide, diffuseScalar, diffuseWide;
+	uint32_t numMismatches = CompareBvh8(bvh, bvh8, primaryOrigins, primaryDirections, tmin, tmax, false, primaryScalar, primaryWide);
+	// the light is at t = 1 along the unnormalized direction
+	numMismatches += CompareBvh8(bvh, bvh8, shadowOrigins, shadowDirections, tmin, 0.999f, true, shadowScalar, shadowWide);
+	numMismatches += CompareBvh8(bvh, bvh8, diffuseOrigins, diffuseDirections, tmin, tmax, false, diffuseScalar, diffuseWide);
+
+	printf("%-32s %8u tris | %6u nodes %6u blocks %7.1f KB, %6.2f ms | primary %6.2f -> %6.2f (x%4.2f) | shadow %6.2f -> %6.2f (x%4.2f) | diffuse %6.2f -> %6.2f (x%4.2f) Mrays/s | %u mismatches\n",
+		ShortFileName(fileName).c_str(), numTriangles,
+		bvh8.GetNumNodes(), bvh8.GetNumTriangleBlocks(), bvh8.GetMemorySize() / 1024.0, collapseMs,
+		primaryScalar, primaryWide, primaryWide / primaryScalar,
+		shadowScalar, shadowWide, shadowWide / Max(shadowScalar, 1e-9),
+		diffuseScalar, diffuseWide, diffuseWide / Max(diffuseScalar, 1e-9),
+		numMismatches);
+
+	return 0 == numMismatches;
+}
+
+bool RunBvh8Benchmark(const uint32_t numRays) {
+	printf("BVH8 benchmark, %s kernel vs scalar binary BVH, 1 thread, %u primary rays per scene\n", Bvh8::GetKernelName(), numRays);
+
+	bool valid = true;
+	for (const char* scene : sBenchScenes) {
+		valid = BenchmarkBvh8(String(sBenchScenesFolder) + scene, numRays) && valid;
+	}
+
+	printf("%s\n", valid ? "All BVH8 hits match the binary BVH" : "BVH8 hits DON'T match the binary BVH");
+	return valid;
+}
+
+// camera outside the +z side of the bounds looking down -z at all of it, like the classic Cornell box shot
+static UniformParams MakeFramingCameraParams(const vec3& boundsMin, const vec3& boundsMax) {
+	const vec3 center = (boundsMin + boundsMax) * 0.5f;
+	const vec3 extent = boundsMax - boundsMin;
+	const float fovY = Deg2Rad(45.0f);
+	const float distance = 0.5f * Max(extent.x, extent.y) / tan(fovY * 0.5f);
+
+	UniformParams params = {};
+	params.sunPosAndAmbient = vec4(1.0f, 1.0f, 1.0f, 0.1f);
+	params.camPos = vec4(center.x, center.y, boundsMax.z + distance, 0.0f);
+	params.camDir = vec4(0.0f, 0.0f, -1.0f, 0.0f);
+	params.camUp = vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	params.camSide = vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	params.camNearFarFov = vec4(0.1f, (distance + extent.z) * 4.0f, fovY, 0.0f);
+	params.frameData = uvec4(0, SWS_SAMPLES_PER_FRAME, SWS_RENDER_NEE, SWS_RR_MIN_DEPTH);
+	params.samplingData = uvec4(SWS_SAMPLER_DEFAULT, 0, 0, 0);
+	params.prevCamPos = params.camPos;
+	params.prevCamDir = params.camDir;
+	params.prevCamUp = params.camUp;
+	params.prevCamSide = params.camSide;
+	params.denoiseData = uvec4(0, SWS_DENOISE_ITERATIONS, 0, 0);
+	return params;
+}
+
+bool RunRayStreamBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames) {
+	static const char* const sStreamScenes[] = {
+		"CornellBox-Glossy.obj",
+		"CornellBox-Water.obj",
+	};
+
+	ThreadPool& pool = ThreadPool::GetDefault();
+	printf("Ray stream benchmark, %ux%u, %u frames, %u threads, %s BVH8 kernel\n", width, height, numFrames, pool.GetNumThreads(), Bvh8::GetKernelName());
+
+	bool valid = true;
+	for (const char* sceneName : sStreamScenes) {
+		const String fileName = String(sBenchScenesFolder) + sceneName;
+		CpuScene scene;
+		if (!scene.Load(fileName)) {
+			printf("%-32s missing or failed to load\n", sceneName);
+			valid = false;
+			continue;
+		}
+
+		const UniformParams baseParams = MakeFramingCameraParams(scene.GetBoundsMin(), scene.GetBoundsMax());
+		const CpuTracer::TraceMode modes[] = { CpuTracer::TraceMode::PerRay, CpuTracer::TraceMode::Stream };
+		const char* const modeNames[] = { "per ray", "streams" };
+		double modeMs[2] = {};
+		Array<uint32_t> images[2];
+
+		for (uint32_t m = 0; m < 2; ++m) {
+			CpuTracer tracer;
+			tracer.Resize(width, height);
+			tracer.SetTraceMode(modes[m]);
+
+			UniformParams params = baseParams;
+			uint64_t numRays = 0;
+			double bestMs = DBL_MAX;
+			for (int it = 0; it < sBenchIterations; ++it) {
+				const BenchClock::time_point start = BenchClock::now();
+				for (uint32_t i = 0; i < numFrames; ++i) {
+					params.frameData.x = i;
+					tracer.Render(scene, params, pool);
+					numRays += tracer.GetNumRays();
+				}
+				bestMs = Min(bestMs, ElapsedMs(start));
+			}
+			numRays /= sBenchIterations;
+
+			modeMs[m] = bestMs;
+			images[m] = tracer.GetImage();
+			printf("%-32s %8u tris | %s | %9.2f ms/frame | %7.2f Mrays/s | %5.2f rays/pixel\n",
+				sceneName, scene.GetNumTriangles(), modeNames[m], bestMs / numFrames,
+				static_cast<double>(numRays) / (bestMs * 1000.0),
+				static_cast<double>(numRays) / (static_cast<double>(width) * height * numFrames));
+		}
+
+		// every path keeps its sampler, so sorting must not change a single pixel
+		uint32_t numDifferent = 0;
+		for (size_t i = 0; i < images[0].size(); ++i) {
+			numDifferent += (images[0][i] != images[1][i]) ? 1 : 0;
+		}
+		printf("%-32s streams x%.2f vs per ray, %u pixels differ\n", sceneName, modeMs[0] / modeMs[1], numDifferent);
+		valid = valid && (0 == numDifferent);
+	}
+
+	printf("%s\n", valid ? "Stream images match per ray ones" : "Stream images DON'T match per ray ones");
+	return valid;
+}
+
+bool RunCpuTracerBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames) {
+	CpuScene scene;
+	if (!scene.Load(kDefaultSceneFile)) {
+		printf("Failed to load %s\n", kDefaultSceneFile);
+		return false;
+	}
+
+	const uint32_t maxThreads = Max(std::thread::hardware_concurrency(), 1u);
+	printf("CPU tracer benchmark, %ux%u, %u frames, %u triangles, up to %u threads\n", width, height, numFrames, scene.GetNumTriangles(), maxThreads);
+
+	// 1, 2, 4, ... plus the full count if it isn't a power of two
+	Array<uint32_t> threadCounts;
+	for (uint32_t n = 1; n < maxThreads; n *= 2) {
+		threadCounts.push_back(n);
+	}
+	threadCounts.push_back(maxThreads);
+
+	const UniformParams baseParams = MakeDefaultCameraParams(width, height);
+	double singleThreadMrays = 0.0;
+	bool valid = true;
+	for (const uint32_t numThreads : threadCounts) {
+		ThreadPool pool(numThreads);
+		CpuTracer tracer;
+		tracer.Resize(width, height);
+
+		UniformParams params = baseParams;
+		uint64_t numRays = 0;
+		uint32_t numSteals = 0;
+		const BenchClock::time_point start = BenchClock::now();
+		for (uint32_t i = 0; i < numFrames; ++i) {
+			params.frameData.x = i;
+			tracer.Render(scene, params, pool);
+			numRays += tracer.GetNumRays();
+			numSteals += pool.GetNumSteals();
+		}
+		const double timeMs = ElapsedMs(start);
+
+		const double mrays = static_cast<double>(numRays) / (timeMs * 1000.0);
+		if (1 == numThreads) {
+			singleThreadMrays = mrays;
+		}
+		const double speedup = singleThreadMrays > 0.0 ? mrays / singleThreadMrays : 0.0;
+		printf("%3u threads | %9.2f ms/frame | %8.2f Mrays/s | x%5.2f | %5.1f%% efficiency | %6.1f steals/frame\n",
+			numThreads, timeMs / numFrames, mrays, speedup, 100.0 * speedup / numThreads,
+			static_cast<double>(numSteals) / numFrames);
+
+		// every pixel shoots at least its camera ray, nothing traced means nothing was measured
+		if (0 == numRays) {
+			printf("%3u threads traced no rays\n", numThreads);
+			valid = false;
+		}
+	}
+	return valid;
+}
+
+// renders numFrames frames into a fresh tracer, returns what they traced
+static CpuRayStats RenderFrames(const CpuScene& scene, const UniformParams& baseParams, const uint32_t width, const uint32_t height,
+                             const uint32_t numFrames, ThreadPool& pool, Array<vec4>& image) {
+	CpuTracer tracer;
+	tracer.Resize(width, height);
+
+	UniformParams params = baseParams;
+	CpuRayStats stats = {};
+	for (uint32_t i = 0; i < numFrames; ++i) {
+		params.frameData.x = i;
+		tracer.Render(scene, params, pool);
+		stats = AddRayStats(stats, tracer.GetRayStats());
+		params.samplingData.z = static_cast<uint32_t>(tracer.GetRayStats().numConvergingPixels);
+	}
+	image = tracer.GetAccumImage();
+	return stats;
+}
+
+// root mean square error over the rgb of every pixel
+static double ImageRmse(const Array<vec4>& image, const Array<vec4>& reference) {
+	double sum = 0.0;
+	for (size_t i = 0; i < image.size(); ++i) {
+		const vec3 diff = vec3(image[i]) - vec3(reference[i]);
+		sum += static_cast<double>(Dot(diff, diff));
+	}
+	return sqrt(sum / (static_cast<double>(image.size()) * 3.0));
+}
+
+static double ImageMeanLuminance(const Array<vec4>& image) {
+	double sum = 0.0;
+	for (const vec4& pixel : image) {
+		sum += static_cast<double>(Luminance(vec3(pixel)));
+	}
+	return image.empty() ? 0.0 : sum / static_cast<double>(image.size());
+}
+
+bool RunNeeBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames) {
+	static const uint32_t sReferenceScale = 64;
+	static const double sMeanTolerance = 0.02;  // relative
+
+	CpuScene scene;
+	if (!scene.Load(kDefaultSceneFile)) {
+		printf("Failed to load %s\n", kDefaultSceneFile);
+		return false;
+	}
+	if (scene.GetLights().empty()) {
+		printf("%s has no emissive triangles\n", kDefaultSceneFile);
+		return false;
+	}
+
+	ThreadPool& pool = ThreadPool::GetDefault();
+	const uint32_t referenceFrames = numFrames * sReferenceScale;
+	printf("NEE benchmark, %ux%u, %u frames vs a %u frame reference, %u light triangles\n",
+		width, height, numFrames, referenceFrames, static_cast<uint32_t>(scene.GetLights().size()));
+
+	UniformParams neeParams = MakeDefaultCameraParams(width, height);
+	neeParams.frameData.z |= SWS_RENDER_NEE;
+	UniformParams bsdfParams = neeParams;
+	bsdfParams.frameData.z &= ~SWS_RENDER_NEE;
+
+	// the two estimators converge to the same image, both references have to agree before comparing noise
+	Array<vec4> reference, bsdfReference;
+	RenderFrames(scene, neeParams, width, height, referenceFrames, pool, reference);
+	RenderFrames(scene, bsdfParams, width, height, referenceFrames, pool, bsdfReference);
+	const double referenceMean = ImageMeanLuminance(reference);
+	const double bsdfReferenceMean = ImageMeanLuminance(bsdfReference);
+	const double meanDiff = referenceMean > 0.0 ? fabs(bsdfReferenceMean - referenceMean) / referenceMean : 1.0;
+	printf("reference mean luminance %.4f with NEE, %.4f without (%.2f%% apart)\n", referenceMean, bsdfReferenceMean, meanDiff * 100.0);
+
+	const UniformParams* const modeParams[] = { &bsdfParams, &neeParams };
+	const char* const modeNames[] = { "BSDF only", "NEE + MIS" };
+	double modeRmse[2] = {};
+	for (uint32_t m = 0; m < 2; ++m) {
+		Array<vec4> image;
+		const BenchClock::time_point start = BenchClock::now();
+		const CpuRayStats stats = RenderFrames(scene, *modeParams[m], width, height, numFrames, pool, image);
+		const double timeMs = ElapsedMs(start);
+		const uint64_t numRays = stats.numBounces + stats.numShadowRays;
+
+		modeRmse[m] = ImageRmse(image, reference);
+		printf("%-9s | %9.2f ms/frame | %5.2f rays/pixel | RMSE %.5f\n", modeNames[m], timeMs / numFrames,
+			static_cast<double>(numRays) / (static_cast<double>(width) * height * numFrames), modeRmse[m]);
+	}
+	printf("NEE RMSE x%.2f lower at equal spp\n", modeRmse[1] > 0.0 ? modeRmse[0] / modeRmse[1] : 0.0);
+
+	return meanDiff < sMeanTolerance;
+}
+
+bool RunRussianRouletteBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames) {
+	static const uint32_t sReferenceScale = 64;
+	static const double sMeanTolerance = 0.02;  // relative
+
+	CpuScene scene;
+	if (!scene.Load(kDefaultSceneFile)) {
+		printf("Failed to load %s\n", kDefaultSceneFile);
+		return false;
+	}
+
+	ThreadPool& pool = ThreadPool::GetDefault();
+	const uint32_t referenceFrames = numFrames * sReferenceScale;
+	printf("Russian roulette benchmark, %ux%u, %u frames vs a %u frame reference, up to %d rays per path\n",
+		width, height, numFrames, referenceFrames, SWS_MAX_RECURSION);
+
+	const UniformParams baseParams = MakeDefaultCameraParams(width, height);
+	UniformParams fullParams = baseParams;
+	fullParams.frameData.w = SWS_MAX_RECURSION;
+
+	// the roulette only moves work around, the converged image has to stay the same
+	Array<vec4> reference, rouletteReference;
+	RenderFrames(scene, fullParams, width, height, referenceFrames, pool, reference);
+	RenderFrames(scene, baseParams, width, height, referenceFrames, pool, rouletteReference);
+	const double referenceMean = ImageMeanLuminance(reference);
+	const double rouletteMean = ImageMeanLuminance(rouletteReference);
+	const double meanDiff = referenceMean > 0.0 ? fabs(rouletteMean - referenceMean) / referenceMean : 1.0;
+	printf("reference mean luminance %.4f without the roulette, %.4f with it (%.2f%% apart)\n", referenceMean, rouletteMean, meanDiff * 100.0);
+
+	const uint32_t depths[] = { SWS_MAX_RECURSION, 5, SWS_RR_MIN_DEPTH, 2, 1 };
+	const uint64_t numPixels = static_cast<uint64_t>(width) * height * numFrames;
+	double fullCost = 0.0;
+	for (const uint32_t depth : depths) {
+		UniformParams params = baseParams;
+		params.frameData.w = depth;
+
+		Array<vec4> image;
+		const BenchClock::time_point start = BenchClock::now();
+		const CpuRayStats stats = RenderFrames(scene, params, width, height, numFrames, pool, image);
+		const double timeMs = ElapsedMs(start);
+		const double rmse = ImageRmse(image, reference);
+
+		// variance times time, what it costs to get to a given noise level
+		const double cost = rmse * rmse * timeMs;
+		if (SWS_MAX_RECURSION == depth) {
+			fullCost = cost;
+		}
+
+		const double paths = static_cast<double>(Max(stats.numPaths, uint64_t(1)));
+		printf("RR from ray %2u | %9.2f ms/frame | %5.2f rays/pixel | %5.2f rays/path | %5.1f%% killed | RMSE %.5f | x%.2f efficiency\n",
+			depth, timeMs / numFrames,
+			static_cast<double>(stats.numBounces + stats.numShadowRays) / static_cast<double>(numPixels),
+			static_cast<double>(stats.numBounces) / paths, 100.0 * static_cast<double>(stats.numRouletteKills) / paths,
+			rmse, cost > 0.0 ? fullCost / cost : 0.0);
+	}
+
+	return meanDiff < sMeanTolerance;
+}
+
+// samples where a falling error curve gets down to target, interpolated on the log-log curve. 0 if it never does
+static double MatchingSamples(const Array<uint32_t>& samples, const Array<double>& errors, const double target) {
+	for (size_t i = 0; i < samples.size(); ++i) {
+		if (errors[i] > target) {
+			continue;
+		}
+		if (0 == i) {
+			return static_cast<double>(samples[0]);
+		}
+		const double f = log(errors[i - 1] / target) / log(errors[i - 1] / errors[i]);
+		return exp(log(static_cast<double>(samples[i - 1])) + f * log(static_cast<double>(samples[i]) / static_cast<double>(samples[i - 1])));
+	}
+	return 0.0;
+}
+
+bool RunSamplerBenchmark(const uint32_t width, const uint32_t height, const uint32_t maxSamples) {
+	static const uint32_t sReferenceScale = 16;
+	static const double sMeanTolerance = 0.02;  // relative
+
+	CpuScene scene;
+	if (!scene.Load(kDefaultSceneFile)) {
+		printf("Failed to load %s\n", kDefaultSceneFile);
+		return false;
+	}
+
+	ThreadPool& pool = ThreadPool::GetDefault();
+	const uint32_t maxFrames = Max(maxSamples / SWS_SAMPLES_PER_FRAME, 1u);
+	const uint32_t referenceFrames = maxFrames * sReferenceScale;
+	printf("Sampler benchmark, %ux%u, up to %u spp vs a %u spp reference\n",
+		width, height, maxFrames * SWS_SAMPLES_PER_FRAME, referenceFrames * SWS_SAMPLES_PER_FRAME);
+
+	UniformParams randomParams = MakeDefaultCameraParams(width, height);
+	randomParams.samplingData.x = SWS_SAMPLER_RANDOM;
+	UniformParams sobolParams = randomParams;
+	sobolParams.samplingData.x = SWS_SAMPLER_SOBOL;
+
+	// the references get their own scrambles, so they don't share the first samples of the renders they judge
+	UniformParams randomReferenceParams = randomParams;
+	randomReferenceParams.samplingData.y = 1;
+	UniformParams sobolReferenceParams = sobolParams;
+	sobolReferenceParams.samplingData.y = 1;
+
+	// both samplers estimate the same image, the references have to agree before comparing noise
+	Array<vec4> reference, randomReference;
+	RenderFrames(scene, sobolReferenceParams, width, height, referenceFrames, pool, reference);
+	RenderFrames(scene, randomReferenceParams, width, height, referenceFrames, pool, randomReference);
+	const double referenceMean = ImageMeanLuminance(reference);
+	const double randomReferenceMean = ImageMeanLuminance(randomReference);
+	const double meanDiff = referenceMean > 0.0 ? fabs(randomReferenceMean - referenceMean) / referenceMean : 1.0;
+	printf("reference mean luminance %.4f with Sobol, %.4f with random (%.2f%% apart)\n", referenceMean, randomReferenceMean, meanDiff * 100.0);
+
+	Array<uint32_t> samples;
+	Array<double> randomRmse, sobolRmse;
+	for (uint32_t numFrames = 1; numFrames <= maxFrames; numFrames *= 2) {
+		Array<vec4> image;
+		RenderFrames(scene, randomParams, width, height, numFrames, pool, image);
+		randomRmse.push_back(ImageRmse(image, reference));
+		RenderFrames(scene, sobolParams, width, height, numFrames, pool, image);
+		sobolRmse.push_back(ImageRmse(image, reference));
+		samples.push_back(numFrames * SWS_SAMPLES_PER_FRAME);
+
+		printf("%5u spp | random RMSE %.5f | Sobol RMSE %.5f | x%.2f lower\n", samples.back(), randomRmse.back(), sobolRmse.back(),
+			sobolRmse.back() > 0.0 ? randomRmse.back() / sobolRmse.back() : 0.0);
+	}
+
+	// log-log slope, -0.5 is plain Monte Carlo
+	const size_t last = samples.size() - 1;
+	if (last > 0) {
+		const double logSamples = log(static_cast<double>(samples[last]) / static_cast<double>(samples[0]));
+		printf("convergence rate: random spp^%.3f, Sobol spp^%.3f\n",
+			log(randomRmse[last] / randomRmse[0]) / logSamples, log(sobolRmse[last] / sobolRmse[0]) / logSamples);
+	}
+
+	// where Sobol gets to the error random ends with
+	const double matchSamples = MatchingSamples(samples, sobolRmse, randomRmse[last]);
+	if (matchSamples > 0.0) {
+		printf("Sobol matches the %u spp random RMSE at %.1f spp, x%.2f fewer samples\n", samples[last], matchSamples, static_cast<double>(samples[last]) / matchSamples);
+	}
+	else {
+		printf("Sobol doesn't reach the %u spp random RMSE\n", samples[last]);
+	}
+
+	return meanDiff < sMeanTolerance;
+}
+
+// squared error over the squared reference, averaged over the rgb channels of one pixel
+static double PixelRelativeSquaredError(const vec4& color, const vec4& reference) {
+	static const double sDarkBias = 0.01;
+
+	double sum = 0.0;
+	for (int c = 0; c < 3; ++c) {
+		const double diff = static_cast<double>(color[c]) - static_cast<double>(reference[c]);
+		const double ref = static_cast<double>(reference[c]);
+		sum += (diff * diff) / (ref * ref + sDarkBias);
+	}
+	return sum / 3.0;
+}
+
+// mean of PixelRelativeSquaredError, what relative noise looks like to the eye
+static double ImageRelativeMse(const Array<vec4>& image, const Array<vec4>& reference) {
+	double sum = 0.0;
+	for (size_t i = 0; i < image.size(); ++i) {
+		sum += PixelRelativeSquaredError(image[i], reference[i]);
+	}
+	return sum / static_cast<double>(Max(image.size(), size_t(1)));
+}
+
+// the same over the worst tenth of the pixels, where the noise is
+static double ImageWorstRelativeMse(const Array<vec4>& image, const Array<vec4>& reference) {
+	Array<double> errors(image.size());
+	for (size_t i = 0; i < image.size(); ++i) {
+		errors[i] = PixelRelativeSquaredError(image[i], reference[i]);
+	}
+
+	const size_t numWorst = Max(errors.size() / 10, size_t(1));
+	std::nth_element(errors.begin(), errors.begin() + (errors.size() - numWorst), errors.end());
+	double sum = 0.0;
+	for (size_t i = errors.size() - numWorst; i < errors.size(); ++i) {
+		sum += errors[i];
+	}
+	return sum / static_cast<double>(numWorst);
+}
+
+bool RunAdaptiveBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames) {
+	static const uint32_t sReferenceScale = 8;
+	static const double sMeanTolerance = 0.02;  // relative
+
+	CpuScene scene;
+	if (!scene.Load(kDefaultSceneFile)) {
+		printf("Failed to load %s\n", kDefaultSceneFile);
+		return false;
+	}
+
+	ThreadPool& pool = ThreadPool::GetDefault();
+	const uint32_t referenceFrames = numFrames * sReferenceScale;
+	printf("Adaptive sampling benchmark, %ux%u, %u frames vs a %u frame reference, converged under %.1f%% relative error\n",
+		width, height, numFrames, referenceFrames, SWS_ADAPTIVE_THRESHOLD * 100.0f);
+
+	UniformParams uniformParams = MakeDefaultCameraParams(width, height);
+	UniformParams adaptiveParams = uniformParams;
+	adaptiveParams.frameData.z |= SWS_RENDER_ADAPTIVE;
+
+	// its own scrambles, so the reference doesn't share the first samples of the renders it judges
+	UniformParams referenceParams = uniformParams;
+	referenceParams.samplingData.y = 1;
+
+	Array<vec4> reference;
+	RenderFrames(scene, referenceParams, width, height, referenceFrames, pool, reference);
+	const double referenceMean = ImageMeanLuminance(reference);
+
+	const UniformParams* const modeParams[] = { &uniformParams, &adaptiveParams };
+	const char* const modeNames[] = { "uniform", "adaptive" };
+	const uint64_t numPixels = static_cast<uint64_t>(width) * height;
+	double modeRelMse[2] = {};
+	double modeWorstRelMse[2] = {};
+	double adaptiveMeanDiff = 1.0;
+	for (uint32_t m = 0; m < 2; ++m) {
+		Array<vec4> image;
+		const BenchClock::time_point start = BenchClock::now();
+		CpuTracer tracer;
+		tracer.Resize(width, height);
+
+		// RenderFrames, plus how many pixels the last frame still traced
+		UniformParams params = *modeParams[m];
+		CpuRayStats stats = {};
+		CpuRayStats lastStats = {};
+		for (uint32_t i = 0; i < numFrames; ++i) {
+			params.frameData.x = i;
+			tracer.Render(scene, params, pool);
+			lastStats = tracer.GetRayStats();
+			stats = AddRayStats(stats, lastStats);
+			params.samplingData.z = static_cast<uint32_t>(lastStats.numConvergingPixels);
+		}
+		image = tracer.GetAccumImage();
+		const double timeMs = ElapsedMs(start);
+
+		const double rmse = ImageRmse(image, reference);
+		const double relMse = ImageRelativeMse(image, reference);
+		const double worstRelMse = ImageWorstRelativeMse(image, reference);
+		modeRelMse[m] = relMse;
+		modeWorstRelMse[m] = worstRelMse;
+		if (1 == m) {
+			adaptiveMeanDiff = referenceMean > 0.0 ? fabs(ImageMeanLuminance(image) - referenceMean) / referenceMean : 1.0;
+		}
+
+		printf("%-8s | %9.2f ms/frame | %6.2f spp | %5.2f rays/pixel | RMSE %.5f | relMSE %.6f, worst 10%% %.6f | %5.1f%% converged | %.2f paths/pixel in the last frame\n",
+			modeNames[m], timeMs / numFrames,
+			static_cast<double>(stats.numPaths) / static_cast<double>(numPixels),
+			static_cast<double>(stats.numBounces + stats.numShadowRays) / static_cast<double>(numPixels * numFrames),
+			rmse, relMse, worstRelMse,
+			(1 == m) ? 100.0 - 100.0 * static_cast<double>(lastStats.numConvergingPixels) / static_cast<double>(numPixels) : 0.0,
+			static_cast<double>(lastStats.numPaths) / static_cast<double>(numPixels));
+	}
+	// both spend the same paths, so the error ratios are what adaptive sampling buys
+	printf("adaptive x%.3f relMSE, x%.3f worst 10%%, mean luminance %.2f%% off the reference\n",
+		modeRelMse[1] > 0.0 ? modeRelMse[0] / modeRelMse[1] : 0.0,
+		modeWorstRelMse[1] > 0.0 ? modeWorstRelMse[0] / modeWorstRelMse[1] : 0.0,
+		adaptiveMeanDiff * 100.0);
+
+	return adaptiveMeanDiff < sMeanTolerance;
+}
+
+bool RunDenoiseBenchmark(const uint32_t width, const uint32_t height, const uint32_t maxSamples) {
+	static const uint32_t sReferenceScale = 16;
+	static const uint32_t sMovingFrames = 32;
+	static const float sMoveStep = 0.02f;     // sideways per frame, in scene units
+	static const double sMeanTolerance = 0.02;  // relative
+
+	CpuScene scene;
+	if (!scene.Load(kDefaultSceneFile)) {
+		printf("Failed to load %s\n", kDefaultSceneFile);
+		return false;
+	}
+
+	ThreadPool& pool = ThreadPool::GetDefault();
+	const uint32_t maxFrames = Max(maxSamples / SWS_SAMPLES_PER_FRAME, 1u);
+	const uint32_t referenceFrames = maxFrames * sReferenceScale;
+	printf("Denoiser benchmark, %ux%u, %u a-trous iterations, up to %u spp vs a %u spp reference\n",
+		width, height, SWS_DENOISE_ITERATIONS, maxFrames * SWS_SAMPLES_PER_FRAME, referenceFrames * SWS_SAMPLES_PER_FRAME);
+
+	UniformParams params = MakeDefaultCameraParams(width, height);
+	params.frameData.z |= SWS_RENDER_DENOISE;
+
+	// its own scrambles, so the reference doesn't share the first samples of the renders it judges
+	UniformParams referenceParams = MakeDefaultCameraParams(width, height);
+	referenceParams.samplingData.y = 1;
+
+	Array<vec4> reference;
+	RenderFrames(scene, referenceParams, width, height, referenceFrames, pool, reference);
+	const double referenceMean = ImageMeanLuminance(reference);
+
+	// still camera: the denoiser on top of the accumulation, checked whenever the samples double
+	CpuTracer tracer;
+	tracer.Resize(width, height);
+	CpuDenoiser denoiser;
+	denoiser.Resize(width, height);
+
+	Array<uint32_t> samples;
+	Array<double> rawRmse, denoisedRmse, rawRelMse, denoisedRelMse;
+	double denoiseMs = 0.0;
+	double denoisedMeanDiff = 1.0;
+	for (uint32_t i = 0, nextCheck = 1; i < maxFrames; ++i) {
+		params.frameData.x = i;
+		params.denoiseData.x = i;
+		tracer.Render(scene, params, pool);
+
+		const BenchClock::time_point start = BenchClock::now();
+		denoiser.Denoise(tracer, params, pool);
+		denoiseMs += ElapsedMs(start);
+
+		if (i + 1 == nextCheck || i + 1 == maxFrames) {
+			const Array<vec4>& raw = tracer.GetAccumImage();
+			const Array<vec4>& denoised = denoiser.GetFilteredImage();
+			samples.push_back((i + 1) * SWS_SAMPLES_PER_FRAME);
+			rawRmse.push_back(ImageRmse(raw, reference));
+			denoisedRmse.push_back(ImageRmse(denoised, reference));
+			rawRelMse.push_back(ImageRelativeMse(raw, reference));
+			denoisedRelMse.push_back(ImageRelativeMse(denoised, reference));
+			denoisedMeanDiff = referenceMean > 0.0 ? fabs(ImageMeanLuminance(denoised) - referenceMean) / referenceMean : 1.0;
+			nextCheck *= 2;
+		}
+	}
+	printf("denoising takes %.3f ms per frame on %u threads\n", denoiseMs / maxFrames, pool.GetNumThreads());
+
+	// what the raw accumulation needs for the denoised error, past the end of the curve it goes on with its last slope
+	const size_t last = samples.size() - 1;
+	const double rawSlope = last > 0 ? log(rawRmse[last] / rawRmse[last - 1]) / log(static_cast<double>(samples[last]) / static_cast<double>(samples[last - 1])) : -0.5;
+	for (size_t i = 0; i <= last; ++i) {
+		double matchSamples = MatchingSamples(samples, rawRmse, denoisedRmse[i]);
+		if (0.0 == matchSamples && rawSlope < 0.0) {
+			matchSamples = static_cast<double>(samples[last]) * pow(denoisedRmse[i] / rawRmse[last], 1.0 / rawSlope);
+		}
+		printf("%5u spp | raw RMSE %.5f relMSE %.6f | denoised RMSE %.5f relMSE %.6f | x%.2f lower RMSE | raw needs %.1f spp for it\n",
+			samples[i], rawRmse[i], rawRelMse[i], denoisedRmse[i], denoisedRelMse[i],
+			denoisedRmse[i] > 0.0 ? rawRmse[i] / denoisedRmse[i] : 0.0, matchSamples);
+	}
+	printf("denoised mean luminance %.2f%% off the reference at %u spp\n", denoisedMeanDiff * 100.0, samples[last]);
+
+	// moving camera: every frame restarts the accumulation with 1 spp, the history is all the temporal pass has.
+	// Each frame gets its own scrambles, like RtxApp gives every accumulation
+	const UniformParams startParams = MakeDefaultCameraParams(width, height);
+	const vec4 moveStep = startParams.camSide * sMoveStep;
+	UniformParams finalReferenceParams = referenceParams;
+	finalReferenceParams.camPos = startParams.camPos + moveStep * static_cast<float>(sMovingFrames - 1);
+	Array<vec4> finalReference;
+	RenderFrames(scene, finalReferenceParams, width, height, referenceFrames, pool, finalReference);
+
+	const char* const modeNames[] = { "spatial only", "temporal + spatial" };
+	double movingRmse[2] = {};
+	double movingRawRmse = 0.0;
+	for (uint32_t m = 0; m < 2; ++m) {
+		CpuTracer movingTracer;
+		movingTracer.Resize(width, height);
+		CpuDenoiser movingDenoiser;
+		movingDenoiser.Resize(width, height);
+
+		UniformParams movingParams = startParams;
+		movingParams.frameData.z |= SWS_RENDER_DENOISE;
+		for (uint32_t i = 0; i < sMovingFrames; ++i) {
+			movingParams.prevCamPos = movingParams.camPos;
+			movingParams.camPos = startParams.camPos + moveStep * static_cast<float>(i);
+			movingParams.frameData.x = 0;
+			movingParams.samplingData.y = 2 + i;
+			movingParams.denoiseData.x = i;
+			movingParams.denoiseData.z = (1 == m && i > 0) ? 1 : 0;
+			movingTracer.Render(scene, movingParams, pool);
+			movingDenoiser.Denoise(movingTracer, movingParams, pool);
+		}
+		movingRmse[m] = ImageRmse(movingDenoiser.GetFilteredImage(), finalReference);
+		movingRawRmse = ImageRmse(movingTracer.GetAccumImage(), finalReference);
+	}
+	printf("moving camera, %u frames at 1 spp: raw RMSE %.5f | %s %.5f | %s %.5f\n",
+		sMovingFrames, movingRawRmse, modeNames[0], movingRmse[0], modeNames[1], movingRmse[1]);
+
+	// the filter has to take noise away at low spp and leave the converged image where it was
+	return denoisedRmse[0] < rawRmse[0] && denoisedMeanDiff < sMeanTolerance;
+}
+
+
+
+// MemoryAllocator on a FakeMemoryBackend, 1 MB blocks: device-local type 0 on heap 0, host-visible type 1 on heap 1
+
+static const VkDeviceSize sTestBlockSize = 1024 * 1024;
+
+#define ALLOCATOR_EXPECT(condition) \
+	if (!(condition)) { \
+		printf("  FAILED (line %d): %s\n", __LINE__, #condition); \
+		++numFailures; \
+	}
+
+static VkPhysicalDeviceMemoryProperties MakeTestMemoryProperties() {
+	VkPhysicalDeviceMemoryProperties properties = {};
+	properties.memoryTypeCount = 2;
+	properties.memoryTypes[0].propertyFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	properties.memoryTypes[0].heapIndex = 0;
+	properties.memoryTypes[1].propertyFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	properties.memoryTypes[1].heapIndex = 1;
+	properties.memoryHeapCount = 2;
+	properties.memoryHeaps[0].size = 1024ull * 1024 * 1024;
+	properties.memoryHeaps[1].size = 256ull * 1024 * 1024;
+	return properties;
+}
+
+static VkMemoryRequirements MakeRequirements(const VkDeviceSize size, const VkDeviceSize alignment) {
+	VkMemoryRequirements requirements;
+	requirements.size = size;
+	requirements.alignment = alignment;
+	requirements.memoryTypeBits = 3;
+	return requirements;
+}
+
+static uint32_t TestBuddySplitAndMerge() {
+	uint32_t numFailures = 0;
+	helpers::FakeMemoryBackend backend;
+	helpers::MemoryAllocator allocator;
+	allocator.Initialize(&backend, MakeTestMemoryProperties(), sTestBlockSize);
+
+	// every allocation takes the lowest free buddy, splitting bigger ones on the way
+	helpers::MemoryAllocation a, b, c, d;
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(256, 256), 0, helpers::MemoryKind::Linear, a));
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(256, 1), 0, helpers::MemoryKind::Linear, b));
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(1000, 4), 0, helpers::MemoryKind::Linear, c));
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(100, 16), 0, helpers::MemoryKind::Linear, d));
+	ALLOCATOR_EXPECT(a.block && 0 == a.offset && 8 == a.order);
+	ALLOCATOR_EXPECT(b.block == a.block && 256 == b.offset && 8 == b.order);
+	ALLOCATOR_EXPECT(c.block == a.block && 1024 == c.offset && 10 == c.order);
+	ALLOCATOR_EXPECT(d.block == a.block && 512 == d.offset && 8 == d.order);
+	ALLOCATOR_EXPECT(1 == backend.GetNumAllocations() && sTestBlockSize == backend.GetAllocatedBytes());
+
+	helpers::MemoryHeapStats stats;
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(1612 == stats.liveBytes && 1792 == stats.usedBytes);
+	ALLOCATOR_EXPECT(4 == stats.numAllocations && 1 == stats.numBlocks && 0 == stats.numDedicated && sTestBlockSize == stats.reservedBytes);
+
+	// freed buddies merge all the way back into one free block, which is kept for the next allocation
+	allocator.Free(b);
+	allocator.Free(d);
+	allocator.Free(a);
+	allocator.Free(c);
+	ALLOCATOR_EXPECT(!b.memory && !b.block);
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(0 == stats.liveBytes && 0 == stats.usedBytes && 0 == stats.numAllocations);
+	ALLOCATOR_EXPECT(1 == stats.numBlocks && sTestBlockSize == stats.largestFreeRange && 0.0f == stats.fragmentation);
+	ALLOCATOR_EXPECT(1 == backend.GetNumAllocations());
+
+	// four quarters: freeing every other one leaves two 256 KB holes that can't merge
+	helpers::MemoryAllocation quarters[4];
+	for (helpers::MemoryAllocation& quarter : quarters) {
+		ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(sTestBlockSize / 4, 256), 0, helpers::MemoryKind::Linear, quarter));
+	}
+	ALLOCATOR_EXPECT(quarters[3].offset == 3 * sTestBlockSize / 4 && 1 == backend.GetNumAllocations());
+	allocator.Free(quarters[0]);
+	allocator.Free(quarters[2]);
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(sTestBlockSize / 4 == stats.largestFreeRange && std::fabs(stats.fragmentation - 0.5f) < 1e-6f);
+	allocator.Free(quarters[1]);
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(sTestBlockSize / 2 == stats.largestFreeRange && std::fabs(stats.fragmentation - 1.0f / 3.0f) < 1e-6f);
+	allocator.Free(quarters[3]);
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(sTestBlockSize == stats.largestFreeRange && 0.0f == stats.fragmentation);
+
+	// a full block makes a new one, which goes back to the driver once it's empty again
+	helpers::MemoryAllocation halves[3];
+	for (helpers::MemoryAllocation& half : halves) {
+		ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(sTestBlockSize / 2, 256), 0, helpers::MemoryKind::Linear, half));
+	}
+	ALLOCATOR_EXPECT(halves[0].block == halves[1].block && halves[2].block != halves[0].block && halves[2].block && 0 == halves[2].offset);
+	ALLOCATOR_EXPECT(2 == backend.GetNumAllocations());
+	allocator.Free(halves[2]);
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(1 == stats.numBlocks && 1 == backend.GetNumAllocations());
+	allocator.Free(halves[0]);
+	allocator.Free(halves[1]);
+
+	// optimal images never share a block with buffers
+	helpers::MemoryAllocation linear, optimal;
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(256, 256), 0, helpers::MemoryKind::Linear, linear));
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(256, 256), 0, helpers::MemoryKind::Optimal, optimal));
+	ALLOCATOR_EXPECT(linear.memory != optimal.memory && 2 == backend.GetNumAllocations());
+	allocator.Free(linear);
+	allocator.Free(optimal);
+
+	allocator.Shutdown();
+	ALLOCATOR_EXPECT(0 == backend.GetNumAllocations() && 0 == backend.GetNumErrors());
+	return numFailures;
+}
+
+static uint32_t TestAlignment() {
+	uint32_t numFailures = 0;
+	helpers::FakeMemoryBackend backend;
+	helpers::MemoryAllocator allocator;
+	allocator.Initialize(&backend, MakeTestMemoryProperties(), sTestBlockSize);
+
+	std::mt19937 rng(777u);
+	std::uniform_int_distribution<uint32_t> sizeLog(0, 16);
+	std::uniform_int_distribution<uint32_t> alignmentLog(0, 16);
+
+	Array<helpers::MemoryAllocation> allocations(300);
+	uint32_t numMisaligned = 0, numOutside = 0, numOverlaps = 0;
+	for (size_t i = 0; i < allocations.size(); ++i) {
+		const VkDeviceSize size = 1 + (rng() % (VkDeviceSize(1) << sizeLog(rng)));
+		const VkDeviceSize alignment = VkDeviceSize(1) << alignmentLog(rng);
+		helpers::MemoryAllocation& allocation = allocations[i];
+		ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(size, alignment), 0, helpers::MemoryKind::Linear, allocation));
+		numMisaligned += (0 != allocation.offset % alignment) ? 1 : 0;
+		numOutside += (allocation.offset + allocation.size > sTestBlockSize) ? 1 : 0;
+
+		for (size_t j = 0; j < i; ++j) {
+			const helpers::MemoryAllocation& other = allocations[j];
+			if (other.memory == allocation.memory && allocation.offset < other.offset + other.size && other.offset < allocation.offset + allocation.size) {
+				++numOverlaps;
+			}
+		}
+	}
+	ALLOCATOR_EXPECT(0 == numMisaligned);
+	ALLOCATOR_EXPECT(0 == numOutside);
+	ALLOCATOR_EXPECT(0 == numOverlaps);
+
+	std::shuffle(allocations.begin(), allocations.end(), rng);
+	for (helpers::MemoryAllocation& allocation : allocations) {
+		allocator.Free(allocation);
+	}
+
+	helpers::MemoryHeapStats stats;
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(0 == stats.numAllocations && 0 == stats.liveBytes && 0 == stats.usedBytes);
+	ALLOCATOR_EXPECT(1 == stats.numBlocks && sTestBlockSize == stats.largestFreeRange);
+
+	allocator.Shutdown();
+	ALLOCATOR_EXPECT(0 == backend.GetNumAllocations() && 0 == backend.GetNumErrors());
+	return numFailures;
+}
+
+static uint32_t TestDedicatedAndMapping() {
+	uint32_t numFailures = 0;
+	helpers::FakeMemoryBackend backend;
+	helpers::MemoryAllocator allocator;
+	allocator.Initialize(&backend, MakeTestMemoryProperties(), sTestBlockSize);
+
+	// more than half a block gets a memory object of its own
+	const VkDeviceSize bigSize = sTestBlockSize / 2 + 4096;
+	helpers::MemoryAllocation big;
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(bigSize, 256), 1, helpers::MemoryKind::Linear, big));
+	ALLOCATOR_EXPECT(big.memory && !big.block && 0 == big.offset && 0 == big.order);
+	ALLOCATOR_EXPECT(1 == backend.GetNumAllocations() && bigSize == backend.GetAllocatedBytes());
+
+	helpers::MemoryHeapStats stats;
+	allocator.GetHeapStats(1, stats);
+	ALLOCATOR_EXPECT(1 == stats.numDedicated && 0 == stats.numBlocks && bigSize == stats.reservedBytes && bigSize == stats.liveBytes);
+
+	// mapped once, then the same pointer
+	uint8_t* bigMapped = static_cast<uint8_t*>(allocator.Map(big));
+	ALLOCATOR_EXPECT(bigMapped && bigMapped == allocator.Map(big) && 1 == backend.GetNumMapped());
+
+	// sub-allocations map their block once and point into it at their offsets
+	helpers::MemoryAllocation a, b;
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(256, 256), 1, helpers::MemoryKind::Linear, a));
+	ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(4096, 4096), 1, helpers::MemoryKind::Linear, b));
+	uint8_t* aMapped = static_cast<uint8_t*>(allocator.Map(a));
+	uint8_t* bMapped = static_cast<uint8_t*>(allocator.Map(b));
+	ALLOCATOR_EXPECT(aMapped && bMapped && bMapped - aMapped == static_cast<ptrdiff_t>(b.offset) - static_cast<ptrdiff_t>(a.offset));
+	ALLOCATOR_EXPECT(2 == backend.GetNumMapped());
+	if (aMapped && bMapped) {
+		std::memset(aMapped, 0xA5, 256);
+		std::memset(bMapped, 0x5A, 4096);
+		ALLOCATOR_EXPECT(0xA5 == aMapped[255] && 0x5A == bMapped[0] && 0x5A == bMapped[4095]);
+	}
+
+	// freeing unmaps, the dedicated memory goes straight back
+	allocator.Free(big);
+	ALLOCATOR_EXPECT(1 == backend.GetNumAllocations() && 1 == backend.GetNumMapped());
+	allocator.GetHeapStats(1, stats);
+	ALLOCATOR_EXPECT(0 == stats.numDedicated && 2 == stats.numAllocations && 4096 + 256 == stats.liveBytes);
+
+	// leaks are reported and released on shutdown
+	allocator.Shutdown();
+	ALLOCATOR_EXPECT(0 == backend.GetNumAllocations() && 0 == backend.GetNumMapped() && 0 == backend.GetNumErrors());
+	return numFailures;
+}
+
+static uint32_t TestOutOfMemory() {
+	uint32_t numFailures = 0;
+	helpers::FakeMemoryBackend backend(sTestBlockSize);
+	helpers::MemoryAllocator allocator;
+	allocator.Initialize(&backend, MakeTestMemoryProperties(), sTestBlockSize);
+
+	helpers::MemoryAllocation halves[2], more, big, badType;
+	for (helpers::MemoryAllocation& half : halves) {
+		ALLOCATOR_EXPECT(VK_SUCCESS == allocator.Allocate(MakeRequirements(sTestBlockSize / 2, 256), 0, helpers::MemoryKind::Linear, half));
+	}
+	ALLOCATOR_EXPECT(VK_ERROR_OUT_OF_DEVICE_MEMORY == allocator.Allocate(MakeRequirements(256, 256), 0, helpers::MemoryKind::Linear, more));
+	ALLOCATOR_EXPECT(VK_ERROR_OUT_OF_DEVICE_MEMORY == allocator.Allocate(MakeRequirements(sTestBlockSize, 256), 0, helpers::MemoryKind::Linear, big));
+	ALLOCATOR_EXPECT(VK_ERROR_INITIALIZATION_FAILED == allocator.Allocate(MakeRequirements(256, 256), 5, helpers::MemoryKind::Linear, badType));
+	ALLOCATOR_EXPECT(!more.memory && !big.memory && !badType.memory);
+
+	// failures leave the stats alone
+	helpers::MemoryHeapStats stats;
+	allocator.GetHeapStats(0, stats);
+	ALLOCATOR_EXPECT(2 == stats.numAllocations && sTestBlockSize == stats.usedBytes && 0 == stats.numDedicated);
+
+	// freeing what failed is harmless
+	allocator.Free(more);
+	for (helpers::MemoryAllocation& half : halves) {
+		allocator.Free(half);
+	}
+	allocator.Shutdown();
+	ALLOCATOR_EXPECT(0 == backend.GetNumAllocations() && 0 == backend.GetNumErrors());
+	return numFailures;
+}
+
+#undef ALLOCATOR_EXPECT
+
+bool RunAllocatorTests() {
+	struct AllocatorTest {
+		const char* name;
+		uint32_t (*run)();
+	};
+	static const AllocatorTest tests[] = {
+		{ "buddy split and merge", TestBuddySplitAndMerge },
+		{ "alignment", TestAlignment },
+		{ "dedicated allocations and mapping", TestDedicatedAndMapping },
+		{ "out of memory", TestOutOfMemory },
+	};
+
+	uint32_t numFailed = 0;
+	for (const AllocatorTest& test : tests) {
+		printf("%s\n", test.name);
+		const uint32_t numFailures = test.run();
+		printf("  %s\n", numFailures ? "FAILED" : "ok");
+		numFailed += numFailures ? 1 : 0;
+	}
+
+	printf("%u of %zu allocator tests passed\n", static_cast<uint32_t>(sizeof(tests) / sizeof(tests[0])) - numFailed, sizeof(tests) / sizeof(tests[0]));
+	return 0 == numFailed;
+}
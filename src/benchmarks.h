@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// command line benchmarks, run instead of the app
+
+// OBJ reader vs tinyobj on every Cornell box scene plus a generated random mesh of numRandomTriangles.
+// Returns false if a file is missing or the two readers disagree on any mesh, position, normal, index or material id
+bool RunObjReaderBenchmark(const uint32_t numRandomTriangles);
+
+// binned SAH BVH on every Cornell box scene: build metrics, then the closest hits of numRays random rays
+// are checked against brute force, returns false on any mismatch
+bool RunBvhBenchmark(const uint32_t numRays);
+
+// 8-wide BVH against the binary one on every Cornell box scene: Mrays/s of primary, shadow and diffuse bounce
+// rays on one thread, returns false if the two trees disagree on any ray
+bool RunBvh8Benchmark(const uint32_t numRays);
+
+// CPU path tracer on the default scene, Mrays/s and scaling from 1 thread up to every hardware thread.
+// Returns false if the scene doesn't load or nothing gets traced
+bool RunCpuTracerBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames);
+
+// CPU path tracer on CornellBox-Glossy and CornellBox-Water, bounces traced one ray at a time vs
+// gathered per tile and sorted by octant and Morton code, the two images have to be identical.
+// Returns false if a scene doesn't load or any pixel differs
+bool RunRayStreamBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames);
+
+// CPU path tracer on the default scene, light sampling with MIS vs BSDF sampling only at equal samples per pixel,
+// RMSE of both against a long NEE render. Returns false if the two estimators converge to different images
+bool RunNeeBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames);
+
+// CPU path tracer on the default scene with Russian roulette starting at different depths: time, rays per pixel
+// and path, and RMSE against a long render without it. Returns false if the roulette shifts the converged image
+bool RunRussianRouletteBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames);
+
+// CPU path tracer on the default scene, white noise vs scrambled Sobol samples: RMSE against a long render from
+// 1 spp up to maxSamples and how many samples Sobol needs for random's final error. Returns false if the two
+// samplers converge to different images
+bool RunSamplerBenchmark(const uint32_t width, const uint32_t height, const uint32_t maxSamples);
+
+// CPU path tracer on the default scene, every pixel getting the same samples vs adaptive sampling at the same
+// budget per frame: RMSE and relative MSE against a long render and how many pixels converged. Returns false
+// if the adaptive image converges to something else
+bool RunAdaptiveBenchmark(const uint32_t width, const uint32_t height, const uint32_t numFrames);
+
+// CPU path tracer on the default scene with the spatio-temporal denoiser: RMSE and relative MSE of the raw and the
+// denoised image against a long render from 1 spp up to maxSamples and the raw spp that match the denoised error, then
+// a camera sliding sideways at 1 spp a frame, spatial only vs with the reprojected history. Returns false if the
+// denoiser doesn't lower the 1 spp error or shifts the converged image
+bool RunDenoiseBenchmark(const uint32_t width, const uint32_t height, const uint32_t maxSamples);
+
+// MemoryAllocator on a FakeMemoryBackend, no device needed: buddy split/merge, alignment, dedicated allocations,
+// mapping, out of memory and the heap stats along the way. Returns false if any check fails
+bool RunAllocatorTests();
@@ -0,0 +1,150 @@
+#include "mapped_file.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+MappedFile::MappedFile()
+	: _Data(nullptr)
+	, _Size(0)
+#ifdef _WIN32
+	, _File(INVALID_HANDLE_VALUE)
+	, _Mapping(nullptr)
+#else
+	, _File(-1)
+#endif
+{
+}
+MappedFile::~MappedFile() {
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char* fileName) {
+	Close();
+
+	_File = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (INVALID_HANDLE_VALUE == _File) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(_File, &fileSize) || !fileSize.QuadPart) {
+		Close();
+		return false;
+	}
+
+	_Mapping = CreateFileMappingA(_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!_Mapping) {
+		Close();
+		return false;
+	}
+
+	_Data = reinterpret_cast<const uint8_t*>(MapViewOfFile(_Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!_Data) {
+		Close();
+		return false;
+	}
+
+	_Size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close() {
+	if (_Data) {
+		UnmapViewOfFile(_Data);
+		_Data = nullptr;
+	}
+	if (_Mapping) {
+		CloseHandle(_Mapping);
+		_Mapping = nullptr;
+	}
+	if (INVALID_HANDLE_VALUE != _File) {
+		CloseHandle(_File);
+		_File = INVALID_HANDLE_VALUE;
+	}
+	_Size = 0;
+}
+
+bool GetFileStamp(const char* fileName, FileStamp& stamp) {
+	struct _stat64 st;
+	if (0 != _stat64(fileName, &st)) {
+		return false;
+	}
+
+	stamp.size = static_cast<uint64_t>(st.st_size);
+	stamp.mtime = static_cast<uint64_t>(st.st_mtime);
+	return true;
+}
+
+#else
+
+bool MappedFile::Open(const char* fileName) {
+	Close();
+
+	_File = open(fileName, O_RDONLY);
+	if (_File < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (0 != fstat(_File, &st) || !st.st_size) {
+		Close();
+		return false;
+	}
+
+	void* mem = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, _File, 0);
+	if (MAP_FAILED == mem) {
+		Close();
+		return false;
+	}
+
+	_Data = reinterpret_cast<const uint8_t*>(mem);
+	_Size = static_cast<size_t>(st.st_size);
+	return true;
+}
+
+void MappedFile::Close() {
+	if (_Data) {
+		munmap(const_cast<uint8_t*>(_Data), _Size);
+		_Data = nullptr;
+	}
+	if (_File >= 0) {
+		close(_File);
+		_File = -1;
+	}
+	_Size = 0;
+}
+
+bool GetFileStamp(const char* fileName, FileStamp& stamp) {
+	struct stat st;
+	if (0 != stat(fileName, &st)) {
+		return false;
+	}
+
+	stamp.size = static_cast<uint64_t>(st.st_size);
+	stamp.mtime = static_cast<uint64_t>(st.st_mtime);
+	return true;
+}
+
+#endif // _WIN32
+
+// getters
+const uint8_t* MappedFile::GetData() const {
+	return _Data;
+}
+
+size_t MappedFile::GetSize() const {
+	return _Size;
+}
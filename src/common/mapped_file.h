@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// read-only memory-mapped view of a whole file
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool            Open(const char* fileName);
+	void            Close();
+
+	// getters
+	const uint8_t*  GetData() const;
+	size_t          GetSize() const;
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+	const uint8_t*  _Data;
+	size_t          _Size;
+#ifdef _WIN32
+	void*           _File;
+	void*           _Mapping;
+#else
+	int             _File;
+#endif
+};
+
+// size and last modification time of a file, used to detect stale caches cheaply
+struct FileStamp {
+	uint64_t    size;
+	uint64_t    mtime;
+};
+
+bool GetFileStamp(const char* fileName, FileStamp& stamp);
@@ -0,0 +1,152 @@
+#include "thread_pool.h"
+
+#include <cassert>
+
+
+ThreadPool::ThreadPool(const uint32_t numThreads)
+	: _Func(nullptr)
+	, _NumSteals(0)
+	, _Generation(0)
+	, _NumWorking(0)
+	, _Quit(false)
+{
+	uint32_t count = numThreads ? numThreads : std::thread::hardware_concurrency();
+	count = Max(count, 1u);
+
+	_Ranges.reset(new TaskRange[count]);
+
+	// thread 0 is the caller of ParallelFor
+	_Threads.reserve(count - 1);
+	for (uint32_t i = 1; i < count; ++i) {
+		_Threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_Mutex);
+		_Quit = true;
+	}
+	_WakeCondition.notify_all();
+
+	for (std::thread& thread : _Threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::ParallelFor(const uint32_t numTasks, const TaskFunc& func) {
+	if (!numTasks) {
+		return;
+	}
+
+	if (_Threads.empty() || 1 == numTasks) {
+		for (uint32_t i = 0; i < numTasks; ++i) {
+			func(i, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_Mutex);
+		assert(!_Func && "ThreadPool::ParallelFor is not reentrant");
+		_Func = &func;
+
+		// even split up front, stealing evens out whatever the tasks' costs turn out to be
+		const uint32_t numThreads = GetNumThreads();
+		for (uint32_t i = 0; i < numThreads; ++i) {
+			std::lock_guard<std::mutex> rangeLock(_Ranges[i].mutex);
+			_Ranges[i].begin = static_cast<uint32_t>((static_cast<uint64_t>(numTasks) * i) / numThreads);
+			_Ranges[i].end = static_cast<uint32_t>((static_cast<uint64_t>(numTasks) * (i + 1)) / numThreads);
+		}
+		_NumSteals.store(0);
+		_NumWorking = static_cast<uint32_t>(_Threads.size());
+		++_Generation;
+	}
+	_WakeCondition.notify_all();
+
+	RunTasks(0);
+
+	std::unique_lock<std::mutex> lock(_Mutex);
+	_DoneCondition.wait(lock, [this]() { return 0 == _NumWorking; });
+	_Func = nullptr;
+}
+
+uint32_t ThreadPool::GetNumThreads() const {
+	return static_cast<uint32_t>(_Threads.size()) + 1;
+}
+
+uint32_t ThreadPool::GetNumSteals() const {
+	return _NumSteals.load();
+}
+
+ThreadPool& ThreadPool::GetDefault() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::WorkerLoop(const uint32_t threadIdx) {
+	uint32_t seenGeneration = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_Mutex);
+			_WakeCondition.wait(lock, [this, seenGeneration]() { return _Quit || _Generation != seenGeneration; });
+			if (_Quit) {
+				return;
+			}
+			seenGeneration = _Generation;
+		}
+
+		RunTasks(threadIdx);
+
+		std::lock_guard<std::mutex> lock(_Mutex);
+		if (0 == --_NumWorking) {
+			_DoneCondition.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunTasks(const uint32_t threadIdx) {
+	uint32_t taskIdx;
+	while (PopTask(threadIdx, taskIdx) || StealTask(threadIdx, taskIdx)) {
+		(*_Func)(taskIdx, threadIdx);
+	}
+}
+
+bool ThreadPool::PopTask(const uint32_t threadIdx, uint32_t& taskIdx) {
+	TaskRange& range = _Ranges[threadIdx];
+	std::lock_guard<std::mutex> lock(range.mutex);
+	if (range.begin >= range.end) {
+		return false;
+	}
+	taskIdx = range.begin++;
+	return true;
+}
+
+bool ThreadPool::StealTask(const uint32_t threadIdx, uint32_t& taskIdx) {
+	const uint32_t numThreads = GetNumThreads();
+	for (uint32_t i = 1; i < numThreads; ++i) {
+		TaskRange& victim = _Ranges[(threadIdx + i) % numThreads];
+
+		uint32_t stolenBegin, stolenEnd;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			const uint32_t remaining = victim.end - Min(victim.begin, victim.end);
+			if (!remaining) {
+				continue;
+			}
+			// the victim keeps working from the front, we take the back half
+			stolenEnd = victim.end;
+			stolenBegin = victim.end - (remaining + 1) / 2;
+			victim.end = stolenBegin;
+		}
+		++_NumSteals;
+
+		// run the first stolen task now, the rest becomes ours (and can be stolen again)
+		TaskRange& own = _Ranges[threadIdx];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		own.begin = stolenBegin + 1;
+		own.end = stolenEnd;
+		taskIdx = stolenBegin;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Fixed set of worker threads for data-parallel loops.
+// The calling thread takes part in the work, so GetNumThreads() includes it.
+// Every thread starts with its own contiguous slice of the tasks (neighbouring tasks stay on one thread),
+// a thread that runs dry steals the back half of somebody else's slice.
+class ThreadPool {
+public:
+	using TaskFunc = std::function<void(const uint32_t taskIdx, const uint32_t threadIdx)>;
+
+	explicit ThreadPool(const uint32_t numThreads = 0); // 0 - one thread per hardware thread
+	~ThreadPool();
+
+	// runs func for every task in [0, numTasks) and returns when all of them are done
+	void        ParallelFor(const uint32_t numTasks, const TaskFunc& func);
+
+	// getters
+	uint32_t    GetNumThreads() const;
+	uint32_t    GetNumSteals() const;   // during the last ParallelFor
+
+	static ThreadPool& GetDefault();
+
+private:
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void        WorkerLoop(const uint32_t threadIdx);
+	void        RunTasks(const uint32_t threadIdx);
+	bool        PopTask(const uint32_t threadIdx, uint32_t& taskIdx);
+	bool        StealTask(const uint32_t threadIdx, uint32_t& taskIdx);
+
+	// [begin, end) of the tasks a thread still owns, padded so neighbours don't share a cache line
+	struct alignas(64) TaskRange {
+		std::mutex  mutex;
+		uint32_t    begin = 0;
+		uint32_t    end = 0;
+	};
+
+private:
+	Array<std::thread>      _Threads;
+	std::mutex              _Mutex;
+	std::condition_variable _WakeCondition;
+	std::condition_variable _DoneCondition;
+
+	const TaskFunc*         _Func;
+	std::unique_ptr<TaskRange[]> _Ranges;
+	std::atomic<uint32_t>   _NumSteals;
+	uint32_t                _Generation;
+	uint32_t                _NumWorking;
+	bool                    _Quit;
+};
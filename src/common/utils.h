@@ -4,6 +4,7 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <cstdint>
 
 template <typename T>
 using Array = std::vector<T>;
@@ -11,6 +12,16 @@ using Array = std::vector<T>;
 using String = std::basic_string<char, std::char_traits<char>>;
 using WString = std::basic_string<wchar_t, std::char_traits<wchar_t>>;
 
+// 64-bit FNV-1a, good enough to detect changed files / geometry
+inline uint64_t HashBytes(const void* data, const size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
 template <typename T>
 String ToString(const T f, const int n = 6) {
 	std::ostringstream out;
@@ -35,6 +46,8 @@ String ToString(const T f, const int n = 6) {
 using vec2 = glm::highp_vec2;
 using vec3 = glm::highp_vec3;
 using vec4 = glm::highp_vec4;
+using uvec4 = glm::highp_uvec4;
+using mat3 = glm::highp_mat3;
 using mat4 = glm::highp_mat4;
 using quat = glm::highp_quat;
 
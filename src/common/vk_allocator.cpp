@@ -0,0 +1,487 @@
+#include "vk_allocator.h"
+#include "volk.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace helpers {
+
+	static const uint32_t       kMinOrder = 8;                      // 256 bytes - the smallest buddy
+	static const VkDeviceSize   kMinBlockSize = 1ull * 1024 * 1024;
+	static const VkDeviceSize   kBlocksPerSmallHeap = 8;
+
+	static uint32_t CeilLog2(const VkDeviceSize value) {
+		uint32_t result = 0;
+		while ((1ull << result) < value) {
+			++result;
+		}
+		return result;
+	}
+
+	static uint32_t FloorLog2(const VkDeviceSize value) {
+		uint32_t result = 0;
+		while ((2ull << result) <= value) {
+			++result;
+		}
+		return result;
+	}
+
+
+
+	VulkanMemoryBackend::VulkanMemoryBackend(VkDevice device)
+		: _Device(device)
+	{
+	}
+
+	VkResult VulkanMemoryBackend::Allocate(const VkDeviceSize size, const uint32_t memoryTypeIndex, VkDeviceMemory& memory) {
+		VkMemoryAllocateInfo memoryAllocateInfo;
+		memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		memoryAllocateInfo.pNext = nullptr;
+		memoryAllocateInfo.allocationSize = size;
+		memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+		return vkAllocateMemory(_Device, &memoryAllocateInfo, nullptr, &memory);
+	}
+
+	void VulkanMemoryBackend::Free(VkDeviceMemory memory) {
+		vkFreeMemory(_Device, memory, nullptr);
+	}
+
+	void* VulkanMemoryBackend::Map(VkDeviceMemory memory) {
+		void* mem = nullptr;
+		if (VK_SUCCESS != vkMapMemory(_Device, memory, 0, VK_WHOLE_SIZE, 0, &mem)) {
+			mem = nullptr;
+		}
+		return mem;
+	}
+
+	void VulkanMemoryBackend::Unmap(VkDeviceMemory memory) {
+		vkUnmapMemory(_Device, memory);
+	}
+
+
+
+	FakeMemoryBackend::FakeMemoryBackend(const VkDeviceSize budget)
+		: _Budget(budget)
+		, _AllocatedBytes(0)
+		, _NumErrors(0)
+	{
+	}
+	FakeMemoryBackend::~FakeMemoryBackend() {
+	}
+
+	VkResult FakeMemoryBackend::Allocate(const VkDeviceSize size, const uint32_t memoryTypeIndex, VkDeviceMemory& memory) {
+		if (!size || (_Budget && _AllocatedBytes + size > _Budget)) {
+			memory = VK_NULL_HANDLE;
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+
+		std::unique_ptr<FakeMemory> fake(new FakeMemory());
+		fake->size = size;
+		fake->memoryTypeIndex = memoryTypeIndex;
+		fake->mapped = false;
+
+		// the handle is the address of its record, unique for as long as it's alive
+		memory = (VkDeviceMemory)(reinterpret_cast<uintptr_t>(fake.get()));
+		_AllocatedBytes += size;
+		_Memories.push_back(std::move(fake));
+		return VK_SUCCESS;
+	}
+
+	void FakeMemoryBackend::Free(VkDeviceMemory memory) {
+		auto it = std::find_if(_Memories.begin(), _Memories.end(), [memory](const std::unique_ptr<FakeMemory>& fake) {
+			return (VkDeviceMemory)(reinterpret_cast<uintptr_t>(fake.get())) == memory;
+		});
+		if (it == _Memories.end()) {
+			++_NumErrors;
+			return;
+		}
+
+		// the driver wants memory unmapped before it's freed
+		if ((*it)->mapped) {
+			++_NumErrors;
+		}
+		_AllocatedBytes -= (*it)->size;
+		_Memories.erase(it);
+	}
+
+	void* FakeMemoryBackend::Map(VkDeviceMemory memory) {
+		FakeMemory* fake = Find(memory);
+		if (!fake || fake->mapped) {
+			++_NumErrors;
+			return nullptr;
+		}
+
+		if (fake->bytes.empty()) {
+			fake->bytes.resize(static_cast<size_t>(fake->size));
+		}
+		fake->mapped = true;
+		return fake->bytes.data();
+	}
+
+	void FakeMemoryBackend::Unmap(VkDeviceMemory memory) {
+		FakeMemory* fake = Find(memory);
+		if (!fake || !fake->mapped) {
+			++_NumErrors;
+			return;
+		}
+		fake->mapped = false;
+	}
+
+	uint32_t FakeMemoryBackend::GetNumAllocations() const {
+		return static_cast<uint32_t>(_Memories.size());
+	}
+
+	VkDeviceSize FakeMemoryBackend::GetAllocatedBytes() const {
+		return _AllocatedBytes;
+	}
+
+	uint32_t FakeMemoryBackend::GetNumMapped() const {
+		return static_cast<uint32_t>(std::count_if(_Memories.begin(), _Memories.end(), [](const std::unique_ptr<FakeMemory>& fake) { return fake->mapped; }));
+	}
+
+	uint32_t FakeMemoryBackend::GetNumErrors() const {
+		return _NumErrors;
+	}
+
+	FakeMemoryBackend::FakeMemory* FakeMemoryBackend::Find(VkDeviceMemory memory) {
+		for (std::unique_ptr<FakeMemory>& fake : _Memories) {
+			if ((VkDeviceMemory)(reinterpret_cast<uintptr_t>(fake.get())) == memory) {
+				return fake.get();
+			}
+		}
+		return nullptr;
+	}
+
+
+
+	MemoryAllocator::MemoryAllocator()
+		: _Backend(nullptr)
+		, _MemoryProperties({})
+		, _PreferredBlockSize(0)
+	{
+	}
+	MemoryAllocator::~MemoryAllocator() {
+		Shutdown();
+	}
+
+	void MemoryAllocator::Initialize(DeviceMemoryBackend* backend, const VkPhysicalDeviceMemoryProperties& memoryProperties, const VkDeviceSize preferredBlockSize) {
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		_Backend = backend;
+		_MemoryProperties = memoryProperties;
+		_PreferredBlockSize = 1ull << FloorLog2(std::max(preferredBlockSize, kMinBlockSize));
+		_Pools.clear();
+		_Pools.resize(VK_MAX_MEMORY_TYPES * static_cast<size_t>(MemoryKind::Count));
+	}
+
+	void MemoryAllocator::Shutdown() {
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		if (!_Backend) {
+			return;
+		}
+
+		for (Pool& pool : _Pools) {
+			if (pool.numAllocations) {
+				printf("MemoryAllocator: %u allocations (%llu bytes) still alive on shutdown\n", pool.numAllocations, static_cast<unsigned long long>(pool.liveBytes));
+			}
+			for (std::unique_ptr<Block>& block : pool.blocks) {
+				DestroyBlock(block.get());
+			}
+			pool.blocks.clear();
+		}
+		_Pools.clear();
+
+		for (const auto& mapping : _DedicatedMappings) {
+			_Backend->Unmap(mapping.first);
+		}
+		_DedicatedMappings.clear();
+
+		_Backend = nullptr;
+	}
+
+	VkResult MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, const uint32_t memoryTypeIndex, const MemoryKind kind, MemoryAllocation& allocation) {
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		if (!_Backend || memoryTypeIndex >= _MemoryProperties.memoryTypeCount) {
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+
+		allocation = MemoryAllocation();
+		allocation.size = requirements.size;
+		allocation.memoryTypeIndex = memoryTypeIndex;
+		allocation.kind = kind;
+
+		Pool& pool = GetPool(memoryTypeIndex, kind);
+		const VkDeviceSize blockSize = GetBlockSize(memoryTypeIndex);
+		const VkDeviceSize neededSize = std::max(requirements.size, requirements.alignment);
+
+		// huge resources get their own memory object
+		if (neededSize > blockSize / 2) {
+			const VkResult result = _Backend->Allocate(requirements.size, memoryTypeIndex, allocation.memory);
+			if (VK_SUCCESS != result) {
+				allocation.memory = VK_NULL_HANDLE;
+				return result;
+			}
+
+			pool.liveBytes += requirements.size;
+			pool.usedBytes += requirements.size;
+			pool.dedicatedBytes += requirements.size;
+			++pool.numAllocations;
+			++pool.numDedicated;
+			return VK_SUCCESS;
+		}
+
+		const uint32_t order = std::max(CeilLog2(neededSize), kMinOrder);
+
+		Block* block = nullptr;
+		VkDeviceSize offset = 0;
+		for (std::unique_ptr<Block>& candidate : pool.blocks) {
+			if (AllocateFromBlock(*candidate, order, offset)) {
+				block = candidate.get();
+				break;
+			}
+		}
+
+		if (!block) {
+			block = CreateBlock(memoryTypeIndex, blockSize);
+			if (!block) {
+				return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+			}
+			pool.blocks.emplace_back(block);
+			AllocateFromBlock(*block, order, offset);
+		}
+
+		++block->numAllocations;
+		pool.liveBytes += requirements.size;
+		pool.usedBytes += 1ull << order;
+		++pool.numAllocations;
+
+		allocation.memory = block->memory;
+		allocation.offset = offset;
+		allocation.order = order;
+		allocation.block = block;
+		return VK_SUCCESS;
+	}
+
+	void MemoryAllocator::Free(MemoryAllocation& allocation) {
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		if (!_Backend || !allocation.memory) {
+			allocation = MemoryAllocation();
+			return;
+		}
+
+		Pool& pool = GetPool(allocation.memoryTypeIndex, allocation.kind);
+		pool.liveBytes -= allocation.size;
+		--pool.numAllocations;
+
+		if (!allocation.block) {
+			auto it = std::find_if(_DedicatedMappings.begin(), _DedicatedMappings.end(), [&allocation](const std::pair<VkDeviceMemory, void*>& mapping) {
+				return mapping.first == allocation.memory;
+			});
+			if (it != _DedicatedMappings.end()) {
+				_Backend->Unmap(it->first);
+				_DedicatedMappings.erase(it);
+			}
+			_Backend->Free(allocation.memory);
+
+			pool.usedBytes -= allocation.size;
+			pool.dedicatedBytes -= allocation.size;
+			--pool.numDedicated;
+		}
+		else {
+			Block* block = static_cast<Block*>(allocation.block);
+			FreeToBlock(*block, allocation.offset, allocation.order);
+			pool.usedBytes -= 1ull << allocation.order;
+
+			// keep one empty block around so that create/destroy loops don't hit the driver every time
+			if (0 == --block->numAllocations && pool.blocks.size() > 1) {
+				auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(), [block](const std::unique_ptr<Block>& b) { return b.get() == block; });
+				DestroyBlock(block);
+				pool.blocks.erase(it);
+			}
+		}
+
+		allocation = MemoryAllocation();
+	}
+
+	void* MemoryAllocator::Map(const MemoryAllocation& allocation) {
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		if (!_Backend || !allocation.memory) {
+			return nullptr;
+		}
+
+		if (!allocation.block) {
+			for (const auto& mapping : _DedicatedMappings) {
+				if (mapping.first == allocation.memory) {
+					return mapping.second;
+				}
+			}
+
+			void* mem = _Backend->Map(allocation.memory);
+			if (mem) {
+				_DedicatedMappings.emplace_back(allocation.memory, mem);
+			}
+			return mem;
+		}
+
+		Block* block = static_cast<Block*>(allocation.block);
+		if (!block->mapped) {
+			block->mapped = _Backend->Map(block->memory);
+		}
+		return block->mapped ? static_cast<uint8_t*>(block->mapped) + allocation.offset : nullptr;
+	}
+
+	uint32_t MemoryAllocator::GetNumHeaps() const {
+		return _MemoryProperties.memoryHeapCount;
+	}
+
+	void MemoryAllocator::GetHeapStats(const uint32_t heapIndex, MemoryHeapStats& stats) const {
+		std::lock_guard<std::mutex> lock(_Mutex);
+
+		stats = MemoryHeapStats();
+
+		VkDeviceSize freeBytes = 0;
+		VkDeviceSize largestFreeBytes = 0;  // sum of the largest free ranges of every block
+		for (uint32_t typeIdx = 0; typeIdx < _MemoryProperties.memoryTypeCount && !_Pools.empty(); ++typeIdx) {
+			if (_MemoryProperties.memoryTypes[typeIdx].heapIndex != heapIndex) {
+				continue;
+			}
+
+			for (uint32_t kind = 0; kind < static_cast<uint32_t>(MemoryKind::Count); ++kind) {
+				const Pool& pool = _Pools[typeIdx * static_cast<size_t>(MemoryKind::Count) + kind];
+
+				stats.reservedBytes += pool.dedicatedBytes;
+				stats.liveBytes += pool.liveBytes;
+				stats.usedBytes += pool.usedBytes;
+				stats.numAllocations += pool.numAllocations;
+				stats.numDedicated += pool.numDedicated;
+				stats.numBlocks += static_cast<uint32_t>(pool.blocks.size());
+
+				for (const std::unique_ptr<Block>& block : pool.blocks) {
+					VkDeviceSize blockLargest = 0;
+					stats.reservedBytes += block->size;
+					for (uint32_t order = kMinOrder; order <= block->maxOrder; ++order) {
+						const size_t numFree = block->freeLists[order].size();
+						if (numFree) {
+							freeBytes += numFree * (1ull << order);
+							blockLargest = VkDeviceSize(1) << order;
+						}
+					}
+					largestFreeBytes += blockLargest;
+					stats.largestFreeRange = std::max(stats.largestFreeRange, blockLargest);
+				}
+			}
+		}
+
+		stats.fragmentation = freeBytes ? 1.0f - static_cast<float>(static_cast<double>(largestFreeBytes) / static_cast<double>(freeBytes)) : 0.0f;
+	}
+
+	void MemoryAllocator::PrintStats() const {
+		const double toMB = 1.0 / (1024.0 * 1024.0);
+
+		for (uint32_t heapIdx = 0; heapIdx < GetNumHeaps(); ++heapIdx) {
+			MemoryHeapStats stats;
+			GetHeapStats(heapIdx, stats);
+			if (!stats.reservedBytes) {
+				continue;
+			}
+
+			printf("Heap %u: %.2f MB reserved (%u blocks, %u dedicated), %.2f MB live (%.2f MB used) in %u allocations, fragmentation %.1f%%\n",
+				heapIdx,
+				stats.reservedBytes * toMB,
+				stats.numBlocks,
+				stats.numDedicated,
+				stats.liveBytes * toMB,
+				stats.usedBytes * toMB,
+				stats.numAllocations,
+				stats.fragmentation * 100.0f);
+		}
+	}
+
+	MemoryAllocator::Pool& MemoryAllocator::GetPool(const uint32_t memoryTypeIndex, const MemoryKind kind) {
+		return _Pools[memoryTypeIndex * static_cast<size_t>(MemoryKind::Count) + static_cast<size_t>(kind)];
+	}
+
+	VkDeviceSize MemoryAllocator::GetBlockSize(const uint32_t memoryTypeIndex) const {
+		// small heaps (like the 256 MB host-visible device-local one) get smaller blocks
+		const uint32_t heapIndex = _MemoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+		const VkDeviceSize heapSize = _MemoryProperties.memoryHeaps[heapIndex].size;
+		if (heapSize / kBlocksPerSmallHeap < _PreferredBlockSize) {
+			return 1ull << FloorLog2(std::max(heapSize / kBlocksPerSmallHeap, kMinBlockSize));
+		}
+		return _PreferredBlockSize;
+	}
+
+	bool MemoryAllocator::AllocateFromBlock(Block& block, const uint32_t order, VkDeviceSize& offset) {
+		if (order > block.maxOrder) {
+			return false;
+		}
+
+		uint32_t freeOrder = order;
+		while (freeOrder <= block.maxOrder && block.freeLists[freeOrder].empty()) {
+			++freeOrder;
+		}
+		if (freeOrder > block.maxOrder) {
+			return false;
+		}
+
+		// lowest offset first keeps the blocks compact
+		auto it = block.freeLists[freeOrder].begin();
+		offset = *it;
+		block.freeLists[freeOrder].erase(it);
+
+		// split down, the upper halves go to the free lists
+		while (freeOrder > order) {
+			--freeOrder;
+			block.freeLists[freeOrder].insert(offset + (1ull << freeOrder));
+		}
+
+		return true;
+	}
+
+	void MemoryAllocator::FreeToBlock(Block& block, VkDeviceSize offset, uint32_t order) {
+		// merge with the buddy for as long as it's free as well
+		while (order < block.maxOrder) {
+			const VkDeviceSize buddy = offset ^ (1ull << order);
+			auto it = block.freeLists[order].find(buddy);
+			if (it == block.freeLists[order].end()) {
+				break;
+			}
+			block.freeLists[order].erase(it);
+			offset = std::min(offset, buddy);
+			++order;
+		}
+
+		block.freeLists[order].insert(offset);
+	}
+
+	MemoryAllocator::Block* MemoryAllocator::CreateBlock(const uint32_t memoryTypeIndex, const VkDeviceSize size) {
+		std::unique_ptr<Block> block(new Block());
+		if (VK_SUCCESS != _Backend->Allocate(size, memoryTypeIndex, block->memory)) {
+			return nullptr;
+		}
+
+		block->size = size;
+		block->maxOrder = FloorLog2(size);
+		block->mapped = nullptr;
+		block->numAllocations = 0;
+		block->freeLists.resize(block->maxOrder + 1);
+		block->freeLists[block->maxOrder].insert(0);
+
+		return block.release();
+	}
+
+	void MemoryAllocator::DestroyBlock(Block* block) {
+		if (block->mapped) {
+			_Backend->Unmap(block->memory);
+			block->mapped = nullptr;
+		}
+		_Backend->Free(block->memory);
+		block->memory = VK_NULL_HANDLE;
+	}
+
+} // namespace helpers
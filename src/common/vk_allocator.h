@@ -0,0 +1,167 @@
+#pragma once
+#define VK_NO_PROTOTYPES
+#include "vulkan/vulkan.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace helpers {
+
+	// Where the allocator gets its VkDeviceMemory from.
+	// The real one talks to the driver, FakeMemoryBackend hands out made-up handles
+	// so the allocator can be exercised without a GPU.
+	class DeviceMemoryBackend {
+	public:
+		virtual ~DeviceMemoryBackend() = default;
+
+		virtual VkResult    Allocate(const VkDeviceSize size, const uint32_t memoryTypeIndex, VkDeviceMemory& memory) = 0;
+		virtual void        Free(VkDeviceMemory memory) = 0;
+		// maps the whole memory object
+		virtual void*       Map(VkDeviceMemory memory) = 0;
+		virtual void        Unmap(VkDeviceMemory memory) = 0;
+	};
+
+	class VulkanMemoryBackend : public DeviceMemoryBackend {
+	public:
+		explicit VulkanMemoryBackend(VkDevice device);
+
+		virtual VkResult    Allocate(const VkDeviceSize size, const uint32_t memoryTypeIndex, VkDeviceMemory& memory) override;
+		virtual void        Free(VkDeviceMemory memory) override;
+		virtual void*       Map(VkDeviceMemory memory) override;
+		virtual void        Unmap(VkDeviceMemory memory) override;
+
+	private:
+		VkDevice    _Device;
+	};
+
+	// Made-up memory objects for running the allocator without a device, the bytes behind one are only
+	// allocated on the host when it's mapped. budget - bytes it hands out before Allocate fails, 0 - no limit
+	class FakeMemoryBackend : public DeviceMemoryBackend {
+	public:
+		explicit FakeMemoryBackend(const VkDeviceSize budget = 0);
+		virtual ~FakeMemoryBackend();
+
+		virtual VkResult    Allocate(const VkDeviceSize size, const uint32_t memoryTypeIndex, VkDeviceMemory& memory) override;
+		virtual void        Free(VkDeviceMemory memory) override;
+		virtual void*       Map(VkDeviceMemory memory) override;
+		virtual void        Unmap(VkDeviceMemory memory) override;
+
+		// what's alive right now
+		uint32_t            GetNumAllocations() const;
+		VkDeviceSize        GetAllocatedBytes() const;
+		uint32_t            GetNumMapped() const;
+		// calls that didn't match an Allocate/Map (double frees, unknown handles, unmapping twice)
+		uint32_t            GetNumErrors() const;
+
+	private:
+		struct FakeMemory {
+			VkDeviceSize            size;
+			uint32_t                memoryTypeIndex;
+			std::vector<uint8_t>    bytes;      // empty until mapped
+			bool                    mapped;
+		};
+
+		FakeMemory*         Find(VkDeviceMemory memory);
+
+	private:
+		VkDeviceSize                        _Budget;
+		VkDeviceSize                        _AllocatedBytes;
+		uint32_t                            _NumErrors;
+		std::vector<std::unique_ptr<FakeMemory>> _Memories;
+	};
+
+
+	// buffers, linear images and acceleration structures never share a block with optimal images,
+	// so bufferImageGranularity can't bite us
+	enum class MemoryKind : uint32_t {
+		Linear = 0,
+		Optimal,
+
+		Count
+	};
+
+	struct MemoryAllocation {
+		VkDeviceMemory  memory = VK_NULL_HANDLE;
+		VkDeviceSize    offset = 0;
+		VkDeviceSize    size = 0;           // requested size
+		uint32_t        memoryTypeIndex = 0;
+		MemoryKind      kind = MemoryKind::Linear;
+		uint32_t        order = 0;          // log2 of the buddy size, 0 for dedicated allocations
+		void*           block = nullptr;    // owning block, nullptr for dedicated allocations
+	};
+
+	struct MemoryHeapStats {
+		VkDeviceSize    reservedBytes;      // blocks + dedicated allocations
+		VkDeviceSize    liveBytes;          // what the resources asked for
+		VkDeviceSize    usedBytes;          // live bytes after rounding up to the buddy sizes
+		VkDeviceSize    largestFreeRange;
+		uint32_t        numAllocations;
+		uint32_t        numDedicated;
+		uint32_t        numBlocks;
+		float           fragmentation;      // share of the free bytes that isn't part of the largest free range of its block
+	};
+
+	// Pooled device memory allocator.
+	// Every memory type (and memory kind) gets a list of big blocks, each block is managed by a binary buddy
+	// allocator, so alignment comes for free and neighbours merge back on free.
+	// Resources bigger than half a block get a dedicated VkDeviceMemory of their own.
+	// Host-visible blocks are mapped once on first use and stay mapped until they're released.
+	class MemoryAllocator {
+	public:
+		MemoryAllocator();
+		~MemoryAllocator();
+
+		void        Initialize(DeviceMemoryBackend* backend,
+			const VkPhysicalDeviceMemoryProperties& memoryProperties,
+			const VkDeviceSize preferredBlockSize = 64ull * 1024 * 1024);
+		void        Shutdown();
+
+		VkResult    Allocate(const VkMemoryRequirements& requirements, const uint32_t memoryTypeIndex, const MemoryKind kind, MemoryAllocation& allocation);
+		void        Free(MemoryAllocation& allocation);
+		// returns a pointer to the start of the allocation, valid until it's freed
+		void*       Map(const MemoryAllocation& allocation);
+
+		// stats
+		uint32_t    GetNumHeaps() const;
+		void        GetHeapStats(const uint32_t heapIndex, MemoryHeapStats& stats) const;
+		void        PrintStats() const;
+
+	private:
+		struct Block {
+			VkDeviceMemory                  memory;
+			VkDeviceSize                    size;
+			uint32_t                        maxOrder;
+			void*                           mapped;
+			uint32_t                        numAllocations;
+			std::vector<std::set<VkDeviceSize>> freeLists;    // free offsets per order
+		};
+
+		struct Pool {
+			std::vector<std::unique_ptr<Block>> blocks;
+			VkDeviceSize                    liveBytes = 0;
+			VkDeviceSize                    usedBytes = 0;
+			VkDeviceSize                    dedicatedBytes = 0;
+			uint32_t                        numAllocations = 0;
+			uint32_t                        numDedicated = 0;
+		};
+
+		Pool&       GetPool(const uint32_t memoryTypeIndex, const MemoryKind kind);
+		VkDeviceSize GetBlockSize(const uint32_t memoryTypeIndex) const;
+		bool        AllocateFromBlock(Block& block, const uint32_t order, VkDeviceSize& offset);
+		void        FreeToBlock(Block& block, VkDeviceSize offset, uint32_t order);
+		Block*      CreateBlock(const uint32_t memoryTypeIndex, const VkDeviceSize size);
+		void        DestroyBlock(Block* block);
+
+	private:
+		DeviceMemoryBackend*                _Backend;
+		VkPhysicalDeviceMemoryProperties    _MemoryProperties;
+		VkDeviceSize                        _PreferredBlockSize;
+		std::vector<Pool>                   _Pools;     // VK_MAX_MEMORY_TYPES * MemoryKind::Count
+		std::vector<std::pair<VkDeviceMemory, void*>> _DedicatedMappings;
+		mutable std::mutex                  _Mutex;
+	};
+
+} // namespace helpers
@@ -4,6 +4,10 @@
 #include <vector>
 #include <fstream>
 #include <cstring> 
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <atomic>
 
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -16,6 +20,18 @@
 
 namespace helpers {
 
+	namespace runtime_info {
+		VkPhysicalDevice                 PhyDevice = VK_NULL_HANDLE;
+		VkDevice                         Device = VK_NULL_HANDLE;
+		VkCommandPool                    CommandPool = VK_NULL_HANDLE;
+		VkQueue                          TransferQueue = VK_NULL_HANDLE;
+		VkPhysicalDeviceMemoryProperties PhysicalDeviceMemoryProperties = {};
+	} // namespace runtime_info
+
+	static std::unique_ptr<VulkanMemoryBackend> sMemoryBackend;
+	static MemoryAllocator                      sAllocator;
+	static std::atomic<uint32_t>                sMapCallCount(0);
+
 	void Initialize(VkPhysicalDevice physicalDevice, VkDevice device, VkCommandPool commandPool, VkQueue transferQueue) {
 		runtime_info::PhyDevice = physicalDevice;
 		runtime_info::Device = device;
@@ -23,6 +39,27 @@ namespace helpers {
 		runtime_info::TransferQueue = transferQueue;
 
 		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &runtime_info::PhysicalDeviceMemoryProperties);
+
+		sMemoryBackend.reset(new VulkanMemoryBackend(device));
+		sAllocator.Initialize(sMemoryBackend.get(), runtime_info::PhysicalDeviceMemoryProperties);
+	}
+
+	void Shutdown() {
+		sAllocator.PrintStats();
+		sAllocator.Shutdown();
+		sMemoryBackend.reset();
+	}
+
+	MemoryAllocator& GetAllocator() {
+		return sAllocator;
+	}
+
+	uint32_t GetMapCallCount() {
+		return sMapCallCount.load();
+	}
+
+	void ResetMapCallCount() {
+		sMapCallCount.store(0);
 	}
 
 	uint32_t GetMemoryType(VkMemoryRequirements& memoryRequiriments, VkMemoryPropertyFlags memoryProperties) {
@@ -69,8 +106,8 @@ namespace helpers {
 
 	Buffer::Buffer()
 		: _Buffer(VK_NULL_HANDLE)
-		, _Memory(VK_NULL_HANDLE)
 		, _Size(0)
+		, _Mapped(nullptr)
 	{
 	}
 	Buffer::~Buffer() {
@@ -97,25 +134,19 @@ namespace helpers {
 			VkMemoryRequirements memoryRequirements;
 			vkGetBufferMemoryRequirements(runtime_info::Device, _Buffer, &memoryRequirements);
 
-			VkMemoryAllocateInfo memoryAllocateInfo;
-			memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			memoryAllocateInfo.pNext = nullptr;
-			memoryAllocateInfo.allocationSize = memoryRequirements.size;
-			memoryAllocateInfo.memoryTypeIndex = GetMemoryType(memoryRequirements, memoryProperties);
+			const uint32_t memoryTypeIndex = GetMemoryType(memoryRequirements, memoryProperties);
 
-			result = vkAllocateMemory(runtime_info::Device, &memoryAllocateInfo, nullptr, &_Memory);
+			result = sAllocator.Allocate(memoryRequirements, memoryTypeIndex, MemoryKind::Linear, _Memory);
 			if (VK_SUCCESS != result) {
 				vkDestroyBuffer(runtime_info::Device, _Buffer, nullptr);
 				_Buffer = VK_NULL_HANDLE;
-				_Memory = VK_NULL_HANDLE;
 			}
 			else {
-				result = vkBindBufferMemory(runtime_info::Device, _Buffer, _Memory, 0);
+				result = vkBindBufferMemory(runtime_info::Device, _Buffer, _Memory.memory, _Memory.offset);
 				if (VK_SUCCESS != result) {
 					vkDestroyBuffer(runtime_info::Device, _Buffer, nullptr);
-					vkFreeMemory(runtime_info::Device, _Memory, nullptr);
+					sAllocator.Free(_Memory);
 					_Buffer = VK_NULL_HANDLE;
-					_Memory = VK_NULL_HANDLE;
 				}
 			}
 		}
@@ -128,38 +159,41 @@ namespace helpers {
 			vkDestroyBuffer(runtime_info::Device, _Buffer, nullptr);
 			_Buffer = VK_NULL_HANDLE;
 		}
-		if (_Memory) {
-			vkFreeMemory(runtime_info::Device, _Memory, nullptr);
-			_Memory = VK_NULL_HANDLE;
-		}
+		sAllocator.Free(_Memory);
+		_Mapped = nullptr;
 	}
 
 	void* Buffer::Map(VkDeviceSize size, VkDeviceSize offset) const {
-		void* mem = nullptr;
+		++sMapCallCount;
 
-		if (size > _Size) {
-			size = _Size;
+		if (offset >= _Size || (VK_WHOLE_SIZE != size && size > _Size - offset)) {
+			return nullptr;
 		}
 
-		VkResult result = vkMapMemory(runtime_info::Device, _Memory, offset, size, 0, &mem);
-		if (VK_SUCCESS != result) {
-			mem = nullptr;
-		}
-
-		return mem;
+		// the allocator keeps the whole block mapped, so this is just pointer math
+		uint8_t* mem = reinterpret_cast<uint8_t*>(_Mapped ? _Mapped : sAllocator.Map(_Memory));
+		return mem ? mem + offset : nullptr;
 	}
 	void Buffer::Unmap() const {
-		vkUnmapMemory(runtime_info::Device, _Memory);
+		// nothing to do, the memory stays mapped until the buffer is destroyed
+		++sMapCallCount;
 	}
 
-	bool Buffer::UploadData(const void* data, VkDeviceSize size, VkDeviceSize offset) const {
-		bool result = false;
+	void* Buffer::MapPersistent() {
+		if (!_Mapped) {
+			_Mapped = Map();
+		}
+		return _Mapped;
+	}
 
+	bool Buffer::UploadData(const void* data, VkDeviceSize size, VkDeviceSize offset) const {
 		void* mem = Map(size, offset);
-		if (mem) {
-			std::memcpy(mem, data, size);
-			Unmap();
+		if (!mem) {
+			return false;
 		}
+
+		std::memcpy(mem, data, size);
+		Unmap();
 		return true;
 	}
 
@@ -172,12 +206,201 @@ namespace helpers {
 		return _Size;
 	}
 
+	void* Buffer::GetMappedMemory() const {
+		return _Mapped;
+	}
+
+
+
+	static double NowMs() {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+	}
+
+	UploadManager::UploadManager()
+		: _StagingMemory(nullptr)
+		, _StagingSize(0)
+		, _StagingHead(0)
+		, _CommandBuffer(VK_NULL_HANDLE)
+		, _Fence(VK_NULL_HANDLE)
+		, _Recording(false)
+		, _BytesUploaded(0)
+		, _UploadTimeMs(0.0)
+		, _BatchStartMs(0.0)
+	{
+	}
+	UploadManager::~UploadManager() {
+		Destroy();
+	}
+
+	VkResult UploadManager::Create(VkDeviceSize stagingSize) {
+		VkResult result = _Staging.Create(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		if (VK_SUCCESS != result) {
+			return result;
+		}
+
+		// staging memory stays mapped for the whole lifetime of the manager
+		_StagingMemory = reinterpret_cast<uint8_t*>(_Staging.MapPersistent());
+		if (!_StagingMemory) {
+			Destroy();
+			return VK_ERROR_MEMORY_MAP_FAILED;
+		}
+		_StagingSize = stagingSize;
+		_StagingHead = 0;
+
+		VkCommandBufferAllocateInfo allocInfo;
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.pNext = nullptr;
+		allocInfo.commandPool = runtime_info::CommandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		result = vkAllocateCommandBuffers(runtime_info::Device, &allocInfo, &_CommandBuffer);
+		if (VK_SUCCESS != result) {
+			Destroy();
+			return result;
+		}
+
+		VkFenceCreateInfo fenceCreateInfo;
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCreateInfo.pNext = nullptr;
+		fenceCreateInfo.flags = 0;
+
+		result = vkCreateFence(runtime_info::Device, &fenceCreateInfo, nullptr, &_Fence);
+		if (VK_SUCCESS != result) {
+			Destroy();
+		}
+		return result;
+	}
+
+	void UploadManager::Destroy() {
+		if (_Recording) {
+			SubmitBatch();
+		}
+		if (_Fence) {
+			vkDestroyFence(runtime_info::Device, _Fence, nullptr);
+			_Fence = VK_NULL_HANDLE;
+		}
+		if (_CommandBuffer) {
+			vkFreeCommandBuffers(runtime_info::Device, runtime_info::CommandPool, 1, &_CommandBuffer);
+			_CommandBuffer = VK_NULL_HANDLE;
+		}
+		_StagingMemory = nullptr;
+		_Staging.Destroy();
+		_StagingSize = 0;
+		_StagingHead = 0;
+	}
+
+	bool UploadManager::Upload(const Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset) {
+		const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+
+		// big uploads get split across several trips around the ring
+		while (size > 0) {
+			if (_StagingHead >= _StagingSize && !SubmitBatch()) {
+				return false;
+			}
+			if (!_Recording && !BeginBatch()) {
+				return false;
+			}
+
+			const VkDeviceSize chunkSize = std::min(size, _StagingSize - _StagingHead);
+			std::memcpy(_StagingMemory + _StagingHead, src, static_cast<size_t>(chunkSize));
+
+			VkBufferCopy region;
+			region.srcOffset = _StagingHead;
+			region.dstOffset = dstOffset;
+			region.size = chunkSize;
+			vkCmdCopyBuffer(_CommandBuffer, _Staging.GetBuffer(), dst.GetBuffer(), 1, &region);
+
+			// keep every copy source 16 bytes aligned
+			_StagingHead = std::min((_StagingHead + chunkSize + 15) & ~VkDeviceSize(15), _StagingSize);
+			_BytesUploaded += chunkSize;
+			src += chunkSize;
+			dstOffset += chunkSize;
+			size -= chunkSize;
+		}
+
+		return true;
+	}
+
+	bool UploadManager::Flush() {
+		return _Recording ? SubmitBatch() : true;
+	}
+
+	bool UploadManager::BeginBatch() {
+		VkCommandBufferBeginInfo beginInfo;
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.pNext = nullptr;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = nullptr;
+
+		if (VK_SUCCESS != vkBeginCommandBuffer(_CommandBuffer, &beginInfo)) {
+			return false;
+		}
+
+		_Recording = true;
+		_BatchStartMs = NowMs();
+		return true;
+	}
+
+	bool UploadManager::SubmitBatch() {
+		// make the copies visible to everything that comes after them on the queue
+		VkMemoryBarrier barrier;
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(_CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		_Recording = false;
+		_StagingHead = 0;
+
+		VkResult error = vkEndCommandBuffer(_CommandBuffer);
+		if (VK_SUCCESS != error) {
+			return false;
+		}
+
+		VkSubmitInfo submitInfo;
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = nullptr;
+		submitInfo.waitSemaphoreCount = 0;
+		submitInfo.pWaitSemaphores = nullptr;
+		submitInfo.pWaitDstStageMask = nullptr;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &_CommandBuffer;
+		submitInfo.signalSemaphoreCount = 0;
+		submitInfo.pSignalSemaphores = nullptr;
+
+		error = vkQueueSubmit(runtime_info::TransferQueue, 1, &submitInfo, _Fence);
+		if (VK_SUCCESS != error) {
+			return false;
+		}
+
+		error = vkWaitForFences(runtime_info::Device, 1, &_Fence, VK_TRUE, UINT64_MAX);
+		vkResetFences(runtime_info::Device, 1, &_Fence);
+		vkResetCommandBuffer(_CommandBuffer, 0);
+
+		_UploadTimeMs += NowMs() - _BatchStartMs;
+		return (VK_SUCCESS == error);
+	}
+
+	VkDeviceSize UploadManager::GetBytesUploaded() const {
+		return _BytesUploaded;
+	}
+
+	double UploadManager::GetUploadTimeMs() const {
+		return _UploadTimeMs;
+	}
+
+	void UploadManager::ResetStats() {
+		_BytesUploaded = 0;
+		_UploadTimeMs = 0.0;
+	}
+
 
 
 	Image::Image()
 		: _Format(VK_FORMAT_B8G8R8A8_UNORM)
 		, _Image(VK_NULL_HANDLE)
-		, _Memory(VK_NULL_HANDLE)
 		, _ImageView(VK_NULL_HANDLE)
 		, _Sampler(VK_NULL_HANDLE)
 	{
@@ -219,25 +442,20 @@ namespace helpers {
 			VkMemoryRequirements memoryRequirements;
 			vkGetImageMemoryRequirements(runtime_info::Device, _Image, &memoryRequirements);
 
-			VkMemoryAllocateInfo memoryAllocateInfo;
-			memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			memoryAllocateInfo.pNext = nullptr;
-			memoryAllocateInfo.allocationSize = memoryRequirements.size;
-			memoryAllocateInfo.memoryTypeIndex = GetMemoryType(memoryRequirements, memoryProperties);
+			const uint32_t memoryTypeIndex = GetMemoryType(memoryRequirements, memoryProperties);
+			const MemoryKind kind = (VK_IMAGE_TILING_OPTIMAL == tiling) ? MemoryKind::Optimal : MemoryKind::Linear;
 
-			result = vkAllocateMemory(runtime_info::Device, &memoryAllocateInfo, nullptr, &_Memory);
+			result = sAllocator.Allocate(memoryRequirements, memoryTypeIndex, kind, _Memory);
 			if (VK_SUCCESS != result) {
 				vkDestroyImage(runtime_info::Device, _Image, nullptr);
 				_Image = VK_NULL_HANDLE;
-				_Memory = VK_NULL_HANDLE;
 			}
 			else {
-				result = vkBindImageMemory(runtime_info::Device, _Image, _Memory, 0);
+				result = vkBindImageMemory(runtime_info::Device, _Image, _Memory.memory, _Memory.offset);
 				if (VK_SUCCESS != result) {
 					vkDestroyImage(runtime_info::Device, _Image, nullptr);
-					vkFreeMemory(runtime_info::Device, _Memory, nullptr);
+					sAllocator.Free(_Memory);
 					_Image = VK_NULL_HANDLE;
-					_Memory = VK_NULL_HANDLE;
 				}
 			}
 		}
@@ -255,14 +473,11 @@ namespace helpers {
 			vkDestroyImageView(runtime_info::Device, _ImageView, nullptr);
 			_ImageView = VK_NULL_HANDLE;
 		}
-		if (_Memory) {
-			vkFreeMemory(runtime_info::Device, _Memory, nullptr);
-			_Memory = VK_NULL_HANDLE;
-		}
 		if (_Image) {
 			vkDestroyImage(runtime_info::Device, _Image, nullptr);
 			_Image = VK_NULL_HANDLE;
 		}
+		sAllocator.Free(_Memory);
 	}
 
 	bool Image::Load(const char* fileName) {
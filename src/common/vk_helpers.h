@@ -2,8 +2,10 @@
 #define VK_NO_PROTOTYPES
 #include "vulkan/vulkan.h"
 #include "volk.h"
+#include "vk_allocator.h"
 
 #include <cassert>
+#include <cstdint>
 
 #define CHECK_VK_ERROR(_error, _message) do {   \
     if (VK_SUCCESS != error) {                  \
@@ -15,14 +17,20 @@
 namespace helpers {
 
 	namespace runtime_info {
-		static VkPhysicalDevice                 PhyDevice;
-		static VkDevice                         Device;
-		static VkCommandPool                    CommandPool;
-		static VkQueue                          TransferQueue;
-		static VkPhysicalDeviceMemoryProperties PhysicalDeviceMemoryProperties;
+		extern VkPhysicalDevice                 PhyDevice;
+		extern VkDevice                         Device;
+		extern VkCommandPool                    CommandPool;
+		extern VkQueue                          TransferQueue;
+		extern VkPhysicalDeviceMemoryProperties PhysicalDeviceMemoryProperties;
 	} // namespace runtime_info
 
 	void     Initialize(VkPhysicalDevice physicalDevice, VkDevice device, VkCommandPool commandPool, VkQueue transferQueue);
+	// releases the pooled device memory, has to be called before the device is destroyed
+	void     Shutdown();
+	MemoryAllocator& GetAllocator();
+	// number of Buffer::Map/Unmap calls since the last reset, should stay at zero in steady-state frames
+	uint32_t GetMapCallCount();
+	void     ResetMapCallCount();
 	uint32_t GetMemoryType(VkMemoryRequirements& memoryRequiriments, VkMemoryPropertyFlags memoryProperties);
 	void     ImageBarrier(VkCommandBuffer commandBuffer,
 		VkImage image,
@@ -41,19 +49,65 @@ namespace helpers {
 		VkResult        Create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties);
 		void            Destroy();
 
-		void* Map(VkDeviceSize size = UINT64_MAX, VkDeviceSize offset = 0) const;
+		// size bytes from offset, VK_WHOLE_SIZE - up to the end. nullptr if the range isn't inside the buffer
+		void*           Map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) const;
+		// the memory stays mapped for the buffer's lifetime, this only pairs up with Map
 		void            Unmap() const;
+		// maps the buffer once for its whole lifetime, later calls return the same pointer
+		void*           MapPersistent();
 
 		bool            UploadData(const void* data, VkDeviceSize size, VkDeviceSize offset = 0) const;
 
 		// getters
 		VkBuffer        GetBuffer() const;
 		VkDeviceSize    GetSize() const;
+		void*           GetMappedMemory() const;
 
 	private:
 		VkBuffer        _Buffer;
-		VkDeviceMemory  _Memory;
+		MemoryAllocation _Memory;
 		VkDeviceSize    _Size;
+		void*           _Mapped;
+	};
+
+
+	// Batches buffer uploads through a fixed-size staging ring into a single command buffer,
+	// so the destination buffers can live in DEVICE_LOCAL memory.
+	// When the ring runs out of space the recorded copies are submitted and waited on, and the ring starts over.
+	class UploadManager {
+	public:
+		UploadManager();
+		~UploadManager();
+
+		VkResult        Create(VkDeviceSize stagingSize);
+		void            Destroy();
+
+		// dst has to be created with VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		bool            Upload(const Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+		// submits all the copies recorded so far and waits for them to finish
+		bool            Flush();
+
+		// stats
+		VkDeviceSize    GetBytesUploaded() const;
+		double          GetUploadTimeMs() const;
+		void            ResetStats();
+
+	private:
+		bool            BeginBatch();
+		bool            SubmitBatch();
+
+	private:
+		Buffer          _Staging;
+		uint8_t*        _StagingMemory;
+		VkDeviceSize    _StagingSize;
+		VkDeviceSize    _StagingHead;
+		VkCommandBuffer _CommandBuffer;
+		VkFence         _Fence;
+		bool            _Recording;
+
+		VkDeviceSize    _BytesUploaded;
+		double          _UploadTimeMs;
+		double          _BatchStartMs;
 	};
 
 
@@ -83,7 +137,7 @@ namespace helpers {
 	private:
 		VkFormat        _Format;
 		VkImage         _Image;
-		VkDeviceMemory  _Memory;
+		MemoryAllocation _Memory;
 		VkImageView     _ImageView;
 		VkSampler       _Sampler;
 	};
@@ -1,8 +1,16 @@
 #include "vulkanapp.h"
 
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
 // include volk.c for implementation
 #include "volk.c"
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
 
 void FPSMeter::Update(const float dt) {
 	fpsAccumulator += dt - fpsHistory[historyPointer];
@@ -20,6 +28,18 @@ float FPSMeter::GetFrameTime() const {
 }
 
 
+void FrameWaitStats::Add(const double waitMs) {
+	lastWaitMs = waitMs;
+	maxWaitMs = Max(maxWaitMs, waitMs);
+	totalWaitMs += waitMs;
+	++numFrames;
+}
+
+double FrameWaitStats::GetAverageMs() const {
+	return numFrames ? totalWaitMs / static_cast<double>(numFrames) : 0.0;
+}
+
+
 
 vulkanapp::vulkanapp()
 	: _Settings({})
@@ -31,14 +51,16 @@ vulkanapp::vulkanapp()
 	, _Surface(VK_NULL_HANDLE)
 	, _Swapchain(VK_NULL_HANDLE)
 	, _CommandPool(VK_NULL_HANDLE)
-	, _SemaphoreImageAcquired(VK_NULL_HANDLE)
-	, _SemaphoreRenderFinished(VK_NULL_HANDLE)
+	, _CurrentFrame(0)
+	, _TimelineSemaphore(VK_NULL_HANDLE)
+	, _TimelineValue(0)
 	, _GraphicsQueueFamilyIndex(0u)
 	, _ComputeQueueFamilyIndex(0u)
 	, _TransferQueueFamilyIndex(0u)
 	, _GraphicsQueue(VK_NULL_HANDLE)
 	, _ComputeQueue(VK_NULL_HANDLE)
 	, _TransferQueue(VK_NULL_HANDLE)
+	, mapCallsPerFrame(0)
 {
 
 }
@@ -46,20 +68,34 @@ vulkanapp::~vulkanapp() {
 	FreeVulkan();
 }
 
-void vulkanapp::Run() {
-	if (Initialize()) {
+bool vulkanapp::Run() {
+	if (!Initialize()) {
+		return false;
+	}
+
+	bool result = true;
+	if (_Settings.headless) {
+		result = RenderHeadless();
+	}
+	else {
 		Loop();
-		Shutdown();
-		FreeResources();
 	}
+
+	Shutdown();
+	FreeResources();
+
+	return result;
+}
+
+void vulkanapp::SetCommandLine(const int argc, char** argv) {
+	_CommandLine.assign(argv + 1, argv + argc);
 }
 
 bool vulkanapp::Initialize() {
-	if (!glfwInit()) {
-		return false;
-	}
+	InitializeSettings();
 
-	if (!glfwVulkanSupported()) {
+	// headless mode doesn't touch glfw at all, so it runs on machines without a display
+	if (!_Settings.headless && !InitializeWindow()) {
 		return false;
 	}
 
@@ -67,35 +103,6 @@ bool vulkanapp::Initialize() {
 		return false;
 	}
 
-	InitializeSettings();
-
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-	GLFWwindow* window = glfwCreateWindow(static_cast<int>(_Settings.resolutionX),
-		static_cast<int>(_Settings.resolutionY),
-		_Settings.name.c_str(),
-		nullptr, nullptr);
-	if (!window) {
-		return false;
-	}
-
-	glfwSetWindowUserPointer(window, this);
-
-	glfwSetKeyCallback(window, [](GLFWwindow* wnd, int key, int scancode, int action, int mods) {
-		vulkanapp* app = reinterpret_cast<vulkanapp*>(glfwGetWindowUserPointer(wnd));
-		app->OnKey(key, scancode, action, mods);
-		});
-	glfwSetMouseButtonCallback(window, [](GLFWwindow* wnd, int button, int action, int mods) {
-		vulkanapp* app = reinterpret_cast<vulkanapp*>(glfwGetWindowUserPointer(wnd));
-		app->OnMouseButton(button, action, mods);
-		});
-	glfwSetCursorPosCallback(window, [](GLFWwindow* wnd, double x, double y) {
-		vulkanapp* app = reinterpret_cast<vulkanapp*>(glfwGetWindowUserPointer(wnd));
-		app->OnMouseMove(static_cast<float>(x), static_cast<float>(y));
-		});
-
-	_Window = window;
-
 	if (!InitializeVulkan()) {
 		return false;
 	}
@@ -105,12 +112,20 @@ bool vulkanapp::Initialize() {
 	if (!InitializeDevicesAndQueues()) {
 		return false;
 	}
-	if (!InitializeSurface()) {
-		return false;
+
+	if (_Settings.headless) {
+		_SurfaceFormat.format = _Settings.surfaceFormat;
+		_SurfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
 	}
-	if (!InitializeSwapchain()) {
-		return false;
+	else {
+		if (!InitializeSurface()) {
+			return false;
+		}
+		if (!InitializeSwapchain()) {
+			return false;
+		}
 	}
+
 	if (!InitializeFencesAndCommandPool()) {
 		return false;
 	}
@@ -128,7 +143,45 @@ bool vulkanapp::Initialize() {
 	}
 
 	InitApp();
-	FillCommandBuffers();
+
+	return true;
+}
+
+bool vulkanapp::InitializeWindow() {
+	if (!glfwInit()) {
+		return false;
+	}
+
+	if (!glfwVulkanSupported()) {
+		return false;
+	}
+
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(static_cast<int>(_Settings.resolutionX),
+		static_cast<int>(_Settings.resolutionY),
+		_Settings.name.c_str(),
+		nullptr, nullptr);
+	if (!window) {
+		return false;
+	}
+
+	glfwSetWindowUserPointer(window, this);
+
+	glfwSetKeyCallback(window, [](GLFWwindow* wnd, int key, int scancode, int action, int mods) {
+		vulkanapp* app = reinterpret_cast<vulkanapp*>(glfwGetWindowUserPointer(wnd));
+		app->OnKey(key, scancode, action, mods);
+		});
+	glfwSetMouseButtonCallback(window, [](GLFWwindow* wnd, int button, int action, int mods) {
+		vulkanapp* app = reinterpret_cast<vulkanapp*>(glfwGetWindowUserPointer(wnd));
+		app->OnMouseButton(button, action, mods);
+		});
+	glfwSetCursorPosCallback(window, [](GLFWwindow* wnd, double x, double y) {
+		vulkanapp* app = reinterpret_cast<vulkanapp*>(glfwGetWindowUserPointer(wnd));
+		app->OnMouseMove(static_cast<float>(x), static_cast<float>(y));
+		});
+
+	_Window = window;
 
 	return true;
 }
@@ -147,10 +200,49 @@ void vulkanapp::Loop() {
 	}
 }
 
+bool vulkanapp::RenderHeadless() {
+	// fixed time step, so runs are reproducible
+	const float dt = 1.0f / 60.0f;
+
+	const auto startTime = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < _Settings.numFrames; ++i) {
+		ProcessFrame(dt);
+	}
+	vkDeviceWaitIdle(_Device);
+	const auto endTime = std::chrono::high_resolution_clock::now();
+
+	const double renderTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	printf("Rendered %u frames at %ux%u in %.2f ms (%.3f ms per frame)\n",
+		_Settings.numFrames,
+		_Settings.resolutionX,
+		_Settings.resolutionY,
+		renderTimeMs,
+		_Settings.numFrames ? renderTimeMs / _Settings.numFrames : 0.0);
+
+	if (!_Settings.outputFile.empty()) {
+		if (!SaveOffscreenImage(_Settings.outputFile)) {
+			printf("Failed to save %s\n", _Settings.outputFile.c_str());
+			return false;
+		}
+		printf("Saved %s\n", _Settings.outputFile.c_str());
+	}
+
+	return true;
+}
+
 void vulkanapp::Shutdown() {
 	vkDeviceWaitIdle(_Device);
 
-	glfwTerminate();
+	printf("%u frames in flight (%s): CPU waited %.3f ms per frame on average, %.3f ms max, over %llu frames\n",
+		_Settings.framesInFlight,
+		_Settings.useTimelineSemaphore ? "timeline semaphore" : "fences",
+		frameWaitStats.GetAverageMs(),
+		frameWaitStats.maxWaitMs,
+		static_cast<unsigned long long>(frameWaitStats.numFrames));
+
+	if (!_Settings.headless) {
+		glfwTerminate();
+	}
 }
 
 void vulkanapp::InitializeSettings() {
@@ -162,8 +254,47 @@ void vulkanapp::InitializeSettings() {
 	_Settings.enableVSync = true;
 	_Settings.supportRaytracing = true;
 	_Settings.supportDescriptorIndexing = false;
+	_Settings.framesInFlight = 2;
+	_Settings.useTimelineSemaphore = false;
+	_Settings.headless = false;
+	_Settings.numFrames = 1;
+	_Settings.outputFile = "";
 
 	InitSettings();
+	ApplyCommandLine();
+}
+
+void vulkanapp::ApplyCommandLine() {
+	for (size_t i = 0; i < _CommandLine.size(); ++i) {
+		const String& arg = _CommandLine[i];
+		const bool hasValue = (i + 1) < _CommandLine.size();
+
+		if (arg == "--frames-in-flight" && hasValue) {
+			_Settings.framesInFlight = static_cast<uint32_t>(strtoul(_CommandLine[++i].c_str(), nullptr, 10));
+		}
+		else if (arg == "--timeline-semaphore") {
+			_Settings.useTimelineSemaphore = true;
+		}
+		else if (arg == "--headless") {
+			_Settings.headless = true;
+		}
+		else if (arg == "--width" && hasValue) {
+			_Settings.resolutionX = static_cast<uint32_t>(strtoul(_CommandLine[++i].c_str(), nullptr, 10));
+		}
+		else if (arg == "--height" && hasValue) {
+			_Settings.resolutionY = static_cast<uint32_t>(strtoul(_CommandLine[++i].c_str(), nullptr, 10));
+		}
+		else if (arg == "--frames" && hasValue) {
+			_Settings.numFrames = static_cast<uint32_t>(strtoul(_CommandLine[++i].c_str(), nullptr, 10));
+		}
+		else if (arg == "--output" && hasValue) {
+			_Settings.outputFile = _CommandLine[++i];
+		}
+	}
+
+	_Settings.framesInFlight = Clamp(_Settings.framesInFlight, 1u, 8u);
+	_Settings.resolutionX = Max(_Settings.resolutionX, 1u);
+	_Settings.resolutionY = Max(_Settings.resolutionY, 1u);
 }
 
 bool vulkanapp::InitializeVulkan() {
@@ -176,17 +307,42 @@ bool vulkanapp::InitializeVulkan() {
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.apiVersion = VK_API_VERSION_1_1;
 
-	uint32_t requiredExtensionsCount = 0;
-	const char** requiredExtensions = glfwGetRequiredInstanceExtensions(&requiredExtensionsCount);
-
 	Array<const char*> extensions;
 	Array<const char*> layers;
 
-	extensions.insert(extensions.begin(), requiredExtensions, requiredExtensions + requiredExtensionsCount);
+	// surface extensions are only needed when we present
+	if (!_Settings.headless) {
+		uint32_t requiredExtensionsCount = 0;
+		const char** requiredExtensions = glfwGetRequiredInstanceExtensions(&requiredExtensionsCount);
+		extensions.insert(extensions.begin(), requiredExtensions, requiredExtensions + requiredExtensionsCount);
+	}
 
 	if (_Settings.enableValidation) {
-		extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-		layers.push_back("VK_LAYER_LUNARG_standard_validation");
+		// use whichever validation layer is installed, CI machines often have none
+		uint32_t numLayers = 0;
+		vkEnumerateInstanceLayerProperties(&numLayers, nullptr);
+		Array<VkLayerProperties> layerProperties(numLayers);
+		vkEnumerateInstanceLayerProperties(&numLayers, layerProperties.data());
+
+		const char* validationLayers[2] = { "VK_LAYER_KHRONOS_validation", "VK_LAYER_LUNARG_standard_validation" };
+		for (const char* validationLayer : validationLayers) {
+			for (const VkLayerProperties& layer : layerProperties) {
+				if (0 == strcmp(layer.layerName, validationLayer)) {
+					layers.push_back(validationLayer);
+					break;
+				}
+			}
+			if (!layers.empty()) {
+				break;
+			}
+		}
+
+		if (layers.empty()) {
+			printf("No validation layer found, running without validation\n");
+		}
+		else {
+			extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+		}
 	}
 
 	VkInstanceCreateInfo instInfo;
@@ -289,8 +445,31 @@ bool vulkanapp::InitializeDevicesAndQueues() {
 		deviceQueueCreateInfos.push_back(deviceQueueCreateInfo);
 	}
 
-	Array<const char*> deviceExtensions({ VK_KHR_SWAPCHAIN_EXTENSION_NAME });
+	uint32_t numExtensions = 0;
+	vkEnumerateDeviceExtensionProperties(_PhysicalDevice, nullptr, &numExtensions, nullptr);
+	Array<VkExtensionProperties> extensionProperties(numExtensions);
+	vkEnumerateDeviceExtensionProperties(_PhysicalDevice, nullptr, &numExtensions, extensionProperties.data());
+
+	auto isExtensionSupported = [&extensionProperties](const char* name) {
+		for (const VkExtensionProperties& ext : extensionProperties) {
+			if (0 == strcmp(ext.extensionName, name)) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	Array<const char*> deviceExtensions;
+	if (!_Settings.headless) {
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
 	if (_Settings.supportRaytracing) {
+		if (!isExtensionSupported(VK_NV_RAY_TRACING_EXTENSION_NAME)) {
+			VkPhysicalDeviceProperties deviceProperties;
+			vkGetPhysicalDeviceProperties(_PhysicalDevice, &deviceProperties);
+			printf("%s doesn't support %s\n", deviceProperties.deviceName, VK_NV_RAY_TRACING_EXTENSION_NAME);
+			return false;
+		}
 		deviceExtensions.push_back(VK_NV_RAY_TRACING_EXTENSION_NAME);
 	}
 
@@ -305,8 +484,28 @@ bool vulkanapp::InitializeDevicesAndQueues() {
 		features2.pNext = &descriptorIndexing;
 	}
 
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphore = { };
+	timelineSemaphore.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+	if (_Settings.useTimelineSemaphore) {
+		if (isExtensionSupported(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+			deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+			timelineSemaphore.pNext = features2.pNext;
+			features2.pNext = &timelineSemaphore;
+		}
+		else {
+			printf("%s is not supported, falling back to fences\n", VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+			_Settings.useTimelineSemaphore = false;
+		}
+	}
+
 	vkGetPhysicalDeviceFeatures2(_PhysicalDevice, &features2); // enable all the features our GPU has
 
+	if (_Settings.useTimelineSemaphore && !timelineSemaphore.timelineSemaphore) {
+		printf("Timeline semaphores are not supported, falling back to fences\n");
+		_Settings.useTimelineSemaphore = false;
+	}
+
 	VkDeviceCreateInfo deviceCreateInfo;
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.pNext = &features2;
@@ -479,14 +678,22 @@ bool vulkanapp::InitializeSwapchain() {
 }
 
 bool vulkanapp::InitializeFencesAndCommandPool() {
-	VkFenceCreateInfo fenceCreateInfo;
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.pNext = nullptr;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	_WaitForFrameFences.resize(_SwapchainImages.size());
-	for (VkFence& fence : _WaitForFrameFences) {
-		vkCreateFence(_Device, &fenceCreateInfo, nullptr, &fence);
+	_Frames.resize(_Settings.framesInFlight);
+	_CurrentFrame = 0;
+
+	// with the timeline semaphore the frames wait on semaphore values instead
+	if (!_Settings.useTimelineSemaphore) {
+		VkFenceCreateInfo fenceCreateInfo;
+		fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceCreateInfo.pNext = nullptr;
+		fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		for (FrameData& frame : _Frames) {
+			const VkResult error = vkCreateFence(_Device, &fenceCreateInfo, nullptr, &frame.fence);
+			if (VK_SUCCESS != error) {
+				return false;
+			}
+		}
 	}
 
 	VkCommandPoolCreateInfo commandPoolCreateInfo;
@@ -518,17 +725,21 @@ bool vulkanapp::InitializeOffscreenImage() {
 }
 
 bool vulkanapp::InitializeCommandBuffers() {
-	_CommandBuffers.resize(_SwapchainImages.size());
-
 	VkCommandBufferAllocateInfo commandBufferAllocateInfo;
 	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	commandBufferAllocateInfo.pNext = nullptr;
 	commandBufferAllocateInfo.commandPool = _CommandPool;
 	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	commandBufferAllocateInfo.commandBufferCount = static_cast<uint32_t>(_CommandBuffers.size());
+	commandBufferAllocateInfo.commandBufferCount = 1;
 
-	const VkResult error = vkAllocateCommandBuffers(_Device, &commandBufferAllocateInfo, _CommandBuffers.data());
-	return (VK_SUCCESS == error);
+	for (FrameData& frame : _Frames) {
+		const VkResult error = vkAllocateCommandBuffers(_Device, &commandBufferAllocateInfo, &frame.commandBuffer);
+		if (VK_SUCCESS != error) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
 bool vulkanapp::InitializeSynchronization() {
@@ -537,124 +748,326 @@ bool vulkanapp::InitializeSynchronization() {
 	semaphoreCreatInfo.pNext = nullptr;
 	semaphoreCreatInfo.flags = 0;
 
-	VkResult error = vkCreateSemaphore(_Device, &semaphoreCreatInfo, nullptr, &_SemaphoreImageAcquired);
-	if (VK_SUCCESS != error) {
-		return false;
+	VkResult error;
+	for (FrameData& frame : _Frames) {
+		error = vkCreateSemaphore(_Device, &semaphoreCreatInfo, nullptr, &frame.imageAcquired);
+		if (VK_SUCCESS != error) {
+			return false;
+		}
+
+		error = vkCreateSemaphore(_Device, &semaphoreCreatInfo, nullptr, &frame.renderFinished);
+		if (VK_SUCCESS != error) {
+			return false;
+		}
 	}
 
-	error = vkCreateSemaphore(_Device, &semaphoreCreatInfo, nullptr, &_SemaphoreRenderFinished);
-	return (VK_SUCCESS == error);
+	if (_Settings.useTimelineSemaphore) {
+		VkSemaphoreTypeCreateInfoKHR semaphoreTypeCreateInfo;
+		semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		semaphoreTypeCreateInfo.pNext = nullptr;
+		semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		semaphoreTypeCreateInfo.initialValue = 0;
+
+		semaphoreCreatInfo.pNext = &semaphoreTypeCreateInfo;
+
+		error = vkCreateSemaphore(_Device, &semaphoreCreatInfo, nullptr, &_TimelineSemaphore);
+		if (VK_SUCCESS != error) {
+			return false;
+		}
+		_TimelineValue = 0;
+	}
+
+	return true;
 }
 
-void vulkanapp::FillCommandBuffers() {
+void vulkanapp::RecordFrameCommands(const uint32_t frameIndex, const uint32_t imageIndex) {
 	VkCommandBufferBeginInfo commandBufferBeginInfo;
 	commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	commandBufferBeginInfo.pNext = nullptr;
-	commandBufferBeginInfo.flags = 0;
+	commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 	commandBufferBeginInfo.pInheritanceInfo = nullptr;
 
 	VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
 
-	for (size_t i = 0; i < _CommandBuffers.size(); i++) {
-		const VkCommandBuffer commandBuffer = _CommandBuffers[i];
-
-		VkResult error = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-		CHECK_VK_ERROR(error, "vkBeginCommandBuffer");
-
-		helpers::ImageBarrier(commandBuffer,
-			_OffscreenImage.GetImage(),
-			subresourceRange,
-			0,
-			VK_ACCESS_SHADER_WRITE_BIT,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_GENERAL);
-
-		FillCommandBuffer(commandBuffer, i); // user draw code
-
-		helpers::ImageBarrier(commandBuffer,
-			_SwapchainImages[i],
-			subresourceRange,
-			0,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-		helpers::ImageBarrier(commandBuffer,
-			_OffscreenImage.GetImage(),
-			subresourceRange,
-			VK_ACCESS_SHADER_WRITE_BIT,
-			VK_ACCESS_TRANSFER_READ_BIT,
-			VK_IMAGE_LAYOUT_GENERAL,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-		VkImageCopy copyRegion;
-		copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-		copyRegion.srcOffset = { 0, 0, 0 };
-		copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-		copyRegion.dstOffset = { 0, 0, 0 };
-		copyRegion.extent = { _Settings.resolutionX, _Settings.resolutionY, 1 };
-		vkCmdCopyImage(commandBuffer,
-			_OffscreenImage.GetImage(),
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			_SwapchainImages[i],
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&copyRegion);
-
-		helpers::ImageBarrier(commandBuffer,
-			_SwapchainImages[i], subresourceRange,
-			VK_ACCESS_TRANSFER_WRITE_BIT,
-			0,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	// frames don't own a swapchain image anymore, so the command buffer is re-recorded for the image we got
+	const VkCommandBuffer commandBuffer = _Frames[frameIndex].commandBuffer;
+
+	VkResult error = vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+	CHECK_VK_ERROR(error, "vkBeginCommandBuffer");
+
+	// ALL_COMMANDS barrier also keeps us from writing the offscreen image while the previous frame still copies it
+	helpers::ImageBarrier(commandBuffer,
+		_OffscreenImage.GetImage(),
+		subresourceRange,
+		0,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_GENERAL);
+
+	FillCommandBuffer(commandBuffer, frameIndex); // user draw code
 
+	// headless - the result stays in the offscreen image until SaveOffscreenImage reads it back
+	if (_Settings.headless) {
 		error = vkEndCommandBuffer(commandBuffer);
 		CHECK_VK_ERROR(error, "vkEndCommandBuffer");
+		return;
 	}
+
+	const VkImage swapchainImage = _SwapchainImages[imageIndex];
+
+	helpers::ImageBarrier(commandBuffer,
+		swapchainImage,
+		subresourceRange,
+		0,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	helpers::ImageBarrier(commandBuffer,
+		_OffscreenImage.GetImage(),
+		subresourceRange,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_ACCESS_TRANSFER_READ_BIT,
+		VK_IMAGE_LAYOUT_GENERAL,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	VkImageCopy copyRegion;
+	copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copyRegion.srcOffset = { 0, 0, 0 };
+	copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	copyRegion.dstOffset = { 0, 0, 0 };
+	copyRegion.extent = { _Settings.resolutionX, _Settings.resolutionY, 1 };
+	vkCmdCopyImage(commandBuffer,
+		_OffscreenImage.GetImage(),
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		swapchainImage,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		1,
+		&copyRegion);
+
+	helpers::ImageBarrier(commandBuffer,
+		swapchainImage, subresourceRange,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		0,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	error = vkEndCommandBuffer(commandBuffer);
+	CHECK_VK_ERROR(error, "vkEndCommandBuffer");
 }
 
 
+bool vulkanapp::SaveOffscreenImage(const String& fileName) {
+	const bool isBGRA = (VK_FORMAT_B8G8R8A8_UNORM == _OffscreenImage.GetFormat() || VK_FORMAT_B8G8R8A8_SRGB == _OffscreenImage.GetFormat());
+	const bool isRGBA = (VK_FORMAT_R8G8B8A8_UNORM == _OffscreenImage.GetFormat() || VK_FORMAT_R8G8B8A8_SRGB == _OffscreenImage.GetFormat());
+	if (!isBGRA && !isRGBA) {
+		printf("SaveOffscreenImage: unsupported offscreen format %d\n", static_cast<int>(_OffscreenImage.GetFormat()));
+		return false;
+	}
+
+	const uint32_t width = _Settings.resolutionX;
+	const uint32_t height = _Settings.resolutionY;
+	const VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+
+	helpers::Buffer readbackBuffer;
+	VkResult error = readbackBuffer.Create(imageSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	if (VK_SUCCESS != error) {
+		return false;
+	}
+
+	VkCommandBufferAllocateInfo allocInfo;
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.pNext = nullptr;
+	allocInfo.commandPool = _CommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	error = vkAllocateCommandBuffers(_Device, &allocInfo, &commandBuffer);
+	if (VK_SUCCESS != error) {
+		return false;
+	}
+
+	VkCommandBufferBeginInfo beginInfo;
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	helpers::ImageBarrier(commandBuffer,
+		_OffscreenImage.GetImage(),
+		subresourceRange,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_ACCESS_TRANSFER_READ_BIT,
+		VK_IMAGE_LAYOUT_GENERAL,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	VkBufferImageCopy region;
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyImageToBuffer(commandBuffer, _OffscreenImage.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer.GetBuffer(), 1, &region);
+
+	VkMemoryBarrier barrier;
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo;
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = nullptr;
+	submitInfo.waitSemaphoreCount = 0;
+	submitInfo.pWaitSemaphores = nullptr;
+	submitInfo.pWaitDstStageMask = nullptr;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 0;
+	submitInfo.pSignalSemaphores = nullptr;
+
+	error = vkQueueSubmit(_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	if (VK_SUCCESS == error) {
+		error = vkQueueWaitIdle(_GraphicsQueue);
+	}
+	vkFreeCommandBuffers(_Device, _CommandPool, 1, &commandBuffer);
+
+	if (VK_SUCCESS != error) {
+		return false;
+	}
+
+	const uint8_t* texels = reinterpret_cast<const uint8_t*>(readbackBuffer.Map());
+	if (!texels) {
+		return false;
+	}
+
+	// png wants rgba with opaque alpha
+	Array<uint8_t> pixels(static_cast<size_t>(imageSize));
+	for (size_t i = 0; i < pixels.size(); i += 4) {
+		pixels[i + 0] = texels[i + (isBGRA ? 2 : 0)];
+		pixels[i + 1] = texels[i + 1];
+		pixels[i + 2] = texels[i + (isBGRA ? 0 : 2)];
+		pixels[i + 3] = 0xFF;
+	}
+	readbackBuffer.Unmap();
+
+	return 0 != stbi_write_png(fileName.c_str(), static_cast<int>(width), static_cast<int>(height), 4, pixels.data(), static_cast<int>(width * 4));
+}
+
 //
+bool vulkanapp::WaitForFrame(FrameData& frame) {
+	const auto waitStart = std::chrono::high_resolution_clock::now();
+
+	VkResult error;
+	if (_Settings.useTimelineSemaphore) {
+		VkSemaphoreWaitInfoKHR waitInfo;
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.pNext = nullptr;
+		waitInfo.flags = 0;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &_TimelineSemaphore;
+		waitInfo.pValues = &frame.timelineValue;
+
+		error = vkWaitSemaphoresKHR(_Device, &waitInfo, UINT64_MAX);
+	}
+	else {
+		error = vkWaitForFences(_Device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+	}
+
+	const auto waitEnd = std::chrono::high_resolution_clock::now();
+	frameWaitStats.Add(std::chrono::duration<double, std::milli>(waitEnd - waitStart).count());
+
+	return (VK_SUCCESS == error);
+}
+
 void vulkanapp::ProcessFrame(const float dt) {
 	fpsMeter.Update(dt);
 
-	uint32_t imageIndex;
-	VkResult error = vkAcquireNextImageKHR(_Device, _Swapchain, UINT64_MAX, _SemaphoreImageAcquired, VK_NULL_HANDLE, &imageIndex);
-	if (VK_SUCCESS != error) {
+	FrameData& frame = _Frames[_CurrentFrame];
+
+	// wait for the GPU to release the resources of this frame slot, this is where CPU/GPU overlap ends
+	if (!WaitForFrame(frame)) {
 		return;
 	}
 
-	const VkFence fence = _WaitForFrameFences[imageIndex];
-	error = vkWaitForFences(_Device, 1, &fence, VK_TRUE, UINT64_MAX);
-	if (VK_SUCCESS != error) {
-		return;
+	uint32_t imageIndex = 0;
+	VkResult error;
+	if (!_Settings.headless) {
+		error = vkAcquireNextImageKHR(_Device, _Swapchain, UINT64_MAX, frame.imageAcquired, VK_NULL_HANDLE, &imageIndex);
+		if (VK_SUCCESS != error) {
+			return;
+		}
+	}
+
+	if (frame.fence) {
+		vkResetFences(_Device, 1, &frame.fence);
 	}
-	vkResetFences(_Device, 1, &fence);
 
-	Update(imageIndex, dt);
+	// buffer maps done since the previous frame, ends up in the window title
+	mapCallsPerFrame = helpers::GetMapCallCount();
+	helpers::ResetMapCallCount();
+
+	Update(_CurrentFrame, dt);
+	RecordFrameCommands(_CurrentFrame, imageIndex);
 
 	const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
+	// binary semaphores only exist for the swapchain, the timeline one goes last
+	const uint32_t numBinarySemaphores = _Settings.headless ? 0 : 1;
+	const VkSemaphore signalSemaphores[2] = { _Settings.headless ? _TimelineSemaphore : frame.renderFinished, _TimelineSemaphore };
+	const uint64_t waitValues[1] = { 0 };
+	uint64_t signalValues[2] = { 0, 0 };
+
 	VkSubmitInfo submitInfo;
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submitInfo.pNext = nullptr;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &_SemaphoreImageAcquired;
+	submitInfo.waitSemaphoreCount = numBinarySemaphores;
+	submitInfo.pWaitSemaphores = &frame.imageAcquired;
 	submitInfo.pWaitDstStageMask = &waitStageMask;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &_CommandBuffers[imageIndex];
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &_SemaphoreRenderFinished;
+	submitInfo.pCommandBuffers = &frame.commandBuffer;
+	submitInfo.signalSemaphoreCount = numBinarySemaphores;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo;
+	if (_Settings.useTimelineSemaphore) {
+		frame.timelineValue = ++_TimelineValue;
+		signalValues[numBinarySemaphores] = frame.timelineValue;
+
+		timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineSubmitInfo.pNext = nullptr;
+		timelineSubmitInfo.waitSemaphoreValueCount = numBinarySemaphores;
+		timelineSubmitInfo.pWaitSemaphoreValues = waitValues;
+		timelineSubmitInfo.signalSemaphoreValueCount = numBinarySemaphores + 1;
+		timelineSubmitInfo.pSignalSemaphoreValues = signalValues;
+
+		submitInfo.pNext = &timelineSubmitInfo;
+		submitInfo.signalSemaphoreCount = numBinarySemaphores + 1;
+	}
 
-	error = vkQueueSubmit(_GraphicsQueue, 1, &submitInfo, fence);
+	error = vkQueueSubmit(_GraphicsQueue, 1, &submitInfo, frame.fence);
 	if (VK_SUCCESS != error) {
 		return;
 	}
 
+	_CurrentFrame = (_CurrentFrame + 1) % static_cast<uint32_t>(_Frames.size());
+
+	if (_Settings.headless) {
+		return;
+	}
+
 	VkPresentInfoKHR presentInfo;
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.pNext = nullptr;
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &_SemaphoreRenderFinished;
+	presentInfo.pWaitSemaphores = &frame.renderFinished;
 	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = &_Swapchain;
 	presentInfo.pImageIndices = &imageIndex;
@@ -667,19 +1080,25 @@ void vulkanapp::ProcessFrame(const float dt) {
 }
 
 void vulkanapp::FreeVulkan() {
-	if (_SemaphoreRenderFinished) {
-		vkDestroySemaphore(_Device, _SemaphoreRenderFinished, nullptr);
-		_SemaphoreRenderFinished = VK_NULL_HANDLE;
-	}
-
-	if (_SemaphoreImageAcquired) {
-		vkDestroySemaphore(_Device, _SemaphoreImageAcquired, nullptr);
-		_SemaphoreImageAcquired = VK_NULL_HANDLE;
+	for (FrameData& frame : _Frames) {
+		if (frame.renderFinished) {
+			vkDestroySemaphore(_Device, frame.renderFinished, nullptr);
+		}
+		if (frame.imageAcquired) {
+			vkDestroySemaphore(_Device, frame.imageAcquired, nullptr);
+		}
+		if (frame.commandBuffer) {
+			vkFreeCommandBuffers(_Device, _CommandPool, 1, &frame.commandBuffer);
+		}
+		if (frame.fence) {
+			vkDestroyFence(_Device, frame.fence, nullptr);
+		}
 	}
+	_Frames.clear();
 
-	if (!_CommandBuffers.empty()) {
-		vkFreeCommandBuffers(_Device, _CommandPool, static_cast<uint32_t>(_CommandBuffers.size()), _CommandBuffers.data());
-		_CommandBuffers.clear();
+	if (_TimelineSemaphore) {
+		vkDestroySemaphore(_Device, _TimelineSemaphore, nullptr);
+		_TimelineSemaphore = VK_NULL_HANDLE;
 	}
 
 	if (_CommandPool) {
@@ -687,11 +1106,6 @@ void vulkanapp::FreeVulkan() {
 		_CommandPool = VK_NULL_HANDLE;
 	}
 
-	for (VkFence& fence : _WaitForFrameFences) {
-		vkDestroyFence(_Device, fence, nullptr);
-	}
-	_WaitForFrameFences.clear();
-
 	_OffscreenImage.Destroy();
 
 	for (VkImageView& view : _SwapchainImageViews) {
@@ -710,6 +1124,8 @@ void vulkanapp::FreeVulkan() {
 		_Surface = VK_NULL_HANDLE;
 	}
 
+	helpers::Shutdown();
+
 	if (_Device) {
 		vkDestroyDevice(_Device, nullptr);
 		_Device = VK_NULL_HANDLE;
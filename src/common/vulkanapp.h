@@ -12,6 +12,11 @@ struct settings {
 	bool        enableVSync;
 	bool        supportRaytracing;
 	bool        supportDescriptorIndexing;
+	uint32_t    framesInFlight;
+	bool        useTimelineSemaphore;   // falls back to fences if the device doesn't support it
+	bool        headless;               // no window, surface or swapchain, renders numFrames into the offscreen image
+	uint32_t    numFrames;
+	std::string outputFile;             // headless result, png
 };
 
 struct FPSMeter {
@@ -27,19 +32,44 @@ struct FPSMeter {
 	float   GetFrameTime() const;
 };
 
+// how long the CPU gets blocked waiting for a frame slot to come back from the GPU
+struct FrameWaitStats {
+	double      lastWaitMs = 0.0;
+	double      maxWaitMs = 0.0;
+	double      totalWaitMs = 0.0;
+	uint64_t    numFrames = 0;
+
+	void    Add(const double waitMs);
+	double  GetAverageMs() const;
+};
+
+// everything one frame in flight owns
+struct FrameData {
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkSemaphore     imageAcquired = VK_NULL_HANDLE;
+	VkSemaphore     renderFinished = VK_NULL_HANDLE;
+	VkFence         fence = VK_NULL_HANDLE;     // only without timeline semaphore
+	uint64_t        timelineValue = 0;          // timeline value signaled once the frame is done
+};
+
 class vulkanapp {
 public:
 	vulkanapp();
 	virtual ~vulkanapp();
 
-	void    Run();
+	bool    Run();
+	// settings overrides like "--frames-in-flight 3", applied after InitSettings
+	void    SetCommandLine(const int argc, char** argv);
 
 protected:
 	bool    Initialize();
 	void    Loop();
+	bool    RenderHeadless();
 	void    Shutdown();
 
 	void    InitializeSettings();
+	void    ApplyCommandLine();
+	bool    InitializeWindow();
 	bool    InitializeVulkan();
 	bool    InitializeDevicesAndQueues();
 	bool    InitializeSurface();
@@ -48,9 +78,11 @@ protected:
 	bool    InitializeOffscreenImage();
 	bool    InitializeCommandBuffers();
 	bool    InitializeSynchronization();
-	void    FillCommandBuffers();
+	void    RecordFrameCommands(const uint32_t frameIndex, const uint32_t imageIndex);
+	bool    SaveOffscreenImage(const String& fileName);
 
 	//
+	bool    WaitForFrame(FrameData& frame);
 	void    ProcessFrame(const float dt);
 	void    FreeVulkan();
 
@@ -58,15 +90,16 @@ protected:
 	virtual void InitSettings();
 	virtual void InitApp();
 	virtual void FreeResources();
-	virtual void FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t imageIndex);
+	virtual void FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t frameIndex);
 
 	virtual void OnMouseMove(const float x, const float y);
 	virtual void OnMouseButton(const int button, const int action, const int mods);
 	virtual void OnKey(const int key, const int scancode, const int action, const int mods);
-	virtual void Update(const size_t imageIndex, const float dt);
+	virtual void Update(const size_t frameIndex, const float dt);
 
 protected:
 	settings             _Settings;
+	Array<String>        _CommandLine;
 	GLFWwindow* _Window;
 
 	VkInstance              _Instance;
@@ -77,12 +110,12 @@ protected:
 	VkSwapchainKHR          _Swapchain;
 	Array<VkImage>          _SwapchainImages;
 	Array<VkImageView>      _SwapchainImageViews;
-	Array<VkFence>          _WaitForFrameFences;
 	VkCommandPool           _CommandPool;
 	helpers::Image    _OffscreenImage;
-	Array<VkCommandBuffer>  _CommandBuffers;
-	VkSemaphore             _SemaphoreImageAcquired;
-	VkSemaphore             _SemaphoreRenderFinished;
+	Array<FrameData>        _Frames;
+	uint32_t                _CurrentFrame;
+	VkSemaphore             _TimelineSemaphore;
+	uint64_t                _TimelineValue;
 
 	uint32_t                _GraphicsQueueFamilyIndex;
 	uint32_t                _ComputeQueueFamilyIndex;
@@ -96,4 +129,6 @@ protected:
 
 	// FPS meter
 	FPSMeter                fpsMeter;
+	FrameWaitStats          frameWaitStats;
+	uint32_t                mapCallsPerFrame;
 };
@@ -0,0 +1,426 @@
+#include "cpu_bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+static const uint32_t sMaxLeafTriangles = 8;        // bigger leaves are split even if SAH says otherwise
+static const uint32_t sMaxStackDepth = 64;
+static const uint32_t sNumBins = 16;
+static const uint32_t sMinSubtreeTriangles = 1024;  // not worth a task of its own below that
+static const float sTraversalCost = 1.0f;
+static const float sIntersectionCost = 1.0f;
+static const uint32_t sNoSubtree = ~0u;
+
+static float SurfaceArea(const vec3& boundsMin, const vec3& boundsMax) {
+	const vec3 extent = boundsMax - boundsMin;
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+
+Bvh::Bvh() {
+	_Stats = {};
+}
+Bvh::~Bvh() {
+}
+
+void Bvh::Build(const Array<vec3>& positions, ThreadPool& pool) {
+	const auto startTime = std::chrono::high_resolution_clock::now();
+
+	const uint32_t numTriangles = static_cast<uint32_t>(positions.size() / 3);
+
+	_Stats = {};
+	_Nodes.clear();
+	_TopNodes.clear();
+	_Subtrees.clear();
+
+	_TriangleIds.resize(numTriangles);
+	_Centroids.resize(numTriangles);
+	_BoundsMin.resize(numTriangles);
+	_BoundsMax.resize(numTriangles);
+	for (uint32_t i = 0; i < numTriangles; ++i) {
+		const vec3& a = positions[i * 3 + 0];
+		const vec3& b = positions[i * 3 + 1];
+		const vec3& c = positions[i * 3 + 2];
+		_TriangleIds[i] = i;
+		_BoundsMin[i] = glm::min(glm::min(a, b), c);
+		_BoundsMax[i] = glm::max(glm::max(a, b), c);
+		_Centroids[i] = (_BoundsMin[i] + _BoundsMax[i]) * 0.5f;
+	}
+
+	if (numTriangles) {
+		// split on this thread until there are a few subtrees per worker, then build those in parallel
+		const uint32_t parallelThreshold = Max(numTriangles / (pool.GetNumThreads() * 8), sMinSubtreeTriangles);
+		BuildTop(0, numTriangles, 1, parallelThreshold);
+
+		pool.ParallelFor(static_cast<uint32_t>(_Subtrees.size()), [this](const uint32_t subtreeIdx, const uint32_t) {
+			SubtreeJob& job = _Subtrees[subtreeIdx];
+			job.nodes.reserve(job.count * 2);
+			BuildSubtree(job.nodes, job.first, job.count, job.depth);
+		});
+
+		size_t numNodes = _TopNodes.size();
+		for (const SubtreeJob& job : _Subtrees) {
+			numNodes += job.nodes.size();
+		}
+		_Nodes.reserve(numNodes);
+
+		const float rootArea = SurfaceArea(_TopNodes[0].boundsMin, _TopNodes[0].boundsMax);
+		Flatten(_TopNodes, 0, 1, rootArea > 0.0f ? rootArea : 1.0f);
+	}
+
+	// swap to the layout the traversal wants
+	_Triangles.resize(numTriangles);
+	for (uint32_t i = 0; i < numTriangles; ++i) {
+		const uint32_t src = _TriangleIds[i];
+		Triangle& tri = _Triangles[i];
+		tri.v0 = positions[src * 3 + 0];
+		tri.e1 = positions[src * 3 + 1] - tri.v0;
+		tri.e2 = positions[src * 3 + 2] - tri.v0;
+	}
+
+	_Stats.numNodes = static_cast<uint32_t>(_Nodes.size());
+	_Stats.numSubtrees = static_cast<uint32_t>(_Subtrees.size());
+
+	_Centroids = Array<vec3>();
+	_BoundsMin = Array<vec3>();
+	_BoundsMax = Array<vec3>();
+	_TopNodes = Array<BuildNode>();
+	_Subtrees = Array<SubtreeJob>();
+
+	_Stats.buildTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+bool Bvh::Intersect(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const {
+	return Traverse<false>(origin, direction, tmin, tmax, hit);
+}
+
+bool Bvh::Occluded(const vec3& origin, const vec3& direction, const float tmin, const float tmax) const {
+	BvhHit hit;
+	return Traverse<true>(origin, direction, tmin, tmax, hit);
+}
+
+// Moller-Trumbore against the triangles of a leaf, then a stack walk over the nodes, near child first
+template <bool AnyHit>
+bool Bvh::Traverse(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const {
+	if (_Nodes.empty()) {
+		return false;
+	}
+
+	const vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+	auto intersectBox = [&origin, &invDir](const BvhNode& node, const float tmin, const float tmax) -> float {
+		const float tx1 = (node.boundsMin.x - origin.x) * invDir.x, tx2 = (node.boundsMax.x - origin.x) * invDir.x;
+		const float ty1 = (node.boundsMin.y - origin.y) * invDir.y, ty2 = (node.boundsMax.y - origin.y) * invDir.y;
+		const float tz1 = (node.boundsMin.z - origin.z) * invDir.z, tz2 = (node.boundsMax.z - origin.z) * invDir.z;
+		const float tnear = Max(Max(Max(Min(tx1, tx2), Min(ty1, ty2)), Min(tz1, tz2)), tmin);
+		const float tfar = Min(Min(Min(Max(tx1, tx2), Max(ty1, ty2)), Max(tz1, tz2)), tmax);
+		return (tnear <= tfar) ? tnear : FLT_MAX;
+	};
+
+	float closest = tmax;
+	bool found = false;
+
+	uint32_t stack[sMaxStackDepth];
+	uint32_t stackSize = 0;
+	uint32_t nodeIdx = 0;
+
+	if (FLT_MAX == intersectBox(_Nodes[0], tmin, closest)) {
+		return false;
+	}
+
+	for (;;) {
+		const BvhNode& node = _Nodes[nodeIdx];
+		if (node.count) {
+			for (uint32_t i = 0; i < node.count; ++i) {
+				const uint32_t triIdx = node.rightOrFirst + i;
+				const Triangle& tri = _Triangles[triIdx];
+
+				const vec3 p = Cross(direction, tri.e2);
+				const float det = Dot(tri.e1, p);
+				if (std::abs(det) < 1e-12f) {
+					continue;
+				}
+				const float invDet = 1.0f / det;
+				const vec3 s = origin - tri.v0;
+				const float u = Dot(s, p) * invDet;
+				if (u < 0.0f || u > 1.0f) {
+					continue;
+				}
+				const vec3 q = Cross(s, tri.e1);
+				const float v = Dot(direction, q) * invDet;
+				if (v < 0.0f || u + v > 1.0f) {
+					continue;
+				}
+				const float t = Dot(tri.e2, q) * invDet;
+				if (t > tmin && t < closest) {
+					closest = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hit.triangle = _TriangleIds[triIdx];
+					found = true;
+					if (AnyHit) {
+						return true;
+					}
+				}
+			}
+		}
+		else {
+			const uint32_t left = nodeIdx + 1;
+			const uint32_t right = node.rightOrFirst;
+			float distLeft = intersectBox(_Nodes[left], tmin, closest);
+			float distRight = intersectBox(_Nodes[right], tmin, closest);
+
+			uint32_t nearIdx = left, farIdx = right;
+			if (distRight < distLeft) {
+				std::swap(distLeft, distRight);
+				std::swap(nearIdx, farIdx);
+			}
+
+			if (FLT_MAX != distLeft) {
+				if (FLT_MAX != distRight) {
+					stack[stackSize++] = farIdx;
+				}
+				nodeIdx = nearIdx;
+				continue;
+			}
+		}
+
+		if (!stackSize) {
+			break;
+		}
+		nodeIdx = stack[--stackSize];
+	}
+
+	return found;
+}
+
+uint32_t Bvh::GetNumNodes() const {
+	return static_cast<uint32_t>(_Nodes.size());
+}
+
+uint32_t Bvh::GetNumTriangles() const {
+	return static_cast<uint32_t>(_TriangleIds.size());
+}
+
+const BvhStats& Bvh::GetStats() const {
+	return _Stats;
+}
+
+const Array<BvhNode>& Bvh::GetNodes() const {
+	return _Nodes;
+}
+
+const Array<uint32_t>& Bvh::GetTriangleIds() const {
+	return _TriangleIds;
+}
+
+void Bvh::MakeNode(const uint32_t first, const uint32_t count, BuildNode& node) const {
+	node.boundsMin = vec3(FLT_MAX);
+	node.boundsMax = vec3(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; ++i) {
+		node.boundsMin = glm::min(node.boundsMin, _BoundsMin[_TriangleIds[i]]);
+		node.boundsMax = glm::max(node.boundsMax, _BoundsMax[_TriangleIds[i]]);
+	}
+	node.first = first;
+	node.count = count;
+	node.left = 0;
+	node.right = 0;
+	node.subtree = sNoSubtree;
+}
+
+// Bins the centroids along every axis and picks the cheapest plane between two bins.
+// Partitions the node's triangles and returns true if splitting beats keeping a leaf.
+bool Bvh::SplitNode(const BuildNode& node, uint32_t& leftCount) {
+	const uint32_t first = node.first;
+	const uint32_t count = node.count;
+	if (count <= 1) {
+		return false;
+	}
+
+	vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; ++i) {
+		centroidMin = glm::min(centroidMin, _Centroids[_TriangleIds[i]]);
+		centroidMax = glm::max(centroidMax, _Centroids[_TriangleIds[i]]);
+	}
+
+	struct Bin {
+		vec3        boundsMin;
+		vec3        boundsMax;
+		uint32_t    count;
+	};
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	uint32_t bestBin = 0;
+
+	for (int axis = 0; axis < 3; ++axis) {
+		const float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0f) {
+			continue;
+		}
+
+		Bin bins[sNumBins];
+		for (Bin& bin : bins) {
+			bin.boundsMin = vec3(FLT_MAX);
+			bin.boundsMax = vec3(-FLT_MAX);
+			bin.count = 0;
+		}
+
+		const float scale = static_cast<float>(sNumBins) / extent;
+		for (uint32_t i = first; i < first + count; ++i) {
+			const uint32_t triIdx = _TriangleIds[i];
+			const uint32_t binIdx = Min(static_cast<uint32_t>((_Centroids[triIdx][axis] - centroidMin[axis]) * scale), sNumBins - 1);
+			Bin& bin = bins[binIdx];
+			bin.boundsMin = glm::min(bin.boundsMin, _BoundsMin[triIdx]);
+			bin.boundsMax = glm::max(bin.boundsMax, _BoundsMax[triIdx]);
+			++bin.count;
+		}
+
+		// sweep from the right to get the area and count of everything right of each plane
+		float rightArea[sNumBins];
+		uint32_t rightCount[sNumBins];
+		vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+		uint32_t sweepCount = 0;
+		for (uint32_t i = sNumBins - 1; i > 0; --i) {
+			sweepMin = glm::min(sweepMin, bins[i].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[i].boundsMax);
+			sweepCount += bins[i].count;
+			rightArea[i] = sweepCount ? SurfaceArea(sweepMin, sweepMax) : 0.0f;
+			rightCount[i] = sweepCount;
+		}
+
+		sweepMin = vec3(FLT_MAX);
+		sweepMax = vec3(-FLT_MAX);
+		sweepCount = 0;
+		for (uint32_t i = 1; i < sNumBins; ++i) {
+			sweepMin = glm::min(sweepMin, bins[i - 1].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[i - 1].boundsMax);
+			sweepCount += bins[i - 1].count;
+			if (!sweepCount || !rightCount[i]) {
+				continue;
+			}
+
+			const float cost = SurfaceArea(sweepMin, sweepMax) * sweepCount + rightArea[i] * rightCount[i];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = i;
+			}
+		}
+	}
+
+	uint32_t* begin = _TriangleIds.data() + first;
+	uint32_t* end = begin + count;
+
+	if (bestAxis < 0) {
+		// every centroid in one spot, no plane separates them - just halve a leaf that got too big
+		if (count <= sMaxLeafTriangles) {
+			return false;
+		}
+		leftCount = count / 2;
+		return true;
+	}
+
+	// costs are scaled by the node area, so no division for flat nodes
+	const float nodeArea = SurfaceArea(node.boundsMin, node.boundsMax);
+	const float splitCost = sTraversalCost * nodeArea + sIntersectionCost * bestCost;
+	const float leafCost = sIntersectionCost * count * nodeArea;
+	if (splitCost >= leafCost && count <= sMaxLeafTriangles) {
+		return false;
+	}
+
+	const float scale = static_cast<float>(sNumBins) / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+	const float axisMin = centroidMin[bestAxis];
+	uint32_t* middle = std::partition(begin, end, [this, bestAxis, bestBin, axisMin, scale](const uint32_t triIdx) {
+		return Min(static_cast<uint32_t>((_Centroids[triIdx][bestAxis] - axisMin) * scale), sNumBins - 1) < bestBin;
+	});
+
+	leftCount = static_cast<uint32_t>(middle - begin);
+	if (!leftCount || leftCount == count) {
+		leftCount = count / 2;
+	}
+	return true;
+}
+
+uint32_t Bvh::BuildTop(const uint32_t first, const uint32_t count, const uint32_t depth, const uint32_t parallelThreshold) {
+	const uint32_t nodeIdx = static_cast<uint32_t>(_TopNodes.size());
+	_TopNodes.emplace_back();
+	MakeNode(first, count, _TopNodes[nodeIdx]);
+
+	if (count <= parallelThreshold) {
+		_TopNodes[nodeIdx].subtree = static_cast<uint32_t>(_Subtrees.size());
+		_Subtrees.emplace_back();
+		SubtreeJob& job = _Subtrees.back();
+		job.first = first;
+		job.count = count;
+		job.depth = depth;
+		return nodeIdx;
+	}
+
+	uint32_t leftCount = 0;
+	const BuildNode node = _TopNodes[nodeIdx];
+	if (depth >= sMaxStackDepth || !SplitNode(node, leftCount)) {
+		return nodeIdx;
+	}
+
+	const uint32_t left = BuildTop(first, leftCount, depth + 1, parallelThreshold);
+	const uint32_t right = BuildTop(first + leftCount, count - leftCount, depth + 1, parallelThreshold);
+	_TopNodes[nodeIdx].left = left;
+	_TopNodes[nodeIdx].right = right;
+	_TopNodes[nodeIdx].count = 0;
+	return nodeIdx;
+}
+
+uint32_t Bvh::BuildSubtree(Array<BuildNode>& nodes, const uint32_t first, const uint32_t count, const uint32_t depth) {
+	const uint32_t nodeIdx = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	MakeNode(first, count, nodes[nodeIdx]);
+
+	// the traversal stack holds at most one node per level
+	uint32_t leftCount = 0;
+	const BuildNode node = nodes[nodeIdx];
+	if (depth >= sMaxStackDepth || !SplitNode(node, leftCount)) {
+		return nodeIdx;
+	}
+
+	const uint32_t left = BuildSubtree(nodes, first, leftCount, depth + 1);
+	const uint32_t right = BuildSubtree(nodes, first + leftCount, count - leftCount, depth + 1);
+	nodes[nodeIdx].left = left;
+	nodes[nodeIdx].right = right;
+	nodes[nodeIdx].count = 0;
+	return nodeIdx;
+}
+
+// depth-first emit, so the left child ends up right after its parent, and SAH cost on the way
+void Bvh::Flatten(const Array<BuildNode>& nodes, const uint32_t nodeIdx, const uint32_t depth, const float rootArea) {
+	const BuildNode& node = nodes[nodeIdx];
+	if (sNoSubtree != node.subtree) {
+		Flatten(_Subtrees[node.subtree].nodes, 0, depth, rootArea);
+		return;
+	}
+
+	const uint32_t outIdx = static_cast<uint32_t>(_Nodes.size());
+	_Nodes.emplace_back();
+	_Nodes[outIdx].boundsMin = node.boundsMin;
+	_Nodes[outIdx].boundsMax = node.boundsMax;
+
+	const float areaRatio = SurfaceArea(node.boundsMin, node.boundsMax) / rootArea;
+	_Stats.maxDepth = Max(_Stats.maxDepth, depth);
+
+	if (node.count) {
+		_Nodes[outIdx].rightOrFirst = node.first;
+		_Nodes[outIdx].count = node.count;
+		_Stats.sahCost += areaRatio * sIntersectionCost * node.count;
+		_Stats.maxLeafTriangles = Max(_Stats.maxLeafTriangles, node.count);
+		++_Stats.numLeaves;
+		return;
+	}
+
+	_Stats.sahCost += areaRatio * sTraversalCost;
+	Flatten(nodes, node.left, depth + 1, rootArea);
+	_Nodes[outIdx].rightOrFirst = static_cast<uint32_t>(_Nodes.size());
+	_Nodes[outIdx].count = 0;
+	Flatten(nodes, node.right, depth + 1, rootArea);
+}
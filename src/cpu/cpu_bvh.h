@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../common/utils.h"
+#include "../common/thread_pool.h"
+
+// 32 bytes and 32-byte aligned, two nodes per cache line.
+// Nodes are laid out depth-first: the left child of an inner node always follows it directly.
+struct alignas(32) BvhNode {
+	vec3        boundsMin;
+	uint32_t    rightOrFirst;   // inner node - index of the right child, leaf - first triangle
+	vec3        boundsMax;
+	uint32_t    count;          // 0 for inner nodes, number of triangles for leaves
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode is expected to be 32 bytes");
+
+struct BvhHit {
+	float       t;
+	float       u, v;           // barycentrics of v1 and v2, same as the hit attribs in the shaders
+	uint32_t    triangle;       // index in the array passed to Build
+};
+
+struct BvhStats {
+	double      buildTimeMs;
+	uint32_t    numNodes;
+	uint32_t    numLeaves;
+	uint32_t    maxDepth;
+	uint32_t    maxLeafTriangles;
+	uint32_t    numSubtrees;    // built in parallel
+	float       sahCost;        // expected traversal + intersection cost of a ray hitting the root
+};
+
+// Binary BVH over triangles for the CPU path tracer.
+// Built with binned SAH: the top of the tree is split on the calling thread until there are enough
+// subtrees to keep the pool busy, then the subtrees are built in parallel and everything is flattened
+// into one depth-first array. Triangles are stored reordered next to the nodes, so a leaf is a
+// contiguous run of them.
+class Bvh {
+public:
+	Bvh();
+	~Bvh();
+
+	// positions - 3 vertices per triangle
+	void        Build(const Array<vec3>& positions, ThreadPool& pool = ThreadPool::GetDefault());
+
+	// closest hit in (tmin, tmax), both sides of the triangles are hit, same as with culling disabled on the GPU
+	bool        Intersect(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const;
+	// any hit in (tmin, tmax), stops at the first one like gl_RayFlagsTerminateOnFirstHitNV
+	bool        Occluded(const vec3& origin, const vec3& direction, const float tmin, const float tmax) const;
+
+	// getters
+	uint32_t    GetNumNodes() const;
+	uint32_t    GetNumTriangles() const;
+	const BvhStats& GetStats() const;
+	const Array<BvhNode>& GetNodes() const;
+	const Array<uint32_t>& GetTriangleIds() const;
+
+private:
+	// v0 plus two edges, that's all the ray/triangle test needs
+	struct Triangle {
+		vec3    v0;
+		vec3    e1;
+		vec3    e2;
+	};
+
+	// children index the array of the tree that owns the node
+	struct BuildNode {
+		vec3        boundsMin;
+		vec3        boundsMax;
+		uint32_t    first;
+		uint32_t    count;          // triangles of a leaf, 0 for inner nodes and subtree links
+		uint32_t    left;
+		uint32_t    right;
+		uint32_t    subtree;        // ~0u unless the node stands in for a subtree built in parallel
+	};
+
+	struct SubtreeJob {
+		uint32_t            first;
+		uint32_t            count;
+		uint32_t            depth;
+		Array<BuildNode>    nodes;
+	};
+
+	template <bool AnyHit>
+	bool        Traverse(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const;
+
+	void        MakeNode(const uint32_t first, const uint32_t count, BuildNode& node) const;
+	bool        SplitNode(const BuildNode& node, uint32_t& leftCount);
+	uint32_t    BuildTop(const uint32_t first, const uint32_t count, const uint32_t depth, const uint32_t parallelThreshold);
+	uint32_t    BuildSubtree(Array<BuildNode>& nodes, const uint32_t first, const uint32_t count, const uint32_t depth);
+	void        Flatten(const Array<BuildNode>& nodes, const uint32_t nodeIdx, const uint32_t depth, const float rootArea);
+
+private:
+	Array<BvhNode>      _Nodes;
+	Array<Triangle>     _Triangles;
+	Array<uint32_t>     _TriangleIds;   // original index of every reordered triangle
+	BvhStats            _Stats;
+
+	// build only
+	Array<vec3>         _Centroids;
+	Array<vec3>         _BoundsMin;
+	Array<vec3>         _BoundsMax;
+	Array<BuildNode>    _TopNodes;
+	Array<SubtreeJob>   _Subtrees;
+};
@@ -0,0 +1,441 @@
+#include "cpu_bvh8.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define BVH8_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH8_SSE
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static const uint32_t sMaxStackSize = 512;     // 7 siblings left behind per level of a 64 deep tree plus one node worth
+
+// The kernels are written once against these few wrappers, one 8-wide node or triangle block is done
+// in one AVX step, two SSE steps or eight scalar ones. Comparisons follow the scalar code in
+// Bvh::Traverse (including NaNs), the arithmetic may still round differently (FMA, vector vs scalar).
+#if defined(BVH8_AVX2)
+using SimdFloat = __m256;
+using SimdMask = __m256;
+static const uint32_t sSimdWidth = 8;
+static inline SimdFloat SimdLoad(const float* p) { return _mm256_load_ps(p); }
+static inline SimdFloat SimdSet(const float f) { return _mm256_set1_ps(f); }
+static inline void SimdStore(float* p, const SimdFloat a) { _mm256_storeu_ps(p, a); }
+static inline SimdFloat SimdAdd(const SimdFloat a, const SimdFloat b) { return _mm256_add_ps(a, b); }
+static inline SimdFloat SimdSub(const SimdFloat a, const SimdFloat b) { return _mm256_sub_ps(a, b); }
+static inline SimdFloat SimdMul(const SimdFloat a, const SimdFloat b) { return _mm256_mul_ps(a, b); }
+static inline SimdFloat SimdDiv(const SimdFloat a, const SimdFloat b) { return _mm256_div_ps(a, b); }
+static inline SimdFloat SimdMin(const SimdFloat a, const SimdFloat b) { return _mm256_min_ps(a, b); }     // a < b ? a : b
+static inline SimdFloat SimdMax(const SimdFloat a, const SimdFloat b) { return _mm256_max_ps(a, b); }     // a > b ? a : b
+static inline SimdFloat SimdAbs(const SimdFloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline SimdMask SimdLess(const SimdFloat a, const SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline SimdMask SimdLessEqual(const SimdFloat a, const SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline SimdMask SimdGreater(const SimdFloat a, const SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline SimdMask SimdNotLess(const SimdFloat a, const SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_NLT_UQ); }
+static inline SimdMask SimdNotGreater(const SimdFloat a, const SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_NGT_UQ); }
+static inline SimdMask SimdAnd(const SimdMask a, const SimdMask b) { return _mm256_and_ps(a, b); }
+static inline uint32_t SimdBits(const SimdMask m) { return static_cast<uint32_t>(_mm256_movemask_ps(m)); }
+#elif defined(BVH8_SSE)
+using SimdFloat = __m128;
+using SimdMask = __m128;
+static const uint32_t sSimdWidth = 4;
+static inline SimdFloat SimdLoad(const float* p) { return _mm_load_ps(p); }
+static inline SimdFloat SimdSet(const float f) { return _mm_set1_ps(f); }
+static inline void SimdStore(float* p, const SimdFloat a) { _mm_storeu_ps(p, a); }
+static inline SimdFloat SimdAdd(const SimdFloat a, const SimdFloat b) { return _mm_add_ps(a, b); }
+static inline SimdFloat SimdSub(const SimdFloat a, const SimdFloat b) { return _mm_sub_ps(a, b); }
+static inline SimdFloat SimdMul(const SimdFloat a, const SimdFloat b) { return _mm_mul_ps(a, b); }
+static inline SimdFloat SimdDiv(const SimdFloat a, const SimdFloat b) { return _mm_div_ps(a, b); }
+static inline SimdFloat SimdMin(const SimdFloat a, const SimdFloat b) { return _mm_min_ps(a, b); }
+static inline SimdFloat SimdMax(const SimdFloat a, const SimdFloat b) { return _mm_max_ps(a, b); }
+static inline SimdFloat SimdAbs(const SimdFloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline SimdMask SimdLess(const SimdFloat a, const SimdFloat b) { return _mm_cmplt_ps(a, b); }
+static inline SimdMask SimdLessEqual(const SimdFloat a, const SimdFloat b) { return _mm_cmple_ps(a, b); }
+static inline SimdMask SimdGreater(const SimdFloat a, const SimdFloat b) { return _mm_cmpgt_ps(a, b); }
+static inline SimdMask SimdNotLess(const SimdFloat a, const SimdFloat b) { return _mm_cmpnlt_ps(a, b); }
+static inline SimdMask SimdNotGreater(const SimdFloat a, const SimdFloat b) { return _mm_cmpngt_ps(a, b); }
+static inline SimdMask SimdAnd(const SimdMask a, const SimdMask b) { return _mm_and_ps(a, b); }
+static inline uint32_t SimdBits(const SimdMask m) { return static_cast<uint32_t>(_mm_movemask_ps(m)); }
+#else
+using SimdFloat = float;
+using SimdMask = bool;
+static const uint32_t sSimdWidth = 1;
+static inline SimdFloat SimdLoad(const float* p) { return *p; }
+static inline SimdFloat SimdSet(const float f) { return f; }
+static inline void SimdStore(float* p, const SimdFloat a) { *p = a; }
+static inline SimdFloat SimdAdd(const SimdFloat a, const SimdFloat b) { return a + b; }
+static inline SimdFloat SimdSub(const SimdFloat a, const SimdFloat b) { return a - b; }
+static inline SimdFloat SimdMul(const SimdFloat a, const SimdFloat b) { return a * b; }
+static inline SimdFloat SimdDiv(const SimdFloat a, const SimdFloat b) { return a / b; }
+static inline SimdFloat SimdMin(const SimdFloat a, const SimdFloat b) { return Min(a, b); }
+static inline SimdFloat SimdMax(const SimdFloat a, const SimdFloat b) { return Max(a, b); }
+static inline SimdFloat SimdAbs(const SimdFloat a) { return std::abs(a); }
+static inline SimdMask SimdLess(const SimdFloat a, const SimdFloat b) { return a < b; }
+static inline SimdMask SimdLessEqual(const SimdFloat a, const SimdFloat b) { return a <= b; }
+static inline SimdMask SimdGreater(const SimdFloat a, const SimdFloat b) { return a > b; }
+static inline SimdMask SimdNotLess(const SimdFloat a, const SimdFloat b) { return !(a < b); }
+static inline SimdMask SimdNotGreater(const SimdFloat a, const SimdFloat b) { return !(a > b); }
+static inline SimdMask SimdAnd(const SimdMask a, const SimdMask b) { return a && b; }
+static inline uint32_t SimdBits(const SimdMask m) { return m ? 1u : 0u; }
+#endif
+
+static inline uint32_t LowestBit(const uint32_t mask) {
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return static_cast<uint32_t>(idx);
+#else
+	return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+static float SurfaceArea(const BvhNode& node) {
+	const vec3 extent = node.boundsMax - node.boundsMin;
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+namespace {
+	// the ray broadcast once, reused for every node and triangle block
+	struct SimdRay {
+		SimdFloat   ox, oy, oz;
+		SimdFloat   dx, dy, dz;
+		SimdFloat   idx, idy, idz;
+		SimdFloat   tmin;
+	};
+
+	struct StackEntry {
+		uint32_t    child;
+		uint32_t    count;
+		float       dist;
+	};
+}
+
+// slab test against all 8 children, returns the mask of the hit ones and their entry distances
+static uint32_t IntersectChildren(const Bvh8Node& node, const SimdRay& ray, const float closest, float dist[8]) {
+	const SimdFloat tmax = SimdSet(closest);
+	uint32_t mask = 0;
+	for (uint32_t lane = 0; lane < 8; lane += sSimdWidth) {
+		const SimdFloat tx1 = SimdMul(SimdSub(SimdLoad(node.boundsMinX + lane), ray.ox), ray.idx);
+		const SimdFloat tx2 = SimdMul(SimdSub(SimdLoad(node.boundsMaxX + lane), ray.ox), ray.idx);
+		const SimdFloat ty1 = SimdMul(SimdSub(SimdLoad(node.boundsMinY + lane), ray.oy), ray.idy);
+		const SimdFloat ty2 = SimdMul(SimdSub(SimdLoad(node.boundsMaxY + lane), ray.oy), ray.idy);
+		const SimdFloat tz1 = SimdMul(SimdSub(SimdLoad(node.boundsMinZ + lane), ray.oz), ray.idz);
+		const SimdFloat tz2 = SimdMul(SimdSub(SimdLoad(node.boundsMaxZ + lane), ray.oz), ray.idz);
+		const SimdFloat tnear = SimdMax(SimdMax(SimdMax(SimdMin(tx1, tx2), SimdMin(ty1, ty2)), SimdMin(tz1, tz2)), ray.tmin);
+		const SimdFloat tfar = SimdMin(SimdMin(SimdMin(SimdMax(tx1, tx2), SimdMax(ty1, ty2)), SimdMax(tz1, tz2)), tmax);
+		SimdStore(dist + lane, tnear);
+		mask |= SimdBits(SimdLessEqual(tnear, tfar)) << lane;
+	}
+	return mask;
+}
+
+// Moller-Trumbore on 8 triangles, the same operations as Bvh::Traverse
+static uint32_t IntersectTriangles(const Bvh8TriangleBlock& block, const SimdRay& ray, const float closest, float t[8], float u[8], float v[8]) {
+	const SimdFloat zero = SimdSet(0.0f);
+	const SimdFloat one = SimdSet(1.0f);
+	const SimdFloat epsilon = SimdSet(1e-12f);
+	const SimdFloat tmax = SimdSet(closest);
+	uint32_t mask = 0;
+	for (uint32_t lane = 0; lane < 8; lane += sSimdWidth) {
+		const SimdFloat e1x = SimdLoad(block.e1x + lane), e1y = SimdLoad(block.e1y + lane), e1z = SimdLoad(block.e1z + lane);
+		const SimdFloat e2x = SimdLoad(block.e2x + lane), e2y = SimdLoad(block.e2y + lane), e2z = SimdLoad(block.e2z + lane);
+
+		// p = cross(direction, e2)
+		const SimdFloat px = SimdSub(SimdMul(ray.dy, e2z), SimdMul(ray.dz, e2y));
+		const SimdFloat py = SimdSub(SimdMul(ray.dz, e2x), SimdMul(ray.dx, e2z));
+		const SimdFloat pz = SimdSub(SimdMul(ray.dx, e2y), SimdMul(ray.dy, e2x));
+		const SimdFloat det = SimdAdd(SimdAdd(SimdMul(e1x, px), SimdMul(e1y, py)), SimdMul(e1z, pz));
+		const SimdFloat invDet = SimdDiv(one, det);
+
+		const SimdFloat sx = SimdSub(ray.ox, SimdLoad(block.v0x + lane));
+		const SimdFloat sy = SimdSub(ray.oy, SimdLoad(block.v0y + lane));
+		const SimdFloat sz = SimdSub(ray.oz, SimdLoad(block.v0z + lane));
+		const SimdFloat uu = SimdMul(SimdAdd(SimdAdd(SimdMul(sx, px), SimdMul(sy, py)), SimdMul(sz, pz)), invDet);
+
+		// q = cross(s, e1)
+		const SimdFloat qx = SimdSub(SimdMul(sy, e1z), SimdMul(sz, e1y));
+		const SimdFloat qy = SimdSub(SimdMul(sz, e1x), SimdMul(sx, e1z));
+		const SimdFloat qz = SimdSub(SimdMul(sx, e1y), SimdMul(sy, e1x));
+		const SimdFloat vv = SimdMul(SimdAdd(SimdAdd(SimdMul(ray.dx, qx), SimdMul(ray.dy, qy)), SimdMul(ray.dz, qz)), invDet);
+		const SimdFloat tt = SimdMul(SimdAdd(SimdAdd(SimdMul(e2x, qx), SimdMul(e2y, qy)), SimdMul(e2z, qz)), invDet);
+
+		SimdMask hit = SimdNotLess(SimdAbs(det), epsilon);
+		hit = SimdAnd(hit, SimdAnd(SimdNotLess(uu, zero), SimdNotGreater(uu, one)));
+		hit = SimdAnd(hit, SimdAnd(SimdNotLess(vv, zero), SimdNotGreater(SimdAdd(uu, vv), one)));
+		hit = SimdAnd(hit, SimdAnd(SimdGreater(tt, ray.tmin), SimdLess(tt, tmax)));
+
+		SimdStore(t + lane, tt);
+		SimdStore(u + lane, uu);
+		SimdStore(v + lane, vv);
+		mask |= SimdBits(hit) << lane;
+	}
+	return mask;
+}
+
+
+Bvh8::Bvh8() {
+}
+Bvh8::~Bvh8() {
+}
+
+void Bvh8::Build(const Bvh& bvh, const Array<vec3>& positions) {
+	_Nodes.clear();
+	_Blocks.clear();
+
+	if (bvh.GetNodes().empty()) {
+		return;
+	}
+
+	_Nodes.reserve(bvh.GetNodes().size() / 4 + 1);
+	_Blocks.reserve(bvh.GetNumTriangles() / 4 + 1);
+	CollapseNode(bvh, positions, 0);
+}
+
+// Triangles of a subtree are contiguous in the binary tree, a subtree that fits in one block
+// becomes a single leaf instead of several half empty ones.
+static bool GetSmallSubtree(const Array<BvhNode>& nodes, const uint32_t nodeIdx, uint32_t& first, uint32_t& count) {
+	const BvhNode& node = nodes[nodeIdx];
+	if (node.count) {
+		first = node.rightOrFirst;
+		count = node.count;
+		return true;
+	}
+
+	uint32_t rightFirst, rightCount;
+	if (!GetSmallSubtree(nodes, nodeIdx + 1, first, count) || !GetSmallSubtree(nodes, node.rightOrFirst, rightFirst, rightCount)) {
+		return false;
+	}
+	if (rightFirst != first + count || count + rightCount > 8) {
+		return false;
+	}
+	count += rightCount;
+	return true;
+}
+
+// Pulls the binary subtree up into one node: the inner child with the biggest surface area is replaced
+// by its two children until there are 8 of them or only leaves are left, then recurses into the inner ones.
+uint32_t Bvh8::CollapseNode(const Bvh& bvh, const Array<vec3>& positions, const uint32_t nodeIdx) {
+	const Array<BvhNode>& nodes = bvh.GetNodes();
+
+	uint32_t children[8], leafFirst[8], leafCount[8];
+	uint32_t numChildren = 0;
+	auto addChild = [&](const uint32_t childIdx, const uint32_t slot) {
+		children[slot] = childIdx;
+		if (!GetSmallSubtree(nodes, childIdx, leafFirst[slot], leafCount[slot])) {
+			leafCount[slot] = 0;
+		}
+	};
+
+	if (nodes[nodeIdx].count) {
+		addChild(nodeIdx, numChildren++);
+	}
+	else {
+		addChild(nodeIdx + 1, numChildren++);
+		addChild(nodes[nodeIdx].rightOrFirst, numChildren++);
+	}
+
+	while (numChildren < 8) {
+		uint32_t best = ~0u;
+		float bestArea = -1.0f;
+		for (uint32_t i = 0; i < numChildren; ++i) {
+			const BvhNode& child = nodes[children[i]];
+			if (!leafCount[i] && SurfaceArea(child) > bestArea) {
+				bestArea = SurfaceArea(child);
+				best = i;
+			}
+		}
+		if (~0u == best) {
+			break;
+		}
+
+		const uint32_t expanded = children[best];
+		addChild(expanded + 1, best);
+		addChild(nodes[expanded].rightOrFirst, numChildren++);
+	}
+
+	const uint32_t idx = static_cast<uint32_t>(_Nodes.size());
+	_Nodes.emplace_back();
+	{
+		Bvh8Node& node = _Nodes[idx];
+		for (uint32_t i = 0; i < 8; ++i) {
+			node.boundsMinX[i] = node.boundsMinY[i] = node.boundsMinZ[i] = INFINITY;
+			node.boundsMaxX[i] = node.boundsMaxY[i] = node.boundsMaxZ[i] = INFINITY;
+			node.child[i] = 0;
+			node.count[i] = 0;
+		}
+	}
+
+	for (uint32_t i = 0; i < numChildren; ++i) {
+		const BvhNode& child = nodes[children[i]];
+		// the recursion grows _Nodes, so no reference to our node is kept across it
+		const uint32_t childIdx = leafCount[i] ? AddLeaf(bvh, positions, leafFirst[i], leafCount[i]) : CollapseNode(bvh, positions, children[i]);
+
+		Bvh8Node& node = _Nodes[idx];
+		node.boundsMinX[i] = child.boundsMin.x;
+		node.boundsMinY[i] = child.boundsMin.y;
+		node.boundsMinZ[i] = child.boundsMin.z;
+		node.boundsMaxX[i] = child.boundsMax.x;
+		node.boundsMaxY[i] = child.boundsMax.y;
+		node.boundsMaxZ[i] = child.boundsMax.z;
+		node.child[i] = childIdx;
+		node.count[i] = (leafCount[i] + 7) / 8;
+	}
+
+	return idx;
+}
+
+uint32_t Bvh8::AddLeaf(const Bvh& bvh, const Array<vec3>& positions, const uint32_t firstTriangle, const uint32_t numTriangles) {
+	const Array<uint32_t>& triangleIds = bvh.GetTriangleIds();
+
+	const uint32_t first = static_cast<uint32_t>(_Blocks.size());
+	const uint32_t numBlocks = (numTriangles + 7) / 8;
+	_Blocks.resize(first + numBlocks);
+
+	for (uint32_t b = 0; b < numBlocks; ++b) {
+		Bvh8TriangleBlock& block = _Blocks[first + b];
+		memset(&block, 0, sizeof(block));
+
+		const uint32_t blockCount = Min(numTriangles - b * 8, 8u);
+		for (uint32_t i = 0; i < blockCount; ++i) {
+			const uint32_t id = triangleIds[firstTriangle + b * 8 + i];
+			const vec3& v0 = positions[id * 3 + 0];
+			const vec3 e1 = positions[id * 3 + 1] - v0;
+			const vec3 e2 = positions[id * 3 + 2] - v0;
+			block.v0x[i] = v0.x; block.v0y[i] = v0.y; block.v0z[i] = v0.z;
+			block.e1x[i] = e1.x; block.e1y[i] = e1.y; block.e1z[i] = e1.z;
+			block.e2x[i] = e2.x; block.e2y[i] = e2.y; block.e2z[i] = e2.z;
+			block.ids[i] = id;
+		}
+	}
+
+	return first;
+}
+
+bool Bvh8::Intersect(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const {
+	return Traverse<false>(origin, direction, tmin, tmax, hit);
+}
+
+bool Bvh8::Occluded(const vec3& origin, const vec3& direction, const float tmin, const float tmax) const {
+	BvhHit hit;
+	return Traverse<true>(origin, direction, tmin, tmax, hit);
+}
+
+// Stack walk over the 8-wide nodes, the hit children are pushed far to near so the nearest is popped
+// first, and entries that start behind the closest hit found meanwhile are dropped when popped.
+template <bool AnyHit>
+bool Bvh8::Traverse(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const {
+	if (_Nodes.empty()) {
+		return false;
+	}
+
+	SimdRay ray;
+	ray.ox = SimdSet(origin.x);
+	ray.oy = SimdSet(origin.y);
+	ray.oz = SimdSet(origin.z);
+	ray.dx = SimdSet(direction.x);
+	ray.dy = SimdSet(direction.y);
+	ray.dz = SimdSet(direction.z);
+	ray.idx = SimdSet(1.0f / direction.x);
+	ray.idy = SimdSet(1.0f / direction.y);
+	ray.idz = SimdSet(1.0f / direction.z);
+	ray.tmin = SimdSet(tmin);
+
+	float closest = tmax;
+	bool found = false;
+
+	StackEntry stack[sMaxStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = { 0, 0, tmin };
+
+	alignas(32) float dist[8];
+	alignas(32) float t[8], u[8], v[8];
+
+	while (stackSize) {
+		const StackEntry entry = stack[--stackSize];
+		if (entry.dist > closest) {
+			continue;
+		}
+
+		if (entry.count) {
+			for (uint32_t b = entry.child; b < entry.child + entry.count; ++b) {
+				const Bvh8TriangleBlock& block = _Blocks[b];
+				uint32_t mask = IntersectTriangles(block, ray, closest, t, u, v);
+				if (!mask) {
+					continue;
+				}
+				if (AnyHit) {
+					// a lane that actually hit, not necessarily the nearest one
+					const uint32_t lane = LowestBit(mask);
+					hit.t = t[lane];
+					hit.u = u[lane];
+					hit.v = v[lane];
+					hit.triangle = block.ids[lane];
+					return true;
+				}
+
+				// nearest lane, the lowest one on ties like the scalar loop
+				uint32_t best = ~0u;
+				for (; mask; mask &= mask - 1) {
+					const uint32_t lane = LowestBit(mask);
+					if (~0u == best || t[lane] < t[best]) {
+						best = lane;
+					}
+				}
+				closest = t[best];
+				hit.t = t[best];
+				hit.u = u[best];
+				hit.v = v[best];
+				hit.triangle = block.ids[best];
+				found = true;
+			}
+			continue;
+		}
+
+		const Bvh8Node& node = _Nodes[entry.child];
+		uint32_t mask = IntersectChildren(node, ray, closest, dist);
+
+		// insertion sort by distance, farthest first
+		StackEntry* sorted = stack + stackSize;
+		uint32_t numSorted = 0;
+		for (; mask; mask &= mask - 1) {
+			const uint32_t lane = LowestBit(mask);
+			const StackEntry child = { node.child[lane], node.count[lane], dist[lane] };
+			uint32_t i = numSorted++;
+			for (; i > 0 && sorted[i - 1].dist < child.dist; --i) {
+				sorted[i] = sorted[i - 1];
+			}
+			sorted[i] = child;
+		}
+		stackSize += numSorted;
+	}
+
+	return found;
+}
+
+uint32_t Bvh8::GetNumNodes() const {
+	return static_cast<uint32_t>(_Nodes.size());
+}
+
+uint32_t Bvh8::GetNumTriangleBlocks() const {
+	return static_cast<uint32_t>(_Blocks.size());
+}
+
+size_t Bvh8::GetMemorySize() const {
+	return _Nodes.size() * sizeof(Bvh8Node) + _Blocks.size() * sizeof(Bvh8TriangleBlock);
+}
+
+const char* Bvh8::GetKernelName() {
+#if defined(BVH8_AVX2)
+	return "AVX2";
+#elif defined(BVH8_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "cpu_bvh.h"
+
+// 8 children with their bounds stored per axis (SoA), so one node is tested against a ray with a single
+// 8-wide slab test. 256 bytes, four cache lines. Unused slots have +inf bounds and never hit.
+struct alignas(64) Bvh8Node {
+	float       boundsMinX[8];
+	float       boundsMaxX[8];
+	float       boundsMinY[8];
+	float       boundsMaxY[8];
+	float       boundsMinZ[8];
+	float       boundsMaxZ[8];
+	uint32_t    child[8];       // inner child - node index, leaf - first triangle block
+	uint32_t    count[8];       // 0 for inner children, number of triangle blocks for leaves
+};
+static_assert(sizeof(Bvh8Node) == 256, "Bvh8Node is expected to be 256 bytes");
+
+// 8 triangles in SoA layout (v0 plus two edges, like Bvh). Unused lanes are all zeros, det is 0 and they never hit.
+struct alignas(32) Bvh8TriangleBlock {
+	float       v0x[8], v0y[8], v0z[8];
+	float       e1x[8], e1y[8], e1z[8];
+	float       e2x[8], e2y[8], e2z[8];
+	uint32_t    ids[8];         // index in the array passed to Bvh::Build
+};
+
+// 8-wide BVH collapsed from the binary one, traced with AVX2 (or SSE, or plain C++, whatever the
+// compiler targets: -mavx2 / -march=native, /arch:AVX2 on MSVC). It's the same triangle test as Bvh
+// done 8 lanes at a time, hit distances agree up to rounding (FMA contraction may differ per kernel).
+class Bvh8 {
+public:
+	Bvh8();
+	~Bvh8();
+
+	// positions - the same array the binary BVH was built from
+	void        Build(const Bvh& bvh, const Array<vec3>& positions);
+
+	// same contract as Bvh::Intersect and Bvh::Occluded
+	bool        Intersect(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const;
+	bool        Occluded(const vec3& origin, const vec3& direction, const float tmin, const float tmax) const;
+
+	// getters
+	uint32_t    GetNumNodes() const;
+	uint32_t    GetNumTriangleBlocks() const;
+	size_t      GetMemorySize() const;
+
+	// "AVX2", "SSE" or "scalar"
+	static const char* GetKernelName();
+
+private:
+	template <bool AnyHit>
+	bool        Traverse(const vec3& origin, const vec3& direction, const float tmin, const float tmax, BvhHit& hit) const;
+
+	uint32_t    CollapseNode(const Bvh& bvh, const Array<vec3>& positions, const uint32_t nodeIdx);
+	uint32_t    AddLeaf(const Bvh& bvh, const Array<vec3>& positions, const uint32_t firstTriangle, const uint32_t numTriangles);
+
+private:
+	Array<Bvh8Node>             _Nodes;
+	Array<Bvh8TriangleBlock>    _Blocks;
+};
@@ -0,0 +1,204 @@
+#include "cpu_denoiser.h"
+
+#include <cmath>
+
+#include "stb_image_write.h"
+
+CpuDenoiser::CpuDenoiser()
+	: _Width(0)
+	, _Height(0)
+{
+}
+CpuDenoiser::~CpuDenoiser() {
+}
+
+void CpuDenoiser::Resize(const uint32_t width, const uint32_t height) {
+	_Width = width;
+	_Height = height;
+	_History.assign(SWS_DENOISE_NUM_HISTORIES * width * height, DenoiseEmptyHistory());
+	_Filtered.assign(SWS_DENOISE_NUM_FILTERED * width * height, vec4(0.0f));
+	_FilteredImage.assign(width * height, vec4(0.0f));
+	_ResultImage.assign(width * height, 0u);
+}
+
+void CpuDenoiser::Denoise(const CpuTracer& tracer, const UniformParams& params, ThreadPool& pool) {
+	pool.ParallelFor(_Height, [this, &tracer, &params](const uint32_t y, const uint32_t) {
+		TemporalRow(tracer, params, y);
+	});
+
+	// every pass reads the whole of the one before, like the barriers between the dispatches
+	const uint32_t numIterations = Max(params.denoiseData.y, 1u);
+	for (uint32_t iteration = 0; iteration < numIterations; ++iteration) {
+		pool.ParallelFor(_Height, [this, &tracer, &params, iteration](const uint32_t y, const uint32_t) {
+			AtrousRow(tracer, params, iteration, y);
+		});
+	}
+}
+
+bool CpuDenoiser::SaveImage(const String& fileName) const {
+	const int stride = static_cast<int>(_Width * sizeof(uint32_t));
+	return 0 != stbi_write_png(fileName.c_str(), static_cast<int>(_Width), static_cast<int>(_Height), 4, _ResultImage.data(), stride);
+}
+
+const Array<uint32_t>& CpuDenoiser::GetImage() const {
+	return _ResultImage;
+}
+
+const Array<vec4>& CpuDenoiser::GetFilteredImage() const {
+	return _FilteredImage;
+}
+
+// main() of denoise_temporal.glsl for a row, keep the two in sync
+void CpuDenoiser::TemporalRow(const CpuTracer& tracer, const UniformParams& params, const uint32_t y) {
+	const Array<PixelStats>& pixels = tracer.GetPixelStats();
+	const Array<DenoiseSurface>& surfaces = tracer.GetSurfaces();
+	const uint32_t numPixels = _Width * _Height;
+	const uint32_t current = params.denoiseData.x & 1u;
+	const uint32_t previous = current ^ 1u;
+	const vec2 size = vec2(static_cast<float>(_Width), static_cast<float>(_Height));
+	const float fovY = params.camNearFarFov.z;
+
+	for (uint32_t x = 0; x < _Width; ++x) {
+		const uint32_t pixelIdx = y * _Width + x;
+		const DenoiseSurface surface = surfaces[current * numPixels + pixelIdx];
+
+		// the prior is found once per accumulation, the frames after that add their samples to the same one
+		DenoiseHistory prior = DenoiseEmptyHistory();
+		if (0 == params.frameData.x) {
+			if (0 != params.denoiseData.z && surface.positionAndDepth.w >= 0.0f) {
+				const vec2 prevPos = DenoiseProject(vec3(surface.positionAndDepth), vec3(params.prevCamPos), vec3(params.prevCamDir),
+					vec3(params.prevCamUp), vec3(params.prevCamSide), fovY, size) - vec2(0.5f, 0.5f);
+				const int baseX = static_cast<int>(floor(prevPos.x));
+				const int baseY = static_cast<int>(floor(prevPos.y));
+				const vec2 f = prevPos - vec2(static_cast<float>(baseX), static_cast<float>(baseY));
+
+				DenoiseHistory sum = DenoiseEmptyHistory();
+				float sumWeight = 0.0f;
+				for (int tap = 0; tap < 4; ++tap) {
+					const int tapX = baseX + (tap & 1);
+					const int tapY = baseY + (tap >> 1);
+					if (tapX < 0 || tapY < 0 || tapX >= static_cast<int>(_Width) || tapY >= static_cast<int>(_Height)) {
+						continue;
+					}
+					const uint32_t tapIdx = static_cast<uint32_t>(tapY) * _Width + static_cast<uint32_t>(tapX);
+					if (!DenoiseSameSurface(surface, surfaces[previous * numPixels + tapIdx])) {
+						continue;
+					}
+					const float weight = DenoiseBilinearWeight(f, tap);
+					DenoiseAddHistory(sum, _History[previous * numPixels + tapIdx], weight);
+					sumWeight += weight;
+				}
+				prior = DenoiseFinishPrior(sum, sumWeight);
+			}
+			_History[SWS_DENOISE_PRIOR_HISTORY * numPixels + pixelIdx] = prior;
+		}
+		else {
+			prior = _History[SWS_DENOISE_PRIOR_HISTORY * numPixels + pixelIdx];
+		}
+
+		const DenoiseHistory history = DenoiseIntegrate(prior, pixels[pixelIdx]);
+		_History[current * numPixels + pixelIdx] = history;
+
+		// a short history doesn't know its variance yet, the neighbours on the same surface stand in for its samples
+		float variance = DenoiseMeanVariance(vec2(history.moments.x, history.moments.y), history.colorAndLength.w);
+		if (history.colorAndLength.w < SWS_DENOISE_MIN_HISTORY && surface.positionAndDepth.w >= 0.0f) {
+			const float footprint = DenoisePixelFootprint(surface.positionAndDepth.w, fovY, size.y);
+			vec2 moments = vec2(0.0f);
+			float sumWeight = 0.0f;
+			for (int dy = -1; dy <= 1; ++dy) {
+				for (int dx = -1; dx <= 1; ++dx) {
+					const int qx = static_cast<int>(x) + dx;
+					const int qy = static_cast<int>(y) + dy;
+					if (qx < 0 || qy < 0 || qx >= static_cast<int>(_Width) || qy >= static_cast<int>(_Height)) {
+						continue;
+					}
+					const uint32_t qIdx = static_cast<uint32_t>(qy) * _Width + static_cast<uint32_t>(qx);
+					const PixelStats& q = pixels[qIdx];
+					if (q.colorA.w + q.colorB.w <= 0.0f) {
+						continue;
+					}
+					const float weight = DenoiseGeometryWeight(surface, surfaces[current * numPixels + qIdx], footprint * Length(vec2(static_cast<float>(dx), static_cast<float>(dy))));
+					moments += DenoisePixelMoments(q) * weight;
+					sumWeight += weight;
+				}
+			}
+			if (sumWeight > 0.0f) {
+				variance = DenoiseMeanVariance(moments / sumWeight, Max(history.colorAndLength.w, 1.0f));
+			}
+		}
+
+		_Filtered[pixelIdx] = vec4(vec3(history.colorAndLength), variance);
+	}
+}
+
+// main() of denoise_atrous.glsl for a row, keep the two in sync
+void CpuDenoiser::AtrousRow(const CpuTracer& tracer, const UniformParams& params, const uint32_t iteration, const uint32_t y) {
+	const Array<DenoiseSurface>& surfaces = tracer.GetSurfaces();
+	const uint32_t numPixels = _Width * _Height;
+	const uint32_t current = params.denoiseData.x & 1u;
+	const uint32_t src = (iteration & 1u) * numPixels;
+	const uint32_t dst = ((iteration + 1u) & 1u) * numPixels;
+	const int tapStep = 1 << iteration;
+	const bool lastIteration = (iteration + 1u) >= Max(params.denoiseData.y, 1u);
+	const int width = static_cast<int>(_Width);
+	const int height = static_cast<int>(_Height);
+
+	for (uint32_t x = 0; x < _Width; ++x) {
+		const uint32_t pixelIdx = y * _Width + x;
+		const DenoiseSurface surface = surfaces[current * numPixels + pixelIdx];
+		const vec4 center = _Filtered[src + pixelIdx];
+
+		// misses have nothing to tell their neighbours apart by, and the background isn't noisy anyway
+		vec4 result = center;
+		if (surface.positionAndDepth.w >= 0.0f) {
+			// the variance blurred a little, one pixel's estimate is noisy itself
+			float variance = 0.0f;
+			for (int dy = -1; dy <= 1; ++dy) {
+				for (int dx = -1; dx <= 1; ++dx) {
+					const int qx = Clamp(static_cast<int>(x) + dx, 0, width - 1);
+					const int qy = Clamp(static_cast<int>(y) + dy, 0, height - 1);
+					variance += _Filtered[src + static_cast<uint32_t>(qy * width + qx)].w * DenoiseGaussianWeight(dx, dy);
+				}
+			}
+			const float stdDev = sqrt(Max(variance, 0.0f));
+			const float luminance = Luminance(vec3(center));
+			const float footprint = DenoisePixelFootprint(surface.positionAndDepth.w, params.camNearFarFov.z, static_cast<float>(_Height)) * static_cast<float>(tapStep);
+
+			const float centerWeight = DenoiseKernelWeight(0) * DenoiseKernelWeight(0);
+			vec3 sumColor = vec3(center) * centerWeight;
+			float sumVariance = center.w * centerWeight * centerWeight;
+			float sumWeight = centerWeight;
+			for (int dy = -2; dy <= 2; ++dy) {
+				for (int dx = -2; dx <= 2; ++dx) {
+					const int qx = static_cast<int>(x) + dx * tapStep;
+					const int qy = static_cast<int>(y) + dy * tapStep;
+					if ((0 == dx && 0 == dy) || qx < 0 || qy < 0 || qx >= width || qy >= height) {
+						continue;
+					}
+					const uint32_t qIdx = static_cast<uint32_t>(qy * width + qx);
+					const vec4 q = _Filtered[src + qIdx];
+					const float weight = DenoiseKernelWeight(dx) * DenoiseKernelWeight(dy) *
+						DenoiseGeometryWeight(surface, surfaces[current * numPixels + qIdx], footprint * Length(vec2(static_cast<float>(dx), static_cast<float>(dy)))) *
+						DenoiseLuminanceWeight(luminance, Luminance(vec3(q)), stdDev);
+					sumColor += vec3(q) * weight;
+					sumVariance += q.w * weight * weight;
+					sumWeight += weight;
+				}
+			}
+			result = vec4(sumColor / sumWeight, sumVariance / (sumWeight * sumWeight));
+		}
+
+		if (!lastIteration) {
+			_Filtered[dst + pixelIdx] = result;
+			continue;
+		}
+
+		// same conversion the rgba8 storage image does on store
+		_FilteredImage[pixelIdx] = result;
+		const vec3 srgb = LinearToSrgb(sqrt(vec3(result)));
+		const uint32_t r = static_cast<uint32_t>(Clamp(srgb.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+		const uint32_t g = static_cast<uint32_t>(Clamp(srgb.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+		const uint32_t b = static_cast<uint32_t>(Clamp(srgb.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+		_ResultImage[pixelIdx] = r | (g << 8) | (b << 16) | (255u << 24);
+	}
+}
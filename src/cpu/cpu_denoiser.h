@@ -0,0 +1,33 @@
+#pragma once
+
+#include "cpu_tracer.h"
+
+// denoise_temporal.glsl and denoise_atrous.glsl on the CPU, run on what a CpuTracer rendered with SWS_RENDER_DENOISE.
+// The buffers are laid out like the GPU ones and every pass goes through the thread pool a row at a time, so the
+// two denoisers give the same images for the same frames.
+class CpuDenoiser {
+public:
+	CpuDenoiser();
+	~CpuDenoiser();
+
+	void        Resize(const uint32_t width, const uint32_t height);
+	// the tracer has just rendered params' frame, history from the frame before is used if denoiseData.z says so
+	void        Denoise(const CpuTracer& tracer, const UniformParams& params, ThreadPool& pool);
+	bool        SaveImage(const String& fileName) const;
+
+	// getters
+	const Array<uint32_t>& GetImage() const;    // rgba8, like the GPU result image
+	const Array<vec4>& GetFilteredImage() const;    // linear, rgb - color, w - its variance
+
+private:
+	void        TemporalRow(const CpuTracer& tracer, const UniformParams& params, const uint32_t y);
+	void        AtrousRow(const CpuTracer& tracer, const UniformParams& params, const uint32_t iteration, const uint32_t y);
+
+private:
+	uint32_t                _Width;
+	uint32_t                _Height;
+	Array<DenoiseHistory>   _History;       // SWS_DENOISE_NUM_HISTORIES slices
+	Array<vec4>             _Filtered;      // SWS_DENOISE_NUM_FILTERED slices
+	Array<vec4>             _FilteredImage; // the last pass
+	Array<uint32_t>         _ResultImage;
+};
@@ -0,0 +1,185 @@
+#include "cpu_renderer.h"
+#include "cpu_denoiser.h"
+#include "../common/camera.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+UniformParams MakeDefaultCameraParams(const uint32_t width, const uint32_t height) {
+	Camera camera;
+	camera.SetViewport({ 0, 0, static_cast<int>(width), static_cast<int>(height) });
+	camera.SetViewPlanes(0.1f, 100.0f);
+	camera.SetFovY(45.0f);
+	camera.LookAt(vec3(0.25f, 3.20f, 6.15f), vec3(0.25f, 2.75f, 5.25f));
+
+	UniformParams params;
+	params.sunPosAndAmbient = vec4(1.0f, 1.0f, 1.0f, 0.1f);
+	params.camPos = vec4(camera.GetPosition(), 0.0f);
+	params.camDir = vec4(camera.GetDirection(), 0.0f);
+	params.camUp = vec4(camera.GetUp(), 0.0f);
+	params.camSide = vec4(camera.GetSide(), 0.0f);
+	params.camNearFarFov = vec4(camera.GetNearPlane(), camera.GetFarPlane(), Deg2Rad(camera.GetFovY()), 0.0f);
+	params.frameData = uvec4(0, SWS_SAMPLES_PER_FRAME, SWS_RENDER_NEE, SWS_RR_MIN_DEPTH);
+	params.samplingData = uvec4(SWS_SAMPLER_DEFAULT, 0, 0, 0);
+	params.prevCamPos = params.camPos;
+	params.prevCamDir = params.camDir;
+	params.prevCamUp = params.camUp;
+	params.prevCamSide = params.camSide;
+	params.denoiseData = uvec4(0, SWS_DENOISE_ITERATIONS, 0, 0);
+	return params;
+}
+
+void PrintRayStats(const CpuRayStats& stats, const uint64_t numPixels) {
+	const double paths = static_cast<double>(Max(stats.numPaths, uint64_t(1)));
+	printf("%.2f rays/pixel (%.2f bounces, %.2f shadow), %.2f rays per path, %.1f%% of paths ended by Russian roulette\n",
+		static_cast<double>(stats.numBounces + stats.numShadowRays) / static_cast<double>(Max(numPixels, uint64_t(1))),
+		static_cast<double>(stats.numBounces) / static_cast<double>(Max(numPixels, uint64_t(1))),
+		static_cast<double>(stats.numShadowRays) / static_cast<double>(Max(numPixels, uint64_t(1))),
+		static_cast<double>(stats.numBounces) / paths,
+		100.0 * static_cast<double>(stats.numRouletteKills) / paths);
+}
+
+bool RunCpuRenderer(const int argc, char** argv) {
+	String sceneFile = kDefaultSceneFile;
+	String outputFile = "cpu_output.png";
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t numFrames = 16;
+	uint32_t numThreads = 0;
+	CpuTracer::TraceMode traceMode = CpuTracer::TraceMode::PerRay;
+	bool sampleLights = true;
+	bool adaptive = false;
+	bool denoise = false;
+	uint32_t rouletteDepth = SWS_RR_MIN_DEPTH;
+	uint32_t samplerType = SWS_SAMPLER_DEFAULT;
+
+	for (int i = 1; i < argc; ++i) {
+		const String arg = argv[i];
+		const bool hasValue = (i + 1) < argc;
+
+		if (arg == "--scene" && hasValue) {
+			sceneFile = argv[++i];
+		}
+		else if (arg == "--width" && hasValue) {
+			width = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--height" && hasValue) {
+			height = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--frames" && hasValue) {
+			numFrames = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--threads" && hasValue) {
+			numThreads = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--output" && hasValue) {
+			outputFile = argv[++i];
+		}
+		else if (arg == "--stream") {
+			traceMode = CpuTracer::TraceMode::Stream;
+		}
+		else if (arg == "--rr-depth" && hasValue) {
+			rouletteDepth = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}
+		else if (arg == "--no-nee") {
+			sampleLights = false;
+		}
+		else if (arg == "--adaptive") {
+			adaptive = true;
+		}
+		else if (arg == "--denoise") {
+			denoise = true;
+		}
+		else if (arg == "--sampler" && hasValue) {
+			const String name = argv[++i];
+			if (name == "random") {
+				samplerType = SWS_SAMPLER_RANDOM;
+			}
+			else if (name == "sobol") {
+				samplerType = SWS_SAMPLER_SOBOL;
+			}
+			else {
+				printf("Unknown sampler %s\n", name.c_str());
+			}
+		}
+	}
+
+	width = Max(width, 1u);
+	height = Max(height, 1u);
+	numFrames = Max(numFrames, 1u);
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	CpuScene scene;
+	if (!scene.Load(sceneFile)) {
+		printf("Failed to load %s\n", sceneFile.c_str());
+		return false;
+	}
+	const double loadTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	printf("Scene %s loaded in %.2f ms (%u meshes, %u triangles, %u BVH nodes, %u light triangles)\n",
+		sceneFile.c_str(), loadTimeMs, scene.GetNumMeshes(), scene.GetNumTriangles(), scene.GetBvh().GetNumNodes(), static_cast<uint32_t>(scene.GetLights().size()));
+
+	ThreadPool pool(numThreads);
+	CpuTracer tracer;
+	tracer.Resize(width, height);
+	tracer.SetTraceMode(traceMode);
+	CpuDenoiser denoiser;
+	denoiser.Resize(width, height);
+
+	UniformParams params = MakeDefaultCameraParams(width, height);
+	if (!sampleLights) {
+		params.frameData.z &= ~SWS_RENDER_NEE;
+	}
+	if (adaptive) {
+		params.frameData.z |= SWS_RENDER_ADAPTIVE;
+	}
+	if (denoise) {
+		params.frameData.z |= SWS_RENDER_DENOISE;
+	}
+	params.frameData.w = rouletteDepth;
+	params.samplingData.x = samplerType;
+
+	uint64_t numRays = 0;
+	CpuRayStats rayStats = {};
+	double denoiseTimeMs = 0.0;
+	startTime = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < numFrames; ++i) {
+		params.frameData.x = i;
+		params.denoiseData.x = i;
+		tracer.Render(scene, params, pool);
+		numRays += tracer.GetNumRays();
+		rayStats = AddRayStats(rayStats, tracer.GetRayStats());
+		params.samplingData.z = static_cast<uint32_t>(tracer.GetRayStats().numConvergingPixels);
+
+		// the camera stays put, so the only history is the accumulation's own
+		if (denoise) {
+			const auto denoiseStart = std::chrono::high_resolution_clock::now();
+			denoiser.Denoise(tracer, params, pool);
+			denoiseTimeMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - denoiseStart).count();
+		}
+	}
+	const double renderTimeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count() - denoiseTimeMs;
+
+	printf("CPU rendered (%s) %u frames at %ux%u on %u threads in %.2f ms (%.3f ms per frame, %.2f Mrays/s)\n",
+		(CpuTracer::TraceMode::Stream == traceMode) ? "ray streams" : "per ray",
+		numFrames, width, height, pool.GetNumThreads(),
+		renderTimeMs, renderTimeMs / numFrames,
+		renderTimeMs > 0.0 ? static_cast<double>(numRays) / (renderTimeMs * 1000.0) : 0.0);
+	PrintRayStats(rayStats, static_cast<uint64_t>(width) * height * numFrames);
+	if (adaptive) {
+		printf("%.1f%% of pixels converged\n", 100.0 - 100.0 * static_cast<double>(tracer.GetRayStats().numConvergingPixels) / (static_cast<double>(width) * height));
+	}
+	if (denoise) {
+		printf("Denoised in %.3f ms per frame (%u a-trous iterations)\n", denoiseTimeMs / numFrames, params.denoiseData.y);
+	}
+
+	if (!outputFile.empty()) {
+		if (denoise ? !denoiser.SaveImage(outputFile) : !tracer.SaveImage(outputFile)) {
+			printf("Failed to save %s\n", outputFile.c_str());
+			return false;
+		}
+		printf("Saved %s\n", outputFile.c_str());
+	}
+
+	return true;
+}
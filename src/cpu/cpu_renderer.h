@@ -0,0 +1,16 @@
+#pragma once
+
+#include "cpu_tracer.h"
+
+// what RtxApp renders by default
+static const char* const kDefaultSceneFile = "_data/scenes/cornell_box/CornellBox.obj";
+
+// camera RtxApp starts with (see RtxApp::CreateCamera), so CPU and GPU images line up pixel for pixel
+UniformParams MakeDefaultCameraParams(const uint32_t width, const uint32_t height);
+
+// rays per pixel and per path, numPixels - pixels times frames the stats were summed over
+void PrintRayStats(const CpuRayStats& stats, const uint64_t numPixels);
+
+// Renders without Vulkan, for GPU-less machines and as a reference for the GPU path.
+// --cpu [--scene file.obj] [--width W] [--height H] [--frames N] [--threads T] [--output file.png] [--stream] [--no-nee] [--rr-depth N] [--sampler random|sobol] [--adaptive] [--denoise]
+bool RunCpuRenderer(const int argc, char** argv);
@@ -0,0 +1,633 @@
+#include "cpu_tracer.h"
+#include "../scene_cache.h"
+#include "../obj_reader.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+#include "stb_image_write.h"
+
+static const uint32_t sTileSize = 16;
+static const uint32_t sStreamTileSize = 64;    // 4096 rays per bounce to sort
+static const float sIdentityTransform[12] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+
+
+// ray_gen.glsl helpers
+static const float sRefractionIndex = 1.0f / 1.31f; // ice
+
+static float Schlick(const float cosine, const float refractionIndex) {
+	float r0 = (1.0f - refractionIndex) / (1.0f + refractionIndex);
+	r0 *= r0;
+	return r0 + (1.0f - r0) * pow(1.0f - cosine, 5.0f);
+}
+
+static vec3 CalcRayDir(const UniformParams& params, const vec2& screenUV, const float aspect) {
+	vec3 u = vec3(params.camSide);
+	vec3 v = vec3(params.camUp);
+	const float planeWidth = tan(params.camNearFarFov.z * 0.5f);
+	u *= (planeWidth * aspect);
+	v *= planeWidth;
+	return Normalize(vec3(params.camDir) + (u * screenUV.x) - (v * screenUV.y));
+}
+
+// PickLight of ray_gen.glsl
+static uint32_t PickLight(const Array<LightTriangle>& lights, const float u) {
+	uint32_t first = 0, last = static_cast<uint32_t>(lights.size()) - 1;
+	while (first < last) {
+		const uint32_t middle = (first + last) / 2;
+		if (u < lights[middle].v0AndCdf.w) {
+			last = middle;
+		}
+		else {
+			first = middle + 1;
+		}
+	}
+	return first;
+}
+
+// one bounce of the ray_gen.glsl loop, returns false when the path ends
+static bool ShadeHit(const CpuScene& scene, const UniformParams& params, const float tmin, const RayPayload& payload, CpuPathState& path, SamplerState& sampler, vec3& finalColor, CpuRayStats& stats) {
+	const uint32_t renderFlags = params.frameData.z;
+	const uint32_t rouletteDepth = params.frameData.w;
+	++path.depth;
+
+	const vec3 hitColor = vec3(payload.colorAndDist);
+	const float hitDistance = payload.colorAndDist.w;
+	const float objectId = payload.normalAndObjId.w;
+	const vec3 normal = vec3(payload.normalAndObjId);
+	const vec3 emission = vec3(payload.emission);
+	if (hitDistance < 0.0f) {
+		finalColor += path.throughput * hitColor;
+		return false;
+	}
+
+	const bool sampleLights = (0 != (renderFlags & SWS_RENDER_NEE)) && !scene.GetLights().empty();
+	const vec3 hitPos = path.origin + path.direction * hitDistance;
+
+	// lights end the path. After a diffuse bounce a shadow ray could've found this one too, so it only gets its MIS share
+	if (Luminance(emission) > 0.0f) {
+		float weight = 1.0f;
+		if (sampleLights && path.bsdfPdf > 0.0f) {
+			const float cosLight = Max(std::abs(Dot(normal, path.direction)), 1e-6f);
+			const float lightPdf = Luminance(emission) / scene.GetLightsPower() * hitDistance * hitDistance / cosLight;
+			weight = PowerHeuristic(path.bsdfPdf, lightPdf);
+		}
+		finalColor += path.throughput * emission * weight;
+		return false;
+	}
+
+	if (objectId == OBJECT_ID_BOX3) {
+		const vec3& direction = path.direction;
+		const float cosTheta = Dot(direction, normal);
+		const vec3 outwardNormal = cosTheta > 0.0f ? -normal : normal;
+		const float niOverNt = cosTheta > 0.0f ? sRefractionIndex : 1.0f / sRefractionIndex;
+		const float cosine = cosTheta > 0.0f ? sRefractionIndex * cosTheta : -cosTheta;
+		const vec3 refracted = glm::refract(direction, outwardNormal, niOverNt);
+		const float reflectProb = refracted != vec3(0.0f) ? Schlick(cosine, sRefractionIndex) : 1.0f;
+		const vec3 scatter = SamplerGet1D(sampler) < reflectProb ? glm::reflect(direction, normal) : refracted;
+		path.origin = hitPos + direction * 0.001f;
+		path.direction = scatter;
+		path.bsdfPdf = 0.0f;
+		return true;
+	}
+
+	// everything else is diffuse
+	const vec3 albedo = hitColor;
+	const vec3 surfaceNormal = Dot(path.direction, normal) > 0.0f ? -normal : normal;
+	path.origin = hitPos + surfaceNormal * 0.001f;
+
+	if (sampleLights) {
+		const Array<LightTriangle>& lights = scene.GetLights();
+		const LightTriangle& light = lights[PickLight(lights, SamplerGet1D(sampler))];
+		const vec2 barycentrics = SampleTriangle(SamplerGet2D(sampler));
+
+		const vec3 edge1 = vec3(light.edge1);
+		const vec3 edge2 = vec3(light.edge2);
+		vec3 toLight = vec3(light.v0AndCdf) + edge1 * barycentrics.x + edge2 * barycentrics.y - path.origin;
+		const float distance = Length(toLight);
+		toLight /= distance;
+
+		const float cosSurface = Dot(surfaceNormal, toLight);
+		const float cosLight = std::abs(Dot(Normalize(Cross(edge1, edge2)), toLight));
+		if (cosSurface > 0.0f && cosLight > 0.0f) {
+			++stats.numShadowRays;
+			if (!scene.Occluded(path.origin, toLight, tmin, distance * 0.999f)) {
+				const float lightPdf = light.emission.w * distance * distance / cosLight;
+				const float bsdfPdf = cosSurface / MM_Pi;
+				finalColor += path.throughput * albedo * (cosSurface / MM_Pi) * vec3(light.emission) * (PowerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+			}
+		}
+	}
+
+	// cosine weighted, so albedo / pi * cos / pdf leaves just the albedo
+	path.direction = SampleCosineHemisphere(SamplerGet2D(sampler), surfaceNormal);
+	path.bsdfPdf = Dot(surfaceNormal, path.direction) / MM_Pi;
+	path.throughput *= albedo;
+
+	const float maxThroughput = Max(path.throughput.x, Max(path.throughput.y, path.throughput.z));
+	if (path.bsdfPdf <= 0.0f || maxThroughput <= 0.0f) {
+		return false;
+	}
+
+	// the ones that survive carry the energy of those that didn't, so the estimate stays unbiased
+	if (path.depth >= rouletteDepth && path.depth < SWS_MAX_RECURSION) {
+		const float survival = Min(maxThroughput, SWS_RR_MAX_SURVIVAL);
+		if (SamplerGet1D(sampler) >= survival) {
+			++stats.numRouletteKills;
+			return false;
+		}
+		path.throughput /= survival;
+	}
+	return true;
+}
+
+CpuRayStats AddRayStats(const CpuRayStats& a, const CpuRayStats& b) {
+	CpuRayStats sum;
+	sum.numPaths = a.numPaths + b.numPaths;
+	sum.numBounces = a.numBounces + b.numBounces;
+	sum.numShadowRays = a.numShadowRays + b.numShadowRays;
+	sum.numRouletteKills = a.numRouletteKills + b.numRouletteKills;
+	sum.numConvergingPixels = a.numConvergingPixels + b.numConvergingPixels;
+	return sum;
+}
+
+// spreads the low 10 bits of v so they land on every third bit
+static uint32_t ExpandBits(uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// direction octant in the top bits, then a 27 bit Morton code of the origin in the scene bounds,
+// rays going the same way from close origins end up next to each other
+static uint32_t RaySortKey(const vec3& origin, const vec3& direction, const vec3& boundsMin, const vec3& invExtent) {
+	const uint32_t octant = (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) | (direction.z < 0.0f ? 4u : 0u);
+	const vec3 p = (origin - boundsMin) * invExtent * 511.0f;
+	const uint32_t x = static_cast<uint32_t>(Clamp(p.x, 0.0f, 511.0f));
+	const uint32_t y = static_cast<uint32_t>(Clamp(p.y, 0.0f, 511.0f));
+	const uint32_t z = static_cast<uint32_t>(Clamp(p.z, 0.0f, 511.0f));
+	return (octant << 27) | (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+}
+
+
+
+CpuScene::CpuScene()
+	: _LightsPower(0.0f)
+	, _BoundsMin(0.0f)
+	, _BoundsMax(0.0f)
+{
+}
+CpuScene::~CpuScene() {
+}
+
+bool CpuScene::Load(const String& fileName) {
+	SceneCache cache;
+	if (cache.Open(fileName + kSceneCacheExt, fileName)) {
+		Array<MeshView> views(cache.GetNumMeshes());
+		for (uint32_t i = 0; i < cache.GetNumMeshes(); ++i) {
+			views[i] = cache.GetMesh(i);
+		}
+		const MaterialParams* materials = cache.GetMaterials();
+		Build(views, Array<MaterialParams>(materials, materials + cache.GetNumMaterials()));
+		return true;
+	}
+
+	ObjScene objScene;
+	if (!LoadObjScene(fileName, objScene)) {
+		return false;
+	}
+
+	Array<MeshView> views(objScene.meshes.size());
+	for (size_t i = 0; i < objScene.meshes.size(); ++i) {
+		views[i] = MakeMeshView(objScene.meshes[i]);
+	}
+
+	Array<MaterialParams> materials;
+	GetMaterialParams(objScene.materials, materials);
+	Build(views, materials);
+	return true;
+}
+
+void CpuScene::Build(const Array<MeshView>& meshes, const Array<MaterialParams>& materials) {
+	size_t numTriangles = 0;
+	for (const MeshView& view : meshes) {
+		numTriangles += view.numFaces;
+	}
+
+	Array<vec3> positions;
+	positions.reserve(numTriangles * 3);
+	_TriangleMesh.clear();
+	_TriangleMesh.reserve(numTriangles);
+	_TrianglePrim.clear();
+	_TrianglePrim.reserve(numTriangles);
+
+	_Materials = materials;
+	_Lights.clear();
+
+	_Meshes.resize(meshes.size());
+	for (size_t meshIdx = 0; meshIdx < meshes.size(); ++meshIdx) {
+		const MeshView& view = meshes[meshIdx];
+		Mesh& mesh = _Meshes[meshIdx];
+		mesh.attribs.assign(view.attribs, view.attribs + view.numVertices);
+		mesh.faces.assign(view.faces, view.faces + view.numFaces * 4);
+		mesh.matIDs.assign(view.matIDs, view.matIDs + view.numFaces);
+		AppendLightTriangles(view, sIdentityTransform, _Materials, _Lights);
+
+		for (uint32_t f = 0; f < view.numFaces; ++f) {
+			positions.push_back(view.positions[view.indices[f * 3 + 0]]);
+			positions.push_back(view.positions[view.indices[f * 3 + 1]]);
+			positions.push_back(view.positions[view.indices[f * 3 + 2]]);
+			_TriangleMesh.push_back(static_cast<uint32_t>(meshIdx));
+			_TrianglePrim.push_back(f);
+		}
+	}
+
+	_Bvh.Build(positions);
+	_Bvh8.Build(_Bvh, positions);
+	_LightsPower = FinishLightTriangles(_Lights);
+
+	_BoundsMin = _BoundsMax = vec3(0.0f);
+	if (!_Bvh.GetNodes().empty()) {
+		_BoundsMin = _Bvh.GetNodes()[0].boundsMin;
+		_BoundsMax = _Bvh.GetNodes()[0].boundsMax;
+	}
+}
+
+void CpuScene::Trace(const vec3& origin, const vec3& direction, const float tmin, const float tmax, RayPayload& payload) const {
+	BvhHit hit;
+	if (!_Bvh8.Intersect(origin, direction, tmin, tmax, hit)) {
+		// ray_miss.glsl
+		payload.colorAndDist = vec4(0.0f, 0.0f, 0.0f, -1.0f);
+		payload.normalAndObjId = vec4(0.0f);
+		payload.emission = vec4(0.0f);
+		return;
+	}
+
+	// ray_chit.glsl
+	const uint32_t meshIdx = _TriangleMesh[hit.triangle];
+	const uint32_t primIdx = _TrianglePrim[hit.triangle];
+	const Mesh& mesh = _Meshes[meshIdx];
+
+	const vec3 barycentrics = vec3(1.0f - hit.u - hit.v, hit.u, hit.v);
+	const uint32_t* face = mesh.faces.data() + primIdx * 4;
+	const VertexAttribute& v0 = mesh.attribs[face[0]];
+	const VertexAttribute& v1 = mesh.attribs[face[1]];
+	const VertexAttribute& v2 = mesh.attribs[face[2]];
+
+	const vec3 normal = Normalize(BaryLerp(vec3(v0.normal), vec3(v1.normal), vec3(v2.normal), barycentrics));
+	const float objId = static_cast<float>(meshIdx);
+
+	const uint32_t matID = mesh.matIDs[primIdx];
+	const bool hasMaterial = matID < _Materials.size();
+
+	payload.colorAndDist = vec4(hasMaterial ? vec3(_Materials[matID].diffuse) : vec3(SWS_DEFAULT_DIFFUSE), hit.t);
+	payload.normalAndObjId = vec4(normal, objId);
+	payload.emission = hasMaterial ? _Materials[matID].emission : vec4(0.0f);
+}
+
+bool CpuScene::Occluded(const vec3& origin, const vec3& direction, const float tmin, const float tmax) const {
+	return _Bvh8.Occluded(origin, direction, tmin, tmax);
+}
+
+uint32_t CpuScene::GetNumMeshes() const {
+	return static_cast<uint32_t>(_Meshes.size());
+}
+
+uint32_t CpuScene::GetNumTriangles() const {
+	return static_cast<uint32_t>(_TriangleMesh.size());
+}
+
+const Bvh& CpuScene::GetBvh() const {
+	return _Bvh;
+}
+
+const Bvh8& CpuScene::GetBvh8() const {
+	return _Bvh8;
+}
+
+const vec3& CpuScene::GetBoundsMin() const {
+	return _BoundsMin;
+}
+
+const vec3& CpuScene::GetBoundsMax() const {
+	return _BoundsMax;
+}
+
+const Array<LightTriangle>& CpuScene::GetLights() const {
+	return _Lights;
+}
+
+float CpuScene::GetLightsPower() const {
+	return _LightsPower;
+}
+
+
+
+CpuTracer::CpuTracer()
+	: _Width(0)
+	, _Height(0)
+	, _TraceMode(TraceMode::PerRay)
+	, _TileSize(sTileSize)
+	, _NumTilesX(0)
+{
+}
+CpuTracer::~CpuTracer() {
+}
+
+void CpuTracer::Resize(const uint32_t width, const uint32_t height) {
+	_Width = width;
+	_Height = height;
+	_AccumImage.assign(width * height, vec4(0.0f));
+	_PixelStats.assign(width * height, PixelStats{ vec4(0.0f), vec4(0.0f), vec4(0.0f) });
+	_ResultImage.assign(width * height, 0u);
+	_Surfaces.assign(SWS_DENOISE_NUM_SURFACES * width * height, DenoiseSurface{ vec4(0.0f), vec4(0.0f, 0.0f, 0.0f, -1.0f) });
+}
+
+void CpuTracer::SetTraceMode(const TraceMode mode) {
+	_TraceMode = mode;
+}
+
+void CpuTracer::Render(const CpuScene& scene, const UniformParams& params, ThreadPool& pool) {
+	_RayCounters.resize(pool.GetNumThreads());
+	for (RayCounter& counter : _RayCounters) {
+		counter.stats = {};
+	}
+
+	_TileSize = (TraceMode::Stream == _TraceMode) ? sStreamTileSize : sTileSize;
+	_NumTilesX = (_Width + _TileSize - 1) / _TileSize;
+	const uint32_t numTilesY = (_Height + _TileSize - 1) / _TileSize;
+
+	if (TraceMode::Stream == _TraceMode) {
+		_StreamScratch.resize(pool.GetNumThreads());
+		pool.ParallelFor(_NumTilesX * numTilesY, [this, &scene, &params](const uint32_t tileIdx, const uint32_t threadIdx) {
+			RenderTileStream(scene, params, tileIdx, threadIdx);
+		});
+	}
+	else {
+		pool.ParallelFor(_NumTilesX * numTilesY, [this, &scene, &params](const uint32_t tileIdx, const uint32_t threadIdx) {
+			RenderTile(scene, params, tileIdx, threadIdx);
+		});
+	}
+}
+
+bool CpuTracer::SaveImage(const String& fileName) const {
+	const int stride = static_cast<int>(_Width * sizeof(uint32_t));
+	return 0 != stbi_write_png(fileName.c_str(), static_cast<int>(_Width), static_cast<int>(_Height), 4, _ResultImage.data(), stride);
+}
+
+uint32_t CpuTracer::GetWidth() const {
+	return _Width;
+}
+
+uint32_t CpuTracer::GetHeight() const {
+	return _Height;
+}
+
+uint64_t CpuTracer::GetNumRays() const {
+	const CpuRayStats stats = GetRayStats();
+	return stats.numBounces + stats.numShadowRays;
+}
+
+CpuRayStats CpuTracer::GetRayStats() const {
+	CpuRayStats stats = {};
+	for (const RayCounter& counter : _RayCounters) {
+		stats = AddRayStats(stats, counter.stats);
+	}
+	return stats;
+}
+
+const Array<uint32_t>& CpuTracer::GetImage() const {
+	return _ResultImage;
+}
+
+const Array<vec4>& CpuTracer::GetAccumImage() const {
+	return _AccumImage;
+}
+
+const Array<PixelStats>& CpuTracer::GetPixelStats() const {
+	return _PixelStats;
+}
+
+const Array<DenoiseSurface>& CpuTracer::GetSurfaces() const {
+	return _Surfaces;
+}
+
+// main() of ray_gen.glsl for every pixel of the tile, keep the two in sync
+void CpuTracer::RenderTile(const CpuScene& scene, const UniformParams& params, const uint32_t tileIdx, const uint32_t threadIdx) {
+	const uint32_t x0 = (tileIdx % _NumTilesX) * _TileSize;
+	const uint32_t y0 = (tileIdx / _NumTilesX) * _TileSize;
+	const uint32_t x1 = Min(x0 + _TileSize, _Width);
+	const uint32_t y1 = Min(y0 + _TileSize, _Height);
+
+	const float aspect = static_cast<float>(_Width) / static_cast<float>(_Height);
+	const float tmin = 0.0001f;
+	const float tmax = params.camNearFarFov.y * 0.75f;
+
+	CpuRayStats stats = {};
+	RayPayload primaryRay;
+
+	for (uint32_t y = y0; y < y1; ++y) {
+		for (uint32_t x = x0; x < x1; ++x) {
+			PixelSamples pixel = BeginPixel(params, x, y);
+			const uint32_t firstSample = pixel.firstSample;
+
+			for (uint32_t t = 0; t < pixel.numSamples; ++t) {
+				SamplerStartSample(pixel.sampler, firstSample + t);
+				const vec2 curPixel = vec2(static_cast<float>(x), static_cast<float>(y)) + SamplerGet2D(pixel.sampler);
+				const vec2 uv = (curPixel / vec2(static_cast<float>(_Width), static_cast<float>(_Height))) * 2.0f - 1.0f;
+				CpuPathState path;
+				path.origin = vec3(params.camPos);
+				path.direction = CalcRayDir(params, uv, aspect);
+				path.throughput = vec3(1.0f);
+				path.bsdfPdf = 0.0f;
+				path.depth = 0;
+				++stats.numPaths;
+
+				vec3 sampleColor = vec3(0.0f);
+				for (int i = 0; i < SWS_MAX_RECURSION; ++i) {
+					scene.Trace(path.origin, path.direction, tmin, tmax, primaryRay);
+					++stats.numBounces;
+					if (0 == t && 0 == i) {
+						StoreSurface(x, y, params, path.origin, path.direction, primaryRay);
+					}
+					if (!ShadeHit(scene, params, tmin, primaryRay, path, pixel.sampler, sampleColor, stats)) {
+						break;
+					}
+				}
+				AddSample(pixel, sampleColor);
+			}
+
+			StorePixel(x, y, pixel, params, stats);
+		}
+	}
+
+	_RayCounters[threadIdx].stats = AddRayStats(_RayCounters[threadIdx].stats, stats);
+}
+
+// Same paths as RenderTile, but bounce by bounce for the whole tile: the live rays are sorted, traced in that
+// order, then shaded and compacted. Samples of a pixel go one after the other, so its sampler hands out the
+// same numbers as in RenderTile.
+void CpuTracer::RenderTileStream(const CpuScene& scene, const UniformParams& params, const uint32_t tileIdx, const uint32_t threadIdx) {
+	const uint32_t x0 = (tileIdx % _NumTilesX) * _TileSize;
+	const uint32_t y0 = (tileIdx / _NumTilesX) * _TileSize;
+	const uint32_t x1 = Min(x0 + _TileSize, _Width);
+	const uint32_t y1 = Min(y0 + _TileSize, _Height);
+	const uint32_t tileWidth = x1 - x0;
+	const uint32_t numPixels = tileWidth * (y1 - y0);
+
+	const float aspect = static_cast<float>(_Width) / static_cast<float>(_Height);
+	const float tmin = 0.0001f;
+	const float tmax = params.camNearFarFov.y * 0.75f;
+
+	const vec3& boundsMin = scene.GetBoundsMin();
+	const vec3 extent = glm::max(scene.GetBoundsMax() - boundsMin, vec3(FLT_MIN));
+	const vec3 invExtent = vec3(1.0f / extent.x, 1.0f / extent.y, 1.0f / extent.z);
+
+	StreamScratch& scratch = _StreamScratch[threadIdx];
+	scratch.paths.resize(numPixels);
+	scratch.keys.resize(numPixels);
+	scratch.payloads.resize(numPixels);
+	scratch.pixels.resize(numPixels);
+	scratch.colors.resize(numPixels);
+
+	uint32_t maxSamples = 0;
+	for (uint32_t p = 0; p < numPixels; ++p) {
+		scratch.pixels[p] = BeginPixel(params, x0 + p % tileWidth, y0 + p / tileWidth);
+		maxSamples = Max(maxSamples, scratch.pixels[p].numSamples);
+	}
+
+	// pixels can have different numbers of samples, the ones done with theirs just sit out
+	CpuRayStats stats = {};
+	for (uint32_t t = 0; t < maxSamples; ++t) {
+		uint32_t numActive = 0;
+		for (uint32_t p = 0; p < numPixels; ++p) {
+			PixelSamples& pixel = scratch.pixels[p];
+			if (t >= pixel.numSamples) {
+				continue;
+			}
+
+			SamplerStartSample(pixel.sampler, pixel.firstSample + t);
+			const vec2 curPixel = vec2(static_cast<float>(x0 + p % tileWidth), static_cast<float>(y0 + p / tileWidth)) + SamplerGet2D(pixel.sampler);
+			const vec2 uv = (curPixel / vec2(static_cast<float>(_Width), static_cast<float>(_Height))) * 2.0f - 1.0f;
+			StreamPath& path = scratch.paths[numActive++];
+			path.state.origin = vec3(params.camPos);
+			path.state.direction = CalcRayDir(params, uv, aspect);
+			path.state.throughput = vec3(1.0f);
+			path.state.bsdfPdf = 0.0f;
+			path.state.depth = 0;
+			path.pixel = p;
+			scratch.colors[p] = vec3(0.0f);
+		}
+		stats.numPaths += numActive;
+
+		for (int i = 0; i < SWS_MAX_RECURSION && numActive; ++i) {
+			// primary rays already come out of the camera in order
+			if (i > 0) {
+				for (uint32_t r = 0; r < numActive; ++r) {
+					const StreamPath& path = scratch.paths[r];
+					scratch.keys[r] = (static_cast<uint64_t>(RaySortKey(path.state.origin, path.state.direction, boundsMin, invExtent)) << 32) | r;
+				}
+				std::sort(scratch.keys.begin(), scratch.keys.begin() + numActive);
+			}
+			else {
+				for (uint32_t r = 0; r < numActive; ++r) {
+					scratch.keys[r] = r;
+				}
+			}
+
+			for (uint32_t r = 0; r < numActive; ++r) {
+				const uint32_t pathIdx = static_cast<uint32_t>(scratch.keys[r]);
+				const StreamPath& path = scratch.paths[pathIdx];
+				scene.Trace(path.state.origin, path.state.direction, tmin, tmax, scratch.payloads[pathIdx]);
+			}
+			stats.numBounces += numActive;
+
+			uint32_t numAlive = 0;
+			for (uint32_t r = 0; r < numActive; ++r) {
+				StreamPath path = scratch.paths[r];
+				if (0 == t && 0 == i) {
+					StoreSurface(x0 + path.pixel % tileWidth, y0 + path.pixel / tileWidth, params, path.state.origin, path.state.direction, scratch.payloads[r]);
+				}
+				if (ShadeHit(scene, params, tmin, scratch.payloads[r], path.state, scratch.pixels[path.pixel].sampler, scratch.colors[path.pixel], stats)) {
+					scratch.paths[numAlive++] = path;
+				}
+			}
+			numActive = numAlive;
+		}
+
+		for (uint32_t p = 0; p < numPixels; ++p) {
+			if (t < scratch.pixels[p].numSamples) {
+				AddSample(scratch.pixels[p], scratch.colors[p]);
+			}
+		}
+	}
+
+	for (uint32_t p = 0; p < numPixels; ++p) {
+		StorePixel(x0 + p % tileWidth, y0 + p / tileWidth, scratch.pixels[p], params, stats);
+	}
+
+	_RayCounters[threadIdx].stats = AddRayStats(_RayCounters[threadIdx].stats, stats);
+}
+
+CpuTracer::PixelSamples CpuTracer::BeginPixel(const UniformParams& params, const uint32_t x, const uint32_t y) const {
+	const uint32_t accumFrame = params.frameData.x;
+	const uint32_t samplesPerFrame = params.frameData.y;
+	const uint32_t renderFlags = params.frameData.z;
+
+	PixelSamples pixel;
+	pixel.stats = (accumFrame > 0) ? _PixelStats[y * _Width + x] : PixelStats{ vec4(0.0f), vec4(0.0f), vec4(0.0f) };
+	pixel.part = accumFrame & 1;
+	pixel.firstSample = static_cast<uint32_t>(pixel.stats.colorA.w + pixel.stats.colorB.w);
+	pixel.sampler = SamplerInit(params.samplingData.x, x, y, pixel.firstSample, params.samplingData.y);
+	pixel.numSamples = samplesPerFrame;
+	if (0 != (renderFlags & SWS_RENDER_ADAPTIVE)) {
+		const float budget = static_cast<float>(_Width * _Height * samplesPerFrame);
+		pixel.numSamples = AdaptiveSampleCount(pixel.sampler, pixel.stats, samplesPerFrame, budget, params.samplingData.z, accumFrame);
+	}
+	pixel.color = vec3(0.0f);
+	pixel.sumLuminance = 0.0f;
+	pixel.sumLuminanceSq = 0.0f;
+	return pixel;
+}
+
+void CpuTracer::AddSample(PixelSamples& pixel, const vec3& color) {
+	const float luminance = Luminance(color);
+	pixel.color += color;
+	pixel.sumLuminance += luminance;
+	pixel.sumLuminanceSq += luminance * luminance;
+}
+
+void CpuTracer::StorePixel(const uint32_t x, const uint32_t y, const PixelSamples& pixel, const UniformParams& params, CpuRayStats& stats) {
+	// running averages in linear space, weighted by samples since pixels don't all get the same number
+	PixelStats newStats = pixel.stats;
+	if (pixel.numSamples > 0) {
+		AccumulateHalf(newStats, pixel.part, pixel.color, vec2(pixel.sumLuminance, pixel.sumLuminanceSq), pixel.numSamples);
+	}
+	_PixelStats[y * _Width + x] = newStats;
+
+	// pixels still converging are what the next frame shares its budget out with
+	if (0 != (params.frameData.z & SWS_RENDER_ADAPTIVE) && !PixelConverged(newStats)) {
+		++stats.numConvergingPixels;
+	}
+
+	const vec3 finalColor = PixelColor(newStats);
+	_AccumImage[y * _Width + x] = vec4(finalColor, 1.0f);
+
+	// same conversion the rgba8 storage image does on store
+	const vec3 srgb = LinearToSrgb(sqrt(finalColor));
+	const uint32_t r = static_cast<uint32_t>(Clamp(srgb.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+	const uint32_t g = static_cast<uint32_t>(Clamp(srgb.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+	const uint32_t b = static_cast<uint32_t>(Clamp(srgb.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+	_ResultImage[y * _Width + x] = r | (g << 8) | (b << 16) | (255u << 24);
+}
+
+// the denoiser tells surfaces apart by the first camera ray's hit
+void CpuTracer::StoreSurface(const uint32_t x, const uint32_t y, const UniformParams& params, const vec3& origin, const vec3& direction, const RayPayload& payload) {
+	if (0 != (params.frameData.z & SWS_RENDER_DENOISE)) {
+		_Surfaces[(params.denoiseData.x & 1u) * _Width * _Height + y * _Width + x] = DenoiseSurfaceFromHit(payload, origin, direction);
+	}
+}
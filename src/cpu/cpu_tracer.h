@@ -0,0 +1,159 @@
+#pragma once
+
+#include "cpu_bvh8.h"
+#include "../scene_data.h"
+#include "../shared_sampler.h"
+#include "../shared_denoiser.h"
+#include "../common/thread_pool.h"
+
+// CPU copy of the scene: one BVH over the triangles of all meshes plus everything ray_chit.glsl and the
+// light sampling in ray_gen.glsl read.
+// Rays go through the 8-wide BVH collapsed from the binary one.
+// The mesh index plays the role of gl_InstanceCustomIndexNV, same as in RtxApp::CreateScene.
+class CpuScene {
+public:
+	CpuScene();
+	~CpuScene();
+
+	// uses the .rtscene cache when it's up to date, parses the obj otherwise (without writing the cache)
+	bool        Load(const String& fileName);
+	void        Build(const Array<MeshView>& meshes, const Array<MaterialParams>& materials);
+
+	// traceNV followed by ray_chit/ray_miss, fills the payload exactly like the shaders do
+	void        Trace(const vec3& origin, const vec3& direction, const float tmin, const float tmax, RayPayload& payload) const;
+	// the shadow ray, terminates on the first hit
+	bool        Occluded(const vec3& origin, const vec3& direction, const float tmin, const float tmax) const;
+
+	// getters
+	uint32_t    GetNumMeshes() const;
+	uint32_t    GetNumTriangles() const;
+	const Bvh&  GetBvh() const;
+	const Bvh8& GetBvh8() const;
+	const vec3& GetBoundsMin() const;
+	const vec3& GetBoundsMax() const;
+	const Array<LightTriangle>& GetLights() const;
+	float       GetLightsPower() const;
+
+private:
+	struct Mesh {
+		Array<VertexAttribute>  attribs;
+		Array<uint32_t>         faces;      // 4 per face
+		Array<uint32_t>         matIDs;
+	};
+
+	Bvh                 _Bvh;
+	Bvh8                _Bvh8;
+	Array<Mesh>         _Meshes;
+	Array<uint32_t>     _TriangleMesh;      // mesh of every triangle in the BVH
+	Array<uint32_t>     _TrianglePrim;      // gl_PrimitiveID of every triangle in the BVH
+	Array<MaterialParams> _Materials;
+	Array<LightTriangle> _Lights;
+	float               _LightsPower;
+	vec3                _BoundsMin;
+	vec3                _BoundsMax;
+};
+
+// what a path carries from one bounce to the next
+struct CpuPathState {
+	vec3        origin;
+	vec3        direction;
+	vec3        throughput;
+	float       bsdfPdf;        // of the bounce that picked direction, 0 for camera rays and specular bounces
+	uint32_t    depth;          // rays traced so far, the camera ray included
+};
+
+// RayCounters of ray_gen.glsl, summed over every thread
+struct CpuRayStats {
+	uint64_t    numPaths;
+	uint64_t    numBounces;
+	uint64_t    numShadowRays;
+	uint64_t    numRouletteKills;
+	uint64_t    numConvergingPixels;    // RayCounters.adaptive.x, the next frame's samplingData.z
+};
+
+CpuRayStats AddRayStats(const CpuRayStats& a, const CpuRayStats& b);
+
+// ray_gen.glsl on the CPU.
+// The image is cut into tiles that go through the thread pool, accumulation works the same way
+// as on the GPU (frameData.x restarts it), so both paths converge to the same image.
+class CpuTracer {
+public:
+	// PerRay - every pixel follows its path to the end, one ray at a time, like the shader.
+	// Stream - every bounce of a whole tile is gathered first, sorted by direction octant and origin Morton
+	//          code and traced in that order, so neighbouring rays walk the same part of the BVH.
+	//          Each path keeps its own sampler, the image is the same as with PerRay.
+	enum class TraceMode : uint32_t {
+		PerRay = 0,
+		Stream
+	};
+
+	CpuTracer();
+	~CpuTracer();
+
+	void        Resize(const uint32_t width, const uint32_t height);
+	void        SetTraceMode(const TraceMode mode);
+	void        Render(const CpuScene& scene, const UniformParams& params, ThreadPool& pool);
+	bool        SaveImage(const String& fileName) const;
+
+	// getters
+	uint32_t    GetWidth() const;
+	uint32_t    GetHeight() const;
+	uint64_t    GetNumRays() const;     // traced by the last Render
+	CpuRayStats GetRayStats() const;    // of the last Render
+	const Array<uint32_t>& GetImage() const;
+	const Array<vec4>& GetAccumImage() const;   // linear
+	const Array<PixelStats>& GetPixelStats() const;
+	const Array<DenoiseSurface>& GetSurfaces() const;   // SWS_RENDER_DENOISE, both halves like the GPU buffer
+
+private:
+	void        RenderTile(const CpuScene& scene, const UniformParams& params, const uint32_t tileIdx, const uint32_t threadIdx);
+	void        RenderTileStream(const CpuScene& scene, const UniformParams& params, const uint32_t tileIdx, const uint32_t threadIdx);
+	// one pixel's frame, from the top of ray_gen.glsl's main() to the bottom
+	struct PixelSamples {
+		SamplerState    sampler;
+		PixelStats      stats;          // before this frame
+		uint32_t        firstSample;
+		uint32_t        part;           // half of the stats this frame goes to
+		uint32_t        numSamples;     // this frame
+		vec3            color;          // sum of this frame's samples
+		float           sumLuminance;
+		float           sumLuminanceSq;
+	};
+
+	PixelSamples BeginPixel(const UniformParams& params, const uint32_t x, const uint32_t y) const;
+	static void AddSample(PixelSamples& pixel, const vec3& color);
+	void        StorePixel(const uint32_t x, const uint32_t y, const PixelSamples& pixel, const UniformParams& params, CpuRayStats& stats);
+	void        StoreSurface(const uint32_t x, const uint32_t y, const UniformParams& params, const vec3& origin, const vec3& direction, const RayPayload& payload);
+
+	// one per thread, padded so the counters don't bounce a cache line between cores
+	struct alignas(64) RayCounter {
+		CpuRayStats stats;
+	};
+
+	struct StreamPath {
+		CpuPathState    state;
+		uint32_t        pixel;      // in the tile
+	};
+
+	// per thread, reused by every tile
+	struct StreamScratch {
+		Array<StreamPath>   paths;
+		Array<uint64_t>     keys;       // sort key in the high half, path index in the low half
+		Array<RayPayload>   payloads;
+		Array<PixelSamples> pixels;
+		Array<vec3>         colors;     // per pixel, of the sample being traced
+	};
+
+private:
+	uint32_t            _Width;
+	uint32_t            _Height;
+	TraceMode           _TraceMode;
+	uint32_t            _TileSize;
+	uint32_t            _NumTilesX;
+	Array<PixelStats>   _PixelStats;    // like the GPU pixel stats buffer
+	Array<vec4>         _AccumImage;    // linear, PixelColor of the stats
+	Array<uint32_t>     _ResultImage;   // rgba8, like the GPU result image
+	Array<DenoiseSurface> _Surfaces;    // like the GPU denoiser surfaces buffer
+	Array<RayCounter>   _RayCounters;
+	Array<StreamScratch> _StreamScratch;
+};
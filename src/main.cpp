@@ -1,6 +1,86 @@
 #include "rtPipe.h"
+#include "benchmarks.h"
+#include "cpu/cpu_renderer.h"
 
-int main() {
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char** argv) {
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-obj")) {
+		const uint32_t numRandomTriangles = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 2000000u;
+		return RunObjReaderBenchmark(numRandomTriangles) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--test-allocator")) {
+		return RunAllocatorTests() ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-bvh")) {
+		const uint32_t numRays = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 100000u;
+		return RunBvhBenchmark(numRays) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-bvh8")) {
+		const uint32_t numRays = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 1000000u;
+		return RunBvh8Benchmark(numRays) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-cpu")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 640u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 360u;
+		const uint32_t numFrames = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 8u;
+		return RunCpuTracerBenchmark(Max(width, 1u), Max(height, 1u), Max(numFrames, 1u)) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-stream")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 640u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 360u;
+		const uint32_t numFrames = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 4u;
+		return RunRayStreamBenchmark(Max(width, 1u), Max(height, 1u), Max(numFrames, 1u)) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-nee")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 160u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 90u;
+		const uint32_t numFrames = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 4u;
+		return RunNeeBenchmark(Max(width, 1u), Max(height, 1u), Max(numFrames, 1u)) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-rr")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 160u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 90u;
+		const uint32_t numFrames = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 4u;
+		return RunRussianRouletteBenchmark(Max(width, 1u), Max(height, 1u), Max(numFrames, 1u)) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-sampler")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 160u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 90u;
+		const uint32_t maxSamples = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 64u;
+		return RunSamplerBenchmark(Max(width, 1u), Max(height, 1u), Max(maxSamples, 1u)) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-adaptive")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 64u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 36u;
+		const uint32_t numFrames = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 1024u;
+		return RunAdaptiveBenchmark(Max(width, 1u), Max(height, 1u), Max(numFrames, 1u)) ? 0 : 1;
+	}
+
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-denoise")) {
+		const uint32_t width = (argc > 2) ? static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)) : 160u;
+		const uint32_t height = (argc > 3) ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 90u;
+		const uint32_t maxSamples = (argc > 4) ? static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)) : 64u;
+		return RunDenoiseBenchmark(Max(width, 1u), Max(height, 1u), Max(maxSamples, 1u)) ? 0 : 1;
+	}
+
+	// --cpu renders with the CPU path tracer, no Vulkan needed
+	if (argc > 1 && 0 == strcmp(argv[1], "--cpu")) {
+		return RunCpuRenderer(argc, argv) ? 0 : 1;
+	}
+
+	// --headless [--width W] [--height H] [--frames N] [--output file.png] renders without a window
 	RtxApp app;
-	app.Run();
-}
\ No newline at end of file
+	app.SetCommandLine(argc, argv);
+	return app.Run() ? 0 : 1;
+}
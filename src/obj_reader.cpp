@@ -0,0 +1,600 @@
+#include "obj_reader.h"
+#include "common/mapped_file.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+
+
+static const int32_t kNoIndex = INT32_MIN;
+static const size_t kMinChunkSize = 256 * 1024;
+
+enum ObjEventType : uint8_t {
+	kObjEventGroup,
+	kObjEventMaterial,
+};
+
+// "g"/"o"/"usemtl" line, takes effect starting from firstTriangle of its chunk
+struct ObjEvent {
+	uint32_t        firstTriangle;
+	ObjEventType    type;
+	const char*     name;
+	uint32_t        nameLength;
+};
+
+struct ObjCorner {
+	int32_t v, vt, vn;
+};
+
+// relative (negative) indices are resolved against chunk-local counts during parsing,
+// these are the corners that have to be shifted by the chunk base once all chunks are counted
+struct ObjRelativeFixup {
+	uint32_t    corner;
+	uint8_t     mask; // 1 - v, 2 - vt, 4 - vn
+};
+
+struct ObjChunk {
+	const char*             begin = nullptr;
+	const char*             end = nullptr;
+
+	Array<vec3>             positions;
+	Array<vec3>             normals;
+	uint32_t                numTexcoords = 0;
+	Array<ObjCorner>        corners;    // 3 per triangle
+	Array<ObjRelativeFixup> fixups;
+	Array<ObjEvent>         events;
+	Array<String>           mtllibs;
+
+	uint32_t                basePosition = 0;
+	uint32_t                baseNormal = 0;
+	uint32_t                baseTexcoord = 0;
+};
+
+// consecutive triangles of one chunk that go to the same mesh with the same material
+struct ObjSegment {
+	uint32_t    chunk;
+	uint32_t    firstTriangle;
+	uint32_t    numTriangles;
+	uint32_t    mesh;
+	uint32_t    material;
+	uint32_t    meshOffset;     // first triangle in the mesh
+};
+
+
+static inline bool IsSpace(const char c) {
+	return ' ' == c || '\t' == c || '\r' == c;
+}
+
+static inline bool IsDigit(const char c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline void SkipSpaces(const char*& p, const char* end) {
+	while (p < end && IsSpace(*p)) {
+		++p;
+	}
+}
+
+static inline bool StartsWithToken(const char* p, const char* end, const char* token, const size_t length) {
+	return static_cast<size_t>(end - p) > length && 0 == std::memcmp(p, token, length) && IsSpace(p[length]);
+}
+
+// rest of the line without leading/trailing whitespace
+static void ParseName(const char* p, const char* end, const char*& name, uint32_t& length) {
+	SkipSpaces(p, end);
+	const char* nameEnd = end;
+	while (nameEnd > p && IsSpace(nameEnd[-1])) {
+		--nameEnd;
+	}
+	name = p;
+	length = static_cast<uint32_t>(nameEnd - p);
+}
+
+float ParseFloat(const char*& p, const char* end) {
+	static const double kPow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	SkipSpaces(p, end);
+
+	bool negative = false;
+	if (p < end && ('-' == *p || '+' == *p)) {
+		negative = ('-' == *p);
+		++p;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	while (p < end && IsDigit(*p)) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+			digits += (mantissa != 0) ? 1 : 0;
+		}
+		else {
+			++exponent;
+		}
+		++p;
+	}
+	if (p < end && '.' == *p) {
+		++p;
+		while (p < end && IsDigit(*p)) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+				digits += (mantissa != 0) ? 1 : 0;
+				--exponent;
+			}
+			++p;
+		}
+	}
+	if (p < end && ('e' == *p || 'E' == *p)) {
+		++p;
+		bool negativeExp = false;
+		if (p < end && ('-' == *p || '+' == *p)) {
+			negativeExp = ('-' == *p);
+			++p;
+		}
+		int e = 0;
+		while (p < end && IsDigit(*p)) {
+			e = Min(e * 10 + (*p - '0'), 1000);
+			++p;
+		}
+		exponent += negativeExp ? -e : e;
+	}
+
+	double value = static_cast<double>(mantissa);
+	if (exponent < 0) {
+		for (; exponent < -22 && value != 0.0; exponent += 22) {
+			value /= kPow10[22];
+		}
+		value /= kPow10[Min(-exponent, 22)];
+	}
+	else {
+		for (; exponent > 22; exponent -= 22) {
+			value *= kPow10[22];
+		}
+		value *= kPow10[exponent];
+	}
+
+	return static_cast<float>(negative ? -value : value);
+}
+
+int32_t ParseInt(const char*& p, const char* end) {
+	SkipSpaces(p, end);
+
+	bool negative = false;
+	if (p < end && ('-' == *p || '+' == *p)) {
+		negative = ('-' == *p);
+		++p;
+	}
+
+	int32_t value = 0;
+	while (p < end && IsDigit(*p)) {
+		value = value * 10 + (*p - '0');
+		++p;
+	}
+	return negative ? -value : value;
+}
+
+// OBJ index -> chunk-local 0-based index, relative indices get flagged for a later fixup
+static inline int32_t ResolveIndex(const int32_t idx, const uint32_t localCount, const uint8_t flag, uint8_t& relativeMask) {
+	if (idx > 0) {
+		return idx - 1;
+	}
+	else if (idx < 0) {
+		relativeMask |= flag;
+		return static_cast<int32_t>(localCount) + idx;
+	}
+	return kNoIndex;
+}
+
+static void ParseChunk(ObjChunk& chunk) {
+	// polygon corners of the current face line, reused between lines
+	Array<ObjCorner> polygon;
+	Array<uint8_t> polygonMasks;
+
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	while (p < end) {
+		const char* lineEnd = reinterpret_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+		if (!lineEnd) {
+			lineEnd = end;
+		}
+
+		SkipSpaces(p, lineEnd);
+		if (p < lineEnd) {
+			const char c = *p;
+			if ('v' == c && p + 1 < lineEnd) {
+				const char c1 = p[1];
+				if (IsSpace(c1)) {
+					p += 2;
+					vec3 pos;
+					pos.x = ParseFloat(p, lineEnd);
+					pos.y = ParseFloat(p, lineEnd);
+					pos.z = ParseFloat(p, lineEnd);
+					chunk.positions.push_back(pos);
+				}
+				else if ('n' == c1) {
+					p += 2;
+					vec3 normal;
+					normal.x = ParseFloat(p, lineEnd);
+					normal.y = ParseFloat(p, lineEnd);
+					normal.z = ParseFloat(p, lineEnd);
+					chunk.normals.push_back(normal);
+				}
+				else if ('t' == c1) {
+					++chunk.numTexcoords;
+				}
+			}
+			else if ('f' == c && p + 1 < lineEnd && IsSpace(p[1])) {
+				p += 2;
+				polygon.clear();
+				polygonMasks.clear();
+
+				for (;;) {
+					SkipSpaces(p, lineEnd);
+					if (p >= lineEnd || !(IsDigit(*p) || '-' == *p || '+' == *p)) {
+						break;
+					}
+
+					uint8_t mask = 0;
+					ObjCorner corner;
+					corner.v = ResolveIndex(ParseInt(p, lineEnd), static_cast<uint32_t>(chunk.positions.size()), 1, mask);
+					corner.vt = kNoIndex;
+					corner.vn = kNoIndex;
+					if (p < lineEnd && '/' == *p) {
+						++p;
+						if (p < lineEnd && '/' != *p) {
+							corner.vt = ResolveIndex(ParseInt(p, lineEnd), chunk.numTexcoords, 2, mask);
+						}
+						if (p < lineEnd && '/' == *p) {
+							++p;
+							corner.vn = ResolveIndex(ParseInt(p, lineEnd), static_cast<uint32_t>(chunk.normals.size()), 4, mask);
+						}
+					}
+					polygon.push_back(corner);
+					polygonMasks.push_back(mask);
+
+					// skip whatever garbage is left of this token
+					while (p < lineEnd && !IsSpace(*p)) {
+						++p;
+					}
+				}
+
+				// fan triangulation
+				for (size_t i = 2; i < polygon.size(); ++i) {
+					const size_t fan[3] = { 0, i - 1, i };
+					for (const size_t k : fan) {
+						if (polygonMasks[k]) {
+							chunk.fixups.push_back({ static_cast<uint32_t>(chunk.corners.size()), polygonMasks[k] });
+						}
+						chunk.corners.push_back(polygon[k]);
+					}
+				}
+			}
+			else if (('g' == c || 'o' == c) && (p + 1 == lineEnd || IsSpace(p[1]))) {
+				ObjEvent ev;
+				ev.firstTriangle = static_cast<uint32_t>(chunk.corners.size() / 3);
+				ev.type = kObjEventGroup;
+				ParseName(p + 1, lineEnd, ev.name, ev.nameLength);
+				chunk.events.push_back(ev);
+			}
+			else if (StartsWithToken(p, lineEnd, "usemtl", 6)) {
+				ObjEvent ev;
+				ev.firstTriangle = static_cast<uint32_t>(chunk.corners.size() / 3);
+				ev.type = kObjEventMaterial;
+				ParseName(p + 6, lineEnd, ev.name, ev.nameLength);
+				chunk.events.push_back(ev);
+			}
+			else if (StartsWithToken(p, lineEnd, "mtllib", 6)) {
+				const char* name;
+				uint32_t nameLength;
+				ParseName(p + 6, lineEnd, name, nameLength);
+				chunk.mtllibs.push_back(String(name, nameLength));
+			}
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+bool LoadMtl(const String& fileName, Array<ObjMaterial>& materials) {
+	std::ifstream file(fileName, std::ios::in | std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	const String text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const char* p = text.data();
+	const char* end = p + text.size();
+
+	ObjMaterial* mat = nullptr;
+	while (p < end) {
+		const char* lineEnd = reinterpret_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+		if (!lineEnd) {
+			lineEnd = end;
+		}
+
+		SkipSpaces(p, lineEnd);
+		if (StartsWithToken(p, lineEnd, "newmtl", 6)) {
+			const char* name;
+			uint32_t nameLength;
+			ParseName(p + 6, lineEnd, name, nameLength);
+
+			materials.push_back(ObjMaterial());
+			mat = &materials.back();
+			mat->name.assign(name, nameLength);
+			mat->diffuse = vec3(0.6f);
+			mat->specular = vec3(0.0f);
+			mat->emission = vec3(0.0f);
+			mat->shininess = 1.0f;
+			mat->ior = 1.0f;
+			mat->dissolve = 1.0f;
+			mat->illum = 0;
+		}
+		else if (mat) {
+			auto parseVec3 = [&p, lineEnd](const size_t tokenLength) {
+				p += tokenLength;
+				vec3 v;
+				v.x = ParseFloat(p, lineEnd);
+				v.y = ParseFloat(p, lineEnd);
+				v.z = ParseFloat(p, lineEnd);
+				return v;
+			};
+
+			if (StartsWithToken(p, lineEnd, "Kd", 2)) {
+				mat->diffuse = parseVec3(2);
+			}
+			else if (StartsWithToken(p, lineEnd, "Ks", 2)) {
+				mat->specular = parseVec3(2);
+			}
+			else if (StartsWithToken(p, lineEnd, "Ke", 2)) {
+				mat->emission = parseVec3(2);
+			}
+			else if (StartsWithToken(p, lineEnd, "Ns", 2)) {
+				p += 2;
+				mat->shininess = ParseFloat(p, lineEnd);
+			}
+			else if (StartsWithToken(p, lineEnd, "Ni", 2)) {
+				p += 2;
+				mat->ior = ParseFloat(p, lineEnd);
+			}
+			else if (StartsWithToken(p, lineEnd, "d", 1)) {
+				p += 1;
+				mat->dissolve = ParseFloat(p, lineEnd);
+			}
+			else if (StartsWithToken(p, lineEnd, "illum", 5)) {
+				p += 5;
+				mat->illum = ParseInt(p, lineEnd);
+			}
+			else if (StartsWithToken(p, lineEnd, "map_Kd", 6)) {
+				const char* name;
+				uint32_t nameLength;
+				ParseName(p + 6, lineEnd, name, nameLength);
+				mat->diffuseTexture.assign(name, nameLength);
+			}
+		}
+
+		p = lineEnd + 1;
+	}
+
+	return true;
+}
+
+bool LoadObjScene(const String& fileName, ObjScene& scene, ThreadPool& pool) {
+	MappedFile file;
+	if (!file.Open(fileName.c_str())) {
+		return false;
+	}
+
+	const char* data = reinterpret_cast<const char*>(file.GetData());
+	const size_t fileSize = file.GetSize();
+
+	// 1. split into line-aligned chunks, a few per thread to even out the load
+	const size_t chunkSize = Max(kMinChunkSize, fileSize / (pool.GetNumThreads() * 4));
+	Array<ObjChunk> chunks;
+	for (const char* p = data; p < data + fileSize;) {
+		const char* chunkEnd = p + Min(chunkSize, static_cast<size_t>(data + fileSize - p));
+		if (chunkEnd < data + fileSize) {
+			const char* nl = reinterpret_cast<const char*>(std::memchr(chunkEnd, '\n', static_cast<size_t>(data + fileSize - chunkEnd)));
+			chunkEnd = nl ? nl + 1 : data + fileSize;
+		}
+
+		ObjChunk chunk;
+		chunk.begin = p;
+		chunk.end = chunkEnd;
+		chunks.push_back(std::move(chunk));
+		p = chunkEnd;
+	}
+
+	// 2. parse all chunks in parallel
+	pool.ParallelFor(static_cast<uint32_t>(chunks.size()), [&chunks](const uint32_t chunkIdx, const uint32_t) {
+		ParseChunk(chunks[chunkIdx]);
+	});
+
+	// 3. global bases of every chunk and materials
+	uint32_t numPositions = 0, numNormals = 0, numTexcoords = 0;
+	Array<String> mtllibs;
+	for (ObjChunk& chunk : chunks) {
+		chunk.basePosition = numPositions;
+		chunk.baseNormal = numNormals;
+		chunk.baseTexcoord = numTexcoords;
+		numPositions += static_cast<uint32_t>(chunk.positions.size());
+		numNormals += static_cast<uint32_t>(chunk.normals.size());
+		numTexcoords += chunk.numTexcoords;
+		mtllibs.insert(mtllibs.end(), chunk.mtllibs.begin(), chunk.mtllibs.end());
+	}
+
+	String baseDir = fileName;
+	const size_t slash = baseDir.find_last_of("/\\");
+	baseDir = (slash != String::npos) ? baseDir.substr(0, slash + 1) : String();
+
+	scene.materials.clear();
+	scene.materialLibraries.clear();
+	for (const String& mtllib : mtllibs) {
+		scene.materialLibraries.push_back(baseDir + mtllib);
+		if (!LoadMtl(baseDir + mtllib, scene.materials)) {
+			printf("Failed to load material library %s\n", (baseDir + mtllib).c_str());
+		}
+	}
+
+	std::unordered_map<String, uint32_t> materialsMap;
+	for (size_t i = 0; i < scene.materials.size(); ++i) {
+		materialsMap.emplace(scene.materials[i].name, static_cast<uint32_t>(i));
+	}
+
+	// 4. gather vertex data into global arrays and shift relative indices
+	Array<vec3> positions(numPositions);
+	Array<vec3> normals(numNormals);
+	pool.ParallelFor(static_cast<uint32_t>(chunks.size()), [&chunks, &positions, &normals](const uint32_t chunkIdx, const uint32_t) {
+		ObjChunk& chunk = chunks[chunkIdx];
+		if (!chunk.positions.empty()) {
+			std::memcpy(&positions[chunk.basePosition], chunk.positions.data(), chunk.positions.size() * sizeof(vec3));
+		}
+		if (!chunk.normals.empty()) {
+			std::memcpy(&normals[chunk.baseNormal], chunk.normals.data(), chunk.normals.size() * sizeof(vec3));
+		}
+
+		for (const ObjRelativeFixup& fixup : chunk.fixups) {
+			ObjCorner& corner = chunk.corners[fixup.corner];
+			if (fixup.mask & 1) {
+				corner.v += static_cast<int32_t>(chunk.basePosition);
+			}
+			if (fixup.mask & 2) {
+				corner.vt += static_cast<int32_t>(chunk.baseTexcoord);
+			}
+			if (fixup.mask & 4) {
+				corner.vn += static_cast<int32_t>(chunk.baseNormal);
+			}
+		}
+
+		Array<vec3>().swap(chunk.positions);
+		Array<vec3>().swap(chunk.normals);
+	});
+
+	// 5. walk groups/materials in file order and cut triangles into per-mesh segments
+	Array<ObjSegment> segments;
+	Array<uint32_t> meshTriangles;
+	scene.meshNames.clear();
+
+	String pendingName;
+	bool meshOpen = false;
+	uint32_t material = ~0u;
+
+	auto addSegment = [&](const uint32_t chunkIdx, const uint32_t first, const uint32_t last) {
+		if (first >= last) {
+			return;
+		}
+		if (!meshOpen) {
+			scene.meshNames.push_back(pendingName);
+			meshTriangles.push_back(0);
+			meshOpen = true;
+		}
+
+		ObjSegment segment;
+		segment.chunk = chunkIdx;
+		segment.firstTriangle = first;
+		segment.numTriangles = last - first;
+		segment.mesh = static_cast<uint32_t>(meshTriangles.size() - 1);
+		segment.material = material;
+		segment.meshOffset = meshTriangles.back();
+		meshTriangles.back() += segment.numTriangles;
+		segments.push_back(segment);
+	};
+
+	for (uint32_t chunkIdx = 0; chunkIdx < static_cast<uint32_t>(chunks.size()); ++chunkIdx) {
+		const ObjChunk& chunk = chunks[chunkIdx];
+		uint32_t cursor = 0;
+		for (const ObjEvent& ev : chunk.events) {
+			addSegment(chunkIdx, cursor, ev.firstTriangle);
+			cursor = ev.firstTriangle;
+
+			const String name(ev.name, ev.nameLength);
+			if (kObjEventGroup == ev.type) {
+				// same as tinyobj - a group only starts a new mesh once it gets faces, empty groups are dropped
+				meshOpen = false;
+				pendingName = name;
+			}
+			else {
+				auto it = materialsMap.find(name);
+				material = (it != materialsMap.end()) ? it->second : ~0u;
+			}
+		}
+		addSegment(chunkIdx, cursor, static_cast<uint32_t>(chunk.corners.size() / 3));
+	}
+
+	// 6. stream triangles straight into the per-mesh arrays
+	scene.meshes.clear();
+	scene.meshes.resize(meshTriangles.size());
+	for (size_t i = 0; i < meshTriangles.size(); ++i) {
+		MeshData& mesh = scene.meshes[i];
+		const size_t numFaces = meshTriangles[i];
+		mesh.positions.resize(numFaces * 3);
+		mesh.attribs.resize(numFaces * 3);
+		mesh.indices.resize(numFaces * 3);
+		mesh.faces.resize(numFaces * 4);
+		mesh.matIDs.resize(numFaces);
+	}
+
+	std::atomic<uint32_t> numBadIndices(0);
+	pool.ParallelFor(static_cast<uint32_t>(segments.size()), [&](const uint32_t segmentIdx, const uint32_t) {
+		const ObjSegment& segment = segments[segmentIdx];
+		const ObjChunk& chunk = chunks[segment.chunk];
+		MeshData& mesh = scene.meshes[segment.mesh];
+		uint32_t badIndices = 0;
+
+		for (uint32_t t = 0; t < segment.numTriangles; ++t) {
+			const ObjCorner* corners = &chunk.corners[(segment.firstTriangle + t) * 3];
+			const uint32_t f = segment.meshOffset + t;
+
+			vec3 pos[3];
+			for (uint32_t j = 0; j < 3; ++j) {
+				const int32_t v = corners[j].v;
+				if (v >= 0 && static_cast<uint32_t>(v) < numPositions) {
+					pos[j] = positions[v];
+				}
+				else {
+					pos[j] = vec3(0.0f);
+					++badIndices;
+				}
+			}
+
+			const vec3 faceNormal = Cross(pos[1] - pos[0], pos[2] - pos[0]);
+			const float faceNormalLength = Length(faceNormal);
+			const vec3 geometricNormal = (faceNormalLength > 0.0f) ? faceNormal / faceNormalLength : vec3(0.0f, 1.0f, 0.0f);
+
+			for (uint32_t j = 0; j < 3; ++j) {
+				const uint32_t vIdx = 3 * f + j;
+				const int32_t vn = corners[j].vn;
+				const vec3 normal = (vn >= 0 && static_cast<uint32_t>(vn) < numNormals) ? normals[vn] : geometricNormal;
+
+				mesh.positions[vIdx] = pos[j];
+				mesh.attribs[vIdx].normal = vec4(normal, 0.0f);
+				mesh.indices[vIdx] = vIdx;
+				mesh.faces[4 * f + j] = vIdx;
+			}
+			mesh.faces[4 * f + 3] = 0;
+			mesh.matIDs[f] = segment.material;
+		}
+
+		if (badIndices) {
+			numBadIndices += badIndices;
+		}
+	});
+
+	if (numBadIndices) {
+		printf("%s: %u out of range vertex indices\n", fileName.c_str(), numBadIndices.load());
+	}
+
+	return true;
+}
+
+void GetMaterialParams(const Array<ObjMaterial>& materials, Array<MaterialParams>& params) {
+	params.resize(materials.size());
+	for (size_t i = 0; i < materials.size(); ++i) {
+		params[i].diffuse = vec4(materials[i].diffuse, 0.0f);
+		params[i].emission = vec4(materials[i].emission, 0.0f);
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "scene_data.h"
+#include "common/thread_pool.h"
+
+struct ObjMaterial {
+	String  name;
+	vec3    diffuse;        // Kd
+	vec3    specular;       // Ks
+	vec3    emission;       // Ke
+	float   shininess;      // Ns
+	float   ior;            // Ni
+	float   dissolve;       // d
+	int     illum;
+	String  diffuseTexture; // map_Kd
+};
+
+struct ObjScene {
+	Array<String>       meshNames;
+	Array<MeshData>     meshes;     // 3 vertices per face, not welded yet
+	Array<ObjMaterial>  materials;
+	Array<String>       materialLibraries;  // every mtllib path, loaded or not, for cache invalidation
+};
+
+// Parallel OBJ reader.
+// The file is memory-mapped and split into line-aligned chunks that are parsed on the thread pool,
+// then faces are written straight into the per-mesh arrays, split into meshes the same way tinyobj
+// does it (new mesh on every "g"/"o" that follows faces). Polygons are fan-triangulated,
+// missing normals are replaced with the geometric face normal.
+bool LoadObjScene(const String& fileName, ObjScene& scene, ThreadPool& pool = ThreadPool::GetDefault());
+bool LoadMtl(const String& fileName, Array<ObjMaterial>& materials);
+
+// what the shaders get of every material, in material id order
+void GetMaterialParams(const Array<ObjMaterial>& materials, Array<MaterialParams>& params);
+
+// locale-independent number parsing, advances p past the parsed number
+float   ParseFloat(const char*& p, const char* end);
+int32_t ParseInt(const char*& p, const char* end);
@@ -1,31 +1,38 @@
 #include "rtPipe.h"
 #include <stdlib.h>
 #include <exception>
+#include <chrono>
 #include "shared_with_shaders.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
+#include "shared_sampler.h"
+#include "shared_denoiser.h"
+#include "scene_cache.h"
+#include "obj_reader.h"
 
 static const String sShadersFolder = "_data/shaders/";
 static const String sScenesFolder = "_data/scenes/";
+static const VkDeviceSize sStagingRingSize = 16 * 1024 * 1024;
+static const VkDeviceSize sBlasBatchSize = 256 * 1024 * 1024;    // uncompacted BLAS memory alive at once while compacting
+static const VkDeviceSize sDefaultScratchBudget = 64 * 1024 * 1024;
+static const VkDeviceSize sScratchAlignment = 256;
+static const uint32_t sMaxTLASRefits = 256;             // refits in a row before a full rebuild anyway
+static const float sTLASRebuildDistance = 1.0f;         // rebuild once an instance moved this many of its own extents
+static const uint32_t sFrameTimestamps = 4;             // TLAS update begin/end, trace begin/end
+static const uint32_t sDefaultGroupMeshFaces = 4096;
+static const uint32_t sMaxGroupFaces = 1024 * 1024;
+static const float sBackgroundAngularSize = 0.05f;      // radians, meshes smaller than this from the start camera are background
+static const uint32_t sSweepTraceFrames = 16;
 
 static const float sMoveSpeed = 2.0f;
 static const float sAccelMult = 5.0f;
 static const float sRotateSpeed = 0.25f;
 
+static const vec3 sCameraStartPos = vec3(0.25f, 3.20f, 6.15f);
+static const vec3 sCameraStartTarget = vec3(0.25f, 2.75f, 5.25f);
+
 static vec3 sSunPos = vec3(1.0f, 1.0f, 1.0f);
 static const float sAmbientLight = 0.1f;
 
 
-struct VkGeometryInstance {
-	float transform[12];
-	uint32_t instanceId : 24;
-	uint32_t mask : 8;
-	uint32_t instanceOffset : 24;
-	uint32_t flags : 8;
-	uint64_t accelerationStructureHandle;
-};
-
 
 
 RtxApp::RtxApp()
@@ -33,6 +40,29 @@ RtxApp::RtxApp()
 	, _RTXPipelineLayout(VK_NULL_HANDLE)
 	, _RTXPipeline(VK_NULL_HANDLE)
 	, _RTXDescriptorPool(VK_NULL_HANDLE)
+	, _CameraSliceSize(0)
+	, _RayCountersSliceSize(0)
+	, _AccumFrameIndex(0)
+	, _AccumSeed(0)
+	, _DenoisePipelineLayout(VK_NULL_HANDLE)
+	, _DenoiseTemporalPipeline(VK_NULL_HANDLE)
+	, _DenoiseAtrousPipeline(VK_NULL_HANDLE)
+	, _DenoiseFrameIndex(0)
+	, _ScratchBudget(sDefaultScratchBudget)
+	, _TimeEachBuild(false)
+	, _TimestampPeriod(0.0f)
+	, _TimestampMask(0)
+	, _FrameTimestampPool(VK_NULL_HANDLE)
+	, _NumTracedFrames(0)
+	, _TraceMs(0.0)
+	, _Animate(false)
+	, _AnimationTime(0.0f)
+	, _MeshGrouping({ sDefaultGroupMeshFaces, sMaxGroupFaces })
+	, _ForcedBuildPolicy(BuildPolicy::Auto)
+	, _BuildPolicySweep(false)
+	, _RenderFlags(SWS_RENDER_NEE)
+	, _RouletteDepth(SWS_RR_MIN_DEPTH)
+	, _SamplerType(SWS_SAMPLER_DEFAULT)
 	, WKeyDown(false)
 	, AKeyDown(false)
 	, SKeyDown(false)
@@ -52,22 +82,88 @@ void RtxApp::InitSettings() {
 	_Settings.enableVSync = false;
 	_Settings.supportRaytracing = true;
 	_Settings.supportDescriptorIndexing = true;
+
+	// --scratch-budget MB, 0 shrinks the pool to what the biggest build needs
+	// --blas-build-timing runs the BLAS builds one after the other so each gets its own GPU time
+	// --animate moves the first instance every frame, exercising the TLAS refit path
+	// --blas-group-faces N merges static meshes of up to N faces into shared BLASes, 0 gives every mesh its own
+	// --blas-policy fast-trace|fast-build|low-memory builds every BLAS that way, ignoring the scene metadata
+	// --blas-policy-sweep builds and traces the scene with every policy in turn and prints how they compare
+	// --no-nee turns off light sampling, paths only find lights by bouncing into them
+	// --rr-depth N lets Russian roulette end paths from their Nth ray on, 16 (SWS_MAX_RECURSION) never does
+	// --sampler random|sobol picks what the paths draw their numbers from
+	// --adaptive stops tracing pixels that have converged, the rest get their samples
+	// --denoise filters every frame with its history and its neighbours before it's shown
+	for (size_t i = 0; i < _CommandLine.size(); ++i) {
+		if (_CommandLine[i] == "--scratch-budget" && (i + 1) < _CommandLine.size()) {
+			_ScratchBudget = static_cast<VkDeviceSize>(strtoul(_CommandLine[i + 1].c_str(), nullptr, 10)) * 1024 * 1024;
+		}
+		else if (_CommandLine[i] == "--blas-build-timing") {
+			_TimeEachBuild = true;
+		}
+		else if (_CommandLine[i] == "--blas-group-faces" && (i + 1) < _CommandLine.size()) {
+			_MeshGrouping.maxMeshFaces = static_cast<uint32_t>(strtoul(_CommandLine[i + 1].c_str(), nullptr, 10));
+		}
+		else if (_CommandLine[i] == "--blas-policy" && (i + 1) < _CommandLine.size()) {
+			if (!ParseBuildPolicy(_CommandLine[i + 1], _ForcedBuildPolicy)) {
+				printf("Unknown BLAS build policy %s\n", _CommandLine[i + 1].c_str());
+			}
+		}
+		else if (_CommandLine[i] == "--blas-policy-sweep") {
+			_BuildPolicySweep = true;
+		}
+		else if (_CommandLine[i] == "--animate") {
+			_Animate = true;
+		}
+		else if (_CommandLine[i] == "--rr-depth" && (i + 1) < _CommandLine.size()) {
+			_RouletteDepth = static_cast<uint32_t>(strtoul(_CommandLine[i + 1].c_str(), nullptr, 10));
+		}
+		else if (_CommandLine[i] == "--no-nee") {
+			_RenderFlags &= ~SWS_RENDER_NEE;
+		}
+		else if (_CommandLine[i] == "--adaptive") {
+			_RenderFlags |= SWS_RENDER_ADAPTIVE;
+		}
+		else if (_CommandLine[i] == "--denoise") {
+			_RenderFlags |= SWS_RENDER_DENOISE;
+		}
+		else if (_CommandLine[i] == "--sampler" && (i + 1) < _CommandLine.size()) {
+			if (_CommandLine[i + 1] == "random") {
+				_SamplerType = SWS_SAMPLER_RANDOM;
+			}
+			else if (_CommandLine[i + 1] == "sobol") {
+				_SamplerType = SWS_SAMPLER_SOBOL;
+			}
+			else {
+				printf("Unknown sampler %s\n", _CommandLine[i + 1].c_str());
+			}
+		}
+	}
 }
 
 void RtxApp::InitApp() {
+	VkResult error = _Uploader.Create(sStagingRingSize);
+	CHECK_VK_ERROR(error, "_Uploader.Create");
+
+	InitTimestamps();
 	LoadSceneGeometry();
 	CreateScene();
 	CreateCamera();
+	CreateRayCounters();
+	CreatePixelStatsBuffer();
+	CreateDenoiseBuffers();
 	CreateDescriptorSetsLayouts();
 	CreateRaytracingPipelineAndSBT();
+	CreateDenoisePipelines();
 	UpdateDescriptorSets();
+
+	if (_BuildPolicySweep) {
+		RunBuildPolicySweep();
+	}
 }
 
 void RtxApp::FreeResources() {
-	for (RTMesh& mesh : _Scene.meshes) {
-		vkDestroyAccelerationStructureNV(_Device, mesh.blas.accelerationStructure, nullptr);
-		vkFreeMemory(_Device, mesh.blas.memory, nullptr);
-	}
+	DestroyBLASes();
 	_Scene.meshes.clear();
 	_Scene.materials.clear();
 
@@ -75,9 +171,37 @@ void RtxApp::FreeResources() {
 		vkDestroyAccelerationStructureNV(_Device, _Scene.topLevelAS.accelerationStructure, nullptr);
 		_Scene.topLevelAS.accelerationStructure = VK_NULL_HANDLE;
 	}
-	if (_Scene.topLevelAS.memory) {
-		vkFreeMemory(_Device, _Scene.topLevelAS.memory, nullptr);
-		_Scene.topLevelAS.memory = VK_NULL_HANDLE;
+	helpers::GetAllocator().Free(_Scene.topLevelAS.memory);
+	_Scene.instancesBuffer.Destroy();
+	_Scene.tlasScratch.Destroy();
+	_Scene.instanceShapes.Destroy();
+	_Scene.materialsBuffer.Destroy();
+	_Scene.lightsBuffer.Destroy();
+
+	if (_NumTracedFrames) {
+		printf("Trace: %zu TLAS instances, %.3f ms avg over %u frames\n", _Scene.instances.size(), _TraceMs / _NumTracedFrames, _NumTracedFrames);
+	}
+	if (_RayStats.numFrames && _RayStats.numPaths) {
+		const double numPixels = static_cast<double>(_Settings.resolutionX) * _Settings.resolutionY * _RayStats.numFrames;
+		const double numPaths = static_cast<double>(_RayStats.numPaths);
+		printf("Rays: %.2f per pixel (%.2f shadow), %.2f rays per path, %.1f%% of paths ended by Russian roulette, over %u frames\n",
+			static_cast<double>(_RayStats.numBounces + _RayStats.numShadowRays) / numPixels,
+			static_cast<double>(_RayStats.numShadowRays) / numPixels,
+			static_cast<double>(_RayStats.numBounces) / numPaths,
+			100.0 * static_cast<double>(_RayStats.numRouletteKills) / numPaths, _RayStats.numFrames);
+	}
+	_Scene.instances.clear();
+
+	const TLASStats& tlasStats = _Scene.tlasStats;
+	if (tlasStats.numRefits || tlasStats.numRebuilds) {
+		printf("TLAS updates: %u refits (%.3f ms avg), %u rebuilds (%.3f ms avg)\n",
+			tlasStats.numRefits, tlasStats.numRefits ? tlasStats.refitMs / tlasStats.numRefits : 0.0,
+			tlasStats.numRebuilds, tlasStats.numRebuilds ? tlasStats.rebuildMs / tlasStats.numRebuilds : 0.0);
+	}
+
+	if (_FrameTimestampPool) {
+		vkDestroyQueryPool(_Device, _FrameTimestampPool, nullptr);
+		_FrameTimestampPool = VK_NULL_HANDLE;
 	}
 
 	if (_RTXDescriptorPool) {
@@ -86,6 +210,27 @@ void RtxApp::FreeResources() {
 	}
 
 	rtxHelper.Destroy();
+	_Uploader.Destroy();
+	_PixelStatsBuffer.Destroy();
+	_RayCountersBuffer.Destroy();
+	_DenoiseSurfacesBuffer.Destroy();
+	_DenoiseHistoryBuffer.Destroy();
+	_DenoiseFilterBuffer.Destroy();
+
+	if (_DenoiseTemporalPipeline) {
+		vkDestroyPipeline(_Device, _DenoiseTemporalPipeline, nullptr);
+		_DenoiseTemporalPipeline = VK_NULL_HANDLE;
+	}
+
+	if (_DenoiseAtrousPipeline) {
+		vkDestroyPipeline(_Device, _DenoiseAtrousPipeline, nullptr);
+		_DenoiseAtrousPipeline = VK_NULL_HANDLE;
+	}
+
+	if (_DenoisePipelineLayout) {
+		vkDestroyPipelineLayout(_Device, _DenoisePipelineLayout, nullptr);
+		_DenoisePipelineLayout = VK_NULL_HANDLE;
+	}
 
 	if (_RTXPipeline) {
 		vkDestroyPipeline(_Device, _RTXPipeline, nullptr);
@@ -103,23 +248,19 @@ void RtxApp::FreeResources() {
 	_RTXDescriptorSetsLayouts.clear();
 }
 
-void RtxApp::FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t imageIndex) {
-	vkCmdBindPipeline(commandBuffer,
-		VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
-		_RTXPipeline);
+void RtxApp::FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t frameIndex) {
+	UpdateTLAS(commandBuffer, frameIndex);
 
-	vkCmdBindDescriptorSets(commandBuffer,
-		VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
-		_RTXPipelineLayout, 0,
-		static_cast<uint32_t>(_RTXDescriptorSets.size()), _RTXDescriptorSets.data(),
-		0, 0);
+	RecordTrace(commandBuffer, frameIndex, _FrameTimestampPool, static_cast<uint32_t>(frameIndex * sFrameTimestamps + 2));
+	_TracePending[frameIndex] = (VK_NULL_HANDLE != _FrameTimestampPool);
 
-	vkCmdTraceRaysNV(commandBuffer,
-		rtxHelper.GetSBTBuffer(), rtxHelper.GetRaygenOffset(),
-		rtxHelper.GetSBTBuffer(), rtxHelper.GetMissGroupsOffset(), rtxHelper.GetGroupsStride(),
-		rtxHelper.GetSBTBuffer(), rtxHelper.GetHitGroupsOffset(), rtxHelper.GetGroupsStride(),
-		VK_NULL_HANDLE, 0, 0,
-		_Settings.resolutionX, _Settings.resolutionY, 1u);
+	if (0 != (_RenderFlags & SWS_RENDER_DENOISE)) {
+		RecordDenoise(commandBuffer, frameIndex);
+		++_DenoiseFrameIndex;
+	}
+
+	// next frame adds to what this one wrote
+	++_AccumFrameIndex;
 }
 
 void RtxApp::OnMouseMove(const float x, const float y) {
@@ -171,41 +312,119 @@ void RtxApp::OnKey(const int key, const int scancode, const int action, const in
 	}
 }
 
-void RtxApp::Update(const size_t, const float dt) {
-	String frameStats = ToString(fpsMeter.GetFPS(), 1) + " FPS (" + ToString(fpsMeter.GetFrameTime(), 1) + " ms)";
-	String fullTitle = _Settings.name + "  " + frameStats;
-	glfwSetWindowTitle(_Window, fullTitle.c_str());
-	UniformParams* params = reinterpret_cast<UniformParams*>(_CameraBuffer.Map());
+void RtxApp::Update(const size_t frameIndex, const float dt) {
+	ReadFrameTimestamps(frameIndex);
+	ReadRayCounters(frameIndex);
+
+	if (_Window) {
+		String frameStats = ToString(fpsMeter.GetFPS(), 1) + " FPS (" + ToString(fpsMeter.GetFrameTime(), 1) + " ms, " + ToString(mapCallsPerFrame) + " maps, " + ToString(frameWaitStats.lastWaitMs, 2) + " ms wait, " + ToString(_AccumFrameIndex * SWS_SAMPLES_PER_FRAME) + " spp)";
+		if (_RayStats.numFrames) {
+			frameStats += " " + ToString(_RayStats.lastRaysPerPixel, 2) + " rays/px, " + ToString(_RayStats.lastRaysPerPath, 2) + " per path";
+		}
+		if (0 != (_RenderFlags & SWS_RENDER_ADAPTIVE)) {
+			const double numPixels = static_cast<double>(_Settings.resolutionX) * _Settings.resolutionY;
+			frameStats += " " + ToString(100.0 - 100.0 * static_cast<double>(_RayStats.lastConvergingPixels) / numPixels, 1) + "% converged";
+		}
+		if (0 != (_RenderFlags & SWS_RENDER_DENOISE)) {
+			frameStats += " denoised";
+		}
+		if (_Scene.tlasStats.numRefits || _Scene.tlasStats.numRebuilds) {
+			frameStats += " TLAS refit " + ToString(_Scene.tlasStats.lastRefitMs, 3) + " ms, rebuild " + ToString(_Scene.tlasStats.lastRebuildMs, 3) + " ms";
+		}
+		String fullTitle = _Settings.name + "  " + frameStats;
+		glfwSetWindowTitle(_Window, fullTitle.c_str());
+	}
+
+	// this frame slot has been waited on, so nothing on the GPU reads its slice anymore
+	uint8_t* cameraMemory = reinterpret_cast<uint8_t*>(_CameraBuffer.GetMappedMemory());
+	UniformParams* params = reinterpret_cast<UniformParams*>(cameraMemory + frameIndex * _CameraSliceSize);
 
 	params->sunPosAndAmbient = vec4(sSunPos, sAmbientLight);
 
 	UpdateCameraParams(params, dt);
+	AnimateInstances(dt);
+
+	// any camera or instance change invalidates the accumulated image
+	if (_Camera.GetPosition() != _AccumCameraPos || _Camera.GetDirection() != _AccumCameraDir || _Camera.GetUp() != _AccumCameraUp) {
+		_AccumCameraPos = _Camera.GetPosition();
+		_AccumCameraDir = _Camera.GetDirection();
+		_AccumCameraUp = _Camera.GetUp();
+		_AccumFrameIndex = 0;
+	}
+	if (_Scene.instancesDirty) {
+		_AccumFrameIndex = 0;
+	}
+
+	// the history carries samples over restarts, the same scrambles again would only add the same error again
+	const bool denoise = (0 != (_RenderFlags & SWS_RENDER_DENOISE));
+	if (denoise && 0 == _AccumFrameIndex) {
+		_AccumSeed = _DenoiseFrameIndex;
+	}
+
+	params->frameData = uvec4(_AccumFrameIndex, SWS_SAMPLES_PER_FRAME, _RenderFlags, _RouletteDepth);
+	params->lightsInfo = vec4(static_cast<float>(_Scene.numLights), _Scene.lightsPower, 0.0f, 0.0f);
+	params->samplingData = uvec4(_SamplerType, _AccumSeed, _RayStats.lastConvergingPixels, 0);
+
+	// the history was left by the frame recorded last, seen from that frame's camera
+	params->prevCamPos = _PrevCamPos;
+	params->prevCamDir = _PrevCamDir;
+	params->prevCamUp = _PrevCamUp;
+	params->prevCamSide = _PrevCamSide;
+	params->denoiseData = uvec4(_DenoiseFrameIndex, SWS_DENOISE_ITERATIONS, (denoise && _DenoiseFrameIndex > 0) ? 1u : 0u, 0);
+	_PrevCamPos = params->camPos;
+	_PrevCamDir = params->camDir;
+	_PrevCamUp = params->camUp;
+	_PrevCamSide = params->camSide;
+}
+
 
-	_CameraBuffer.Unmap();
+uint32_t RtxApp::GetNumInstances() const {
+	return static_cast<uint32_t>(_Scene.instances.size());
 }
 
+void RtxApp::SetInstanceTransform(const uint32_t instanceIdx, const mat4& transform) {
+	assert(instanceIdx < _Scene.instances.size());
+
+	// 3x4 row-major, glm is column-major
+	float* dst = _Scene.instances[instanceIdx].transform;
+	for (int row = 0; row < 3; ++row) {
+		for (int col = 0; col < 4; ++col) {
+			dst[row * 4 + col] = transform[col][row];
+		}
+	}
+	_Scene.instancesDirty = true;
+}
+
+void RtxApp::SetInstanceMask(const uint32_t instanceIdx, const uint8_t mask) {
+	assert(instanceIdx < _Scene.instances.size());
+
+	_Scene.instances[instanceIdx].mask = mask;
+	_Scene.instancesDirty = true;
+}
 
 
 bool RtxApp::CreateAS(const VkAccelerationStructureTypeNV type,
 	const uint32_t geometryCount,
 	const VkGeometryNV* geometries,
 	const uint32_t instanceCount,
+	const VkBuildAccelerationStructureFlagsNV flags,
+	const VkDeviceSize compactedSize,
 	RTAccelerationStructure& _as) {
 
 	VkAccelerationStructureInfoNV& accelerationStructureInfo = _as.accelerationStructureInfo;
 	accelerationStructureInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
 	accelerationStructureInfo.pNext = nullptr;
 	accelerationStructureInfo.type = type;
-	accelerationStructureInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_NV;
-	accelerationStructureInfo.geometryCount = geometryCount;
-	accelerationStructureInfo.instanceCount = instanceCount;
-	accelerationStructureInfo.pGeometries = geometries;
+	accelerationStructureInfo.flags = flags;
+	accelerationStructureInfo.geometryCount = compactedSize ? 0 : geometryCount;
+	accelerationStructureInfo.instanceCount = compactedSize ? 0 : instanceCount;
+	accelerationStructureInfo.pGeometries = compactedSize ? nullptr : geometries;
 
 	VkAccelerationStructureCreateInfoNV accelerationStructureCreateInfo;
 	accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV;
 	accelerationStructureCreateInfo.pNext = nullptr;
 	accelerationStructureCreateInfo.info = accelerationStructureInfo;
-	accelerationStructureCreateInfo.compactedSize = 0;
+	accelerationStructureCreateInfo.compactedSize = compactedSize;
 
 	VkResult error = vkCreateAccelerationStructureNV(_Device, &accelerationStructureCreateInfo, nullptr, &_as.accelerationStructure);
 	if (VK_SUCCESS != error) {
@@ -222,15 +441,11 @@ bool RtxApp::CreateAS(const VkAccelerationStructureTypeNV type,
 	VkMemoryRequirements2 memoryRequirements;
 	vkGetAccelerationStructureMemoryRequirementsNV(_Device, &memoryRequirementsInfo, &memoryRequirements);
 
-	VkMemoryAllocateInfo memoryAllocateInfo;
-	memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	memoryAllocateInfo.pNext = nullptr;
-	memoryAllocateInfo.allocationSize = memoryRequirements.memoryRequirements.size;
-	memoryAllocateInfo.memoryTypeIndex = helpers::GetMemoryType(memoryRequirements.memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	const uint32_t memoryTypeIndex = helpers::GetMemoryType(memoryRequirements.memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	error = vkAllocateMemory(_Device, &memoryAllocateInfo, nullptr, &_as.memory);
+	error = helpers::GetAllocator().Allocate(memoryRequirements.memoryRequirements, memoryTypeIndex, helpers::MemoryKind::Linear, _as.memory);
 	if (VK_SUCCESS != error) {
-		CHECK_VK_ERROR(error, "vkAllocateMemory for AS");
+		CHECK_VK_ERROR(error, "Allocate memory for AS");
 		return false;
 	}
 
@@ -238,8 +453,8 @@ bool RtxApp::CreateAS(const VkAccelerationStructureTypeNV type,
 	bindInfo.sType = VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_NV;
 	bindInfo.pNext = nullptr;
 	bindInfo.accelerationStructure = _as.accelerationStructure;
-	bindInfo.memory = _as.memory;
-	bindInfo.memoryOffset = 0;
+	bindInfo.memory = _as.memory.memory;
+	bindInfo.memoryOffset = _as.memory.offset;
 	bindInfo.deviceIndexCount = 0;
 	bindInfo.pDeviceIndices = nullptr;
 
@@ -258,110 +473,237 @@ bool RtxApp::CreateAS(const VkAccelerationStructureTypeNV type,
 	return true;
 }
 
+void RtxApp::InitTimestamps() {
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(_PhysicalDevice, &deviceProperties);
+
+	uint32_t numQueueFamilies = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(_PhysicalDevice, &numQueueFamilies, nullptr);
+	Array<VkQueueFamilyProperties> queueFamilies(numQueueFamilies);
+	vkGetPhysicalDeviceQueueFamilyProperties(_PhysicalDevice, &numQueueFamilies, queueFamilies.data());
+
+	const uint32_t validBits = (_GraphicsQueueFamilyIndex < numQueueFamilies) ? queueFamilies[_GraphicsQueueFamilyIndex].timestampValidBits : 0;
+	_TimestampPeriod = validBits ? deviceProperties.limits.timestampPeriod : 0.0f;
+	_TimestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+}
+
+VkCommandBuffer RtxApp::BeginOneTimeCommands() {
+	VkCommandBufferAllocateInfo commandBufferAllocateInfo;
+	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferAllocateInfo.pNext = nullptr;
+	commandBufferAllocateInfo.commandPool = _CommandPool;
+	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferAllocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkResult error = vkAllocateCommandBuffers(_Device, &commandBufferAllocateInfo, &commandBuffer);
+	CHECK_VK_ERROR(error, "vkAllocateCommandBuffers");
+
+	VkCommandBufferBeginInfo beginInfo;
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	return commandBuffer;
+}
+
+// submits and waits, everything recorded is done when this returns
+void RtxApp::SubmitOneTimeCommands(VkCommandBuffer commandBuffer) {
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo;
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = nullptr;
+	submitInfo.waitSemaphoreCount = 0;
+	submitInfo.pWaitSemaphores = nullptr;
+	submitInfo.pWaitDstStageMask = nullptr;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 0;
+	submitInfo.pSignalSemaphores = nullptr;
+
+	vkQueueSubmit(_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(_GraphicsQueue);
+	vkFreeCommandBuffers(_Device, _CommandPool, 1, &commandBuffer);
+}
+
+static bool LoadMeshesFromObj(const String& fileName, Array<MeshData>& meshes, Array<MaterialParams>& materials, Array<String>& materialLibraries) {
+	ObjScene objScene;
+	if (!LoadObjScene(fileName, objScene)) {
+		return false;
+	}
+
+	meshes.swap(objScene.meshes);
+	materialLibraries.swap(objScene.materialLibraries);
+	GetMaterialParams(objScene.materials, materials);
+
+	Array<WeldStats> weldStats(meshes.size());
+	ThreadPool::GetDefault().ParallelFor(static_cast<uint32_t>(meshes.size()), [&meshes, &weldStats](const uint32_t meshIdx, const uint32_t) {
+		weldStats[meshIdx] = WeldVertices(meshes[meshIdx]);
+	});
+
+	for (size_t meshIdx = 0; meshIdx < meshes.size(); ++meshIdx) {
+		const WeldStats& weld = weldStats[meshIdx];
+		printf("Mesh %zu: welded %u -> %u vertices, saved %zu bytes\n", meshIdx, weld.verticesBefore, weld.verticesAfter, weld.bytesSaved);
+	}
+
+	return true;
+}
+
 void RtxApp::LoadSceneGeometry() {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	String warn, error;
+	const auto startTime = std::chrono::high_resolution_clock::now();
 
 	String fileName = sScenesFolder + "cornell_box/CornellBox.obj";//"fake_whitted/fake_whitted.obj";
-	String baseDir = fileName;
-	const size_t slash = baseDir.find_last_of('/');
-	if (slash != String::npos) {
-		baseDir.erase(slash);
-	}
-
-	const bool result = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &error, fileName.c_str(), baseDir.c_str(), true);
-	if (result) {
-		_Scene.meshes.resize(shapes.size());
-		_Scene.materials.resize(materials.size());
-		
-		for (size_t meshIdx = 0; meshIdx < shapes.size(); ++meshIdx) {
-			RTMesh& mesh = _Scene.meshes[meshIdx];
-			const tinyobj::shape_t& shape = shapes[meshIdx];
-
-			const size_t numFaces = shape.mesh.num_face_vertices.size();
-			const size_t numVertices = numFaces * 3;
-
-			mesh.numVertices = static_cast<uint32_t>(numVertices);
-			mesh.numFaces = static_cast<uint32_t>(numFaces);
-
-			const size_t positionsBufferSize = numVertices * sizeof(vec3);
-			const size_t indicesBufferSize = numFaces * 3 * sizeof(uint32_t);
-			const size_t facesBufferSize = numFaces * 4 * sizeof(uint32_t);
-			const size_t attribsBufferSize = numVertices * sizeof(VertexAttribute);
-			const size_t matIDsBufferSize = numFaces * sizeof(uint32_t);
-
-			VkResult error = mesh.positions.Create(positionsBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			CHECK_VK_ERROR(error, "mesh.positions.Create");
-
-			error = mesh.indices.Create(indicesBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			CHECK_VK_ERROR(error, "mesh.indices.Create");
-
-			error = mesh.faces.Create(facesBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			CHECK_VK_ERROR(error, "mesh.faces.Create");
-
-			error = mesh.attribs.Create(attribsBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			CHECK_VK_ERROR(error, "mesh.attribs.Create");
-
-			error = mesh.matIDs.Create(matIDsBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			CHECK_VK_ERROR(error, "mesh.matIDs.Create");
-
-			vec3* positions = reinterpret_cast<vec3*>(mesh.positions.Map());
-			VertexAttribute* attribs = reinterpret_cast<VertexAttribute*>(mesh.attribs.Map());
-			uint32_t* indices = reinterpret_cast<uint32_t*>(mesh.indices.Map());
-			uint32_t* faces = reinterpret_cast<uint32_t*>(mesh.faces.Map());
-			uint32_t* matIDs = reinterpret_cast<uint32_t*>(mesh.matIDs.Map());
-
-			size_t vIdx = 0;
-			for (size_t f = 0; f < numFaces; ++f) {
-				if (shape.mesh.num_face_vertices[f] == 3) {
-				
-					for (size_t j = 0; j < 3; ++j, ++vIdx) {
-						const tinyobj::index_t& i = shape.mesh.indices[vIdx];							
-						vec3& pos = positions[vIdx];
-						vec4& normal = attribs[vIdx].normal;								
-						pos.x = attrib.vertices[3 * i.vertex_index + 0];
-						pos.y = attrib.vertices[3 * i.vertex_index + 1];
-						pos.z = attrib.vertices[3 * i.vertex_index + 2];
-						normal.x = attrib.normals[3 * i.normal_index + 0];
-						normal.y = attrib.normals[3 * i.normal_index + 1];
-						normal.z = attrib.normals[3 * i.normal_index + 2];										
-					}
-
-					const uint32_t a = static_cast<uint32_t>(3 * f + 0);
-					const uint32_t b = static_cast<uint32_t>(3 * f + 1);
-					const uint32_t c = static_cast<uint32_t>(3 * f + 2);
-					indices[a] = a;
-					indices[b] = b;
-					indices[c] = c;
-					faces[4 * f + 0] = a;
-					faces[4 * f + 1] = b;
-					faces[4 * f + 2] = c;
-					matIDs[f] = static_cast<uint32_t>(shape.mesh.material_ids[f]);
-				}
-				else {
-					printf("%d %d", meshIdx, f);
-				}
+	const String cacheFileName = fileName + kSceneCacheExt;
+
+	// warm path - map the cache and copy straight from it, cold path - parse the obj and write the cache for the next run
+	SceneCache cache;
+	Array<MeshData> meshesData;
+	Array<MeshView> meshViews;
+	Array<MaterialParams> materials;
+	Array<String> materialLibraries;
+
+	const bool warmStart = cache.Open(cacheFileName, fileName);
+	if (warmStart) {
+		materials.assign(cache.GetMaterials(), cache.GetMaterials() + cache.GetNumMaterials());
+		meshViews.resize(cache.GetNumMeshes());
+		for (uint32_t i = 0; i < cache.GetNumMeshes(); ++i) {
+			meshViews[i] = cache.GetMesh(i);
+		}
+	}
+	else if (LoadMeshesFromObj(fileName, meshesData, materials, materialLibraries)) {
+		if (!SceneCache::Write(cacheFileName, fileName, materialLibraries, meshesData, materials)) {
+			printf("Failed to write scene cache %s\n", cacheFileName.c_str());
+		}
+
+		meshViews.resize(meshesData.size());
+		for (size_t i = 0; i < meshesData.size(); ++i) {
+			meshViews[i] = MakeMeshView(meshesData[i]);
+		}
+	}
+
+	// rigidly moved copies of a mesh become instances of it, only the unique meshes get buffers and a BLAS
+	Array<uint32_t> uniqueMeshes;
+	const InstancingStats instancing = FindMeshInstances(meshViews, uniqueMeshes, _Scene.sceneInstances);
+	printf("Instancing: %u shapes -> %u meshes, %zu bytes of geometry shared\n", instancing.meshesBefore, instancing.meshesAfter, instancing.bytesSaved);
+
+	// BLAS build policies and deforming shapes the scene lists, if it comes with any
+	Array<BuildPolicy> shapePolicies;
+	Array<bool> deformingShapes;
+	if (LoadBuildPolicies(fileName + kBuildPolicyExt, shapePolicies, deformingShapes)) {
+		for (SceneInstance& instance : _Scene.sceneInstances) {
+			if (instance.firstShape < shapePolicies.size()) {
+				instance.buildPolicy = shapePolicies[instance.firstShape];
+				instance.deforming = deformingShapes[instance.firstShape];
 			}
+		}
+	}
+
+	Array<MeshView> sceneMeshes(uniqueMeshes.size());
+	for (size_t i = 0; i < uniqueMeshes.size(); ++i) {
+		sceneMeshes[i] = meshViews[uniqueMeshes[i]];
+	}
+
+	// then the small static ones are merged, each group is one BLAS and one TLAS instance
+	if (_Animate && !_Scene.sceneInstances.empty()) {
+		_Scene.sceneInstances[0].dynamic = true;
+	}
+	Array<MeshData> groupedMeshes;
+	const MeshGroupingStats grouping = GroupStaticMeshes(sceneMeshes, _Scene.sceneInstances, _MeshGrouping, groupedMeshes);
+	printf("BLAS grouping: %u meshes merged into %u groups, %u -> %u TLAS instances\n", grouping.meshesGrouped, grouping.numGroups, grouping.instancesBefore, grouping.instancesAfter);
+
+	// lights are baked with the placements they're loaded with, an animated emitter would leave its light behind
+	Array<LightTriangle> lights;
+	for (const SceneInstance& instance : _Scene.sceneInstances) {
+		AppendLightTriangles(sceneMeshes[instance.meshIdx], instance.transform, materials, lights);
+	}
+	_Scene.lightsPower = FinishLightTriangles(lights);
+	_Scene.numLights = static_cast<uint32_t>(lights.size());
+	printf("Lights: %u emissive triangles, %.2f total power\n", _Scene.numLights, _Scene.lightsPower);
+
+	_Scene.meshes.resize(sceneMeshes.size());
+	_Scene.materials.resize(materials.size());
+
+	for (size_t meshIdx = 0; meshIdx < sceneMeshes.size(); ++meshIdx) {
+		RTMesh& mesh = _Scene.meshes[meshIdx];
+		const MeshView& view = sceneMeshes[meshIdx];
 
-			mesh.matIDs.Unmap();
-			mesh.indices.Unmap();
-			mesh.faces.Unmap();
-			mesh.attribs.Unmap();
-			mesh.positions.Unmap();
+		mesh.numVertices = view.numVertices;
+		mesh.numFaces = view.numFaces;
+
+		mesh.boundsMin = vec3(FLT_MAX);
+		mesh.boundsMax = vec3(-FLT_MAX);
+		for (uint32_t i = 0; i < mesh.numVertices; ++i) {
+			mesh.boundsMin = glm::min(mesh.boundsMin, view.positions[i]);
+			mesh.boundsMax = glm::max(mesh.boundsMax, view.positions[i]);
 		}
 
-		VkImageSubresourceRange subresourceRange;
-		subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		subresourceRange.baseMipLevel = 0;
-		subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-		subresourceRange.baseArrayLayer = 0;
-		subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+		const size_t positionsBufferSize = mesh.numVertices * sizeof(vec3);
+		const size_t indicesBufferSize = mesh.numFaces * 3 * sizeof(uint32_t);
+		const size_t facesBufferSize = mesh.numFaces * 4 * sizeof(uint32_t);
+		const size_t attribsBufferSize = mesh.numVertices * sizeof(VertexAttribute);
+		const size_t matIDsBufferSize = mesh.numFaces * sizeof(uint32_t);
+
+		VkResult error = mesh.positions.Create(positionsBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CHECK_VK_ERROR(error, "mesh.positions.Create");
+
+		error = mesh.indices.Create(indicesBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CHECK_VK_ERROR(error, "mesh.indices.Create");
 
-		
+		error = mesh.faces.Create(facesBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CHECK_VK_ERROR(error, "mesh.faces.Create");
+
+		error = mesh.attribs.Create(attribsBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CHECK_VK_ERROR(error, "mesh.attribs.Create");
+
+		error = mesh.matIDs.Create(matIDsBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		CHECK_VK_ERROR(error, "mesh.matIDs.Create");
+
+		// all the copies go into one command buffer, submitted by the Flush below
+		_Uploader.Upload(mesh.positions, view.positions, positionsBufferSize);
+		_Uploader.Upload(mesh.attribs, view.attribs, attribsBufferSize);
+		_Uploader.Upload(mesh.indices, view.indices, indicesBufferSize);
+		_Uploader.Upload(mesh.faces, view.faces, facesBufferSize);
+		_Uploader.Upload(mesh.matIDs, view.matIDs, matIDsBufferSize);
 	}
 
+	// both buffers get at least one element, a zero sized storage buffer can't be bound
+	Array<uint8_t> materialsData(sizeof(uvec4) + Max(materials.size(), size_t(1)) * sizeof(MaterialParams), 0);
+	const uvec4 materialsInfo(static_cast<uint32_t>(materials.size()), 0, 0, 0);
+	std::memcpy(materialsData.data(), &materialsInfo, sizeof(materialsInfo));
+	if (!materials.empty()) {
+		std::memcpy(materialsData.data() + sizeof(uvec4), materials.data(), materials.size() * sizeof(MaterialParams));
+	}
+	if (lights.empty()) {
+		lights.push_back(LightTriangle());
+	}
+	const size_t lightsBufferSize = lights.size() * sizeof(LightTriangle);
+
+	VkResult error = _Scene.materialsBuffer.Create(materialsData.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_Scene.materialsBuffer.Create");
+	error = _Scene.lightsBuffer.Create(lightsBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_Scene.lightsBuffer.Create");
+
+	_Uploader.Upload(_Scene.materialsBuffer, materialsData.data(), materialsData.size());
+	_Uploader.Upload(_Scene.lightsBuffer, lights.data(), lightsBufferSize);
+
+	if (!_Uploader.Flush()) {
+		assert(false && "Failed to upload scene geometry");
+	}
+
+	cache.Close();
+
+	const auto endTime = std::chrono::high_resolution_clock::now();
+	const double loadTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	printf("Scene %s loaded in %.2f ms (%s start, %zu meshes)\n", fileName.c_str(), loadTimeMs, warmStart ? "warm" : "cold", meshViews.size());
+
+	const double uploadedMB = static_cast<double>(_Uploader.GetBytesUploaded()) / (1024.0 * 1024.0);
+	const double uploadTimeMs = _Uploader.GetUploadTimeMs();
+	printf("Uploaded %.2f MB of geometry in %.2f ms (%.1f MB/s)\n", uploadedMB, uploadTimeMs, uploadTimeMs > 0.0 ? uploadedMB * 1000.0 / uploadTimeMs : 0.0);
+	_Uploader.ResetStats();
+
 	// prepare shader resources infos
 	const size_t numMeshes = _Scene.meshes.size();
 	const size_t numMaterials = _Scene.materials.size();
@@ -398,106 +740,578 @@ void RtxApp::LoadSceneGeometry() {
 	}
 }
 
-void RtxApp::CreateScene() {
-	const float transform[12] = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-	};
+// world space box around the mesh's object space bounds, transform is 3x4 row-major
+static void InstanceWorldBounds(const float* transform, const RTMesh& mesh, vec3& worldMin, vec3& worldMax) {
+	const float* m = transform;
+	worldMin = vec3(FLT_MAX);
+	worldMax = vec3(-FLT_MAX);
+	for (int corner = 0; corner < 8; ++corner) {
+		const vec3 p((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x,
+			(corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y,
+			(corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+		const vec3 w(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+			m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+			m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+		worldMin = glm::min(worldMin, w);
+		worldMax = glm::max(worldMax, w);
+	}
+}
+
+static VkBuildAccelerationStructureFlagsNV GetBuildFlags(const BuildPolicy policy) {
+	switch (policy) {
+	case BuildPolicy::FastBuild:
+		return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV;
+	case BuildPolicy::LowMemory:
+		return VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV;
+	default:
+		return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_NV;
+	}
+}
 
+// a mesh shared by instances that ask for different policies gets the one it can't do without:
+// updates (fast build) first, then trace speed, then memory
+static BuildPolicy StrongerBuildPolicy(const BuildPolicy a, const BuildPolicy b) {
+	static const uint32_t sRank[] = { 0, 2, 3, 1 };    // Auto, FastTrace, FastBuild, LowMemory
+	return (sRank[static_cast<uint32_t>(b)] > sRank[static_cast<uint32_t>(a)]) ? b : a;
+}
+
+static VkGeometryNV MakeBLASGeometry(const RTMesh& mesh) {
+	VkGeometryNV geometry;
+	geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
+	geometry.pNext = nullptr;
+	geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
+	geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
+	geometry.geometry.triangles.pNext = nullptr;
+	geometry.geometry.triangles.vertexData = mesh.positions.GetBuffer();
+	geometry.geometry.triangles.vertexOffset = 0;
+	geometry.geometry.triangles.vertexCount = mesh.numVertices;
+	geometry.geometry.triangles.vertexStride = sizeof(vec3);
+	geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+	geometry.geometry.triangles.indexData = mesh.indices.GetBuffer();
+	geometry.geometry.triangles.indexOffset = 0;
+	geometry.geometry.triangles.indexCount = mesh.numFaces * 3;
+	geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+	geometry.geometry.triangles.transformData = VK_NULL_HANDLE;
+	geometry.geometry.triangles.transformOffset = 0;
+	geometry.geometry.aabbs = { };
+	geometry.geometry.aabbs.sType = VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV;
+	geometry.flags = VK_GEOMETRY_OPAQUE_BIT_NV;
+	return geometry;
+}
+
+// Every mesh gets a policy: --blas-policy forces one for all, then comes what the scene metadata asks for
+// (the strongest one, if its instances disagree), the rest is guessed - deforming meshes build fast, meshes
+// that look tiny from where the camera starts are background and go low memory, everything else traces fast.
+// An instance that only moves rigidly never touches its BLAS (the TLAS refit takes care of it), so it
+// traces fast, and isn't sent to low memory either since the start camera says little about where it goes.
+void RtxApp::ChooseBuildPolicies() {
 	const size_t numMeshes = _Scene.meshes.size();
 
-	Array<VkGeometryNV> geometries(numMeshes);
-	Array<VkGeometryInstance> instances(numMeshes);
+	Array<BuildPolicy> requested(numMeshes, BuildPolicy::Auto);
+	Array<bool> dynamic(numMeshes, false);
+	Array<bool> deforming(numMeshes, false);
+	Array<float> angularSizes(numMeshes, 0.0f);
+	for (const SceneInstance& instance : _Scene.sceneInstances) {
+		const uint32_t meshIdx = instance.meshIdx;
+		requested[meshIdx] = StrongerBuildPolicy(requested[meshIdx], instance.buildPolicy);
+		dynamic[meshIdx] = dynamic[meshIdx] || instance.dynamic;
+		deforming[meshIdx] = deforming[meshIdx] || instance.deforming;
+
+		vec3 worldMin, worldMax;
+		InstanceWorldBounds(instance.transform, _Scene.meshes[meshIdx], worldMin, worldMax);
+		const float radius = 0.5f * glm::length(worldMax - worldMin);
+		const float distance = glm::length((worldMin + worldMax) * 0.5f - sCameraStartPos);
+		angularSizes[meshIdx] = Max(angularSizes[meshIdx], (distance > radius) ? radius / distance : FLT_MAX);
+	}
 
+	uint32_t numPerPolicy[static_cast<uint32_t>(BuildPolicy::Count)] = { };
 	for (size_t i = 0; i < numMeshes; ++i) {
-		RTMesh& mesh = _Scene.meshes[i];
-		VkGeometryNV& geometry = geometries[i];
-
-		geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
-		geometry.pNext = nullptr;
-		geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
-		geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
-		geometry.geometry.triangles.pNext = nullptr;
-		geometry.geometry.triangles.vertexData = mesh.positions.GetBuffer();
-		geometry.geometry.triangles.vertexOffset = 0;
-		geometry.geometry.triangles.vertexCount = mesh.numVertices;
-		geometry.geometry.triangles.vertexStride = sizeof(vec3);
-		geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-		geometry.geometry.triangles.indexData = mesh.indices.GetBuffer();
-		geometry.geometry.triangles.indexOffset = 0;
-		geometry.geometry.triangles.indexCount = mesh.numFaces * 3;
-		geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-		geometry.geometry.triangles.transformData = VK_NULL_HANDLE;
-		geometry.geometry.triangles.transformOffset = 0;
-		geometry.geometry.aabbs = { };
-		geometry.geometry.aabbs.sType = VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV;
-		geometry.flags = VK_GEOMETRY_OPAQUE_BIT_NV;
-
-		CreateAS(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV, 1, &geometry, 0, mesh.blas);
-
-		VkGeometryInstance& instance = instances[i];
-		std::memcpy(instance.transform, transform, sizeof(transform));
-		instance.instanceId = static_cast<uint32_t>(i);
+		BuildPolicy& policy = _Scene.meshes[i].buildPolicy;
+		if (BuildPolicy::Auto != _ForcedBuildPolicy) {
+			policy = _ForcedBuildPolicy;
+		}
+		else if (BuildPolicy::Auto != requested[i]) {
+			policy = requested[i];
+		}
+		else if (deforming[i]) {
+			policy = BuildPolicy::FastBuild;
+		}
+		else if (!dynamic[i] && angularSizes[i] < sBackgroundAngularSize) {
+			policy = BuildPolicy::LowMemory;
+		}
+		else {
+			policy = BuildPolicy::FastTrace;
+		}
+		++numPerPolicy[static_cast<uint32_t>(policy)];
+	}
+
+	printf("BLAS policies: %u fast-trace, %u fast-build, %u low-memory\n",
+		numPerPolicy[static_cast<uint32_t>(BuildPolicy::FastTrace)],
+		numPerPolicy[static_cast<uint32_t>(BuildPolicy::FastBuild)],
+		numPerPolicy[static_cast<uint32_t>(BuildPolicy::LowMemory)]);
+}
+
+void RtxApp::CreateScene() {
+	const size_t numMeshes = _Scene.meshes.size();
+
+	ChooseBuildPolicies();
+
+	const BLASBuildStats buildStats = BuildBLASes();
+	printf("BLAS builds took %.2f ms (GPU %.3f ms)\n", buildStats.wallMs, buildStats.gpuMs);
+	printf("BLAS compaction: %zu meshes, %llu -> %llu bytes (%.1f%%)\n", numMeshes,
+		static_cast<unsigned long long>(buildStats.builtBytes), static_cast<unsigned long long>(buildStats.compactedBytes),
+		buildStats.builtBytes ? 100.0 * static_cast<double>(buildStats.compactedBytes) / static_cast<double>(buildStats.builtBytes) : 0.0);
+
+	// the BLAS handles are filled in by RebuildTLAS, they change whenever the BLASes are rebuilt
+	const size_t numInstances = _Scene.sceneInstances.size();
+	_Scene.instances.resize(numInstances);
+	for (size_t i = 0; i < numInstances; ++i) {
+		const SceneInstance& sceneInstance = _Scene.sceneInstances[i];
+		VkGeometryInstance& instance = _Scene.instances[i];
+		std::memcpy(instance.transform, sceneInstance.transform, sizeof(sceneInstance.transform));
+		instance.instanceId = sceneInstance.meshIdx;
 		instance.mask = 0xff;
 		instance.instanceOffset = 0;
 		instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_CULL_DISABLE_BIT_NV;
-		instance.accelerationStructureHandle = mesh.blas.handle;
+		instance.accelerationStructureHandle = 0;
 	}
+	printf("TLAS: %zu instances over %zu BLASes\n", numInstances, numMeshes);
 
-	helpers::Buffer instancesBuffer;
-	VkResult error = instancesBuffer.Create(instances.size() * sizeof(VkGeometryInstance), VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	CHECK_VK_ERROR(error, "instancesBuffer.Create");
+	// the hit shader gets the shape it hit from here plus faces.w
+	Array<uint32_t> firstShapes(numInstances);
+	for (size_t i = 0; i < numInstances; ++i) {
+		firstShapes[i] = _Scene.sceneInstances[i].firstShape;
+	}
+
+	VkResult error = _Scene.instanceShapes.Create(firstShapes.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_Scene.instanceShapes.Create");
 
-	if (!instancesBuffer.UploadData(instances.data(), instancesBuffer.GetSize())) {
-		assert(false && "Failed to upload instances buffer");
+	if (!_Uploader.Upload(_Scene.instanceShapes, firstShapes.data(), _Scene.instanceShapes.GetSize()) || !_Uploader.Flush()) {
+		assert(false && "Failed to upload instance shapes");
 	}
 
-	CreateAS(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV, 0, nullptr, 1, _Scene.topLevelAS);
+	// instances change from frame to frame, so every frame in flight gets its own host visible slice
+	const VkDeviceSize instancesSliceSize = _Scene.instances.size() * sizeof(VkGeometryInstance);
+	error = _Scene.instancesBuffer.Create(instancesSliceSize * _Settings.framesInFlight, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	CHECK_VK_ERROR(error, "_Scene.instancesBuffer.Create");
 
+	if (!_Scene.instancesBuffer.MapPersistent()) {
+		assert(false && "Failed to map instances buffer");
+	}
+
+	CreateAS(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV, 0, nullptr, static_cast<uint32_t>(_Scene.instances.size()),
+		VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_NV | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV, 0, _Scene.topLevelAS);
+
+	// the scratch stays around for the per frame updates
 	VkAccelerationStructureMemoryRequirementsInfoNV memoryRequirementsInfo;
 	memoryRequirementsInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
 	memoryRequirementsInfo.pNext = nullptr;
+	memoryRequirementsInfo.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
+	memoryRequirementsInfo.accelerationStructure = _Scene.topLevelAS.accelerationStructure;
 
-	VkDeviceSize maximumBlasSize = 0;
-	for (const RTMesh& mesh : _Scene.meshes) {
-		memoryRequirementsInfo.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
-		memoryRequirementsInfo.accelerationStructure = mesh.blas.accelerationStructure;
+	VkMemoryRequirements2 memReqBuild;
+	vkGetAccelerationStructureMemoryRequirementsNV(_Device, &memoryRequirementsInfo, &memReqBuild);
+
+	memoryRequirementsInfo.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_NV;
+	VkMemoryRequirements2 memReqUpdate;
+	vkGetAccelerationStructureMemoryRequirementsNV(_Device, &memoryRequirementsInfo, &memReqUpdate);
+
+	const VkDeviceSize scratchSize = Max(memReqBuild.memoryRequirements.size, memReqUpdate.memoryRequirements.size);
+	error = _Scene.tlasScratch.Create(scratchSize, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_Scene.tlasScratch.Create");
+
+	// sFrameTimestamps per frame in flight, around that frame's refit or rebuild and its trace
+	_TLASPendingUpdate.assign(_Settings.framesInFlight, 0);
+	_TracePending.assign(_Settings.framesInFlight, false);
+	if (_TimestampPeriod > 0.0f) {
+		VkQueryPoolCreateInfo queryPoolCreateInfo;
+		queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolCreateInfo.pNext = nullptr;
+		queryPoolCreateInfo.flags = 0;
+		queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCreateInfo.queryCount = sFrameTimestamps * _Settings.framesInFlight;
+		queryPoolCreateInfo.pipelineStatistics = 0;
+
+		error = vkCreateQueryPool(_Device, &queryPoolCreateInfo, nullptr, &_FrameTimestampPool);
+		CHECK_VK_ERROR(error, "vkCreateQueryPool");
+	}
 
-		VkMemoryRequirements2 memReqBLAS;
-		vkGetAccelerationStructureMemoryRequirementsNV(_Device, &memoryRequirementsInfo, &memReqBLAS);
+	RebuildTLAS();
+}
+
+// BLASes are built a batch at a time and compacted right away, so at most sBlasBatchSize of
+// uncompacted memory is alive on top of what's already compacted. Each with the flags of its mesh's policy.
+BLASBuildStats RtxApp::BuildBLASes() {
+	const auto buildStart = std::chrono::high_resolution_clock::now();
+	const size_t numMeshes = _Scene.meshes.size();
+
+	Array<VkGeometryNV> geometries(numMeshes);
+	for (size_t i = 0; i < numMeshes; ++i) {
+		geometries[i] = MakeBLASGeometry(_Scene.meshes[i]);
+	}
+
+	BLASBuildStats stats;
+	for (size_t first = 0; first < numMeshes;) {
+		size_t last = first;
+		VkDeviceSize batchBytes = 0;
+		while (last < numMeshes && batchBytes < sBlasBatchSize) {
+			RTMesh& mesh = _Scene.meshes[last];
+			CreateAS(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV, 1, &geometries[last], 0, GetBuildFlags(mesh.buildPolicy), 0, mesh.blas);
+			batchBytes += mesh.blas.memory.size;
+			++last;
+		}
+
+		BuildBLASBatch(geometries, first, last, stats);
+		first = last;
+	}
+
+	stats.wallMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+	return stats;
+}
+
+// Points the instances at the current BLASes and builds the TLAS from scratch, outside of the frame loop
+void RtxApp::RebuildTLAS() {
+	const size_t numInstances = _Scene.instances.size();
+	for (VkGeometryInstance& instance : _Scene.instances) {
+		instance.accelerationStructureHandle = _Scene.meshes[instance.instanceId].blas.handle;
+	}
+	std::memcpy(_Scene.instancesBuffer.GetMappedMemory(), _Scene.instances.data(), numInstances * sizeof(VkGeometryInstance));
+
+	VkCommandBuffer commandBuffer = BeginOneTimeCommands();
+
+	VkMemoryBarrier memoryBarrier;
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.pNext = nullptr;
+	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+
+	RecordTLASBuild(commandBuffer, 0, false);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+
+	SubmitOneTimeCommands(commandBuffer);
+
+	_Scene.instanceBuildCenters.resize(numInstances);
+	for (size_t i = 0; i < numInstances; ++i) {
+		vec3 worldMin, worldMax;
+		InstanceWorldBounds(_Scene.instances[i].transform, _Scene.meshes[_Scene.instances[i].instanceId], worldMin, worldMax);
+		_Scene.instanceBuildCenters[i] = (worldMin + worldMax) * 0.5f;
+	}
+	_Scene.numRefitsSinceBuild = 0;
+	_Scene.instancesDirty = false;
+}
+
+// builds the TLAS from the instances at instancesOffset of instancesBuffer, or refits it in place with update
+void RtxApp::RecordTLASBuild(VkCommandBuffer commandBuffer, const VkDeviceSize instancesOffset, const bool update) {
+	RTAccelerationStructure& tlas = _Scene.topLevelAS;
+	tlas.accelerationStructureInfo.instanceCount = static_cast<uint32_t>(_Scene.instances.size());
+	tlas.accelerationStructureInfo.geometryCount = 0;
+	tlas.accelerationStructureInfo.pGeometries = nullptr;
+
+	// an update reads the old tree from src, for a refit that's the TLAS itself
+	vkCmdBuildAccelerationStructureNV(commandBuffer, &tlas.accelerationStructureInfo,
+		_Scene.instancesBuffer.GetBuffer(), instancesOffset, update ? VK_TRUE : VK_FALSE,
+		tlas.accelerationStructure, update ? tlas.accelerationStructure : VK_NULL_HANDLE,
+		_Scene.tlasScratch.GetBuffer(), 0);
+}
+
+// Refits the TLAS in place when instances changed, or rebuilds it when a refit would leave it too loose:
+// once any instance has moved further than its own size since the last build (the refit keeps the old
+// tree topology, so its boxes stretch over the path) or after sMaxTLASRefits refits in a row.
+void RtxApp::UpdateTLAS(VkCommandBuffer commandBuffer, const size_t frameIndex) {
+	_TLASPendingUpdate[frameIndex] = 0;
+	if (!_Scene.instancesDirty) {
+		return;
+	}
+
+	const size_t numInstances = _Scene.instances.size();
+	bool rebuild = (_Scene.numRefitsSinceBuild >= sMaxTLASRefits);
+
+	Array<vec3> centers(numInstances);
+	for (size_t i = 0; i < numInstances; ++i) {
+		vec3 worldMin, worldMax;
+		InstanceWorldBounds(_Scene.instances[i].transform, _Scene.meshes[_Scene.instances[i].instanceId], worldMin, worldMax);
+
+		centers[i] = (worldMin + worldMax) * 0.5f;
+		if (glm::length(centers[i] - _Scene.instanceBuildCenters[i]) > sTLASRebuildDistance * glm::length(worldMax - worldMin)) {
+			rebuild = true;
+		}
+	}
+
+	// nothing on the GPU reads this frame's slice anymore, the frame slot has been waited on
+	const VkDeviceSize instancesSliceSize = numInstances * sizeof(VkGeometryInstance);
+	const VkDeviceSize instancesOffset = frameIndex * instancesSliceSize;
+	std::memcpy(reinterpret_cast<uint8_t*>(_Scene.instancesBuffer.GetMappedMemory()) + instancesOffset, _Scene.instances.data(), instancesSliceSize);
+
+	// the previous frame's rays are still reading the TLAS (and the scratch may still be in use by its update)
+	VkMemoryBarrier memoryBarrier;
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.pNext = nullptr;
+	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+
+	const uint32_t firstQuery = static_cast<uint32_t>(frameIndex * sFrameTimestamps);
+	if (_FrameTimestampPool) {
+		vkCmdResetQueryPool(commandBuffer, _FrameTimestampPool, firstQuery, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _FrameTimestampPool, firstQuery);
+	}
+
+	RecordTLASBuild(commandBuffer, instancesOffset, !rebuild);
+
+	if (_FrameTimestampPool) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, _FrameTimestampPool, firstQuery + 1);
+	}
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+
+	if (rebuild) {
+		_Scene.instanceBuildCenters.swap(centers);
+		_Scene.numRefitsSinceBuild = 0;
+		++_Scene.tlasStats.numRebuilds;
+	}
+	else {
+		++_Scene.numRefitsSinceBuild;
+		++_Scene.tlasStats.numRefits;
+	}
+	_Scene.instancesDirty = false;
+	_TLASPendingUpdate[frameIndex] = rebuild ? 2 : 1;
+}
+
+// Traces one frame into the offscreen image with frameIndex's camera slice, queryPool (if there is one)
+// gets the start and the end of the trace at firstQuery and firstQuery + 1.
+void RtxApp::RecordTrace(VkCommandBuffer commandBuffer, const size_t frameIndex, VkQueryPool queryPool, const uint32_t firstQuery) {
+	vkCmdBindPipeline(commandBuffer,
+		VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
+		_RTXPipeline);
+
+	// every frame in flight reads its own camera slice and counts into its own counters, in binding order
+	const uint32_t dynamicOffsets[2] = {
+		static_cast<uint32_t>(frameIndex * _CameraSliceSize),
+		static_cast<uint32_t>(frameIndex * _RayCountersSliceSize)
+	};
+
+	vkCmdBindDescriptorSets(commandBuffer,
+		VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
+		_RTXPipelineLayout, 0,
+		static_cast<uint32_t>(_RTXDescriptorSets.size()), _RTXDescriptorSets.data(),
+		2, dynamicOffsets);
+
+	// the previous frame's stats are read back here, the first frame after a restart ignores them in the shader
+	VkMemoryBarrier memoryBarrier;
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.pNext = nullptr;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+
+	if (queryPool) {
+		vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, firstQuery);
+	}
+
+	vkCmdTraceRaysNV(commandBuffer,
+		rtxHelper.GetSBTBuffer(), rtxHelper.GetRaygenOffset(),
+		rtxHelper.GetSBTBuffer(), rtxHelper.GetMissGroupsOffset(), rtxHelper.GetGroupsStride(),
+		rtxHelper.GetSBTBuffer(), rtxHelper.GetHitGroupsOffset(), rtxHelper.GetGroupsStride(),
+		VK_NULL_HANDLE, 0, 0,
+		_Settings.resolutionX, _Settings.resolutionY, 1u);
+
+	if (queryPool) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, queryPool, firstQuery + 1);
+	}
+}
+
+// Filters what RecordTrace just wrote: denoise_temporal.glsl, then SWS_DENOISE_ITERATIONS passes of denoise_atrous.glsl,
+// the last of which overwrites the result image. Every pass reads the whole output of the one before
+void RtxApp::RecordDenoise(VkCommandBuffer commandBuffer, const size_t frameIndex) {
+	const uint32_t dynamicOffsets[2] = {
+		static_cast<uint32_t>(frameIndex * _CameraSliceSize),
+		static_cast<uint32_t>(frameIndex * _RayCountersSliceSize)
+	};
+
+	vkCmdBindDescriptorSets(commandBuffer,
+		VK_PIPELINE_BIND_POINT_COMPUTE,
+		_DenoisePipelineLayout, 0,
+		1, &_RTXDescriptorSets[SWS_SCENE_AS_SET],
+		2, dynamicOffsets);
+
+	VkMemoryBarrier memoryBarrier;
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.pNext = nullptr;
+	memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	// the trace's pixels and surfaces, and the history the last frame's passes left
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+
+	const uint32_t groupsX = (_Settings.resolutionX + SWS_DENOISE_GROUP_SIZE - 1) / SWS_DENOISE_GROUP_SIZE;
+	const uint32_t groupsY = (_Settings.resolutionY + SWS_DENOISE_GROUP_SIZE - 1) / SWS_DENOISE_GROUP_SIZE;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _DenoiseTemporalPipeline);
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _DenoiseAtrousPipeline);
+	for (uint32_t iteration = 0; iteration < SWS_DENOISE_ITERATIONS; ++iteration) {
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+		vkCmdPushConstants(commandBuffer, _DenoisePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &iteration);
+		vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+	}
+
+	// the next trace overwrites the pixel stats these passes read
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+}
+
+// called once the frame slot has been waited on, so its timestamps are there
+void RtxApp::ReadFrameTimestamps(const size_t frameIndex) {
+	if (!_FrameTimestampPool || frameIndex >= _TracePending.size()) {
+		return;
+	}
+
+	const double msPerTick = static_cast<double>(_TimestampPeriod) * 1e-6;
+	const uint32_t firstQuery = static_cast<uint32_t>(frameIndex * sFrameTimestamps);
+	uint64_t timestamps[2] = { 0, 0 };
+
+	if (_TLASPendingUpdate[frameIndex]) {
+		const VkResult error = vkGetQueryPoolResults(_Device, _FrameTimestampPool, firstQuery, 2,
+			sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		if (VK_SUCCESS == error) {
+			const double ms = static_cast<double>((timestamps[1] - timestamps[0]) & _TimestampMask) * msPerTick;
+			TLASStats& stats = _Scene.tlasStats;
+			if (2 == _TLASPendingUpdate[frameIndex]) {
+				stats.rebuildMs += ms;
+				stats.lastRebuildMs = ms;
+			}
+			else {
+				stats.refitMs += ms;
+				stats.lastRefitMs = ms;
+			}
+		}
+		_TLASPendingUpdate[frameIndex] = 0;
+	}
+
+	if (_TracePending[frameIndex]) {
+		const VkResult error = vkGetQueryPoolResults(_Device, _FrameTimestampPool, firstQuery + 2, 2,
+			sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		if (VK_SUCCESS == error) {
+			_TraceMs += static_cast<double>((timestamps[1] - timestamps[0]) & _TimestampMask) * msPerTick;
+			++_NumTracedFrames;
+		}
+		_TracePending[frameIndex] = false;
+	}
+}
+
+// called once the frame slot has been waited on, so the trace that counted into its slice is done
+void RtxApp::ReadRayCounters(const size_t frameIndex) {
+	uint8_t* countersMemory = reinterpret_cast<uint8_t*>(_RayCountersBuffer.GetMappedMemory());
+	if (!countersMemory) {
+		return;
+	}
+
+	RayCounters& counters = *reinterpret_cast<RayCounters*>(countersMemory + frameIndex * _RayCountersSliceSize);
+	if (counters.counts.x) {
+		const double numPixels = static_cast<double>(_Settings.resolutionX) * _Settings.resolutionY;
+		_RayStats.lastRaysPerPixel = static_cast<double>(counters.counts.y + counters.counts.z) / numPixels;
+		_RayStats.lastRaysPerPath = static_cast<double>(counters.counts.y) / static_cast<double>(counters.counts.x);
+
+		++_RayStats.numFrames;
+		_RayStats.numPaths += counters.counts.x;
+		_RayStats.numBounces += counters.counts.y;
+		_RayStats.numShadowRays += counters.counts.z;
+		_RayStats.numRouletteKills += counters.counts.w;
+	}
+	_RayStats.lastConvergingPixels = counters.adaptive.x;
+	counters.counts = uvec4(0);
+	counters.adaptive = uvec4(0);
+}
+
+// --animate: the first instance spins around its center and bobs up and down
+void RtxApp::AnimateInstances(const float dt) {
+	if (!_Animate || _Scene.instances.empty()) {
+		return;
+	}
+
+	_AnimationTime += dt;
 
-		maximumBlasSize = Max(maximumBlasSize, memReqBLAS.memoryRequirements.size);
+	// the motion is applied on top of where the instance was loaded
+	const SceneInstance& sceneInstance = _Scene.sceneInstances[0];
+	mat4 placement(1.0f);
+	for (int row = 0; row < 3; ++row) {
+		for (int col = 0; col < 4; ++col) {
+			placement[col][row] = sceneInstance.transform[row * 4 + col];
+		}
 	}
 
-	VkMemoryRequirements2 memReqTLAS;
+	const RTMesh& mesh = _Scene.meshes[sceneInstance.meshIdx];
+	const vec3 center = vec3(placement * vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+	const float bob = 0.25f * (mesh.boundsMax.y - mesh.boundsMin.y) * glm::sin(_AnimationTime * 2.0f);
+
+	const mat4 transform = glm::translate(center + vec3(0.0f, bob, 0.0f)) *
+		glm::rotate(_AnimationTime, vec3(0.0f, 1.0f, 0.0f)) *
+		glm::translate(-center) * placement;
+	SetInstanceTransform(0, transform);
+}
+
+// Builds the BLASes of [first, last) (already created with ALLOW_COMPACTION), reads back their compacted
+// sizes, copies each into a right-sized one and destroys the original.
+// Builds get disjoint ranges of a scratch pool of up to _ScratchBudget bytes, so the ones sharing the pool
+// don't depend on each other and the GPU can overlap them. A barrier only goes in when the pool is used up,
+// or after every build with --blas-build-timing, since overlapping builds have no time of their own.
+void RtxApp::BuildBLASBatch(const Array<VkGeometryNV>& geometries, const size_t first, const size_t last, BLASBuildStats& stats) {
+	const uint32_t count = static_cast<uint32_t>(last - first);
+
+	VkAccelerationStructureMemoryRequirementsInfoNV memoryRequirementsInfo;
+	memoryRequirementsInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
+	memoryRequirementsInfo.pNext = nullptr;
 	memoryRequirementsInfo.type = VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
-	memoryRequirementsInfo.accelerationStructure = _Scene.topLevelAS.accelerationStructure;
-	vkGetAccelerationStructureMemoryRequirementsNV(_Device, &memoryRequirementsInfo, &memReqTLAS);
 
-	const VkDeviceSize scratchBufferSize = Max(maximumBlasSize, memReqTLAS.memoryRequirements.size);
+	Array<VkAccelerationStructureNV> structures(count);
+	Array<VkDeviceSize> scratchSizes(count);
+	VkDeviceSize scratchAlignment = sScratchAlignment;
+	for (size_t i = first; i < last; ++i) {
+		memoryRequirementsInfo.accelerationStructure = _Scene.meshes[i].blas.accelerationStructure;
 
-	helpers::Buffer scratchBuffer;
-	error = scratchBuffer.Create(scratchBufferSize, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	CHECK_VK_ERROR(error, "scratchBuffer.Create");
+		VkMemoryRequirements2 memReqBLAS;
+		vkGetAccelerationStructureMemoryRequirementsNV(_Device, &memoryRequirementsInfo, &memReqBLAS);
 
-	VkCommandBufferAllocateInfo commandBufferAllocateInfo;
-	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferAllocateInfo.pNext = nullptr;
-	commandBufferAllocateInfo.commandPool = _CommandPool;
-	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	commandBufferAllocateInfo.commandBufferCount = 1;
+		scratchSizes[i - first] = memReqBLAS.memoryRequirements.size;
+		scratchAlignment = Max(scratchAlignment, memReqBLAS.memoryRequirements.alignment);
+		structures[i - first] = _Scene.meshes[i].blas.accelerationStructure;
+	}
 
-	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-	error = vkAllocateCommandBuffers(_Device, &commandBufferAllocateInfo, &commandBuffer);
-	CHECK_VK_ERROR(error, "vkAllocateCommandBuffers");
+	VkDeviceSize totalScratchSize = 0, maxScratchSize = 0;
+	for (VkDeviceSize& size : scratchSizes) {
+		size = (size + scratchAlignment - 1) & ~(scratchAlignment - 1);
+		totalScratchSize += size;
+		maxScratchSize = Max(maxScratchSize, size);
+	}
+	// never less than the biggest build needs, never more than all of them together
+	const VkDeviceSize scratchBufferSize = Max(Min(_ScratchBudget, totalScratchSize), maxScratchSize);
 
-	VkCommandBufferBeginInfo beginInfo;
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.pNext = nullptr;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	beginInfo.pInheritanceInfo = nullptr;
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	helpers::Buffer scratchBuffer;
+	VkResult error = scratchBuffer.Create(scratchBufferSize, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "scratchBuffer.Create");
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo;
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.pNext = nullptr;
+	queryPoolCreateInfo.flags = 0;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_NV;
+	queryPoolCreateInfo.queryCount = count;
+	queryPoolCreateInfo.pipelineStatistics = 0;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	error = vkCreateQueryPool(_Device, &queryPoolCreateInfo, nullptr, &queryPool);
+	CHECK_VK_ERROR(error, "vkCreateQueryPool");
+
+	// start of the batch and its end, or the end of every build when they run one after the other
+	const uint32_t numTimestamps = _TimeEachBuild ? count + 1 : 2;
+	VkQueryPool timestampPool = VK_NULL_HANDLE;
+	if (_TimestampPeriod > 0.0f) {
+		queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolCreateInfo.queryCount = numTimestamps;
+		error = vkCreateQueryPool(_Device, &queryPoolCreateInfo, nullptr, &timestampPool);
+		CHECK_VK_ERROR(error, "vkCreateQueryPool");
+	}
 
 	VkMemoryBarrier memoryBarrier;
 	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
@@ -505,55 +1319,270 @@ void RtxApp::CreateScene() {
 	memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
 	memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
 
-	for (size_t i = 0; i < numMeshes; ++i) {
-		_Scene.meshes[i].blas.accelerationStructureInfo.instanceCount = 0;
-		_Scene.meshes[i].blas.accelerationStructureInfo.geometryCount = 1;
-		_Scene.meshes[i].blas.accelerationStructureInfo.pGeometries = &geometries[i];
-		vkCmdBuildAccelerationStructureNV(commandBuffer, &_Scene.meshes[i].blas.accelerationStructureInfo,
+	VkCommandBuffer commandBuffer = BeginOneTimeCommands();
+	vkCmdResetQueryPool(commandBuffer, queryPool, 0, count);
+	if (timestampPool) {
+		vkCmdResetQueryPool(commandBuffer, timestampPool, 0, numTimestamps);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+	}
+
+	VkDeviceSize scratchOffset = 0;
+	uint32_t numGroups = 1;
+	for (size_t i = first; i < last; ++i) {
+		const uint32_t idx = static_cast<uint32_t>(i - first);
+		if (scratchOffset + scratchSizes[idx] > scratchBufferSize) {
+			// the pool is used up, the next builds reuse it once these are done
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+			scratchOffset = 0;
+			++numGroups;
+		}
+
+		RTAccelerationStructure& blas = _Scene.meshes[i].blas;
+		blas.accelerationStructureInfo.instanceCount = 0;
+		blas.accelerationStructureInfo.geometryCount = 1;
+		blas.accelerationStructureInfo.pGeometries = &geometries[i];
+		vkCmdBuildAccelerationStructureNV(commandBuffer, &blas.accelerationStructureInfo,
 			VK_NULL_HANDLE, 0, VK_FALSE,
-			_Scene.meshes[i].blas.accelerationStructure, VK_NULL_HANDLE,
-			scratchBuffer.GetBuffer(), 0);
+			blas.accelerationStructure, VK_NULL_HANDLE,
+			scratchBuffer.GetBuffer(), scratchOffset);
 
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+		if (_TimeEachBuild) {
+			// the next build waits for this one, so the time between two timestamps is one build
+			if (timestampPool) {
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, timestampPool, idx + 1);
+			}
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+		}
+		scratchOffset += scratchSizes[idx];
+	}
+	if (timestampPool && !_TimeEachBuild) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, timestampPool, 1);
 	}
 
-	
-	_Scene.topLevelAS.accelerationStructureInfo.instanceCount = static_cast<uint32_t>(instances.size());
-	_Scene.topLevelAS.accelerationStructureInfo.geometryCount = 0;
-	_Scene.topLevelAS.accelerationStructureInfo.pGeometries = nullptr;
-	vkCmdBuildAccelerationStructureNV(commandBuffer, &_Scene.topLevelAS.accelerationStructureInfo,
-		instancesBuffer.GetBuffer(), 0, VK_FALSE,
-		_Scene.topLevelAS.accelerationStructure, VK_NULL_HANDLE,
-		scratchBuffer.GetBuffer(), 0);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+	vkCmdWriteAccelerationStructuresPropertiesNV(commandBuffer, count, structures.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_NV, queryPool, 0);
+	SubmitOneTimeCommands(commandBuffer);
+
+	Array<uint64_t> compactedSizes(count);
+	error = vkGetQueryPoolResults(_Device, queryPool, 0, count, count * sizeof(uint64_t), compactedSizes.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	CHECK_VK_ERROR(error, "vkGetQueryPoolResults");
+	vkDestroyQueryPool(_Device, queryPool, nullptr);
+	scratchBuffer.Destroy();
+
+	// A timestamp lands once every earlier command got past its stage, so the last one is the end of the batch.
+	// Builds that overlap have no span of their own, only serialized ones (--blas-build-timing) get a time each.
+	// The batch span is the number to compare between scratch budgets, serializing makes it longer.
+	const bool timedEachBuild = _TimeEachBuild && timestampPool;
+	Array<double> buildMs(count, 0.0);
+	double batchMs = 0.0;
+	if (timestampPool) {
+		Array<uint64_t> timestamps(numTimestamps);
+		error = vkGetQueryPoolResults(_Device, timestampPool, 0, numTimestamps, timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		CHECK_VK_ERROR(error, "vkGetQueryPoolResults");
+		vkDestroyQueryPool(_Device, timestampPool, nullptr);
+
+		const double msPerTick = static_cast<double>(_TimestampPeriod) * 1e-6;
+		for (uint32_t i = 0; timedEachBuild && i < count; ++i) {
+			buildMs[i] = static_cast<double>((timestamps[i + 1] - timestamps[i]) & _TimestampMask) * msPerTick;
+		}
+		batchMs = static_cast<double>((timestamps[numTimestamps - 1] - timestamps[0]) & _TimestampMask) * msPerTick;
+	}
 
-	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+	printf("BLAS %zu-%zu: %u builds in %u groups%s, %llu bytes of scratch, GPU %.3f ms\n", first, last - 1, count, numGroups,
+		_TimeEachBuild ? " (serialized)" : "", static_cast<unsigned long long>(scratchBufferSize), batchMs);
+	stats.gpuMs += batchMs;
+
+	Array<RTAccelerationStructure> compacted(count);
+	commandBuffer = BeginOneTimeCommands();
+	for (size_t i = first; i < last; ++i) {
+		const RTAccelerationStructure& blas = _Scene.meshes[i].blas;
+		RTAccelerationStructure& dst = compacted[i - first];
+		CreateAS(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV, 0, nullptr, 0, blas.accelerationStructureInfo.flags, compactedSizes[i - first], dst);
+		vkCmdCopyAccelerationStructureNV(commandBuffer, dst.accelerationStructure, blas.accelerationStructure, VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_NV);
+	}
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0, 1, &memoryBarrier, 0, 0, 0, 0);
+	SubmitOneTimeCommands(commandBuffer);
+
+	for (size_t i = first; i < last; ++i) {
+		RTAccelerationStructure& blas = _Scene.meshes[i].blas;
+		RTAccelerationStructure& dst = compacted[i - first];
+		if (timedEachBuild) {
+			printf("BLAS %zu: %u faces, %s, built in %.3f ms, %llu -> %llu bytes\n", i, _Scene.meshes[i].numFaces, GetBuildPolicyName(_Scene.meshes[i].buildPolicy),
+				buildMs[i - first], static_cast<unsigned long long>(blas.memory.size), static_cast<unsigned long long>(dst.memory.size));
+		}
+		else {
+			printf("BLAS %zu: %u faces, %s, %llu -> %llu bytes\n", i, _Scene.meshes[i].numFaces, GetBuildPolicyName(_Scene.meshes[i].buildPolicy),
+				static_cast<unsigned long long>(blas.memory.size), static_cast<unsigned long long>(dst.memory.size));
+		}
+		stats.builtBytes += blas.memory.size;
+		stats.compactedBytes += dst.memory.size;
 
-	vkEndCommandBuffer(commandBuffer);
+		vkDestroyAccelerationStructureNV(_Device, blas.accelerationStructure, nullptr);
+		helpers::GetAllocator().Free(blas.memory);
+		blas = dst;
+	}
+}
 
-	VkSubmitInfo submitInfo;
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.pNext = nullptr;
-	submitInfo.waitSemaphoreCount = 0;
-	submitInfo.pWaitSemaphores = nullptr;
-	submitInfo.pWaitDstStageMask = nullptr;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	submitInfo.signalSemaphoreCount = 0;
-	submitInfo.pSignalSemaphores = nullptr;
+void RtxApp::DestroyBLASes() {
+	for (RTMesh& mesh : _Scene.meshes) {
+		vkDestroyAccelerationStructureNV(_Device, mesh.blas.accelerationStructure, nullptr);
+		helpers::GetAllocator().Free(mesh.blas.memory);
+		mesh.blas.accelerationStructure = VK_NULL_HANDLE;
+	}
+}
 
-	vkQueueSubmit(_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(_GraphicsQueue);
-	vkFreeCommandBuffers(_Device, _CommandPool, 1, &commandBuffer);
+// --blas-policy-sweep: rebuilds every BLAS with one policy after the other (and last with the policies
+// ChooseBuildPolicies picked, which is what the scene keeps) and traces sSweepTraceFrames frames from
+// the start camera with each, then prints build time, BLAS memory and trace time side by side.
+void RtxApp::RunBuildPolicySweep() {
+	if (_TimestampPeriod <= 0.0f) {
+		printf("BLAS policy sweep: the queue has no timestamps, skipped\n");
+		return;
+	}
+
+	const size_t numMeshes = _Scene.meshes.size();
+	Array<BuildPolicy> chosen(numMeshes);
+	for (size_t i = 0; i < numMeshes; ++i) {
+		chosen[i] = _Scene.meshes[i].buildPolicy;
+	}
+
+	// every frame of the sweep restarts the accumulation from the same view
+	UniformParams* params = reinterpret_cast<UniformParams*>(_CameraBuffer.GetMappedMemory());
+	params->sunPosAndAmbient = vec4(sSunPos, sAmbientLight);
+	UpdateCameraParams(params, 0.0f);
+	params->frameData = uvec4(0, SWS_SAMPLES_PER_FRAME, _RenderFlags, _RouletteDepth);
+	params->lightsInfo = vec4(static_cast<float>(_Scene.numLights), _Scene.lightsPower, 0.0f, 0.0f);
+	params->samplingData = uvec4(_SamplerType, 0, 0, 0);
+	_AccumFrameIndex = 0;
+
+	VkQueryPoolCreateInfo queryPoolCreateInfo;
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.pNext = nullptr;
+	queryPoolCreateInfo.flags = 0;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = sSweepTraceFrames * 2;
+	queryPoolCreateInfo.pipelineStatistics = 0;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	VkResult error = vkCreateQueryPool(_Device, &queryPoolCreateInfo, nullptr, &queryPool);
+	CHECK_VK_ERROR(error, "vkCreateQueryPool");
+
+	static const BuildPolicy sSweepPolicies[] = { BuildPolicy::FastTrace, BuildPolicy::FastBuild, BuildPolicy::LowMemory, BuildPolicy::Auto };
+	struct SweepResult {
+		BLASBuildStats  build;
+		double          traceMs;
+	};
+	Array<SweepResult> results;
+
+	const double msPerTick = static_cast<double>(_TimestampPeriod) * 1e-6;
+	VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	for (const BuildPolicy policy : sSweepPolicies) {
+		DestroyBLASes();
+		for (size_t i = 0; i < numMeshes; ++i) {
+			_Scene.meshes[i].buildPolicy = (BuildPolicy::Auto == policy) ? chosen[i] : policy;
+		}
+
+		SweepResult result;
+		result.build = BuildBLASes();
+		RebuildTLAS();
+
+		VkCommandBuffer commandBuffer = BeginOneTimeCommands();
+		for (uint32_t frame = 0; frame < sSweepTraceFrames; ++frame) {
+			helpers::ImageBarrier(commandBuffer,
+				_OffscreenImage.GetImage(),
+				subresourceRange,
+				VK_ACCESS_SHADER_WRITE_BIT,
+				VK_ACCESS_SHADER_WRITE_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_GENERAL);
+			RecordTrace(commandBuffer, 0, queryPool, frame * 2);
+		}
+		SubmitOneTimeCommands(commandBuffer);
+
+		uint64_t timestamps[sSweepTraceFrames * 2];
+		error = vkGetQueryPoolResults(_Device, queryPool, 0, sSweepTraceFrames * 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		CHECK_VK_ERROR(error, "vkGetQueryPoolResults");
+
+		result.traceMs = 0.0;
+		for (uint32_t frame = 0; frame < sSweepTraceFrames; ++frame) {
+			result.traceMs += static_cast<double>((timestamps[frame * 2 + 1] - timestamps[frame * 2]) & _TimestampMask) * msPerTick;
+		}
+		result.traceMs /= sSweepTraceFrames;
+		results.push_back(result);
+	}
+
+	vkDestroyQueryPool(_Device, queryPool, nullptr);
+
+	// the sweep traced into the first slice, that's not a frame of the app
+	std::memset(_RayCountersBuffer.GetMappedMemory(), 0, sizeof(RayCounters));
+
+	printf("BLAS policy sweep, %zu meshes, trace averaged over %u frames:\n", numMeshes, sSweepTraceFrames);
+	printf("  %-12s %10s %12s %14s %10s\n", "policy", "build ms", "build GPU ms", "BLAS bytes", "trace ms");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const SweepResult& result = results[i];
+		printf("  %-12s %10.2f %12.3f %14llu %10.3f\n", (BuildPolicy::Auto == sSweepPolicies[i]) ? "chosen" : GetBuildPolicyName(sSweepPolicies[i]),
+			result.build.wallMs, result.build.gpuMs, static_cast<unsigned long long>(result.build.compactedBytes), result.traceMs);
+	}
 }
 
 void RtxApp::CreateCamera() {
-	VkResult error = _CameraBuffer.Create(sizeof(UniformParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(_PhysicalDevice, &deviceProperties);
+
+	const VkDeviceSize alignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+	_CameraSliceSize = (sizeof(UniformParams) + alignment - 1) & ~(alignment - 1);
+
+	VkResult error = _CameraBuffer.Create(_CameraSliceSize * _Settings.framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 	CHECK_VK_ERROR(error, "_CameraBuffer.Create");
 
+	if (!_CameraBuffer.MapPersistent()) {
+		assert(false && "Failed to map camera buffer");
+	}
+
 	_Camera.SetViewport({ 0, 0, static_cast<int>(_Settings.resolutionX), static_cast<int>(_Settings.resolutionY) });
 	_Camera.SetViewPlanes(0.1f, 100.0f);
 	_Camera.SetFovY(45.0f);
-	_Camera.LookAt(vec3(0.25f, 3.20f, 6.15f), vec3(0.25f, 2.75f, 5.25f));
+	_Camera.LookAt(sCameraStartPos, sCameraStartTarget);
+}
+
+void RtxApp::CreateRayCounters() {
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(_PhysicalDevice, &deviceProperties);
+
+	const VkDeviceSize alignment = deviceProperties.limits.minStorageBufferOffsetAlignment;
+	_RayCountersSliceSize = (sizeof(RayCounters) + alignment - 1) & ~(alignment - 1);
+
+	VkResult error = _RayCountersBuffer.Create(_RayCountersSliceSize * _Settings.framesInFlight, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	CHECK_VK_ERROR(error, "_RayCountersBuffer.Create");
+
+	if (!_RayCountersBuffer.MapPersistent()) {
+		assert(false && "Failed to map ray counters buffer");
+	}
+	std::memset(_RayCountersBuffer.GetMappedMemory(), 0, _RayCountersBuffer.GetSize());
+}
+
+void RtxApp::CreatePixelStatsBuffer() {
+	const VkDeviceSize size = static_cast<VkDeviceSize>(_Settings.resolutionX) * _Settings.resolutionY * sizeof(PixelStats);
+	VkResult error = _PixelStatsBuffer.Create(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_PixelStatsBuffer.Create");
+
+	// contents are garbage until the first frame writes them, see ray_gen.glsl
+	_AccumFrameIndex = 0;
+}
+
+void RtxApp::CreateDenoiseBuffers() {
+	const bool denoise = (0 != (_RenderFlags & SWS_RENDER_DENOISE));
+	const VkDeviceSize numPixels = denoise ? static_cast<VkDeviceSize>(_Settings.resolutionX) * _Settings.resolutionY : 1;
+
+	VkResult error = _DenoiseSurfacesBuffer.Create(numPixels * SWS_DENOISE_NUM_SURFACES * sizeof(DenoiseSurface), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_DenoiseSurfacesBuffer.Create");
+	error = _DenoiseHistoryBuffer.Create(numPixels * SWS_DENOISE_NUM_HISTORIES * sizeof(DenoiseHistory), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_DenoiseHistoryBuffer.Create");
+	error = _DenoiseFilterBuffer.Create(numPixels * SWS_DENOISE_NUM_FILTERED * sizeof(vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	CHECK_VK_ERROR(error, "_DenoiseFilterBuffer.Create");
+
+	// garbage as well, the first frame has no history to read (denoiseData.z)
+	_DenoiseFrameIndex = 0;
 }
 
 void RtxApp::UpdateCameraParams(UniformParams* params, const float dt) {
@@ -598,20 +1627,84 @@ void RtxApp::CreateDescriptorSetsLayouts() {
 	resultImageLayoutBinding.binding = SWS_RESULT_IMAGE_BINDING;
 	resultImageLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 	resultImageLayoutBinding.descriptorCount = 1;
-	resultImageLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+	resultImageLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_COMPUTE_BIT;
 	resultImageLayoutBinding.pImmutableSamplers = nullptr;
 
 	VkDescriptorSetLayoutBinding camdataBufferBinding;
 	camdataBufferBinding.binding = SWS_CAMDATA_BINDING;
-	camdataBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	camdataBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	camdataBufferBinding.descriptorCount = 1;
-	camdataBufferBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+	camdataBufferBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_COMPUTE_BIT;
 	camdataBufferBinding.pImmutableSamplers = nullptr;
 
+	VkDescriptorSetLayoutBinding pixelStatsBinding;
+	pixelStatsBinding.binding = SWS_PIXEL_STATS_BINDING;
+	pixelStatsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pixelStatsBinding.descriptorCount = 1;
+	pixelStatsBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_COMPUTE_BIT;
+	pixelStatsBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding instanceShapesBinding;
+	instanceShapesBinding.binding = SWS_INSTANCE_SHAPES_BINDING;
+	instanceShapesBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	instanceShapesBinding.descriptorCount = 1;
+	instanceShapesBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+	instanceShapesBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding materialsBinding;
+	materialsBinding.binding = SWS_MATERIALS_BINDING;
+	materialsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	materialsBinding.descriptorCount = 1;
+	materialsBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+	materialsBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding rayCountersBinding;
+	rayCountersBinding.binding = SWS_RAY_COUNTERS_BINDING;
+	rayCountersBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	rayCountersBinding.descriptorCount = 1;
+	rayCountersBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+	rayCountersBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding lightsBinding;
+	lightsBinding.binding = SWS_LIGHTS_BINDING;
+	lightsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightsBinding.descriptorCount = 1;
+	lightsBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+	lightsBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding denoiseSurfacesBinding;
+	denoiseSurfacesBinding.binding = SWS_DENOISE_SURFACES_BINDING;
+	denoiseSurfacesBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	denoiseSurfacesBinding.descriptorCount = 1;
+	denoiseSurfacesBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_COMPUTE_BIT;
+	denoiseSurfacesBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding denoiseHistoryBinding;
+	denoiseHistoryBinding.binding = SWS_DENOISE_HISTORY_BINDING;
+	denoiseHistoryBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	denoiseHistoryBinding.descriptorCount = 1;
+	denoiseHistoryBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	denoiseHistoryBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding denoiseFilterBinding;
+	denoiseFilterBinding.binding = SWS_DENOISE_FILTER_BINDING;
+	denoiseFilterBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	denoiseFilterBinding.descriptorCount = 1;
+	denoiseFilterBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	denoiseFilterBinding.pImmutableSamplers = nullptr;
+
 	std::vector<VkDescriptorSetLayoutBinding> bindings({
 		accelerationStructureLayoutBinding,
 		resultImageLayoutBinding,
-		camdataBufferBinding
+		camdataBufferBinding,
+		pixelStatsBinding,
+		instanceShapesBinding,
+		materialsBinding,
+		lightsBinding,
+		rayCountersBinding,
+		denoiseSurfacesBinding,
+		denoiseHistoryBinding,
+		denoiseFilterBinding
 		});
 
 	VkDescriptorSetLayoutCreateInfo set0LayoutInfo;
@@ -712,7 +1805,51 @@ void RtxApp::CreateRaytracingPipelineAndSBT() {
 	error = vkCreateRayTracingPipelinesNV(_Device, VK_NULL_HANDLE, 1, &rayPipelineInfo, VK_NULL_HANDLE, &_RTXPipeline);
 	CHECK_VK_ERROR(error, "vkCreateRaytracingPipelinesNVX");
 
-	rtxHelper.CreateSBT(_Device, _RTXPipeline);
+	rtxHelper.CreateSBT(_Device, _RTXPipeline, _Uploader);
+}
+
+// the denoiser only needs set 0, plus the a-trous iteration as a push constant
+void RtxApp::CreateDenoisePipelines() {
+	if (0 == (_RenderFlags & SWS_RENDER_DENOISE)) {
+		return;
+	}
+
+	VkPushConstantRange pushConstantRange;
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(uint32_t);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo;
+	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutCreateInfo.pNext = nullptr;
+	pipelineLayoutCreateInfo.flags = 0;
+	pipelineLayoutCreateInfo.setLayoutCount = 1;
+	pipelineLayoutCreateInfo.pSetLayouts = &_RTXDescriptorSetsLayouts[SWS_SCENE_AS_SET];
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkResult error = vkCreatePipelineLayout(_Device, &pipelineLayoutCreateInfo, nullptr, &_DenoisePipelineLayout);
+	CHECK_VK_ERROR(error, "vkCreatePipelineLayout");
+
+	helpers::Shader temporalShader, atrousShader;
+	temporalShader.LoadFromFile((sShadersFolder + "denoise_temporal.bin").c_str());
+	atrousShader.LoadFromFile((sShadersFolder + "denoise_atrous.bin").c_str());
+
+	VkComputePipelineCreateInfo computePipelineInfo;
+	computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	computePipelineInfo.pNext = nullptr;
+	computePipelineInfo.flags = 0;
+	computePipelineInfo.stage = temporalShader.GetShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
+	computePipelineInfo.layout = _DenoisePipelineLayout;
+	computePipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	computePipelineInfo.basePipelineIndex = 0;
+
+	error = vkCreateComputePipelines(_Device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &_DenoiseTemporalPipeline);
+	CHECK_VK_ERROR(error, "vkCreateComputePipelines");
+
+	computePipelineInfo.stage = atrousShader.GetShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
+	error = vkCreateComputePipelines(_Device, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &_DenoiseAtrousPipeline);
+	CHECK_VK_ERROR(error, "vkCreateComputePipelines");
 }
 
 void RtxApp::UpdateDescriptorSets() {
@@ -722,8 +1859,9 @@ void RtxApp::UpdateDescriptorSets() {
 	std::vector<VkDescriptorPoolSize> poolSizes({
 		{ VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, 1 },
 		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, numMeshes * 3 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, numMeshes * 3 + 7 },
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, numMaterials }
 		});
 
@@ -796,10 +1934,28 @@ void RtxApp::UpdateDescriptorSets() {
 	resultImageWrite.pTexelBufferView = nullptr;
 
 
+	VkDescriptorBufferInfo pixelStatsBufferInfo;
+	pixelStatsBufferInfo.buffer = _PixelStatsBuffer.GetBuffer();
+	pixelStatsBufferInfo.offset = 0;
+	pixelStatsBufferInfo.range = _PixelStatsBuffer.GetSize();
+
+	VkWriteDescriptorSet pixelStatsBufferWrite;
+	pixelStatsBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	pixelStatsBufferWrite.pNext = nullptr;
+	pixelStatsBufferWrite.dstSet = _RTXDescriptorSets[SWS_PIXEL_STATS_SET];
+	pixelStatsBufferWrite.dstBinding = SWS_PIXEL_STATS_BINDING;
+	pixelStatsBufferWrite.dstArrayElement = 0;
+	pixelStatsBufferWrite.descriptorCount = 1;
+	pixelStatsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pixelStatsBufferWrite.pImageInfo = nullptr;
+	pixelStatsBufferWrite.pBufferInfo = &pixelStatsBufferInfo;
+	pixelStatsBufferWrite.pTexelBufferView = nullptr;
+
+
 	VkDescriptorBufferInfo camdataBufferInfo;
 	camdataBufferInfo.buffer = _CameraBuffer.GetBuffer();
 	camdataBufferInfo.offset = 0;
-	camdataBufferInfo.range = _CameraBuffer.GetSize();
+	camdataBufferInfo.range = sizeof(UniformParams);
 
 	VkWriteDescriptorSet camdataBufferWrite;
 	camdataBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -808,12 +1964,132 @@ void RtxApp::UpdateDescriptorSets() {
 	camdataBufferWrite.dstBinding = SWS_CAMDATA_BINDING;
 	camdataBufferWrite.dstArrayElement = 0;
 	camdataBufferWrite.descriptorCount = 1;
-	camdataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	camdataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	camdataBufferWrite.pImageInfo = nullptr;
 	camdataBufferWrite.pBufferInfo = &camdataBufferInfo;
 	camdataBufferWrite.pTexelBufferView = nullptr;
 
 
+	VkDescriptorBufferInfo instanceShapesBufferInfo;
+	instanceShapesBufferInfo.buffer = _Scene.instanceShapes.GetBuffer();
+	instanceShapesBufferInfo.offset = 0;
+	instanceShapesBufferInfo.range = _Scene.instanceShapes.GetSize();
+
+	VkWriteDescriptorSet instanceShapesBufferWrite;
+	instanceShapesBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	instanceShapesBufferWrite.pNext = nullptr;
+	instanceShapesBufferWrite.dstSet = _RTXDescriptorSets[SWS_INSTANCE_SHAPES_SET];
+	instanceShapesBufferWrite.dstBinding = SWS_INSTANCE_SHAPES_BINDING;
+	instanceShapesBufferWrite.dstArrayElement = 0;
+	instanceShapesBufferWrite.descriptorCount = 1;
+	instanceShapesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	instanceShapesBufferWrite.pImageInfo = nullptr;
+	instanceShapesBufferWrite.pBufferInfo = &instanceShapesBufferInfo;
+	instanceShapesBufferWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo materialsBufferInfo;
+	materialsBufferInfo.buffer = _Scene.materialsBuffer.GetBuffer();
+	materialsBufferInfo.offset = 0;
+	materialsBufferInfo.range = _Scene.materialsBuffer.GetSize();
+
+	VkWriteDescriptorSet materialsBufferWrite;
+	materialsBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	materialsBufferWrite.pNext = nullptr;
+	materialsBufferWrite.dstSet = _RTXDescriptorSets[SWS_MATERIALS_SET];
+	materialsBufferWrite.dstBinding = SWS_MATERIALS_BINDING;
+	materialsBufferWrite.dstArrayElement = 0;
+	materialsBufferWrite.descriptorCount = 1;
+	materialsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	materialsBufferWrite.pImageInfo = nullptr;
+	materialsBufferWrite.pBufferInfo = &materialsBufferInfo;
+	materialsBufferWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo lightsBufferInfo;
+	lightsBufferInfo.buffer = _Scene.lightsBuffer.GetBuffer();
+	lightsBufferInfo.offset = 0;
+	lightsBufferInfo.range = _Scene.lightsBuffer.GetSize();
+
+	VkWriteDescriptorSet lightsBufferWrite;
+	lightsBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	lightsBufferWrite.pNext = nullptr;
+	lightsBufferWrite.dstSet = _RTXDescriptorSets[SWS_LIGHTS_SET];
+	lightsBufferWrite.dstBinding = SWS_LIGHTS_BINDING;
+	lightsBufferWrite.dstArrayElement = 0;
+	lightsBufferWrite.descriptorCount = 1;
+	lightsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightsBufferWrite.pImageInfo = nullptr;
+	lightsBufferWrite.pBufferInfo = &lightsBufferInfo;
+	lightsBufferWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo rayCountersBufferInfo;
+	rayCountersBufferInfo.buffer = _RayCountersBuffer.GetBuffer();
+	rayCountersBufferInfo.offset = 0;
+	rayCountersBufferInfo.range = sizeof(RayCounters);
+
+	VkWriteDescriptorSet rayCountersBufferWrite;
+	rayCountersBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	rayCountersBufferWrite.pNext = nullptr;
+	rayCountersBufferWrite.dstSet = _RTXDescriptorSets[SWS_RAY_COUNTERS_SET];
+	rayCountersBufferWrite.dstBinding = SWS_RAY_COUNTERS_BINDING;
+	rayCountersBufferWrite.dstArrayElement = 0;
+	rayCountersBufferWrite.descriptorCount = 1;
+	rayCountersBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	rayCountersBufferWrite.pImageInfo = nullptr;
+	rayCountersBufferWrite.pBufferInfo = &rayCountersBufferInfo;
+	rayCountersBufferWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo denoiseSurfacesBufferInfo;
+	denoiseSurfacesBufferInfo.buffer = _DenoiseSurfacesBuffer.GetBuffer();
+	denoiseSurfacesBufferInfo.offset = 0;
+	denoiseSurfacesBufferInfo.range = _DenoiseSurfacesBuffer.GetSize();
+
+	VkWriteDescriptorSet denoiseSurfacesBufferWrite;
+	denoiseSurfacesBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	denoiseSurfacesBufferWrite.pNext = nullptr;
+	denoiseSurfacesBufferWrite.dstSet = _RTXDescriptorSets[SWS_DENOISE_SURFACES_SET];
+	denoiseSurfacesBufferWrite.dstBinding = SWS_DENOISE_SURFACES_BINDING;
+	denoiseSurfacesBufferWrite.dstArrayElement = 0;
+	denoiseSurfacesBufferWrite.descriptorCount = 1;
+	denoiseSurfacesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	denoiseSurfacesBufferWrite.pImageInfo = nullptr;
+	denoiseSurfacesBufferWrite.pBufferInfo = &denoiseSurfacesBufferInfo;
+	denoiseSurfacesBufferWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo denoiseHistoryBufferInfo;
+	denoiseHistoryBufferInfo.buffer = _DenoiseHistoryBuffer.GetBuffer();
+	denoiseHistoryBufferInfo.offset = 0;
+	denoiseHistoryBufferInfo.range = _DenoiseHistoryBuffer.GetSize();
+
+	VkWriteDescriptorSet denoiseHistoryBufferWrite;
+	denoiseHistoryBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	denoiseHistoryBufferWrite.pNext = nullptr;
+	denoiseHistoryBufferWrite.dstSet = _RTXDescriptorSets[SWS_DENOISE_HISTORY_SET];
+	denoiseHistoryBufferWrite.dstBinding = SWS_DENOISE_HISTORY_BINDING;
+	denoiseHistoryBufferWrite.dstArrayElement = 0;
+	denoiseHistoryBufferWrite.descriptorCount = 1;
+	denoiseHistoryBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	denoiseHistoryBufferWrite.pImageInfo = nullptr;
+	denoiseHistoryBufferWrite.pBufferInfo = &denoiseHistoryBufferInfo;
+	denoiseHistoryBufferWrite.pTexelBufferView = nullptr;
+
+	VkDescriptorBufferInfo denoiseFilterBufferInfo;
+	denoiseFilterBufferInfo.buffer = _DenoiseFilterBuffer.GetBuffer();
+	denoiseFilterBufferInfo.offset = 0;
+	denoiseFilterBufferInfo.range = _DenoiseFilterBuffer.GetSize();
+
+	VkWriteDescriptorSet denoiseFilterBufferWrite;
+	denoiseFilterBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	denoiseFilterBufferWrite.pNext = nullptr;
+	denoiseFilterBufferWrite.dstSet = _RTXDescriptorSets[SWS_DENOISE_FILTER_SET];
+	denoiseFilterBufferWrite.dstBinding = SWS_DENOISE_FILTER_BINDING;
+	denoiseFilterBufferWrite.dstArrayElement = 0;
+	denoiseFilterBufferWrite.descriptorCount = 1;
+	denoiseFilterBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	denoiseFilterBufferWrite.pImageInfo = nullptr;
+	denoiseFilterBufferWrite.pBufferInfo = &denoiseFilterBufferInfo;
+	denoiseFilterBufferWrite.pTexelBufferView = nullptr;
+
+
 	VkWriteDescriptorSet matIDsBufferWrite;
 	matIDsBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	matIDsBufferWrite.pNext = nullptr;
@@ -855,7 +2131,15 @@ void RtxApp::UpdateDescriptorSets() {
 	Array<VkWriteDescriptorSet> descriptorWrites({
 		accelerationStructureWrite,
 		resultImageWrite,
+		pixelStatsBufferWrite,
 		camdataBufferWrite,
+		instanceShapesBufferWrite,
+		materialsBufferWrite,
+		lightsBufferWrite,
+		rayCountersBufferWrite,
+		denoiseSurfacesBufferWrite,
+		denoiseHistoryBufferWrite,
+		denoiseFilterBufferWrite,
 		matIDsBufferWrite,
 		attribsBufferWrite,
 		facesBufferWrite
@@ -1013,22 +2297,25 @@ uint32_t RTXHelper::GetSBTSize() const {
 	return GetNu_Groups() * _ShaderHeaderSize;
 }
 
-bool RTXHelper::CreateSBT(VkDevice device, VkPipeline rtPipeline) {
+bool RTXHelper::CreateSBT(VkDevice device, VkPipeline rtPipeline, helpers::UploadManager& uploader) {
 	const size_t sbtSize = GetSBTSize();
 
-	VkResult error = rtxHelper.Create(sbtSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	VkResult error = rtxHelper.Create(sbtSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	CHECK_VK_ERROR(error, "rtxHelper.Create");
 
 	if (VK_SUCCESS != error) {
 		return false;
 	}
 
-	void* mem = rtxHelper.Map();
-	error = vkGetRayTracingShaderGroupHandlesNV(device, rtPipeline, 0, GetNu_Groups(), sbtSize, mem);
+	Array<uint8_t> handles(sbtSize);
+	error = vkGetRayTracingShaderGroupHandlesNV(device, rtPipeline, 0, GetNu_Groups(), sbtSize, handles.data());
 	CHECK_VK_ERROR(error, L"vkGetRaytracingShaderHandleNV");
-	rtxHelper.Unmap();
 
-	return (VK_SUCCESS == error);
+	if (VK_SUCCESS != error) {
+		return false;
+	}
+
+	return uploader.Upload(rtxHelper, handles.data(), sbtSize) && uploader.Flush();
 }
 
 VkBuffer RTXHelper::GetSBTBuffer() const {
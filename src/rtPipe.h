@@ -2,9 +2,10 @@
 
 #include "common/vulkanapp.h"
 #include "common/camera.h"
+#include "scene_data.h"
 
 struct RTAccelerationStructure {
-	VkDeviceMemory                memory;
+	helpers::MemoryAllocation     memory;
 	VkAccelerationStructureInfoNV accelerationStructureInfo;
 	VkAccelerationStructureNV     accelerationStructure;
 	uint64_t                      handle;
@@ -13,6 +14,9 @@ struct RTAccelerationStructure {
 struct RTMesh {
 	uint32_t                    numVertices;
 	uint32_t                    numFaces;
+	vec3                        boundsMin;      // object space
+	vec3                        boundsMax;
+	BuildPolicy                 buildPolicy;    // never Auto, see RtxApp::ChooseBuildPolicies
 
 	helpers::Buffer       positions;
 	helpers::Buffer       attribs;
@@ -27,11 +31,72 @@ struct RTMaterial {
 	helpers::Image        texture;
 };
 
+// VK_NV_ray_tracing instance layout
+struct VkGeometryInstance {
+	float transform[12];
+	uint32_t instanceId : 24;
+	uint32_t mask : 8;
+	uint32_t instanceOffset : 24;
+	uint32_t flags : 8;
+	uint64_t accelerationStructureHandle;
+};
+
+// TLAS updates done so far, the times come from GPU timestamps
+struct TLASStats {
+	uint32_t    numRefits = 0;
+	uint32_t    numRebuilds = 0;
+	double      refitMs = 0.0;
+	double      rebuildMs = 0.0;
+	double      lastRefitMs = 0.0;
+	double      lastRebuildMs = 0.0;
+};
+
+// RayCounters read back from ray_gen.glsl, summed over the frames since the start
+struct RayStats {
+	uint32_t    numFrames = 0;
+	uint64_t    numPaths = 0;
+	uint64_t    numBounces = 0;
+	uint64_t    numShadowRays = 0;
+	uint64_t    numRouletteKills = 0;
+	double      lastRaysPerPixel = 0.0;
+	double      lastRaysPerPath = 0.0;  // bounces only
+	uint32_t    lastConvergingPixels = 0;   // --adaptive, RayCounters.adaptive.x
+};
+
+// what building all the BLASes took, summed over the batches
+struct BLASBuildStats {
+	VkDeviceSize    builtBytes = 0;
+	VkDeviceSize    compactedBytes = 0;
+	double          gpuMs = 0.0;        // batch spans from GPU timestamps
+	double          wallMs = 0.0;       // including the compaction round trips
+};
+
 struct RTScene {
 	Array<RTMesh>               meshes;
 	Array<RTMaterial>           materials;
 	RTAccelerationStructure     topLevelAS;
 
+	// placements as loaded, several of them can share a mesh (see FindMeshInstances)
+	Array<SceneInstance>        sceneInstances;
+
+	// one per scene instance, instanceId is the mesh index the shaders look the mesh buffers up with.
+	// The host copy goes into the frame's slice of instancesBuffer whenever it changes and the TLAS
+	// is refit (or rebuilt, see RtxApp::UpdateTLAS) in that frame
+	Array<VkGeometryInstance>   instances;
+	helpers::Buffer             instancesBuffer;        // host visible, one slice per frame in flight
+	helpers::Buffer             tlasScratch;            // fits both a build and an update
+	Array<vec3>                 instanceBuildCenters;   // world space bounds centers at the last full build
+	uint32_t                    numRefitsSinceBuild = 0;
+	bool                        instancesDirty = false;
+	TLASStats                   tlasStats;
+	helpers::Buffer             instanceShapes;         // firstShape of every TLAS instance, by gl_InstanceID
+
+	// shading: MTL Kd / Ke by matID (after a uvec4 with their count), emissive triangles in world space for NEE
+	helpers::Buffer             materialsBuffer;
+	helpers::Buffer             lightsBuffer;
+	uint32_t                    numLights = 0;
+	float                       lightsPower = 0.0f;
+
 	// shader resources stuff
 	Array<VkDescriptorBufferInfo>   matIDsBufferInfos;
 	Array<VkDescriptorBufferInfo>   attribsBufferInfos;
@@ -62,7 +127,7 @@ public:
 	const VkRayTracingShaderGroupCreateInfoNV* GetGroups() const;
 
 	uint32_t    GetSBTSize() const;
-	bool        CreateSBT(VkDevice device, VkPipeline rtPipeline);
+	bool        CreateSBT(VkDevice device, VkPipeline rtPipeline, helpers::UploadManager& uploader);
 	VkBuffer    GetSBTBuffer() const;
 
 private:
@@ -86,25 +151,54 @@ protected:
 	virtual void InitSettings() override;
 	virtual void InitApp() override;
 	virtual void FreeResources() override;
-	virtual void FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t imageIndex) override;
+	virtual void FillCommandBuffer(VkCommandBuffer commandBuffer, const size_t frameIndex) override;
 
 	virtual void OnMouseMove(const float x, const float y) override;
 	virtual void OnMouseButton(const int button, const int action, const int mods) override;
 	virtual void OnKey(const int key, const int scancode, const int action, const int mods) override;
-	virtual void Update(const size_t imageIndex, const float dt) override;
+	virtual void Update(const size_t frameIndex, const float dt) override;
+
+public:
+	// scene API, changes show up in the next recorded frame
+	uint32_t    GetNumInstances() const;
+	void        SetInstanceTransform(const uint32_t instanceIdx, const mat4& transform);
+	void        SetInstanceMask(const uint32_t instanceIdx, const uint8_t mask);
 
 private:
+	// compactedSize != 0 creates the destination of a compacting copy, geometries and instances are ignored then
 	bool CreateAS(const VkAccelerationStructureTypeNV type,
 		const uint32_t geometryCount,
 		const VkGeometryNV* geometries,
 		const uint32_t instanceCount,
+		const VkBuildAccelerationStructureFlagsNV flags,
+		const VkDeviceSize compactedSize,
 		RTAccelerationStructure& _as);
+	void InitTimestamps();
+	VkCommandBuffer BeginOneTimeCommands();
+	void SubmitOneTimeCommands(VkCommandBuffer commandBuffer);
 	void LoadSceneGeometry();
 	void CreateScene();
+	void ChooseBuildPolicies();
+	BLASBuildStats BuildBLASes();
+	void BuildBLASBatch(const Array<VkGeometryNV>& geometries, const size_t first, const size_t last, BLASBuildStats& stats);
+	void DestroyBLASes();
+	void RebuildTLAS();
+	void RecordTLASBuild(VkCommandBuffer commandBuffer, const VkDeviceSize instancesOffset, const bool update);
+	void UpdateTLAS(VkCommandBuffer commandBuffer, const size_t frameIndex);
+	void RecordTrace(VkCommandBuffer commandBuffer, const size_t frameIndex, VkQueryPool queryPool, const uint32_t firstQuery);
+	void RecordDenoise(VkCommandBuffer commandBuffer, const size_t frameIndex);
+	void RunBuildPolicySweep();
+	void ReadFrameTimestamps(const size_t frameIndex);
+	void ReadRayCounters(const size_t frameIndex);
+	void AnimateInstances(const float dt);
 	void CreateCamera();
+	void CreateRayCounters();
+	void CreatePixelStatsBuffer();
+	void CreateDenoiseBuffers();
 	void UpdateCameraParams(struct UniformParams* params, const float dt);
 	void CreateDescriptorSetsLayouts();
 	void CreateRaytracingPipelineAndSBT();
+	void CreateDenoisePipelines();
 	void UpdateDescriptorSets();
 
 private:
@@ -117,9 +211,60 @@ private:
 	RTXHelper                       rtxHelper;
 
 	RTScene                         _Scene;
+	helpers::UploadManager          _Uploader;
 
 	Camera                          _Camera;
-	helpers::Buffer           _CameraBuffer;
+	helpers::Buffer           _CameraBuffer;    // one UniformParams slice per frame in flight
+	VkDeviceSize                    _CameraSliceSize;
+
+	// what the trace did, one RayCounters slice per frame in flight, zeroed once read
+	helpers::Buffer                 _RayCountersBuffer;
+	VkDeviceSize                    _RayCountersSliceSize;
+	RayStats                        _RayStats;
+
+	// progressive accumulation, restarts whenever the camera moves. One PixelStats per pixel
+	helpers::Buffer                 _PixelStatsBuffer;
+	uint32_t                        _AccumFrameIndex;
+	vec3                            _AccumCameraPos;
+	vec3                            _AccumCameraDir;
+	vec3                            _AccumCameraUp;
+	uint32_t                        _AccumSeed;         // samplingData.y, with --denoise every accumulation gets its own
+
+	// --denoise, compute passes between the trace and the copy to the swapchain (see shared_denoiser.h).
+	// The buffers hold a single element when it's off, the descriptors want something to point at
+	helpers::Buffer                 _DenoiseSurfacesBuffer;     // SWS_DENOISE_NUM_SURFACES slices, written by ray_gen.glsl
+	helpers::Buffer                 _DenoiseHistoryBuffer;      // SWS_DENOISE_NUM_HISTORIES slices
+	helpers::Buffer                 _DenoiseFilterBuffer;       // SWS_DENOISE_NUM_FILTERED slices, the a-trous ping-pong
+	VkPipelineLayout                _DenoisePipelineLayout;     // set 0 and the a-trous iteration
+	VkPipeline                      _DenoiseTemporalPipeline;
+	VkPipeline                      _DenoiseAtrousPipeline;
+	uint32_t                        _DenoiseFrameIndex;         // frames denoised so far, 0 - no history to reproject yet
+	vec4                            _PrevCamPos;                // the camera of the last frame, where the history was seen from
+	vec4                            _PrevCamDir;
+	vec4                            _PrevCamUp;
+	vec4                            _PrevCamSide;
+
+	// BLAS builds
+	VkDeviceSize                    _ScratchBudget;     // scratch pool shared by builds that run side by side
+	bool                            _TimeEachBuild;     // --blas-build-timing, a barrier after every build
+	float                           _TimestampPeriod;   // ns per tick, 0 when the queue has no timestamps
+	uint64_t                        _TimestampMask;
+
+	// per frame GPU timings, a pair of timestamps for the TLAS refit/rebuild and one for the trace
+	VkQueryPool                     _FrameTimestampPool;
+	Array<uint32_t>                 _TLASPendingUpdate;     // per frame in flight: 0 - none, 1 - refit, 2 - rebuild
+	Array<bool>                     _TracePending;          // per frame in flight
+	uint32_t                        _NumTracedFrames;
+	double                          _TraceMs;
+	bool                            _Animate;               // --animate, moves the first instance around
+	float                           _AnimationTime;
+	MeshGroupingPolicy              _MeshGrouping;          // --blas-group-faces
+	BuildPolicy                     _ForcedBuildPolicy;     // --blas-policy, Auto leaves it to every mesh
+	bool                            _BuildPolicySweep;      // --blas-policy-sweep
+	uint32_t                        _RenderFlags;           // SWS_RENDER_ flags, --no-nee clears SWS_RENDER_NEE, --adaptive sets SWS_RENDER_ADAPTIVE, --denoise SWS_RENDER_DENOISE
+	uint32_t                        _RouletteDepth;         // --rr-depth, SWS_MAX_RECURSION turns Russian roulette off
+	uint32_t                        _SamplerType;           // --sampler, SWS_SAMPLER_
+
 	bool                            WKeyDown;
 	bool                            AKeyDown;
 	bool                            SKeyDown;
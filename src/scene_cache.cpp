@@ -0,0 +1,281 @@
+#include "scene_cache.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+
+static bool HashSourceFile(const String& fileName, uint64_t& hash) {
+	MappedFile source;
+	if (!source.Open(fileName.c_str())) {
+		return false;
+	}
+
+	hash = HashBytes(source.GetData(), source.GetSize());
+	return true;
+}
+
+// size + mtime match is the fast path, otherwise the file could've been just touched - compare contents hash
+static bool FileUnchanged(const String& fileName, const FileStamp& stamp, const uint64_t size, const uint64_t mtime, const uint64_t hash) {
+	if (size == stamp.size && mtime == stamp.mtime) {
+		return true;
+	}
+	uint64_t fileHash = 0;
+	return size == stamp.size && HashSourceFile(fileName, fileHash) && fileHash == hash;
+}
+
+static bool DependencyUnchanged(const SceneCacheDependency& dependency) {
+	if (dependency.fileName[kSceneCacheMaxPath - 1] != '\0') {
+		return false;
+	}
+
+	FileStamp stamp;
+	if (!GetFileStamp(dependency.fileName, stamp)) {
+		return dependency.size == kSceneCacheMissingFile;
+	}
+	return dependency.size != kSceneCacheMissingFile && FileUnchanged(dependency.fileName, stamp, dependency.size, dependency.mtime, dependency.hash);
+}
+
+static uint64_t AlignUp(const uint64_t value, const uint64_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool SectionInFile(const uint64_t offset, const uint64_t size, const size_t fileSize) {
+	return (offset % kSceneCacheAlignment) == 0 && offset <= fileSize && size <= fileSize - offset;
+}
+
+
+SceneCache::SceneCache()
+	: _Header(nullptr)
+	, _Meshes(nullptr)
+{
+}
+SceneCache::~SceneCache() {
+	Close();
+}
+
+bool SceneCache::Open(const String& cacheFileName, const String& sourceFileName) {
+	Close();
+
+	FileStamp sourceStamp;
+	if (!GetFileStamp(sourceFileName.c_str(), sourceStamp)) {
+		return false;
+	}
+
+	if (!_File.Open(cacheFileName.c_str())) {
+		return false;
+	}
+
+	const uint8_t* data = _File.GetData();
+	const size_t fileSize = _File.GetSize();
+
+	const SceneCacheHeader* header = reinterpret_cast<const SceneCacheHeader*>(data);
+	if (fileSize < sizeof(SceneCacheHeader) || header->magic != kSceneCacheMagic || header->version != kSceneCacheVersion) {
+		Close();
+		return false;
+	}
+
+	if (!FileUnchanged(sourceFileName, sourceStamp, header->sourceSize, header->sourceMTime, header->sourceHash)) {
+		Close();
+		return false;
+	}
+
+	// the materials come from the mtl libraries, so those have to be unchanged as well
+	if (!SectionInFile(header->dependenciesOffset, header->numDependencies * sizeof(SceneCacheDependency), fileSize)) {
+		Close();
+		return false;
+	}
+	const SceneCacheDependency* dependencies = reinterpret_cast<const SceneCacheDependency*>(data + header->dependenciesOffset);
+	for (uint32_t i = 0; i < header->numDependencies; ++i) {
+		if (!DependencyUnchanged(dependencies[i])) {
+			Close();
+			return false;
+		}
+	}
+
+	const uint64_t entriesOffset = header->entriesOffset;
+	if (!SectionInFile(entriesOffset, header->numMeshes * sizeof(SceneCacheMeshEntry), fileSize)) {
+		Close();
+		return false;
+	}
+
+	if (!SectionInFile(header->materialsOffset, header->numMaterials * sizeof(MaterialParams), fileSize)) {
+		Close();
+		return false;
+	}
+
+	const SceneCacheMeshEntry* entries = reinterpret_cast<const SceneCacheMeshEntry*>(data + entriesOffset);
+	for (uint32_t i = 0; i < header->numMeshes; ++i) {
+		const SceneCacheMeshEntry& e = entries[i];
+		const bool valid = SectionInFile(e.positionsOffset, e.numVertices * sizeof(vec3), fileSize) &&
+			SectionInFile(e.attribsOffset, e.numVertices * sizeof(VertexAttribute), fileSize) &&
+			SectionInFile(e.indicesOffset, e.numFaces * 3 * sizeof(uint32_t), fileSize) &&
+			SectionInFile(e.facesOffset, e.numFaces * 4 * sizeof(uint32_t), fileSize) &&
+			SectionInFile(e.matIDsOffset, e.numFaces * sizeof(uint32_t), fileSize);
+		if (!valid) {
+			Close();
+			return false;
+		}
+	}
+
+	_Header = header;
+	_Meshes = entries;
+	return true;
+}
+
+void SceneCache::Close() {
+	_Header = nullptr;
+	_Meshes = nullptr;
+	_File.Close();
+}
+
+bool SceneCache::Write(const String& cacheFileName, const String& sourceFileName, const Array<String>& dependencyFileNames,
+	const Array<MeshData>& meshes, const Array<MaterialParams>& materials) {
+	SceneCacheHeader header = { };
+	header.magic = kSceneCacheMagic;
+	header.version = kSceneCacheVersion;
+	header.numDependencies = static_cast<uint32_t>(dependencyFileNames.size());
+	header.numMeshes = static_cast<uint32_t>(meshes.size());
+	header.numMaterials = static_cast<uint32_t>(materials.size());
+
+	FileStamp sourceStamp;
+	if (!GetFileStamp(sourceFileName.c_str(), sourceStamp) || !HashSourceFile(sourceFileName, header.sourceHash)) {
+		return false;
+	}
+	header.sourceSize = sourceStamp.size;
+	header.sourceMTime = sourceStamp.mtime;
+
+	// a dependency that can't be read now is stored as missing, so the cache goes stale once it appears
+	Array<SceneCacheDependency> dependencies(dependencyFileNames.size());
+	for (size_t i = 0; i < dependencyFileNames.size(); ++i) {
+		const String& fileName = dependencyFileNames[i];
+		SceneCacheDependency& dependency = dependencies[i];
+		if (fileName.size() >= kSceneCacheMaxPath) {
+			return false;
+		}
+		std::memset(dependency.fileName, 0, sizeof(dependency.fileName));
+		std::memcpy(dependency.fileName, fileName.c_str(), fileName.size());
+
+		FileStamp stamp;
+		if (!GetFileStamp(fileName.c_str(), stamp)) {
+			dependency.size = kSceneCacheMissingFile;
+			dependency.mtime = 0;
+			dependency.hash = 0;
+		}
+		else if (HashSourceFile(fileName, dependency.hash)) {
+			dependency.size = stamp.size;
+			dependency.mtime = stamp.mtime;
+		}
+		else {
+			return false;
+		}
+	}
+
+	// lay out all the sections first
+	Array<SceneCacheMeshEntry> entries(meshes.size());
+	uint64_t offset = AlignUp(sizeof(SceneCacheHeader), kSceneCacheAlignment);
+	header.dependenciesOffset = offset;
+	offset = AlignUp(offset + dependencies.size() * sizeof(SceneCacheDependency), kSceneCacheAlignment);
+	header.entriesOffset = offset;
+	offset = AlignUp(offset + entries.size() * sizeof(SceneCacheMeshEntry), kSceneCacheAlignment);
+	header.materialsOffset = offset;
+	offset = AlignUp(offset + materials.size() * sizeof(MaterialParams), kSceneCacheAlignment);
+
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		const MeshView mesh = MakeMeshView(meshes[i]);
+		SceneCacheMeshEntry& e = entries[i];
+		e.numVertices = mesh.numVertices;
+		e.numFaces = mesh.numFaces;
+
+		e.positionsOffset = offset;
+		offset = AlignUp(offset + mesh.numVertices * sizeof(vec3), kSceneCacheAlignment);
+		e.attribsOffset = offset;
+		offset = AlignUp(offset + mesh.numVertices * sizeof(VertexAttribute), kSceneCacheAlignment);
+		e.indicesOffset = offset;
+		offset = AlignUp(offset + mesh.numFaces * 3 * sizeof(uint32_t), kSceneCacheAlignment);
+		e.facesOffset = offset;
+		offset = AlignUp(offset + mesh.numFaces * 4 * sizeof(uint32_t), kSceneCacheAlignment);
+		e.matIDsOffset = offset;
+		offset = AlignUp(offset + mesh.numFaces * sizeof(uint32_t), kSceneCacheAlignment);
+	}
+
+	// write to a temp file and swap it in, so a crash never leaves a half-written cache behind
+	const String tempFileName = cacheFileName + ".tmp";
+	std::ofstream file(tempFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	uint64_t written = 0;
+	auto writeSection = [&file, &written](const uint64_t sectionOffset, const void* sectionData, const uint64_t sectionSize) {
+		static const char zeros[kSceneCacheAlignment] = { 0 };
+		while (written < sectionOffset) {
+			const uint64_t pad = Min(sectionOffset - written, kSceneCacheAlignment);
+			file.write(zeros, static_cast<std::streamsize>(pad));
+			written += pad;
+		}
+		if (sectionSize) {
+			file.write(reinterpret_cast<const char*>(sectionData), static_cast<std::streamsize>(sectionSize));
+			written += sectionSize;
+		}
+	};
+
+	writeSection(0, &header, sizeof(header));
+	writeSection(header.dependenciesOffset, dependencies.data(), dependencies.size() * sizeof(SceneCacheDependency));
+	writeSection(header.entriesOffset, entries.data(), entries.size() * sizeof(SceneCacheMeshEntry));
+	writeSection(header.materialsOffset, materials.data(), materials.size() * sizeof(MaterialParams));
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		const MeshData& mesh = meshes[i];
+		const SceneCacheMeshEntry& e = entries[i];
+		writeSection(e.positionsOffset, mesh.positions.data(), mesh.positions.size() * sizeof(vec3));
+		writeSection(e.attribsOffset, mesh.attribs.data(), mesh.attribs.size() * sizeof(VertexAttribute));
+		writeSection(e.indicesOffset, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+		writeSection(e.facesOffset, mesh.faces.data(), mesh.faces.size() * sizeof(uint32_t));
+		writeSection(e.matIDsOffset, mesh.matIDs.data(), mesh.matIDs.size() * sizeof(uint32_t));
+	}
+
+	file.close();
+	if (!file) {
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+
+	std::remove(cacheFileName.c_str());
+	if (0 != std::rename(tempFileName.c_str(), cacheFileName.c_str())) {
+		std::remove(tempFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// getters
+uint32_t SceneCache::GetNumMeshes() const {
+	return _Header ? _Header->numMeshes : 0;
+}
+
+uint32_t SceneCache::GetNumMaterials() const {
+	return _Header ? _Header->numMaterials : 0;
+}
+
+MeshView SceneCache::GetMesh(const uint32_t meshIdx) const {
+	assert(_Header && meshIdx < _Header->numMeshes);
+
+	const uint8_t* data = _File.GetData();
+	const SceneCacheMeshEntry& e = _Meshes[meshIdx];
+
+	MeshView view;
+	view.numVertices = e.numVertices;
+	view.numFaces = e.numFaces;
+	view.positions = reinterpret_cast<const vec3*>(data + e.positionsOffset);
+	view.attribs = reinterpret_cast<const VertexAttribute*>(data + e.attribsOffset);
+	view.indices = reinterpret_cast<const uint32_t*>(data + e.indicesOffset);
+	view.faces = reinterpret_cast<const uint32_t*>(data + e.facesOffset);
+	view.matIDs = reinterpret_cast<const uint32_t*>(data + e.matIDsOffset);
+	return view;
+}
+
+const MaterialParams* SceneCache::GetMaterials() const {
+	return _Header ? reinterpret_cast<const MaterialParams*>(_File.GetData() + _Header->materialsOffset) : nullptr;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "scene_data.h"
+#include "common/mapped_file.h"
+
+// Binary scene cache (.rtscene)
+//
+// File layout, all sections aligned to kSceneCacheAlignment:
+//   SceneCacheHeader
+//   SceneCacheDependency[numDependencies]
+//   SceneCacheMeshEntry[numMeshes]
+//   MaterialParams[numMaterials]
+//   per mesh: positions | attribs | indices | faces | matIDs
+// Every per-mesh section is a verbatim copy of the matching RTMesh GPU buffer,
+// so loading is just a memcpy from the mapped file into the upload buffers.
+// The obj and every mtl it references are checked for changes, a missing mtl showing up counts too.
+
+static const uint32_t kSceneCacheMagic = 0x43535452; // 'RTSC'
+static const uint32_t kSceneCacheVersion = 4;
+static const uint64_t kSceneCacheAlignment = 16;
+static const uint32_t kSceneCacheMaxPath = 256;
+static const uint64_t kSceneCacheMissingFile = ~0ull; // size of a dependency that didn't exist when the cache was written
+static const char* const kSceneCacheExt = ".rtscene"; // appended to the source file name
+
+struct SceneCacheHeader {
+	uint32_t    magic;
+	uint32_t    version;
+	uint64_t    sourceSize;
+	uint64_t    sourceMTime;
+	uint64_t    sourceHash;
+	uint32_t    numDependencies;
+	uint32_t    numMeshes;
+	uint32_t    numMaterials;
+	uint32_t    pad;
+	uint64_t    dependenciesOffset;
+	uint64_t    entriesOffset;
+	uint64_t    materialsOffset;
+};
+
+// a file the cached data was built from besides the source, the mtl libraries
+struct SceneCacheDependency {
+	char        fileName[kSceneCacheMaxPath];   // as the obj reader opened it, zero terminated
+	uint64_t    size;
+	uint64_t    mtime;
+	uint64_t    hash;
+};
+
+struct SceneCacheMeshEntry {
+	uint32_t    numVertices;
+	uint32_t    numFaces;
+	uint64_t    positionsOffset;
+	uint64_t    attribsOffset;
+	uint64_t    indicesOffset;
+	uint64_t    facesOffset;
+	uint64_t    matIDsOffset;
+};
+
+class SceneCache {
+public:
+	SceneCache();
+	~SceneCache();
+
+	// maps the cache file and checks it against the source file and the dependencies it was written with,
+	// returns false if the cache is missing, corrupted or stale
+	bool        Open(const String& cacheFileName, const String& sourceFileName);
+	void        Close();
+
+	static bool Write(const String& cacheFileName, const String& sourceFileName, const Array<String>& dependencyFileNames,
+		const Array<MeshData>& meshes, const Array<MaterialParams>& materials);
+
+	// getters
+	uint32_t    GetNumMeshes() const;
+	uint32_t    GetNumMaterials() const;
+	MeshView    GetMesh(const uint32_t meshIdx) const;
+	const MaterialParams* GetMaterials() const;
+
+private:
+	MappedFile                  _File;
+	const SceneCacheHeader*     _Header;
+	const SceneCacheMeshEntry*  _Meshes;
+};
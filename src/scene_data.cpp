@@ -0,0 +1,501 @@
+#include "scene_data.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+
+// bit-exact vertex key, -0.0 is folded into 0.0 so mirrored exports still weld
+struct WeldKey {
+	uint32_t bits[6];
+};
+
+static uint32_t FloatKeyBits(const float f) {
+	uint32_t u;
+	std::memcpy(&u, &f, sizeof(u));
+	return (u == 0x80000000u) ? 0u : u;
+}
+
+static WeldKey MakeWeldKey(const vec3& pos, const VertexAttribute& attrib) {
+	WeldKey key;
+	key.bits[0] = FloatKeyBits(pos.x);
+	key.bits[1] = FloatKeyBits(pos.y);
+	key.bits[2] = FloatKeyBits(pos.z);
+	key.bits[3] = FloatKeyBits(attrib.normal.x);
+	key.bits[4] = FloatKeyBits(attrib.normal.y);
+	key.bits[5] = FloatKeyBits(attrib.normal.z);
+	return key;
+}
+
+static uint32_t NextPowerOfTwo(uint32_t v) {
+	uint32_t result = 1;
+	while (result < v) {
+		result <<= 1;
+	}
+	return result;
+}
+
+WeldStats WeldVertices(MeshData& mesh) {
+	WeldStats stats = { };
+
+	const uint32_t numVertices = static_cast<uint32_t>(mesh.positions.size());
+	const uint32_t numFaces = static_cast<uint32_t>(mesh.matIDs.size());
+	stats.verticesBefore = numVertices;
+	stats.verticesAfter = numVertices;
+	if (!numVertices) {
+		return stats;
+	}
+
+	// open addressing table of unique vertex indices, kept at most half full
+	static const uint32_t kEmpty = ~0u;
+	const uint32_t tableSize = NextPowerOfTwo(numVertices * 2);
+	const uint32_t tableMask = tableSize - 1;
+	Array<uint32_t> table(tableSize, kEmpty);
+	Array<WeldKey> uniqueKeys;
+	uniqueKeys.reserve(numVertices);
+
+	Array<uint32_t> remap(numVertices);
+	uint32_t numUnique = 0;
+
+	for (uint32_t v = 0; v < numVertices; ++v) {
+		const WeldKey key = MakeWeldKey(mesh.positions[v], mesh.attribs[v]);
+		uint32_t slot = static_cast<uint32_t>(HashBytes(&key, sizeof(key))) & tableMask;
+
+		for (;;) {
+			const uint32_t idx = table[slot];
+			if (kEmpty == idx) {
+				table[slot] = numUnique;
+				uniqueKeys.push_back(key);
+
+				// compact in place, unique vertex can only move towards the front
+				mesh.positions[numUnique] = mesh.positions[v];
+				mesh.attribs[numUnique] = mesh.attribs[v];
+				remap[v] = numUnique++;
+				break;
+			}
+			else if (0 == std::memcmp(&uniqueKeys[idx], &key, sizeof(key))) {
+				remap[v] = idx;
+				break;
+			}
+			slot = (slot + 1) & tableMask;
+		}
+	}
+
+	mesh.positions.resize(numUnique);
+	mesh.positions.shrink_to_fit();
+	mesh.attribs.resize(numUnique);
+	mesh.attribs.shrink_to_fit();
+
+	for (uint32_t f = 0; f < numFaces; ++f) {
+		for (uint32_t j = 0; j < 3; ++j) {
+			const uint32_t idx = remap[mesh.indices[3 * f + j]];
+			mesh.indices[3 * f + j] = idx;
+			mesh.faces[4 * f + j] = idx;
+		}
+	}
+
+	stats.verticesAfter = numUnique;
+	stats.bytesSaved = static_cast<size_t>(numVertices - numUnique) * (sizeof(vec3) + sizeof(VertexAttribute));
+	return stats;
+}
+
+
+static uint64_t HashTopology(const MeshView& mesh) {
+	uint64_t hash = HashBytes(&mesh.numVertices, sizeof(mesh.numVertices));
+	hash = HashBytes(&mesh.numFaces, sizeof(mesh.numFaces), hash);
+	hash = HashBytes(mesh.indices, mesh.numFaces * 3 * sizeof(uint32_t), hash);
+	return HashBytes(mesh.matIDs, mesh.numFaces * sizeof(uint32_t), hash);
+}
+
+static bool SameTopology(const MeshView& a, const MeshView& b) {
+	return a.numVertices == b.numVertices && a.numFaces == b.numFaces &&
+		0 == std::memcmp(a.indices, b.indices, a.numFaces * 3 * sizeof(uint32_t)) &&
+		0 == std::memcmp(a.matIDs, b.matIDs, a.numFaces * sizeof(uint32_t));
+}
+
+static vec3 Centroid(const MeshView& mesh) {
+	vec3 sum(0.0f);
+	for (uint32_t v = 0; v < mesh.numVertices; ++v) {
+		sum += mesh.positions[v];
+	}
+	return sum / static_cast<float>(mesh.numVertices);
+}
+
+// orthonormal frame from the centroid towards vertices i1 and i2, false if they don't span a plane
+static bool MakeFrame(const MeshView& mesh, const vec3& centroid, const uint32_t i1, const uint32_t i2, mat3& frame) {
+	const vec3 d1 = mesh.positions[i1] - centroid;
+	const vec3 d2 = mesh.positions[i2] - centroid;
+	const float len1 = glm::length(d1);
+	if (len1 <= 0.0f) {
+		return false;
+	}
+
+	const vec3 u1 = d1 / len1;
+	const vec3 ortho = d2 - u1 * glm::dot(d2, u1);
+	const float len2 = glm::length(ortho);
+	if (len2 <= 1e-4f * len1) {
+		return false;
+	}
+
+	const vec3 u2 = ortho / len2;
+	frame = mat3(u1, u2, glm::cross(u1, u2));
+	return true;
+}
+
+// b = rotation * a + translation for every vertex (and rotation * normal for the normals), within tolerance
+static bool FindRigidTransform(const MeshView& a, const MeshView& b, mat3& rotation, vec3& translation) {
+	if (!a.numVertices) {
+		return false;
+	}
+
+	const vec3 centroidA = Centroid(a);
+	const vec3 centroidB = Centroid(b);
+
+	// the vertex furthest from the centroid, then the one furthest off that axis, give the best conditioned frame
+	uint32_t i1 = 0;
+	float maxDist = 0.0f;
+	for (uint32_t v = 0; v < a.numVertices; ++v) {
+		const float dist = glm::length(a.positions[v] - centroidA);
+		if (dist > maxDist) {
+			maxDist = dist;
+			i1 = v;
+		}
+	}
+
+	const vec3 axis = (maxDist > 0.0f) ? (a.positions[i1] - centroidA) / maxDist : vec3(0.0f);
+	uint32_t i2 = 0;
+	float maxOffAxis = 0.0f;
+	for (uint32_t v = 0; v < a.numVertices; ++v) {
+		const float offAxis = glm::length(glm::cross(a.positions[v] - centroidA, axis));
+		if (offAxis > maxOffAxis) {
+			maxOffAxis = offAxis;
+			i2 = v;
+		}
+	}
+
+	mat3 frameA, frameB;
+	if (!MakeFrame(a, centroidA, i1, i2, frameA) || !MakeFrame(b, centroidB, i1, i2, frameB)) {
+		return false;
+	}
+
+	rotation = frameB * glm::transpose(frameA);
+	translation = centroidB - rotation * centroidA;
+
+	const float positionTolerance = 1e-4f * maxDist;
+	const float normalTolerance = 1e-3f;
+	for (uint32_t v = 0; v < a.numVertices; ++v) {
+		if (glm::length(rotation * a.positions[v] + translation - b.positions[v]) > positionTolerance) {
+			return false;
+		}
+		if (glm::length(rotation * vec3(a.attribs[v].normal) - vec3(b.attribs[v].normal)) > normalTolerance) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static size_t MeshBytes(const MeshView& mesh) {
+	return static_cast<size_t>(mesh.numVertices) * (sizeof(vec3) + sizeof(VertexAttribute)) +
+		static_cast<size_t>(mesh.numFaces) * (3 + 4 + 1) * sizeof(uint32_t);
+}
+
+InstancingStats FindMeshInstances(const Array<MeshView>& meshes, Array<uint32_t>& uniqueMeshes, Array<SceneInstance>& instances) {
+	InstancingStats stats = { };
+	stats.meshesBefore = static_cast<uint32_t>(meshes.size());
+
+	uniqueMeshes.clear();
+	instances.resize(meshes.size());
+
+	// topology hash -> indices into uniqueMeshes
+	std::unordered_map<uint64_t, Array<uint32_t>> candidates;
+
+	for (uint32_t meshIdx = 0; meshIdx < meshes.size(); ++meshIdx) {
+		const MeshView& mesh = meshes[meshIdx];
+		SceneInstance& instance = instances[meshIdx];
+
+		mat3 rotation(1.0f);
+		vec3 translation(0.0f);
+		bool found = false;
+
+		Array<uint32_t>& sameTopology = candidates[HashTopology(mesh)];
+		for (const uint32_t uniqueIdx : sameTopology) {
+			const MeshView& unique = meshes[uniqueMeshes[uniqueIdx]];
+			if (SameTopology(unique, mesh) && FindRigidTransform(unique, mesh, rotation, translation)) {
+				instance.meshIdx = uniqueIdx;
+				stats.bytesSaved += MeshBytes(mesh);
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			rotation = mat3(1.0f);
+			translation = vec3(0.0f);
+			instance.meshIdx = static_cast<uint32_t>(uniqueMeshes.size());
+			sameTopology.push_back(instance.meshIdx);
+			uniqueMeshes.push_back(meshIdx);
+		}
+
+		instance.firstShape = meshIdx;
+		instance.dynamic = false;
+		instance.deforming = false;
+		instance.buildPolicy = BuildPolicy::Auto;
+		for (int row = 0; row < 3; ++row) {
+			instance.transform[row * 4 + 0] = rotation[0][row];
+			instance.transform[row * 4 + 1] = rotation[1][row];
+			instance.transform[row * 4 + 2] = rotation[2][row];
+			instance.transform[row * 4 + 3] = translation[row];
+		}
+	}
+
+	stats.meshesAfter = static_cast<uint32_t>(uniqueMeshes.size());
+	return stats;
+}
+
+static vec3 TransformPoint(const float* m, const vec3& p) {
+	return vec3(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+		m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+		m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+}
+
+// the transforms are rigid, so the normals just get rotated
+static vec3 TransformDirection(const float* m, const vec3& d) {
+	return vec3(m[0] * d.x + m[1] * d.y + m[2] * d.z,
+		m[4] * d.x + m[5] * d.y + m[6] * d.z,
+		m[8] * d.x + m[9] * d.y + m[10] * d.z);
+}
+
+static void AppendToGroup(MeshData& group, const MeshView& mesh, const SceneInstance& instance, const uint32_t groupFirstShape) {
+	const uint32_t vertexBase = static_cast<uint32_t>(group.positions.size());
+	const uint32_t shapeOffset = instance.firstShape - groupFirstShape;
+
+	for (uint32_t v = 0; v < mesh.numVertices; ++v) {
+		group.positions.push_back(TransformPoint(instance.transform, mesh.positions[v]));
+
+		VertexAttribute attrib = mesh.attribs[v];
+		attrib.normal = vec4(TransformDirection(instance.transform, vec3(attrib.normal)), attrib.normal.w);
+		group.attribs.push_back(attrib);
+	}
+
+	for (uint32_t f = 0; f < mesh.numFaces; ++f) {
+		for (uint32_t j = 0; j < 3; ++j) {
+			group.indices.push_back(vertexBase + mesh.indices[3 * f + j]);
+			group.faces.push_back(vertexBase + mesh.faces[4 * f + j]);
+		}
+		group.faces.push_back(shapeOffset + mesh.faces[4 * f + 3]);
+		group.matIDs.push_back(mesh.matIDs[f]);
+	}
+}
+
+MeshGroupingStats GroupStaticMeshes(Array<MeshView>& meshes, Array<SceneInstance>& instances, const MeshGroupingPolicy& policy, Array<MeshData>& groupedMeshes) {
+	MeshGroupingStats stats = { };
+	stats.instancesBefore = static_cast<uint32_t>(instances.size());
+	stats.instancesAfter = stats.instancesBefore;
+	if (!policy.maxMeshFaces) {
+		return stats;
+	}
+
+	Array<uint32_t> numUses(meshes.size(), 0);
+	for (const SceneInstance& instance : instances) {
+		++numUses[instance.meshIdx];
+	}
+
+	// greedy in instance order, so the shapes of a group stay close in the file (and usually in space)
+	Array<Array<uint32_t>> groups;
+	Array<uint32_t> groupFaces;
+	for (uint32_t i = 0; i < instances.size(); ++i) {
+		const SceneInstance& instance = instances[i];
+		const uint32_t numFaces = meshes[instance.meshIdx].numFaces;
+		if (instance.dynamic || instance.deforming || instance.buildPolicy != BuildPolicy::Auto || numUses[instance.meshIdx] != 1 || numFaces > policy.maxMeshFaces) {
+			continue;
+		}
+
+		if (groups.empty() || groupFaces.back() + numFaces > policy.maxGroupFaces) {
+			groups.emplace_back();
+			groupFaces.push_back(0);
+		}
+		groups.back().push_back(i);
+		groupFaces.back() += numFaces;
+	}
+
+	// a group of one saves nothing
+	Array<bool> grouped(instances.size(), false);
+	size_t numGroups = 0;
+	for (const Array<uint32_t>& group : groups) {
+		if (group.size() > 1) {
+			for (const uint32_t i : group) {
+				grouped[i] = true;
+			}
+			groups[numGroups++] = group;
+		}
+	}
+	groups.resize(numGroups);
+	if (!numGroups) {
+		return stats;
+	}
+
+	groupedMeshes.resize(numGroups);
+	Array<SceneInstance> groupInstances(numGroups);
+	for (size_t g = 0; g < numGroups; ++g) {
+		SceneInstance& groupInstance = groupInstances[g];
+		groupInstance = instances[groups[g].front()];
+		groupInstance.dynamic = false;
+		groupInstance.deforming = false;
+		groupInstance.buildPolicy = BuildPolicy::Auto;
+		for (int row = 0; row < 3; ++row) {
+			for (int col = 0; col < 4; ++col) {
+				groupInstance.transform[row * 4 + col] = (row == col) ? 1.0f : 0.0f;
+			}
+		}
+
+		for (const uint32_t i : groups[g]) {
+			AppendToGroup(groupedMeshes[g], meshes[instances[i].meshIdx], instances[i], groupInstance.firstShape);
+		}
+		stats.meshesGrouped += static_cast<uint32_t>(groups[g].size());
+	}
+
+	// drop the meshes that went into groups, then add the groups
+	Array<uint32_t> meshRemap(meshes.size(), ~0u);
+	Array<MeshView> keptMeshes;
+	Array<SceneInstance> keptInstances;
+	for (uint32_t i = 0; i < instances.size(); ++i) {
+		if (grouped[i]) {
+			continue;
+		}
+
+		SceneInstance instance = instances[i];
+		if (~0u == meshRemap[instance.meshIdx]) {
+			meshRemap[instance.meshIdx] = static_cast<uint32_t>(keptMeshes.size());
+			keptMeshes.push_back(meshes[instance.meshIdx]);
+		}
+		instance.meshIdx = meshRemap[instance.meshIdx];
+		keptInstances.push_back(instance);
+	}
+
+	for (size_t g = 0; g < numGroups; ++g) {
+		groupInstances[g].meshIdx = static_cast<uint32_t>(keptMeshes.size());
+		keptMeshes.push_back(MakeMeshView(groupedMeshes[g]));
+		keptInstances.push_back(groupInstances[g]);
+	}
+
+	meshes.swap(keptMeshes);
+	instances.swap(keptInstances);
+
+	stats.instancesAfter = static_cast<uint32_t>(instances.size());
+	stats.numGroups = static_cast<uint32_t>(numGroups);
+	return stats;
+}
+
+static const char* const sBuildPolicyNames[] = { "auto", "fast-trace", "fast-build", "low-memory" };
+static_assert(sizeof(sBuildPolicyNames) / sizeof(sBuildPolicyNames[0]) == static_cast<size_t>(BuildPolicy::Count), "a name for every BuildPolicy");
+
+const char* GetBuildPolicyName(const BuildPolicy policy) {
+	return (policy < BuildPolicy::Count) ? sBuildPolicyNames[static_cast<uint32_t>(policy)] : "unknown";
+}
+
+bool ParseBuildPolicy(const String& name, BuildPolicy& policy) {
+	for (uint32_t i = 0; i < static_cast<uint32_t>(BuildPolicy::Count); ++i) {
+		if (name == sBuildPolicyNames[i]) {
+			policy = static_cast<BuildPolicy>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool LoadBuildPolicies(const String& fileName, Array<BuildPolicy>& shapePolicies, Array<bool>& deformingShapes) {
+	std::ifstream file(fileName);
+	if (!file) {
+		return false;
+	}
+
+	String line;
+	uint32_t lineNumber = 0;
+	while (std::getline(file, line)) {
+		++lineNumber;
+		const size_t comment = line.find('#');
+		if (comment != String::npos) {
+			line.resize(comment);
+		}
+
+		std::istringstream fields(line);
+		uint32_t shape = 0;
+		if (!(fields >> shape)) {
+			continue;
+		}
+
+		String name;
+		BuildPolicy policy = BuildPolicy::Auto;
+		const bool deforming = (fields >> name) && name == "deforming";
+		if (!deforming && !ParseBuildPolicy(name, policy)) {
+			printf("%s(%u): unknown build policy \"%s\"\n", fileName.c_str(), lineNumber, name.c_str());
+			continue;
+		}
+
+		if (shape >= shapePolicies.size()) {
+			shapePolicies.resize(shape + 1, BuildPolicy::Auto);
+			deformingShapes.resize(shape + 1, false);
+		}
+		if (deforming) {
+			deformingShapes[shape] = true;
+		}
+		else {
+			shapePolicies[shape] = policy;
+		}
+	}
+	return true;
+}
+
+void AppendLightTriangles(const MeshView& mesh, const float* transform, const Array<MaterialParams>& materials, Array<LightTriangle>& lights) {
+	const float* m = transform;
+	for (uint32_t f = 0; f < mesh.numFaces; ++f) {
+		const uint32_t matID = mesh.matIDs[f];
+		if (matID >= materials.size() || Luminance(vec3(materials[matID].emission)) <= 0.0f) {
+			continue;
+		}
+
+		vec3 v[3];
+		for (int i = 0; i < 3; ++i) {
+			const vec3& p = mesh.positions[mesh.indices[f * 3 + i]];
+			v[i] = vec3(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+				m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+				m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+		}
+
+		LightTriangle light;
+		light.v0AndCdf = vec4(v[0], 0.0f);
+		light.edge1 = vec4(v[1] - v[0], 0.0f);
+		light.edge2 = vec4(v[2] - v[0], 0.0f);
+		light.emission = vec4(vec3(materials[matID].emission), 0.0f);
+		if (Length(Cross(vec3(light.edge1), vec3(light.edge2))) > 0.0f) {
+			lights.push_back(light);
+		}
+	}
+}
+
+float FinishLightTriangles(Array<LightTriangle>& lights) {
+	double totalPower = 0.0;
+	for (const LightTriangle& light : lights) {
+		const float area = 0.5f * Length(Cross(vec3(light.edge1), vec3(light.edge2)));
+		totalPower += static_cast<double>(area * Luminance(vec3(light.emission)));
+	}
+	if (totalPower <= 0.0) {
+		lights.clear();
+		return 0.0f;
+	}
+
+	double cdf = 0.0;
+	for (LightTriangle& light : lights) {
+		const float area = 0.5f * Length(Cross(vec3(light.edge1), vec3(light.edge2)));
+		const float luminance = Luminance(vec3(light.emission));
+		cdf += static_cast<double>(area * luminance) / totalPower;
+		light.v0AndCdf.w = static_cast<float>(cdf);
+		light.emission.w = static_cast<float>(luminance / totalPower);
+	}
+	// so the search in the shaders always ends on a light
+	lights.back().v0AndCdf.w = 1.0f;
+
+	return static_cast<float>(totalPower);
+}
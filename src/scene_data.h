@@ -0,0 +1,115 @@
+#pragma once
+
+#include "shared_with_shaders.h"
+
+// CPU-side mesh data, every array is laid out exactly like the matching RTMesh GPU buffer
+struct MeshData {
+	Array<vec3>             positions;
+	Array<VertexAttribute>  attribs;
+	Array<uint32_t>         indices;    // 3 per face
+	Array<uint32_t>         faces;      // 4 per face (uvec4 in the shaders)
+	Array<uint32_t>         matIDs;     // 1 per face
+};
+
+// non-owning view onto mesh data, either from MeshData or from a memory-mapped scene cache
+struct MeshView {
+	uint32_t                numVertices;
+	uint32_t                numFaces;
+
+	const vec3*             positions;
+	const VertexAttribute*  attribs;
+	const uint32_t*         indices;
+	const uint32_t*         faces;
+	const uint32_t*         matIDs;
+};
+
+inline MeshView MakeMeshView(const MeshData& mesh) {
+	MeshView view;
+	view.numVertices = static_cast<uint32_t>(mesh.positions.size());
+	view.numFaces = static_cast<uint32_t>(mesh.matIDs.size());
+	view.positions = mesh.positions.data();
+	view.attribs = mesh.attribs.data();
+	view.indices = mesh.indices.data();
+	view.faces = mesh.faces.data();
+	view.matIDs = mesh.matIDs.data();
+	return view;
+}
+
+struct WeldStats {
+	uint32_t    verticesBefore;
+	uint32_t    verticesAfter;
+	size_t      bytesSaved;
+};
+
+// merges bit-identical vertices (position + attributes) and rewrites indices and faces to point at them
+WeldStats WeldVertices(MeshData& mesh);
+
+static const char* const kBuildPolicyExt = ".policy"; // appended to the scene file name
+
+// How a mesh's BLAS is built. Scene metadata can set it per shape, Auto leaves it to the renderer's heuristics.
+enum class BuildPolicy : uint32_t {
+	Auto = 0,
+	FastTrace,      // static geometry that's hit a lot
+	FastBuild,      // deforming, rebuilt or refit often
+	LowMemory,      // rarely hit background
+
+	Count
+};
+
+// one placement of a mesh, the transform is 3x4 row-major (same as VkGeometryInstance)
+struct SceneInstance {
+	uint32_t    meshIdx;
+	uint32_t    firstShape;     // shape (object in the scene file) of the mesh's faces, plus faces.w
+	bool        dynamic;        // moved at runtime (rigidly, through its TLAS transform), never merged into a group
+	bool        deforming;      // its vertices change at runtime (scene metadata), never merged into a group either
+	BuildPolicy buildPolicy;    // from the scene metadata, anything but Auto keeps it out of groups too
+	float       transform[12];
+};
+
+struct InstancingStats {
+	uint32_t    meshesBefore;
+	uint32_t    meshesAfter;
+	size_t      bytesSaved;
+};
+
+// Finds meshes that are a rigidly moved copy of an earlier one: same indices and material ids, positions and
+// normals differ by one rotation + translation. Candidates are grouped by a hash of the topology, the transform
+// is solved from a frame spanned by the same vertices of both meshes and then checked against every vertex.
+// uniqueMeshes gets the indices (into meshes) of the meshes to keep, instances gets one entry per input mesh,
+// with meshIdx indexing uniqueMeshes.
+InstancingStats FindMeshInstances(const Array<MeshView>& meshes, Array<uint32_t>& uniqueMeshes, Array<SceneInstance>& instances);
+
+struct MeshGroupingPolicy {
+	uint32_t    maxMeshFaces;   // meshes up to this many faces get merged, 0 turns grouping off
+	uint32_t    maxGroupFaces;  // a group is closed once it has this many faces
+};
+
+struct MeshGroupingStats {
+	uint32_t    instancesBefore;
+	uint32_t    instancesAfter;
+	uint32_t    meshesGrouped;
+	uint32_t    numGroups;
+};
+
+// "fast-trace", "fast-build", "low-memory" or "auto"
+const char* GetBuildPolicyName(const BuildPolicy policy);
+bool        ParseBuildPolicy(const String& name, BuildPolicy& policy);
+
+// Build policy metadata, a text file with one "<shape index> <policy>" or "<shape index> deforming" per line
+// and # comments. shapePolicies and deformingShapes get an entry up to the highest shape mentioned,
+// Auto and false for the ones not mentioned.
+bool LoadBuildPolicies(const String& fileName, Array<BuildPolicy>& shapePolicies, Array<bool>& deformingShapes);
+
+// Merges small static meshes into bigger ones, so a scene of many tiny shapes doesn't become as many BLASes
+// and TLAS instances. Only meshes placed by a single static, non-deforming instance with no build policy of
+// their own are merged (shared ones would lose their instancing); their vertices are baked into world space
+// and faces.w keeps the shape each face came from.
+// meshes and instances are rewritten: grouped meshes are dropped, every group adds a mesh (its data lives in
+// groupedMeshes, meshes gets a view of it) and replaces its members' instances with one identity instance.
+MeshGroupingStats GroupStaticMeshes(Array<MeshView>& meshes, Array<SceneInstance>& instances, const MeshGroupingPolicy& policy, Array<MeshData>& groupedMeshes);
+
+// Lights for next-event estimation: every face of the mesh whose material has a non-black Ke, placed with
+// transform (3x4 row-major). Faces without a material (matID out of range) never emit.
+void AppendLightTriangles(const MeshView& mesh, const float* transform, const Array<MaterialParams>& materials, Array<LightTriangle>& lights);
+// Once every light is in: fills in the pick cdf and the per area pdfs, returns the total power (0 - no lights)
+float FinishLightTriangles(Array<LightTriangle>& lights);
@@ -0,0 +1,90 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "../shared_with_shaders.h"
+#include "../shared_denoiser.h"
+
+// one a-trous pass of the denoiser, 1 << Iteration pixels between the taps, see shared_denoiser.h.
+// Reads one half of the filter buffer and writes the other, the last pass writes the result image instead
+
+layout(local_size_x = SWS_DENOISE_GROUP_SIZE, local_size_y = SWS_DENOISE_GROUP_SIZE) in;
+
+layout(push_constant) uniform AtrousPass {
+    uint Iteration;
+};
+
+layout(set = SWS_RESULT_IMAGE_SET, binding = SWS_RESULT_IMAGE_BINDING, rgba8) uniform image2D ResultImage;
+
+layout(set = SWS_CAMDATA_SET,      binding = SWS_CAMDATA_BINDING, std140)     uniform AppData {
+    UniformParams Params;
+};
+
+layout(set = SWS_DENOISE_SURFACES_SET, binding = SWS_DENOISE_SURFACES_BINDING, std430) readonly buffer DenoiseSurfacesBuffer {
+    DenoiseSurface Surfaces[];
+};
+
+layout(set = SWS_DENOISE_FILTER_SET, binding = SWS_DENOISE_FILTER_BINDING, std430) buffer DenoiseFilterBuffer {
+    vec4 Filtered[];
+};
+
+void main() {
+	const ivec2 size = imageSize(ResultImage);
+	const ivec2 pixelPos = ivec2(gl_GlobalInvocationID.xy);
+	if (pixelPos.x >= size.x || pixelPos.y >= size.y) {
+		return;
+	}
+
+	const uint numPixels = uint(size.x * size.y);
+	const uint pixelIdx = uint(pixelPos.y * size.x + pixelPos.x);
+	const uint current = Params.denoiseData.x & 1u;
+	const uint src = (Iteration & 1u) * numPixels;
+	const uint dst = ((Iteration + 1u) & 1u) * numPixels;
+	const int tapStep = 1 << Iteration;
+	const DenoiseSurface surface = Surfaces[current * numPixels + pixelIdx];
+	const vec4 center = Filtered[src + pixelIdx];
+
+	// misses have nothing to tell their neighbours apart by, and the background isn't noisy anyway
+	vec4 result = center;
+	if (surface.positionAndDepth.w >= 0.0f) {
+		// the variance blurred a little, one pixel's estimate is noisy itself
+		float variance = 0.0f;
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx) {
+				const ivec2 q = clamp(pixelPos + ivec2(dx, dy), ivec2(0), size - 1);
+				variance += Filtered[src + uint(q.y * size.x + q.x)].w * DenoiseGaussianWeight(dx, dy);
+			}
+		}
+		const float stdDev = sqrt(max(variance, 0.0f));
+		const float luminance = Luminance(center.rgb);
+		const float footprint = DenoisePixelFootprint(surface.positionAndDepth.w, Params.camNearFarFov.z, float(size.y)) * float(tapStep);
+
+		const float centerWeight = DenoiseKernelWeight(0) * DenoiseKernelWeight(0);
+		vec3 sumColor = center.rgb * centerWeight;
+		float sumVariance = center.w * centerWeight * centerWeight;
+		float sumWeight = centerWeight;
+		for (int dy = -2; dy <= 2; ++dy) {
+			for (int dx = -2; dx <= 2; ++dx) {
+				const ivec2 q = pixelPos + ivec2(dx, dy) * tapStep;
+				if ((0 == dx && 0 == dy) || q.x < 0 || q.y < 0 || q.x >= size.x || q.y >= size.y) {
+					continue;
+				}
+				const uint qIdx = uint(q.y * size.x + q.x);
+				const vec4 qColor = Filtered[src + qIdx];
+				const float weight = DenoiseKernelWeight(dx) * DenoiseKernelWeight(dy) *
+					DenoiseGeometryWeight(surface, Surfaces[current * numPixels + qIdx], footprint * length(vec2(dx, dy))) *
+					DenoiseLuminanceWeight(luminance, Luminance(qColor.rgb), stdDev);
+				sumColor += qColor.rgb * weight;
+				sumVariance += qColor.w * weight * weight;
+				sumWeight += weight;
+			}
+		}
+		result = vec4(sumColor / sumWeight, sumVariance / (sumWeight * sumWeight));
+	}
+
+	if (Iteration + 1u < max(Params.denoiseData.y, 1u)) {
+		Filtered[dst + pixelIdx] = result;
+		return;
+	}
+
+	imageStore(ResultImage, pixelPos, vec4(LinearToSrgb(sqrt(result.rgb)), 1.0f)); //gamma
+}
@@ -0,0 +1,110 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "../shared_with_shaders.h"
+#include "../shared_denoiser.h"
+
+// first pass of the denoiser: the pixel's samples on top of its (reprojected) history, see shared_denoiser.h
+
+layout(local_size_x = SWS_DENOISE_GROUP_SIZE, local_size_y = SWS_DENOISE_GROUP_SIZE) in;
+
+layout(set = SWS_RESULT_IMAGE_SET, binding = SWS_RESULT_IMAGE_BINDING, rgba8) uniform readonly image2D ResultImage;
+
+layout(set = SWS_CAMDATA_SET,      binding = SWS_CAMDATA_BINDING, std140)     uniform AppData {
+    UniformParams Params;
+};
+
+layout(set = SWS_PIXEL_STATS_SET,   binding = SWS_PIXEL_STATS_BINDING, std430)  readonly buffer PixelStatsBuffer {
+    PixelStats Pixels[];
+};
+
+layout(set = SWS_DENOISE_SURFACES_SET, binding = SWS_DENOISE_SURFACES_BINDING, std430) readonly buffer DenoiseSurfacesBuffer {
+    DenoiseSurface Surfaces[];
+};
+
+layout(set = SWS_DENOISE_HISTORY_SET, binding = SWS_DENOISE_HISTORY_BINDING, std430) buffer DenoiseHistoryBuffer {
+    DenoiseHistory History[];
+};
+
+layout(set = SWS_DENOISE_FILTER_SET, binding = SWS_DENOISE_FILTER_BINDING, std430) writeonly buffer DenoiseFilterBuffer {
+    vec4 Filtered[];
+};
+
+void main() {
+	const ivec2 size = imageSize(ResultImage);
+	const ivec2 pixelPos = ivec2(gl_GlobalInvocationID.xy);
+	if (pixelPos.x >= size.x || pixelPos.y >= size.y) {
+		return;
+	}
+
+	const uint numPixels = uint(size.x * size.y);
+	const uint pixelIdx = uint(pixelPos.y * size.x + pixelPos.x);
+	const uint current = Params.denoiseData.x & 1u;
+	const uint previous = current ^ 1u;
+	const float fovY = Params.camNearFarFov.z;
+	const DenoiseSurface surface = Surfaces[current * numPixels + pixelIdx];
+
+	// the prior is found once per accumulation, the frames after that add their samples to the same one
+	DenoiseHistory prior = DenoiseEmptyHistory();
+	if (0 == Params.frameData.x) {
+		if (0 != Params.denoiseData.z && surface.positionAndDepth.w >= 0.0f) {
+			const vec2 prevPos = DenoiseProject(surface.positionAndDepth.xyz, Params.prevCamPos.xyz, Params.prevCamDir.xyz,
+				Params.prevCamUp.xyz, Params.prevCamSide.xyz, fovY, vec2(size)) - vec2(0.5f);
+			const ivec2 base = ivec2(floor(prevPos));
+			const vec2 f = prevPos - vec2(base);
+
+			DenoiseHistory sum = DenoiseEmptyHistory();
+			float sumWeight = 0.0f;
+			for (int tap = 0; tap < 4; ++tap) {
+				const ivec2 tapPos = base + ivec2(tap & 1, tap >> 1);
+				if (tapPos.x < 0 || tapPos.y < 0 || tapPos.x >= size.x || tapPos.y >= size.y) {
+					continue;
+				}
+				const uint tapIdx = uint(tapPos.y * size.x + tapPos.x);
+				if (!DenoiseSameSurface(surface, Surfaces[previous * numPixels + tapIdx])) {
+					continue;
+				}
+				const float weight = DenoiseBilinearWeight(f, tap);
+				DenoiseAddHistory(sum, History[previous * numPixels + tapIdx], weight);
+				sumWeight += weight;
+			}
+			prior = DenoiseFinishPrior(sum, sumWeight);
+		}
+		History[SWS_DENOISE_PRIOR_HISTORY * numPixels + pixelIdx] = prior;
+	}
+	else {
+		prior = History[SWS_DENOISE_PRIOR_HISTORY * numPixels + pixelIdx];
+	}
+
+	const DenoiseHistory history = DenoiseIntegrate(prior, Pixels[pixelIdx]);
+	History[current * numPixels + pixelIdx] = history;
+
+	// a short history doesn't know its variance yet, the neighbours on the same surface stand in for its samples
+	float variance = DenoiseMeanVariance(history.moments.xy, history.colorAndLength.w);
+	if (history.colorAndLength.w < SWS_DENOISE_MIN_HISTORY && surface.positionAndDepth.w >= 0.0f) {
+		const float footprint = DenoisePixelFootprint(surface.positionAndDepth.w, fovY, float(size.y));
+		vec2 moments = vec2(0.0f);
+		float sumWeight = 0.0f;
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx) {
+				const ivec2 q = pixelPos + ivec2(dx, dy);
+				if (q.x < 0 || q.y < 0 || q.x >= size.x || q.y >= size.y) {
+					continue;
+				}
+				const uint qIdx = uint(q.y * size.x + q.x);
+				const PixelStats qPixel = Pixels[qIdx];
+				if (qPixel.colorA.w + qPixel.colorB.w <= 0.0f) {
+					continue;
+				}
+				const float weight = DenoiseGeometryWeight(surface, Surfaces[current * numPixels + qIdx], footprint * length(vec2(dx, dy)));
+				moments += DenoisePixelMoments(qPixel) * weight;
+				sumWeight += weight;
+			}
+		}
+		if (sumWeight > 0.0f) {
+			variance = DenoiseMeanVariance(moments / sumWeight, max(history.colorAndLength.w, 1.0f));
+		}
+	}
+
+	Filtered[pixelIdx] = vec4(history.colorAndLength.rgb, variance);
+}
@@ -19,6 +19,15 @@ layout(set = SWS_FACES_SET, binding = 0, std430) readonly buffer FacesBuffer {
 
 layout(set = SWS_TEXTURES_SET, binding = 0) uniform sampler2D TexturesArray[];
 
+layout(set = SWS_INSTANCE_SHAPES_SET, binding = SWS_INSTANCE_SHAPES_BINDING, std430) readonly buffer InstanceShapesBuffer {
+    uint InstanceShapes[];
+};
+
+layout(set = SWS_MATERIALS_SET, binding = SWS_MATERIALS_BINDING, std430) readonly buffer MaterialsBuffer {
+    uvec4 MaterialsInfo;    // x - number of materials
+    MaterialParams Materials[];
+};
+
 layout(location = SWS_LOC_PRIMARY_RAY) rayPayloadInNV RayPayload PrimaryRay;
                                        hitAttributeNV vec2 HitAttribs;
 
@@ -34,29 +43,19 @@ void main() {
     VertexAttribute v1 = AttribsArray[nonuniformEXT(gl_InstanceCustomIndexNV)].VertexAttribs[int(face.y)];
     VertexAttribute v2 = AttribsArray[nonuniformEXT(gl_InstanceCustomIndexNV)].VertexAttribs[int(face.z)];
 
-    // interpolate our vertex attribs
-    const vec3 normal = normalize(BaryLerp(v0.normal.xyz, v1.normal.xyz, v2.normal.xyz, barycentrics));
-	vec3 texel;
-   	
-	
-    const float objId = float(gl_InstanceCustomIndexNV);
-	if (objId == 0) {
-		texel = vec3(0.0f, 0.0f, 1.0f);
-	}
-	else if (objId == 1) { //global box
-		texel = vec3(1.0f, 1.0f, 1.0f);
-	}
-	else if (objId == 2) {
-		texel = vec3(0.0f, 1.0f, 0.0f);
-	}
-	else if (objId == 3) {
-		texel = vec3(0.1f, 0.1f, 0.1f);
-	}
-	else {
-		texel = vec3(0.0f, 0.0f, 0.0f);
-	}
-	
-
-    PrimaryRay.colorAndDist = vec4(texel, gl_HitTNV);
+    // interpolate our vertex attribs, instances are placed with rigid transforms so the normal just gets rotated
+    const vec3 objectNormal = BaryLerp(v0.normal.xyz, v1.normal.xyz, v2.normal.xyz, barycentrics);
+    const vec3 normal = normalize(mat3(gl_ObjectToWorldNV) * objectNormal);
+
+    // the shape as it was in the scene file: instances of one mesh still get told apart,
+    // and so do the meshes merged into one BLAS (faces.w is the shape within the group)
+    const float objId = float(InstanceShapes[gl_InstanceID] + face.w);
+
+    const bool hasMaterial = matID < MaterialsInfo.x;
+    const vec3 albedo = hasMaterial ? Materials[matID].diffuse.rgb : vec3(SWS_DEFAULT_DIFFUSE);
+    const vec3 emission = hasMaterial ? Materials[matID].emission.rgb : vec3(0.0f);
+
+    PrimaryRay.colorAndDist = vec4(albedo, gl_HitTNV);
     PrimaryRay.normalAndObjId = vec4(normal, objId);
+    PrimaryRay.emission = vec4(emission, 0.0f);
 }
@@ -4,7 +4,8 @@
 #extension GL_EXT_nonuniform_qualifier : require
 
 #include "../shared_with_shaders.h"
-#include "../shaders/random.glsl"
+#include "../shared_sampler.h"
+#include "../shared_denoiser.h"
 
 layout(set = SWS_SCENE_AS_SET,     binding = SWS_SCENE_AS_BINDING)            uniform accelerationStructureNV Scene;
 layout(set = SWS_RESULT_IMAGE_SET, binding = SWS_RESULT_IMAGE_BINDING, rgba8) uniform image2D ResultImage;
@@ -13,6 +14,22 @@ layout(set = SWS_CAMDATA_SET,      binding = SWS_CAMDATA_BINDING, std140)     un
     UniformParams Params;
 };
 
+layout(set = SWS_LIGHTS_SET,        binding = SWS_LIGHTS_BINDING, std430)      readonly buffer LightsBuffer {
+    LightTriangle Lights[];
+};
+
+layout(set = SWS_RAY_COUNTERS_SET,  binding = SWS_RAY_COUNTERS_BINDING, std430) buffer RayCountersBuffer {
+    RayCounters Counters;
+};
+
+layout(set = SWS_PIXEL_STATS_SET,   binding = SWS_PIXEL_STATS_BINDING, std430)  buffer PixelStatsBuffer {
+    PixelStats Pixels[];
+};
+
+layout(set = SWS_DENOISE_SURFACES_SET, binding = SWS_DENOISE_SURFACES_BINDING, std430) writeonly buffer DenoiseSurfacesBuffer {
+    DenoiseSurface Surfaces[];
+};
+
 layout(location = SWS_LOC_PRIMARY_RAY) rayPayloadNV RayPayload PrimaryRay;
 layout(location = SWS_LOC_SHADOW_RAY)  rayPayloadNV ShadowRayPayload ShadowRay;
 
@@ -34,11 +51,61 @@ vec3 CalcRayDir(vec2 screenUV, float aspect) {
 	return rayDir;
 }
 
+// binary search of the light cdf
+uint PickLight(const float u) {
+	uint first = 0, last = uint(Params.lightsInfo.x) - 1;
+	while (first < last) {
+		const uint middle = (first + last) / 2;
+		if (u < Lights[middle].v0AndCdf.w) {
+			last = middle;
+		}
+		else {
+			first = middle + 1;
+		}
+	}
+	return first;
+}
+
+// pixels still converging are what the next frame shares its budget out with
+void CountConvergingPixel(const PixelStats pixel) {
+	if (!PixelConverged(pixel)) {
+		atomicAdd(Counters.adaptive.x, 1u);
+	}
+}
+
 void main() {
-	uint seed = InitRandomSeed(gl_LaunchIDNV.x, gl_LaunchIDNV.y);
+	const uint accumFrame = Params.frameData.x;
+	const uint samplesPerFrame = Params.frameData.y;
+	const uint renderFlags = Params.frameData.z;
+	const uint rouletteDepth = Params.frameData.w;
+
+	// the first frame after a reset starts over, whatever is in the buffer
+	const uint pixelIdx = gl_LaunchIDNV.y * gl_LaunchSizeNV.x + gl_LaunchIDNV.x;
+	PixelStats pixel = Pixels[pixelIdx];
+	if (0 == accumFrame) {
+		pixel.colorA = pixel.colorB = pixel.luminance = vec4(0.0f);
+	}
+	const uint part = accumFrame & 1;
+	const uint firstSample = uint(pixel.colorA.w + pixel.colorB.w);
+
+	// every accumulated frame carries on the pixel's sequence, otherwise we'd just average the same image
+	SamplerState pixelSampler = SamplerInit(Params.samplingData.x, gl_LaunchIDNV.x, gl_LaunchIDNV.y, firstSample, Params.samplingData.y);
+
+	uint numSamples = samplesPerFrame;
+	if (0 != (renderFlags & SWS_RENDER_ADAPTIVE)) {
+		const float budget = float(gl_LaunchSizeNV.x * gl_LaunchSizeNV.y * samplesPerFrame);
+		numSamples = AdaptiveSampleCount(pixelSampler, pixel, samplesPerFrame, budget, Params.samplingData.z, accumFrame);
+	}
+
+	// converged or rounded down to nothing, the offscreen image still needs the pixel every frame
+	if (0 == numSamples) {
+		imageStore(ResultImage, ivec2(gl_LaunchIDNV.xy), vec4(LinearToSrgb(sqrt(PixelColor(pixel))), 1.0f));
+		CountConvergingPixel(pixel);
+		return;
+	}
+
     const float aspect = float(gl_LaunchSizeNV.x) / float(gl_LaunchSizeNV.y);
-	const vec3 LightSource = vec3(0.0f, 100.0f, 0.0f);
-       
+
     const uint rayFlags = gl_RayFlagsOpaqueNV;
     const uint shadowRayFlags = gl_RayFlagsOpaqueNV | gl_RayFlagsTerminateOnFirstHitNV;
 
@@ -48,73 +115,149 @@ void main() {
 
     const float tmin = 0.0001f;
 	const float tmax = Params.camNearFarFov.y * 0.75f;
-	
-	
-	vec2 curPixel = vec2(gl_LaunchIDNV.x, gl_LaunchIDNV.y);
 
-    vec3 finalColor = vec3(0.0f);
-	for(int t = 0; t < SWS_MAX_RAYS; ++t){
+	const bool sampleLights = (0 != (renderFlags & SWS_RENDER_NEE)) && Params.lightsInfo.x > 0.0f;
+	const float lightsPower = Params.lightsInfo.y;
 
+	// summed here, so the counters see one atomic per launch index
+	uint numBounces = 0, numShadowRays = 0, numRouletteKills = 0;
+
+    vec3 finalColor = vec3(0.0f);
+	float sumLuminance = 0.0f, sumLuminanceSq = 0.0f;
+	for(uint t = 0; t < numSamples; ++t){
+		SamplerStartSample(pixelSampler, firstSample + t);
+		const vec2 curPixel = vec2(gl_LaunchIDNV.xy) + SamplerGet2D(pixelSampler);
 		const vec2 uv = (curPixel / gl_LaunchSizeNV.xy) * 2.0f - 1.0f;
 		vec3 origin = Params.camPos.xyz;
 		vec3 direction = CalcRayDir(uv, aspect);
-		vec3 rayColor = vec3(1.0f);
+		vec3 throughput = vec3(1.0f);
+		float bsdfPdf = 0.0f;  // 0 after the camera and glass, nothing but the bounce itself could've found what's hit next
+		vec3 sampleColor = vec3(0.0f);
+
 		for (int i = 0; i < SWS_MAX_RECURSION; ++i) {
 
-			traceNV(Scene, rayFlags, cullMask, 0, stbRecordStride, 0, origin, tmin, direction, tmax, 0);
+			traceNV(Scene, rayFlags, cullMask, SWS_PRIMARY_HIT_SHADERS_IDX, stbRecordStride, SWS_PRIMARY_MISS_SHADERS_IDX, origin, tmin, direction, tmax, SWS_LOC_PRIMARY_RAY);
+			++numBounces;
 
 			const vec3 hitColor = PrimaryRay.colorAndDist.rgb;
 			const float hitDistance = PrimaryRay.colorAndDist.w;
 			const float objectId = PrimaryRay.normalAndObjId.w;
 			const vec3 normal = PrimaryRay.normalAndObjId.xyz;
+			const vec3 emission = PrimaryRay.emission.rgb;
+
+			// the denoiser tells surfaces apart by the first camera ray's hit
+			if (0 == t && 0 == i && 0 != (renderFlags & SWS_RENDER_DENOISE)) {
+				const uint surfaceIdx = (Params.denoiseData.x & 1u) * gl_LaunchSizeNV.x * gl_LaunchSizeNV.y + pixelIdx;
+				Surfaces[surfaceIdx] = DenoiseSurfaceFromHit(PrimaryRay, origin, direction);
+			}
+
 			if (hitDistance < 0.0f) {
-				finalColor += hitColor;
+				sampleColor += throughput * hitColor;
 				break;
 			}
-			else {
-				const vec3 hitNormal = PrimaryRay.normalAndObjId.xyz;
-				const vec3 hitPos = origin + direction * hitDistance;
-				vec3 toLight = abs(normalize(hitPos - LightSource));
-
-				if (objectId == OBJECT_ID_BOX1) {
-					finalColor += hitColor * 0.1f;
-					origin = hitPos + direction * 0.001f;
-					direction = vec3(normal + RandomInUnitSphere(seed));					
-				}
-				else if (objectId == OBJECT_ID_BOX2) { //ROOM					
-					origin = hitPos + direction * 0.001f;
-					direction = vec3(hitNormal + RandomInUnitSphere(seed));
-					traceNV(Scene, rayFlags, cullMask, 0, stbRecordStride, 0, origin, tmin, direction, tmax, 0);
-				}
-				else if (objectId == OBJECT_ID_BOX3) {
-					const float dot = dot(direction, normal);
-					const vec3 outwardDormal = dot > 0 ? -normal : normal;
-					const float niOverNt = dot > 0 ? RefractionIndex : 1 / RefractionIndex;
-					const float cosine = dot > 0 ? RefractionIndex * dot : -dot;
-					const vec3 refracted = refract(direction, outwardDormal, niOverNt);
-					const float reflectProb = refracted != vec3(0) ? Schlick(cosine, RefractionIndex) : 1;
-					const vec3 scatter = RandomFloat(seed) < reflectProb ? reflect(direction, normal) : refracted;
-					origin = hitPos + direction * 0.001f;
-					direction = vec3(scatter);				
+
+			const vec3 hitPos = origin + direction * hitDistance;
+
+			// lights end the path. After a diffuse bounce a shadow ray could've found this one too, so it only gets its MIS share
+			if (Luminance(emission) > 0.0f) {
+				float weight = 1.0f;
+				if (sampleLights && bsdfPdf > 0.0f) {
+					const float cosLight = max(abs(dot(normal, direction)), 1e-6f);
+					const float lightPdf = Luminance(emission) / lightsPower * hitDistance * hitDistance / cosLight;
+					weight = PowerHeuristic(bsdfPdf, lightPdf);
 				}
-				else if (objectId == OBJECT_ID_LIGHT_PLANE) {
-					origin = hitPos + direction * 0.001f;
-					finalColor += vec3(1);
-					direction = vec3(normal + RandomInUnitSphere(seed));
-					break;
+				sampleColor += throughput * emission * weight;
+				break;
+			}
+
+			if (objectId == OBJECT_ID_BOX3) {
+				const float dot = dot(direction, normal);
+				const vec3 outwardDormal = dot > 0 ? -normal : normal;
+				const float niOverNt = dot > 0 ? RefractionIndex : 1 / RefractionIndex;
+				const float cosine = dot > 0 ? RefractionIndex * dot : -dot;
+				const vec3 refracted = refract(direction, outwardDormal, niOverNt);
+				const float reflectProb = refracted != vec3(0) ? Schlick(cosine, RefractionIndex) : 1;
+				const vec3 scatter = SamplerGet1D(pixelSampler) < reflectProb ? reflect(direction, normal) : refracted;
+				origin = hitPos + direction * 0.001f;
+				direction = vec3(scatter);
+				bsdfPdf = 0.0f;
+				continue;
+			}
+
+			// everything else is diffuse
+			const vec3 albedo = hitColor;
+			const vec3 surfaceNormal = dot(direction, normal) > 0.0f ? -normal : normal;
+			origin = hitPos + surfaceNormal * 0.001f;
+
+			if (sampleLights) {
+				const uint lightIdx = PickLight(SamplerGet1D(pixelSampler));
+				const vec2 barycentrics = SampleTriangle(SamplerGet2D(pixelSampler));
+
+				const vec3 edge1 = Lights[lightIdx].edge1.xyz;
+				const vec3 edge2 = Lights[lightIdx].edge2.xyz;
+				vec3 toLight = Lights[lightIdx].v0AndCdf.xyz + edge1 * barycentrics.x + edge2 * barycentrics.y - origin;
+				const float distance = length(toLight);
+				toLight /= distance;
+
+				const float cosSurface = dot(surfaceNormal, toLight);
+				const float cosLight = abs(dot(normalize(cross(edge1, edge2)), toLight));
+				if (cosSurface > 0.0f && cosLight > 0.0f) {
+					// stops at the first hit, the miss shader is what tells us the light is visible
+					traceNV(Scene, shadowRayFlags, cullMask, SWS_SHADOW_HIT_SHADERS_IDX, stbRecordStride, SWS_SHADOW_MISS_SHADERS_IDX, origin, tmin, toLight, distance * 0.999f, SWS_LOC_SHADOW_RAY);
+					++numShadowRays;
+					if (ShadowRay.distance < 0.0f) {
+						const float lightPdf = Lights[lightIdx].emission.w * distance * distance / cosLight;
+						const float lightBsdfPdf = cosSurface / MM_Pi;
+						sampleColor += throughput * albedo * (cosSurface / MM_Pi) * Lights[lightIdx].emission.rgb * (PowerHeuristic(lightPdf, lightBsdfPdf) / lightPdf);
+					}
 				}
-				else {
-					origin = hitPos + direction * 0.001f;
-					direction = vec3(hitNormal + RandomInUnitSphere(seed));
+			}
+
+			// cosine weighted, so albedo / pi * cos / pdf leaves just the albedo
+			direction = SampleCosineHemisphere(SamplerGet2D(pixelSampler), surfaceNormal);
+			bsdfPdf = dot(surfaceNormal, direction) / MM_Pi;
+			throughput *= albedo;
+
+			const float maxThroughput = max(throughput.x, max(throughput.y, throughput.z));
+			if (bsdfPdf <= 0.0f || maxThroughput <= 0.0f) {
+				break;
+			}
+
+			// the ones that survive carry the energy of those that didn't, so the estimate stays unbiased
+			const uint depth = uint(i) + 1;
+			if (depth >= rouletteDepth && depth < SWS_MAX_RECURSION) {
+				const float survival = min(maxThroughput, SWS_RR_MAX_SURVIVAL);
+				if (SamplerGet1D(pixelSampler) >= survival) {
+					++numRouletteKills;
 					break;
 				}
+				throughput /= survival;
 			}
-	
 		}
 
-		curPixel = vec2(gl_LaunchIDNV.x + RandomFloat(seed), gl_LaunchIDNV.y + RandomFloat(seed));
+		const float luminance = Luminance(sampleColor);
+		finalColor += sampleColor;
+		sumLuminance += luminance;
+		sumLuminanceSq += luminance * luminance;
 	}
-	finalColor = finalColor / SWS_MAX_RAYS;
-	finalColor = sqrt(finalColor); //gamma
+
+	atomicAdd(Counters.counts.x, numSamples);
+	atomicAdd(Counters.counts.y, numBounces);
+	if (numShadowRays > 0) {
+		atomicAdd(Counters.counts.z, numShadowRays);
+	}
+	if (numRouletteKills > 0) {
+		atomicAdd(Counters.counts.w, numRouletteKills);
+	}
+
+	// running averages in linear space, weighted by samples since pixels don't all get the same number
+	AccumulateHalf(pixel, part, finalColor, vec2(sumLuminance, sumLuminanceSq), numSamples);
+	Pixels[pixelIdx] = pixel;
+
+	if (0 != (renderFlags & SWS_RENDER_ADAPTIVE)) {
+		CountConvergingPixel(pixel);
+	}
+
+	finalColor = sqrt(PixelColor(pixel)); //gamma
 	imageStore(ResultImage, ivec2(gl_LaunchIDNV.xy), vec4(LinearToSrgb(finalColor), 1.0f));
 }
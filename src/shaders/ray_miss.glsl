@@ -10,4 +10,5 @@ void main() {
     const vec3 backgroundColor = vec3(0.0f, 0.0f, 0.0f);
     PrimaryRay.colorAndDist = vec4(backgroundColor, -1.0f);
     PrimaryRay.normalAndObjId = vec4(0.0f);
+    PrimaryRay.emission = vec4(0.0f);
 }
@@ -0,0 +1,174 @@
+#ifndef SHARED_DENOISER_H
+#define SHARED_DENOISER_H
+
+#include "shared_with_shaders.h"
+#include "shared_sampler.h"
+
+// Spatio-temporal denoiser (SWS_RENDER_DENOISE), after Schied et al. 2017, "Spatiotemporal Variance-Guided
+// Filtering". It runs on what ray_gen.glsl accumulated, the same code in denoise_*.glsl and in CpuDenoiser:
+//   temporal - the pixel's samples are added to a prior. When accumulation restarts (the camera moved) the prior is
+//              what the frame before integrated, reprojected into the new view wherever it saw the same surface
+//              (object id, normal, plane distance). The variance of the integrated mean comes from the luminance
+//              moments, or from the 3x3 neighbours on the same surface while the history is too short for that.
+//   spatial  - a-trous passes of the 5x5 B3 spline, 1, 2, 4... pixels apart, weighted by normal, plane distance,
+//              object id and by the luminance difference over its standard deviation. The variance is filtered
+//              along with the color, so every pass trusts the luminance a bit more.
+// The history keeps the unfiltered colors: with a still camera the variance goes down with the samples, the luminance
+// weights shut the filter off and the image ends up at the path traced one.
+// Colors aren't demodulated by albedo, the payload's albedo is the first hit's and isn't the pixel's texture behind
+// the glass box, the luminance weights keep the edges between materials instead.
+
+#define SWS_DENOISE_ITERATIONS          5
+#define SWS_DENOISE_MAX_HISTORY         32.0f   // samples a reprojected prior counts for at most, older ones fade out
+#define SWS_DENOISE_MIN_HISTORY         4.0f    // below this the pixel's own moments can't be trusted for its variance
+#define SWS_DENOISE_SIGMA_NORMAL        128.0f  // power of the cosine between the normals
+#define SWS_DENOISE_SIGMA_DEPTH         1.0f    // distance to the pixel's plane, in footprints of the step
+#define SWS_DENOISE_SIGMA_LUMINANCE     8.0f    // luminance difference, in standard deviations
+#define SWS_DENOISE_REPROJECT_DEPTH     0.01f   // plane distance of a reprojected surface, relative to its depth
+#define SWS_DENOISE_GROUP_SIZE          8       // compute shader workgroups are this squared
+
+// buffers, every one of them has a slice of one element per pixel for each of these
+#define SWS_DENOISE_NUM_SURFACES        2       // by frame parity
+#define SWS_DENOISE_NUM_HISTORIES       3       // by frame parity, then the prior
+#define SWS_DENOISE_PRIOR_HISTORY       2
+#define SWS_DENOISE_NUM_FILTERED        2       // a-trous ping-pong, rgb - color, w - variance
+
+#ifdef __cplusplus
+// GLSL built-ins below
+using glm::dot;
+#endif
+
+SWS_FUNC DenoiseSurface DenoiseSurfaceFromHit(RayPayload payload, vec3 origin, vec3 direction) {
+	DenoiseSurface surface;
+	surface.normalAndObjId = payload.normalAndObjId;
+	surface.positionAndDepth = vec4(origin + direction * payload.colorAndDist.w, payload.colorAndDist.w);
+	return surface;
+}
+
+// continuous pixel coordinates (centers at +0.5) a world position shows up at for a camera, ray_gen.glsl's
+// CalcRayDir backwards. Behind the camera it's (-1, -1)
+SWS_FUNC vec2 DenoiseProject(vec3 position, vec3 camPos, vec3 camDir, vec3 camUp, vec3 camSide, float fovY, vec2 size) {
+	const vec3 toPoint = position - camPos;
+	const float z = dot(toPoint, camDir);
+	if (z <= 0.0f) {
+		return vec2(-1.0f, -1.0f);
+	}
+
+	const float planeWidth = tan(fovY * 0.5f);
+	const float aspect = size.x / size.y;
+	const vec2 uv = vec2(dot(toPoint, camSide) / (z * planeWidth * aspect), -dot(toPoint, camUp) / (z * planeWidth));
+	return (uv + vec2(1.0f, 1.0f)) * 0.5f * size;
+}
+
+// world size of a pixel at a depth
+SWS_FUNC float DenoisePixelFootprint(float depth, float fovY, float height) {
+	return depth * 2.0f * tan(fovY * 0.5f) / height;
+}
+
+// whether a pixel of the frame before saw the surface this one sees, so its history can be carried on
+SWS_FUNC bool DenoiseSameSurface(DenoiseSurface current, DenoiseSurface previous) {
+	if (previous.positionAndDepth.w < 0.0f || current.normalAndObjId.w != previous.normalAndObjId.w) {
+		return false;
+	}
+	if (dot(vec3(current.normalAndObjId), vec3(previous.normalAndObjId)) < 0.9f) {
+		return false;
+	}
+	const float planeDistance = dot(vec3(current.normalAndObjId), vec3(previous.positionAndDepth) - vec3(current.positionAndDepth));
+	const float tolerance = SWS_DENOISE_REPROJECT_DEPTH * current.positionAndDepth.w;
+	return planeDistance * planeDistance < tolerance * tolerance;
+}
+
+// bilinear weight of tap 0..3 (x in bit 0, y in bit 1) of the 2x2 around a point, f - its fraction
+SWS_FUNC float DenoiseBilinearWeight(vec2 f, int tap) {
+	const float wx = (0 != (tap & 1)) ? f.x : 1.0f - f.x;
+	const float wy = (0 != (tap & 2)) ? f.y : 1.0f - f.y;
+	return wx * wy;
+}
+
+SWS_FUNC DenoiseHistory DenoiseEmptyHistory() {
+	DenoiseHistory history;
+	history.colorAndLength = vec4(0.0f);
+	history.moments = vec4(0.0f);
+	return history;
+}
+
+SWS_FUNC void DenoiseAddHistory(SWS_INOUT(DenoiseHistory) sum, DenoiseHistory history, float weight) {
+	sum.colorAndLength += history.colorAndLength * weight;
+	sum.moments += history.moments * weight;
+}
+
+// the weighted sum of the reprojected taps as a prior, too little of them and there's none
+SWS_FUNC DenoiseHistory DenoiseFinishPrior(DenoiseHistory sum, float sumWeight) {
+	if (sumWeight < 0.01f) {
+		return DenoiseEmptyHistory();
+	}
+
+	DenoiseHistory prior;
+	prior.colorAndLength = sum.colorAndLength / sumWeight;
+	prior.moments = sum.moments / sumWeight;
+	prior.colorAndLength.w = prior.colorAndLength.w < SWS_DENOISE_MAX_HISTORY ? prior.colorAndLength.w : SWS_DENOISE_MAX_HISTORY;
+	return prior;
+}
+
+// x - mean luminance of the pixel's samples, y - mean of its square, 0 without samples
+SWS_FUNC vec2 DenoisePixelMoments(PixelStats pixel) {
+	const float n = pixel.colorA.w + pixel.colorB.w;
+	if (n <= 0.0f) {
+		return vec2(0.0f, 0.0f);
+	}
+	return vec2(pixel.luminance.x + pixel.luminance.z, pixel.luminance.y + pixel.luminance.w) / n;
+}
+
+// the accumulated samples of the pixel on top of its prior, both are means weighted by their samples
+SWS_FUNC DenoiseHistory DenoiseIntegrate(DenoiseHistory prior, PixelStats pixel) {
+	const float n = pixel.colorA.w + pixel.colorB.w;
+	const float total = prior.colorAndLength.w + n;
+	if (total <= 0.0f) {
+		return DenoiseEmptyHistory();
+	}
+
+	DenoiseHistory history;
+	history.colorAndLength = vec4((vec3(prior.colorAndLength) * prior.colorAndLength.w + PixelColor(pixel) * n) / total, total);
+	const vec2 moments = (vec2(prior.moments.x, prior.moments.y) * prior.colorAndLength.w + DenoisePixelMoments(pixel) * n) / total;
+	history.moments = vec4(moments.x, moments.y, 0.0f, 0.0f);
+	return history;
+}
+
+// variance of a mean of numSamples samples, from their luminance moments
+SWS_FUNC float DenoiseMeanVariance(vec2 moments, float numSamples) {
+	const float variance = moments.y - moments.x * moments.x;
+	return (variance > 0.0f && numSamples > 0.0f) ? variance / numSamples : 0.0f;
+}
+
+// how much of neighbour q goes into pixel p, luminance aside. footprint - world size of the step between them at p
+SWS_FUNC float DenoiseGeometryWeight(DenoiseSurface p, DenoiseSurface q, float footprint) {
+	if (q.positionAndDepth.w < 0.0f || p.normalAndObjId.w != q.normalAndObjId.w) {
+		return 0.0f;
+	}
+
+	const float cosine = dot(vec3(p.normalAndObjId), vec3(q.normalAndObjId));
+	const float normalWeight = pow(cosine > 0.0f ? cosine : 0.0f, SWS_DENOISE_SIGMA_NORMAL);
+	const float planeDistance = dot(vec3(p.normalAndObjId), vec3(q.positionAndDepth) - vec3(p.positionAndDepth));
+	const float depthWeight = exp(-(planeDistance > 0.0f ? planeDistance : -planeDistance) / (SWS_DENOISE_SIGMA_DEPTH * footprint + 1e-6f));
+	return normalWeight * depthWeight;
+}
+
+SWS_FUNC float DenoiseLuminanceWeight(float luminanceP, float luminanceQ, float stdDev) {
+	const float diff = luminanceP - luminanceQ;
+	return exp(-(diff > 0.0f ? diff : -diff) / (SWS_DENOISE_SIGMA_LUMINANCE * stdDev + 1e-10f));
+}
+
+// 1/16 1/4 3/8 1/4 1/16, by the tap's offset from -2 to 2
+SWS_FUNC float DenoiseKernelWeight(int offset) {
+	if (0 == offset) {
+		return 0.375f;
+	}
+	return (1 == offset || -1 == offset) ? 0.25f : 0.0625f;
+}
+
+// 3x3 gaussian the variance is blurred with before the luminance weights use it, offsets from -1 to 1
+SWS_FUNC float DenoiseGaussianWeight(int dx, int dy) {
+	return ((0 == dx) ? 0.5f : 0.25f) * ((0 == dy) ? 0.5f : 0.25f);
+}
+
+#endif // SHARED_DENOISER_H
@@ -0,0 +1,275 @@
+#ifndef SHARED_SAMPLER_H
+#define SHARED_SAMPLER_H
+
+#include "shared_with_shaders.h"
+
+// Sample generation for the path tracer, the same code in ray_gen.glsl and in the CPU tracer.
+// A path asks for its numbers one dimension (SamplerGet1D) or one pair (SamplerGet2D) at a time, always in
+// the same order, and every call moves on to the next dimension:
+//   SWS_SAMPLER_RANDOM - LCG white noise, what the tracer always had, kept as the baseline
+//   SWS_SAMPLER_SOBOL  - the 2D Sobol (0,2)-sequence, Owen scrambled per pixel and per dimension, and padded:
+//                        every dimension also shuffles the sample index with its own seed, so dimensions
+//                        don't correlate with each other (Burley 2020, "Practical Hash-based Owen Scrambling")
+// Samples of a pixel are numbered across the accumulated frames, so frame N carries on the sequence of the
+// frames before it instead of starting it over.
+// Directions come from closed-form warps of those numbers, no rejection loops.
+
+#define SWS_SAMPLER_RANDOM              0u
+#define SWS_SAMPLER_SOBOL               1u
+#define SWS_SAMPLER_DEFAULT             SWS_SAMPLER_SOBOL
+
+struct SamplerState {
+	uint type;          // SWS_SAMPLER_
+	uint seed;          // hash of the pixel, the LCG state with SWS_SAMPLER_RANDOM
+	uint index;         // sample of the pixel
+	uint dimension;     // next one to hand out
+};
+
+// lowbias32 by Chris Wellons
+SWS_FUNC uint HashUint(uint x) {
+	x ^= x >> 16u;
+	x *= 0x7feb352du;
+	x ^= x >> 15u;
+	x *= 0x846ca68bu;
+	x ^= x >> 16u;
+	return x;
+}
+
+#ifdef __cplusplus
+SWS_FUNC uint ReverseBits(uint v) {
+	v = ((v >> 1u) & 0x55555555u) | ((v & 0x55555555u) << 1u);
+	v = ((v >> 2u) & 0x33333333u) | ((v & 0x33333333u) << 2u);
+	v = ((v >> 4u) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4u);
+	v = ((v >> 8u) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8u);
+	return (v >> 16u) | (v << 16u);
+}
+#else
+#define ReverseBits(v) bitfieldReverse(v)
+#endif // __cplusplus
+
+// top 24 bits, exactly representable, never 1
+SWS_FUNC float UintToUnitFloat(uint x) {
+	return float(x >> 8u) * (1.0f / 16777216.0f);
+}
+
+// Laine-Karras style hash, a bit only ever changes the bits above it
+SWS_FUNC uint LaineKarrasPermutation(uint x, uint seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+// Owen scrambling of a 0.32 fixed point number, a bit only ever changes the bits below it
+SWS_FUNC uint NestedUniformScramble(uint x, uint seed) {
+	return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+// the second Sobol dimension, its direction numbers follow v ^= v >> 1 (the first is the index bit reversed)
+SWS_FUNC uint SobolSecondDimension(uint index) {
+	uint result = 0u;
+	uint direction = 0x80000000u;
+	for (uint bits = index; bits != 0u; bits >>= 1u) {
+		if ((bits & 1u) != 0u) {
+			result ^= direction;
+		}
+		direction ^= direction >> 1u;
+	}
+	return result;
+}
+
+SWS_FUNC float SamplerRandomFloat(SWS_INOUT(uint) seed) {
+	// LCG values from Numerical Recipes
+	seed = 1664525u * seed + 1013904223u;
+	return UintToUnitFloat(seed);
+}
+
+// firstSample - index of the pixel's first sample in this frame, accumulated frames times samples per frame
+// scramble - picks another set of scrambles for the whole image, 0 is the usual one
+SWS_FUNC SamplerState SamplerInit(uint type, uint x, uint y, uint firstSample, uint scramble) {
+	SamplerState state;
+	state.type = type;
+	state.seed = HashUint(x ^ HashUint(y ^ HashUint(scramble)));
+	state.index = firstSample;
+	state.dimension = 0u;
+
+	// white noise has no sequence to carry on, every frame just gets its own
+	if (SWS_SAMPLER_RANDOM == type) {
+		state.seed = HashUint(state.seed ^ HashUint(firstSample));
+	}
+	return state;
+}
+
+SWS_FUNC void SamplerStartSample(SWS_INOUT(SamplerState) state, uint index) {
+	state.index = index;
+	state.dimension = 0u;
+}
+
+// seed of the scrambling and the shuffle of one dimension
+SWS_FUNC uint SamplerDimensionSeed(SamplerState state, uint dimension) {
+	return HashUint(state.seed ^ HashUint(dimension + 0x9e3779b9u));
+}
+
+SWS_FUNC float SamplerGet1D(SWS_INOUT(SamplerState) state) {
+	const uint dimension = state.dimension;
+	state.dimension += 1u;
+
+	if (SWS_SAMPLER_SOBOL == state.type) {
+		const uint seed = SamplerDimensionSeed(state, dimension);
+		const uint index = NestedUniformScramble(state.index, seed);
+		return UintToUnitFloat(NestedUniformScramble(ReverseBits(index), HashUint(seed)));
+	}
+	return SamplerRandomFloat(state.seed);
+}
+
+SWS_FUNC vec2 SamplerGet2D(SWS_INOUT(SamplerState) state) {
+	const uint dimension = state.dimension;
+	state.dimension += 1u;
+
+	if (SWS_SAMPLER_SOBOL == state.type) {
+		const uint seed = SamplerDimensionSeed(state, dimension);
+		const uint index = NestedUniformScramble(state.index, seed);
+		const uint x = NestedUniformScramble(ReverseBits(index), HashUint(seed));
+		const uint y = NestedUniformScramble(SobolSecondDimension(index), HashUint(seed ^ 0x5851f42du));
+		return vec2(UintToUnitFloat(x), UintToUnitFloat(y));
+	}
+
+	const float u = SamplerRandomFloat(state.seed);
+	const float v = SamplerRandomFloat(state.seed);
+	return vec2(u, v);
+}
+
+
+// warps of the unit square
+
+// Shirley-Chiu concentric mapping, keeps the strata of the square together on the disk
+SWS_FUNC vec2 SampleConcentricDisk(vec2 u) {
+	const float a = u.x * 2.0f - 1.0f;
+	const float b = u.y * 2.0f - 1.0f;
+	if (a == 0.0f && b == 0.0f) {
+		return vec2(0.0f, 0.0f);
+	}
+
+	float radius, theta;
+	if (a * a > b * b) {
+		radius = a;
+		theta = (MM_Pi * 0.25f) * (b / a);
+	}
+	else {
+		radius = b;
+		theta = (MM_Pi * 0.5f) - (MM_Pi * 0.25f) * (a / b);
+	}
+	return vec2(cos(theta) * radius, sin(theta) * radius);
+}
+
+// Duff et al. 2017, "Building an Orthonormal Basis, Revisited"
+SWS_FUNC void BuildOrthonormalBasis(vec3 normal, SWS_INOUT(vec3) tangent, SWS_INOUT(vec3) bitangent) {
+	const float s = normal.z >= 0.0f ? 1.0f : -1.0f;
+	const float a = -1.0f / (s + normal.z);
+	const float b = normal.x * normal.y * a;
+	tangent = vec3(1.0f + s * normal.x * normal.x * a, s * b, -s * normal.x);
+	bitangent = vec3(b, s + normal.y * normal.y * a, -normal.y);
+}
+
+// around a unit normal, pdf is cos / pi
+SWS_FUNC vec3 SampleCosineHemisphere(vec2 u, vec3 normal) {
+	const vec2 disk = SampleConcentricDisk(u);
+	const float zSquared = 1.0f - disk.x * disk.x - disk.y * disk.y;
+	const float z = zSquared > 0.0f ? sqrt(zSquared) : 0.0f;
+
+	vec3 tangent, bitangent;
+	BuildOrthonormalBasis(normal, tangent, bitangent);
+	return tangent * disk.x + bitangent * disk.y + normal * z;
+}
+
+// uniform over a triangle, barycentrics of v1 and v2
+SWS_FUNC vec2 SampleTriangle(vec2 u) {
+	return (u.x + u.y > 1.0f) ? vec2(1.0f - u.x, 1.0f - u.y) : u;
+}
+
+
+// adaptive sampling (SWS_RENDER_ADAPTIVE)
+// Frames alternate between the two halves of PixelStats, so each half is an independent estimate of the pixel.
+// A pixel has converged once the relative standard error of both halves is under SWS_ADAPTIVE_THRESHOLD, and it
+// isn't traced anymore. The frame's budget (the samples a uniform frame would take) is split between the pixels
+// that are left, counted by the frame before. Both halves have to agree: a single estimate that hasn't come across
+// the rare bright paths of a pixel yet looks smooth, and stopping on it would leave the pixel too dark.
+
+#define SWS_ADAPTIVE_MIN_SAMPLES        128u    // per half, below this the variance estimates can't be trusted yet
+#define SWS_ADAPTIVE_MAX_SAMPLES        16u     // per pixel per frame
+#define SWS_ADAPTIVE_THRESHOLD          0.03f   // relative standard error of the mean luminance of a converged half
+#define SWS_ADAPTIVE_DARK_BIAS          0.05f   // added to the mean, so near black pixels don't need endless samples
+
+// relative standard error of the mean luminance of one half, part 0 - A, 1 - B
+SWS_FUNC float PixelError(PixelStats pixel, uint part) {
+	const float n = (0u == part) ? pixel.colorA.w : pixel.colorB.w;
+	const float sum = (0u == part) ? pixel.luminance.x : pixel.luminance.z;
+	const float sumSq = (0u == part) ? pixel.luminance.y : pixel.luminance.w;
+
+	const float mean = sum / n;
+	const float variance = (sumSq / n - mean * mean) * n / (n - 1.0f);    // rounding can take it below 0
+	return sqrt(variance > 0.0f ? variance / n : 0.0f) / (mean + SWS_ADAPTIVE_DARK_BIAS);
+}
+
+SWS_FUNC bool PixelHasMinSamples(PixelStats pixel) {
+	return pixel.colorA.w >= float(SWS_ADAPTIVE_MIN_SAMPLES) && pixel.colorB.w >= float(SWS_ADAPTIVE_MIN_SAMPLES);
+}
+
+SWS_FUNC bool PixelConverged(PixelStats pixel) {
+	if (!PixelHasMinSamples(pixel)) {
+		return false;
+	}
+	return PixelError(pixel, 0u) < SWS_ADAPTIVE_THRESHOLD && PixelError(pixel, 1u) < SWS_ADAPTIVE_THRESHOLD;
+}
+
+// samples of a pixel this frame. budget - samples of the whole frame, numConverging - samplingData.z.
+// Until the pixel has its minimum it's a uniform frame, by then numConverging is one of this accumulation's
+SWS_FUNC uint AdaptiveSampleCount(SamplerState state, PixelStats pixel, uint samplesPerFrame, float budget, uint numConverging, uint frame) {
+	if (!PixelHasMinSamples(pixel)) {
+		return samplesPerFrame;
+	}
+	if (PixelConverged(pixel)) {
+		return 0u;
+	}
+	if (0u == numConverging) {
+		return samplesPerFrame;
+	}
+
+	// rounded up or down at random, so the frame takes its budget on average
+	const float share = budget / float(numConverging);
+	const float u = UintToUnitFloat(HashUint(state.seed ^ HashUint(frame)));
+	const uint count = uint(share + u);
+	return count < SWS_ADAPTIVE_MAX_SAMPLES ? count : SWS_ADAPTIVE_MAX_SAMPLES;
+}
+
+// adds a frame's samples to one half. colorSum - of the samples, luminance - x sum, y sum of squares
+SWS_FUNC void AccumulateHalf(SWS_INOUT(PixelStats) pixel, uint part, vec3 colorSum, vec2 luminance, uint numSamples) {
+	const float k = float(numSamples);
+	if (0u == part) {
+		const float n = pixel.colorA.w + k;
+		const vec3 mean = vec3(pixel.colorA);
+		pixel.colorA = vec4(mean + (colorSum / k - mean) * (k / n), n);
+		pixel.luminance.x += luminance.x;
+		pixel.luminance.y += luminance.y;
+	}
+	else {
+		const float n = pixel.colorB.w + k;
+		const vec3 mean = vec3(pixel.colorB);
+		pixel.colorB = vec4(mean + (colorSum / k - mean) * (k / n), n);
+		pixel.luminance.z += luminance.x;
+		pixel.luminance.w += luminance.y;
+	}
+}
+
+// the two halves together, weighted by their samples
+SWS_FUNC vec3 PixelColor(PixelStats pixel) {
+	const float n = pixel.colorA.w + pixel.colorB.w;
+	if (n <= 0.0f) {
+		return vec3(0.0f);
+	}
+	return (vec3(pixel.colorA) * pixel.colorA.w + vec3(pixel.colorB) * pixel.colorB.w) / n;
+}
+
+#endif // SHARED_SAMPLER_H
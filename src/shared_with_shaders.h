@@ -4,6 +4,18 @@
 #ifdef __cplusplus
 // include vec & mat types (same namings as in GLSL)
 #include "common/utils.h"
+
+// helpers below are defined in this header, so they have to be inline for C++
+#define SWS_FUNC inline
+// GLSL inout parameters
+#define SWS_INOUT(type) type&
+
+using uint = uint32_t;
+#else
+#define SWS_FUNC
+#define SWS_INOUT(type) inout type
+
+const float MM_Pi = 3.1415926536f;
 #endif // __cplusplus
 
 //
@@ -19,6 +31,22 @@
 #define SWS_RESULT_IMAGE_BINDING        1
 #define SWS_CAMDATA_SET                 0
 #define SWS_CAMDATA_BINDING             2
+#define SWS_PIXEL_STATS_SET             0
+#define SWS_PIXEL_STATS_BINDING         3
+#define SWS_INSTANCE_SHAPES_SET         0
+#define SWS_INSTANCE_SHAPES_BINDING     4
+#define SWS_MATERIALS_SET               0
+#define SWS_MATERIALS_BINDING           5
+#define SWS_LIGHTS_SET                  0
+#define SWS_LIGHTS_BINDING              6
+#define SWS_RAY_COUNTERS_SET            0
+#define SWS_RAY_COUNTERS_BINDING        7
+#define SWS_DENOISE_SURFACES_SET        0
+#define SWS_DENOISE_SURFACES_BINDING    8
+#define SWS_DENOISE_HISTORY_SET         0
+#define SWS_DENOISE_HISTORY_BINDING     9
+#define SWS_DENOISE_FILTER_SET          0
+#define SWS_DENOISE_FILTER_BINDING      10
 
 #define SWS_MATIDS_SET                  1
 #define SWS_ATTRIBS_SET                 2
@@ -33,7 +61,19 @@
 #define SWS_LOC_SHADOW_RAY              2
 
 #define SWS_MAX_RECURSION               16
-#define SWS_MAX_RAYS					16
+#define SWS_SAMPLES_PER_FRAME           1   // the rest comes from accumulating over frames
+
+// frameData.z flags
+#define SWS_RENDER_NEE                  1u  // next-event estimation: a shadow ray to a light at every diffuse bounce
+#define SWS_RENDER_ADAPTIVE             2u  // converged pixels aren't traced, the rest share their samples
+#define SWS_RENDER_DENOISE              4u  // primary hits go to the denoiser's surfaces, see shared_denoiser.h
+
+#define SWS_DEFAULT_DIFFUSE             0.8f    // albedo of faces without a material
+
+// Russian roulette: from frameData.w bounces on, a path goes on with the probability of its throughput
+// (capped, so even white walls end paths) and is divided by it when it survives
+#define SWS_RR_MIN_DEPTH                3
+#define SWS_RR_MAX_SURVIVAL             0.95f
 
 #define OBJECT_ID_BOX1					0.0f
 #define OBJECT_ID_BOX2					1.0f
@@ -41,14 +81,59 @@
 #define OBJECT_ID_LIGHT_PLANE			3.0f
 
 struct RayPayload {
-	vec4 colorAndDist;
+	vec4 colorAndDist;      // rgb - diffuse albedo (Kd)
 	vec4 normalAndObjId;
+	vec4 emission;          // rgb - Ke of the hit face
 };
 
 struct ShadowRayPayload {
 	float distance;
 };
 
+// one per material id
+struct MaterialParams {
+	vec4 diffuse;           // Kd
+	vec4 emission;          // Ke
+};
+
+// Emissive triangle in world space. Lights are picked in proportion to their power (area times the luminance
+// of Ke), so the pdf of a point on a light per unit area is luminance(Ke) / total power, whatever the triangle.
+struct LightTriangle {
+	vec4 v0AndCdf;          // w - sum of the pick probabilities up to and including this one
+	vec4 edge1;             // v1 - v0
+	vec4 edge2;             // v2 - v0
+	vec4 emission;          // rgb - Ke, w - pdf per unit area
+};
+
+// work done by ray_gen.glsl in one frame, summed over the launch
+struct RayCounters {
+	uvec4 counts;           // x - paths, y - bounces (closest hit rays, camera rays included), z - shadow rays,
+	                        // w - paths ended by Russian roulette
+	uvec4 adaptive;         // SWS_RENDER_ADAPTIVE only: x - pixels still converging, yzw - unused
+};
+
+// Per pixel accumulation of ray_gen.glsl. Even frames go into one half and odd frames into the other, two
+// independent estimates for adaptive sampling to judge the pixel by (see shared_sampler.h)
+struct PixelStats {
+	vec4 colorA;            // rgb - mean of the even frames' samples, w - their number
+	vec4 colorB;            // the same for the odd frames
+	vec4 luminance;         // x - sum of the luminance of A's samples, y - sum of its squares, zw - the same for B
+};
+
+// Primary hit of the pixel's first sample in a frame, what the denoiser tells surfaces apart by.
+// Two per pixel, frames write the one their denoiseData.x parity picks
+struct DenoiseSurface {
+	vec4 normalAndObjId;    // RayPayload's
+	vec4 positionAndDepth;  // xyz - world space hit, w - its distance from the camera, < 0 for a miss
+};
+
+// Pixel integrated over time by the denoiser: two of them per pixel, by frame parity, plus the prior the
+// current accumulation started from
+struct DenoiseHistory {
+	vec4 colorAndLength;    // rgb - mean color, w - samples it's the mean of
+	vec4 moments;           // x - mean luminance of those samples, y - mean of its square, zw - unused
+};
+
 struct VertexAttribute {
 	vec4 normal;
 	//vec4 uv;
@@ -65,19 +150,47 @@ struct UniformParams {
 	vec4 camUp;
 	vec4 camSide;
 	vec4 camNearFarFov;
+
+	// Accumulation
+	uvec4 frameData;    // x - frames accumulated so far (0 restarts accumulation), y - samples per frame, z - SWS_RENDER_ flags,
+	                    // w - bounce Russian roulette starts at (SWS_MAX_RECURSION or more turns it off)
+
+	// Lights
+	vec4 lightsInfo;    // x - number of light triangles, y - their total power
+
+	// Sampling
+	uvec4 samplingData; // x - SWS_SAMPLER_ type, y - scramble seed (0 unless renders need to be independent),
+	                    // z - RayCounters.adaptive.x of the last frame read back, w - unused
+
+	// Denoiser, the camera of the frame before is what the history gets reprojected from
+	vec4 prevCamPos;
+	vec4 prevCamDir;
+	vec4 prevCamUp;
+	vec4 prevCamSide;
+	uvec4 denoiseData;  // x - frames denoised so far (the parity picks the surfaces and history written), y - a-trous iterations,
+	                    // z - 1 if the frame before left a history to reproject, w - unused
 };
 
 
 // shaders helper functions
-vec2 BaryLerp(vec2 a, vec2 b, vec2 c, vec3 barycentrics) {
+SWS_FUNC vec2 BaryLerp(vec2 a, vec2 b, vec2 c, vec3 barycentrics) {
 	return a * barycentrics.x + b * barycentrics.y + c * barycentrics.z;
 }
 
-vec3 BaryLerp(vec3 a, vec3 b, vec3 c, vec3 barycentrics) {
+SWS_FUNC vec3 BaryLerp(vec3 a, vec3 b, vec3 c, vec3 barycentrics) {
 	return a * barycentrics.x + b * barycentrics.y + c * barycentrics.z;
 }
 
-float LinearToSrgb(float channel) {
+SWS_FUNC float Luminance(vec3 color) {
+	return color.r * 0.2126f + color.g * 0.7152f + color.b * 0.0722f;
+}
+
+// MIS weight of a sample drawn with pdf a, when the other strategy would've drawn it with pdf b
+SWS_FUNC float PowerHeuristic(float a, float b) {
+	return (a * a) / (a * a + b * b);
+}
+
+SWS_FUNC float LinearToSrgb(float channel) {
 	if (channel <= 0.0031308f) {
 		return 12.92f * channel;
 	}
@@ -86,7 +199,7 @@ float LinearToSrgb(float channel) {
 	}
 }
 
-vec3 LinearToSrgb(vec3 linear) {
+SWS_FUNC vec3 LinearToSrgb(vec3 linear) {
 	return vec3(LinearToSrgb(linear.r), LinearToSrgb(linear.g), LinearToSrgb(linear.b));
 }
 